@@ -12,6 +12,8 @@
 #include "Renderer/TiledMultipleDeferredRenderer.h"
 #include "Renderer/ClusteredForwardRenderer.h"
 #include "Renderer/ClusteredDeferredRenderer.h"
+#include "Renderer/ClusteredVisibilityRenderer.h"
+#include "Renderer/LightBVHShader.h"
 #include <bx/string.h>
 #include <bimg/bimg.h>
 #include <glm/gtx/component_wise.hpp>
@@ -121,13 +123,17 @@ void Cluster::initialize(int _argc, char* _argv[])
         scene->camera.lookAt({ -7.0f, 2.0f, 0.0f }, scene->center, glm::vec3(0.0f, 1.0f, 0.0f));
         if(config->useLightsFromScene)
         {
-            scene->pointLights.lights = { // pos, power
+            const PointLight lights[] = { // pos, power
                                           { { -5.0f, 0.3f, 0.0f }, { 100.0f, 100.0f, 100.0f } },
                                           { { 0.0f, 0.3f, 0.0f }, { 100.0f, 100.0f, 100.0f } },
                                           { { 5.0f, 0.3f, 0.0f }, { 100.0f, 100.0f, 100.0f } }
             };
+            for(const PointLight& light : lights)
+            {
+                scene->pointLights.add(light);
+            }
 
-            config->lights = (int)scene->pointLights.lights.size();
+            config->lights = (int)scene->pointLights.size();
 
             scene->pointLights.update();
         }
@@ -177,7 +183,7 @@ void Cluster::onCursorPos(double xpos, double ypos)
 
     if(mouseX >= 0.0f && mouseY >= 0.0f)
     {
-        if(isMouseButtonDown(GLFW_MOUSE_BUTTON_RIGHT))
+        if(isMouseButtonDown(GLFW_MOUSE_BUTTON_RIGHT) && !renderer->freezesMotion())
         {
             glfwSetInputMode(mWindow, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
             scene->camera.rotate(-glm::vec2(ypos - mouseY, xpos - mouseX) * angularVelocity);
@@ -202,7 +208,8 @@ void Cluster::onCursorEnter(int entered)
 void Cluster::onScroll(double xoffset, double yoffset)
 {
     // wheel scrolled up = zoom in by 2 extra degrees
-    scene->camera.zoom((float)yoffset * 2.0f);
+    if(!renderer->freezesMotion())
+        scene->camera.zoom((float)yoffset * 2.0f);
 }
 
 void Cluster::update(float dt)
@@ -223,25 +230,42 @@ void Cluster::update(float dt)
     }
     const float t = (float)glfwGetTime();
 
+    // measuring the lightcuts error compares two consecutive frames, stop the camera and the lights for those
+    const float sceneDt = renderer->freezesMotion() ? 0.0f : dt;
+
     float velocity = scene->diagonal / 5.0f; // m/s
     if(isKeyDown(GLFW_KEY_W))
-        scene->camera.move(scene->camera.forward() * velocity * dt);
+        scene->camera.move(scene->camera.forward() * velocity * sceneDt);
     if(isKeyDown(GLFW_KEY_A))
-        scene->camera.move(-scene->camera.right() * velocity * dt);
+        scene->camera.move(-scene->camera.right() * velocity * sceneDt);
     if(isKeyDown(GLFW_KEY_S))
-        scene->camera.move(-scene->camera.forward() * velocity * dt);
+        scene->camera.move(-scene->camera.forward() * velocity * sceneDt);
     if(isKeyDown(GLFW_KEY_D))
-        scene->camera.move(scene->camera.right() * velocity * dt);
+        scene->camera.move(scene->camera.right() * velocity * sceneDt);
     if(isKeyDown(GLFW_KEY_SPACE))
-        scene->camera.move(scene->camera.up() * velocity * dt);
+        scene->camera.move(scene->camera.up() * velocity * sceneDt);
     if(isKeyDown(GLFW_KEY_LEFT_CONTROL))
-        scene->camera.move(-scene->camera.up() * velocity * dt);
-
-    if(config->movingLights)
-        moveLights(t, dt);
-    scene->pointLights.update();
+        scene->camera.move(-scene->camera.up() * velocity * sceneDt);
 
-    renderer->render(dt);
+    // the renderer checks the same options, so this frame's GPU animation matches
+    const bool gpuLightAnimation = renderer->animatesLights();
+    if(!gpuLightAnimation)
+    {
+        // CPU culling, z-binning and pre-culling read the CPU copy
+        // catch up with lights animated on the GPU in earlier frames
+        scene->pointLights.syncAnimation();
+        if(config->movingLights)
+            moveLights(t, sceneDt);
+    }
+    // room for a virtual light per light BVH node
+    scene->pointLights.setVirtualCapacity(
+        config->lightcuts ? LightBVHShader::getNodeCount(scene->pointLights.size()) : 0);
+    // shaders only read the pre-culled lights, uploading the scene lights can wait
+    scene->pointLights.update(!renderer->preCullsLights());
+
+    renderer->render(sceneDt);
+    if(gpuLightAnimation)
+        scene->pointLights.animatedOnGpu(sceneDt);
     if(config->measureOverSeconds > 0)
     {
         ++completedFrames;
@@ -365,6 +389,9 @@ void Cluster::setRenderPath(RenderPath path)
         case RenderPath::ClusteredDeferred:
             renderer = std::make_unique<ClusteredDeferredRenderer>(scene.get(), config.get());
             break;
+        case RenderPath::ClusteredVisibility:
+            renderer = std::make_unique<ClusteredVisibilityRenderer>(scene.get(), config.get());
+            break;
         default:
             assert(false);
             break;
@@ -381,13 +408,13 @@ void Cluster::generateLights(unsigned int count)
 {
     // TODO? normalize power
 
-    auto& lights = scene->pointLights.lights;
+    auto& lights = scene->pointLights;
 
-    size_t keep = lights.size();
-    if(count < keep)
-        keep = count;
-
-    lights.resize(count);
+    // removing from the end doesn't move any lights
+    while(lights.size() > count)
+    {
+        lights.remove(lights.getHandle(lights.size() - 1));
+    }
 
     glm::vec3 scale = glm::abs(scene->maxBounds - scene->minBounds) * 0.75f;
 
@@ -400,7 +427,7 @@ void Cluster::generateLights(unsigned int count)
     //std::mt19937 mt(seed);
     //std::uniform_real_distribution<float> dist(0.0f, 1.0f);
 
-    for(size_t i = keep; i < count; i++)
+    for(size_t i = lights.size(); i < count; i++)
     {
         glm::vec3 position = scene->center;
         position += glm::vec3(dist(mt), dist(mt), dist(mt)) * scale - (scale * 0.5f);
@@ -410,22 +437,18 @@ void Cluster::generateLights(unsigned int count)
 
         glm::vec3 color = glm::vec3(dist(mt), dist(mt), dist(mt));
         glm::vec3 power = color * POWER;//(dist(mt) * (POWER_MAX - POWER_MIN) + POWER_MIN);
-        lights[i] = { position, power };
+        lights.add({ position, power });
     }
 }
 
 void Cluster::moveLights(float t, float dt)
 {
-    const float angularVelocity = glm::radians(10.0f);
-    const float angle = angularVelocity * dt;
     //const glm::vec3 translationExtent = glm::abs(scene->maxBounds - scene->minBounds) * glm::vec3( 0.1f, 0.0f, 0.1f ); // { 1.0f, 0.0f, 1.0f };
 
-    for(PointLight& light : scene->pointLights.lights)
-    {
-        light.position =
-            glm::mat3(glm::rotate(glm::identity<glm::mat4>(), angle, glm::vec3(0.0f, 1.0f, 0.0f))) * light.position;
-        //light.position += glm::sin(glm::vec3(t) * glm::vec3(1.0f, 2.0f, 3.0f)) * translationExtent * dt;
-    }
+    // every light follows its motion (see PointLightList::DEFAULT_MOTION)
+    // the renderer does this on the GPU if it can, see Renderer::animatesLights
+    scene->pointLights.animate(dt);
+    //light.position += glm::sin(glm::vec3(t) * glm::vec3(1.0f, 2.0f, 3.0f)) * translationExtent * dt;
 }
 
 stats Cluster::getFrameTimeStatistics() const
@@ -61,7 +61,8 @@ public:
         TiledMultipleForward,
         TiledMultipleDeferred,
         ClusteredForward,
-        ClusteredDeferred
+        ClusteredDeferred,
+        ClusteredVisibility
     };
     void setRenderPath(RenderPath path);
 
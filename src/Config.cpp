@@ -18,7 +18,7 @@ Config::Config() :
     useLightsFromScene(false),
     measureOverSeconds(-1),
     lights(1),
-    maxLights(262144),
+    maxLights(4194304),
     tilePixelSizeX(16),
     tilePixelSizeY(16),
     backbufferResolutionX(3840),
@@ -28,7 +28,24 @@ Config::Config() :
     clustersY(8),
     clustersZ(24),
     maxLightsPerTileOrCluster(4096),
+    adaptiveLightLists(true),
+    cullActiveClustersOnly(true),
+    clusterLightCullingMode(ClusterShader::LightCullingMode::Gather),
+    clusterGridLayout(ClusterShader::GridLayout::Linear),
+    tileDepthBounds(TileShader::DepthBoundsMode::DepthMask),
+    zBinning(false),
+    worldLightGrid(false),
+    worldGridCellSize(2.0f),
+    lightBVH(true),
+    lightcuts(false),
+    lightcutsErrorBound(0.1f),
+    radiusClasses(false),
+    largeLightRadius(1.5f),
+    cpuLightCulling(false),
     movingLights(false),
+    lightPreCulling(false),
+    stencilLightVolumes(false),
+    thinGBuffer(false),
     fullscreen(false),
     showUI(true),
     showConfigWindow(true),
@@ -63,6 +80,10 @@ void Config::readArgv(int argc, char* argv[])
     else if(cmdLine.hasArg("mtl"))
         renderer = bgfx::RendererType::Metal;
 
+    // useful with noop, compute shaders don't run there
+    if(cmdLine.hasArg("cpuculling"))
+        cpuLightCulling = true;
+
     const char* scene = cmdLine.findOption("scene");
     if(scene)
     {
@@ -2,6 +2,8 @@
 
 #include <bgfx/bgfx.h>
 #include "Renderer/Renderer.h"
+#include "Renderer/ClusterShader.h"
+#include "Renderer/TileShader.h"
 #include "Cluster.h"
 
 class Config
@@ -46,7 +48,47 @@ public:
     int clustersY;
     int clustersZ;
     int maxLightsPerTileOrCluster;
+    // resize the light lists to fit, using overflow counters read back from the GPU
+    // maxLightsPerTileOrCluster becomes the upper limit
+    bool adaptiveLightLists;
+    // only cull lights for clusters containing geometry
+    // requires a depth prepass in the forward renderer, transparent meshes get their own depth pass
+    bool cullActiveClustersOnly;
+    // cluster-centric (each cluster tests all lights) or light-centric (each light visits the clusters it overlaps)
+    ClusterShader::LightCullingMode clusterLightCullingMode;
+    // memory order of the cluster grid, swizzled keeps neighbouring clusters close together
+    // ignored by CPU light culling (always linear)
+    ClusterShader::GridLayout clusterGridLayout;
+    // cull lights against the depth range of geometry in each tile (optionally 2.5D with a depth mask)
+    // requires a depth prepass in the forward renderer, transparent meshes get their own depth pass
+    TileShader::DepthBoundsMode tileDepthBounds;
+    // sort lights by depth into 1D depth bins and 2D tile bitmasks instead of a 3D light grid
+    bool zBinning;
+    // assign lights to a hashed world-space grid instead of view-space clusters
+    // only rebuilt when lights change, camera movement doesn't need any light culling
+    // moving lights have their own grid, so animating them leaves static lights alone
+    // (pre-culled lights change with the camera, so it gets rebuilt with light pre-culling)
+    bool worldLightGrid;
+    float worldGridCellSize;
+    // traverse a bounding volume hierarchy over the lights instead of testing every light
+    bool lightBVH;
+    // lightcuts: clustered light culling replaces far away groups of lights with one virtual light
+    // (needs the light BVH), a higher error bound merges more lights
+    bool lightcuts;
+    float lightcutsErrorBound;
+    // radius classes: lights with a radius above largeLightRadius are culled against a coarser cluster grid
+    // (cluster-centric culling on the GPU only, not together with lightcuts)
+    bool radiusClasses;
+    float largeLightRadius;
+    // assign lights to tiles/clusters on the CPU (all cores, SIMD) and upload the result
+    bool cpuLightCulling;
     bool movingLights;
+    // test lights against the view frustum on the CPU and only upload the visible ones
+    bool lightPreCulling;
+    // deferred renderer: mark pixels inside light volumes in the stencil buffer and only shade those
+    bool stencilLightVolumes;
+    // deferred renderers: base color + metallic and octahedral normal + roughness, emissive only if used
+    bool thinGBuffer;
     int measureOverSeconds;
 
     // UI
@@ -0,0 +1,376 @@
+#include "CPULightCulling.h"
+
+#include "Scene/Scene.h"
+#include "Renderer/LightShader.h"
+#include "Util/SIMD.h"
+#include <bgfx/bgfx.h>
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+using namespace simd;
+
+namespace
+{
+// lights intersecting the depth range [depthNear, depthFar]
+// same as the second half of pointLightIntersectsCluster in clusterculling.sh
+inline vfloat depthTest(vfloat z, vfloat r, vfloat depthNear, vfloat depthFar, vfloat halfZ)
+{
+    vfloat nearHalf = vand(vless(vsub(depthNear, z), r), vless(vsub(z, halfZ), r));
+    vfloat halfFar = vand(vless(vsub(halfZ, z), r), vless(vsub(z, depthFar), r));
+    return vor(nearHalf, halfFar);
+}
+} // namespace
+
+uint32_t CPULightCulling::getSIMDWidth()
+{
+    return SIMD_WIDTH;
+}
+
+void CPULightCulling::cullClusters(const LightShader& lightShader,
+                                   const Scene* scene,
+                                   const glm::mat4& viewMat,
+                                   const glm::mat4& projMat,
+                                   uint16_t screenWidth,
+                                   uint16_t screenHeight,
+                                   uint32_t clustersX,
+                                   uint32_t clustersY,
+                                   uint32_t clustersZ,
+                                   uint32_t maxLightsPerCluster,
+                                   uint32_t maxLightIndices)
+{
+    assert(scene != nullptr);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    transformLights(lightShader.getPointLights(scene), viewMat);
+
+    const glm::mat4 invProj = glm::inverse(projMat);
+    const float zNear = scene->camera.zNear;
+    const float zFar = scene->camera.zFar;
+    // same as u_clusterSize
+    const float clusterWidth = std::ceil((float)screenWidth / clustersX);
+    const float clusterHeight = std::ceil((float)screenHeight / clustersY);
+
+    const uint32_t columns = clustersX * clustersY;
+    const uint32_t chunkCount = (columns + TILES_PER_JOB - 1) / TILES_PER_JOB;
+
+    lightGrid.resize((size_t)columns * clustersZ * 2);
+    chunkIndices.resize(chunkCount);
+
+    // cull all lights against the side planes of each cluster column (tile) first
+    // the depth slices of that column then only test the remaining lights against their depth range
+    // every job appends to its own light index list, offsets are relative to that list for now
+    pool.parallelFor(columns, TILES_PER_JOB, [&](uint32_t begin, uint32_t end) {
+        std::vector<uint32_t>& indices = chunkIndices[begin / TILES_PER_JOB];
+        indices.clear();
+        LightsSoA columnLights;
+
+        for(uint32_t column = begin; column < end; column++)
+        {
+            const uint32_t x = column % clustersX;
+            const uint32_t y = column / clustersX;
+            const TileFrustum frustum =
+                getTileFrustum(invProj, screenWidth, screenHeight, x, y, clusterWidth, clusterHeight);
+            cullLightsToSoA(lights, frustum, zNear, zFar, columnLights);
+
+            for(uint32_t z = 0; z < clustersZ; z++)
+            {
+                // see cs_clustered_clusterbuilding.sc
+                const float clusterNear = zNear * std::pow(zFar / zNear, z / float(clustersZ));
+                const float clusterFar = zNear * std::pow(zFar / zNear, (z + 1) / float(clustersZ));
+
+                const size_t offset = indices.size();
+                indices.resize(offset + std::min(columnLights.count, maxLightsPerCluster));
+                const uint32_t count = cullLights(
+                    columnLights, nullptr, clusterNear, clusterFar, maxLightsPerCluster, indices.data() + offset);
+                indices.resize(offset + count);
+
+                const size_t cluster = (size_t)z * columns + column;
+                lightGrid[2 * cluster + 0] = (uint32_t)offset;
+                lightGrid[2 * cluster + 1] = count;
+            }
+        }
+    });
+
+    const std::vector<uint32_t> chunkOffsets = concatenateChunks(chunkCount, maxLightIndices);
+
+    pool.parallelFor(columns, TILES_PER_JOB, [&](uint32_t begin, uint32_t end) {
+        const uint32_t chunkOffset = chunkOffsets[begin / TILES_PER_JOB];
+        for(uint32_t column = begin; column < end; column++)
+        {
+            for(uint32_t z = 0; z < clustersZ; z++)
+            {
+                const size_t cluster = (size_t)z * columns + column;
+                const size_t offset = (size_t)chunkOffset + lightGrid[2 * cluster + 0];
+                uint32_t count = lightGrid[2 * cluster + 1];
+                // same as allocateLightIndices in clusters.sh, drop lights that don't fit
+                if(offset >= maxLightIndices)
+                    count = 0;
+                else
+                    count = (uint32_t)std::min((size_t)count, maxLightIndices - offset);
+                lightGrid[2 * cluster + 0] = (uint32_t)std::min(offset, (size_t)maxLightIndices);
+                lightGrid[2 * cluster + 1] = count;
+            }
+        }
+    });
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    cullingTime = std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void CPULightCulling::cullTiles(const LightShader& lightShader,
+                                const Scene* scene,
+                                const glm::mat4& viewMat,
+                                const glm::mat4& projMat,
+                                uint16_t screenWidth,
+                                uint16_t screenHeight,
+                                uint32_t tilePixelSizeX,
+                                uint32_t tilePixelSizeY,
+                                uint32_t maxLightsPerTile)
+{
+    assert(scene != nullptr);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    transformLights(lightShader.getPointLights(scene), viewMat);
+
+    const glm::mat4 invProj = glm::inverse(projMat);
+    const float zNear = scene->camera.zNear;
+    const float zFar = scene->camera.zFar;
+
+    const uint32_t tilesX = (uint32_t)std::ceil((float)screenWidth / tilePixelSizeX);
+    const uint32_t tilesY = (uint32_t)std::ceil((float)screenHeight / tilePixelSizeY);
+    const uint32_t tileCount = tilesX * tilesY;
+
+    const uint32_t chunkCount = (tileCount + TILES_PER_JOB - 1) / TILES_PER_JOB;
+
+    lightGrid.resize((size_t)tileCount * 2);
+    chunkIndices.resize(chunkCount);
+
+    pool.parallelFor(tileCount, TILES_PER_JOB, [&](uint32_t begin, uint32_t end) {
+        std::vector<uint32_t>& indices = chunkIndices[begin / TILES_PER_JOB];
+        indices.clear();
+
+        for(uint32_t tile = begin; tile < end; tile++)
+        {
+            const uint32_t x = tile % tilesX;
+            const uint32_t y = tile / tilesX;
+            const TileFrustum frustum = getTileFrustum(
+                invProj, screenWidth, screenHeight, x, y, (float)tilePixelSizeX, (float)tilePixelSizeY);
+
+            const size_t offset = indices.size();
+            indices.resize(offset + std::min(lights.count, maxLightsPerTile));
+            const uint32_t count =
+                cullLights(lights, &frustum, zNear, zFar, maxLightsPerTile, indices.data() + offset);
+            indices.resize(offset + count);
+
+            lightGrid[2 * tile + 0] = (uint32_t)offset;
+            lightGrid[2 * tile + 1] = count;
+        }
+    });
+
+    // the GPU buffer has room for maxLightsPerTile lights in every tile, the compacted list always fits
+    const std::vector<uint32_t> chunkOffsets = concatenateChunks(chunkCount, tileCount * maxLightsPerTile);
+
+    pool.parallelFor(tileCount, TILES_PER_JOB, [&](uint32_t begin, uint32_t end) {
+        const uint32_t chunkOffset = chunkOffsets[begin / TILES_PER_JOB];
+        for(uint32_t tile = begin; tile < end; tile++)
+        {
+            lightGrid[2 * tile + 0] += chunkOffset;
+        }
+    });
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    cullingTime = std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+std::vector<uint32_t> CPULightCulling::concatenateChunks(uint32_t chunkCount, uint32_t maxLightIndices)
+{
+    std::vector<uint32_t> chunkOffsets(chunkCount);
+    size_t totalIndices = 0;
+    for(uint32_t i = 0; i < chunkCount; i++)
+    {
+        chunkOffsets[i] = (uint32_t)std::min(totalIndices, (size_t)maxLightIndices);
+        totalIndices += chunkIndices[i].size();
+    }
+    lightIndices.resize(std::min(totalIndices, (size_t)maxLightIndices));
+
+    pool.parallelFor(chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+        for(uint32_t i = begin; i < end; i++)
+        {
+            const size_t fits = std::min(chunkIndices[i].size(), (size_t)(maxLightIndices - chunkOffsets[i]));
+            std::copy_n(chunkIndices[i].begin(), fits, lightIndices.begin() + chunkOffsets[i]);
+        }
+    });
+
+    return chunkOffsets;
+}
+
+void CPULightCulling::transformLights(const PointLightList& pointLights, const glm::mat4& viewMat)
+{
+    const uint32_t count = pointLights.size();
+    const float* pointLightsX = pointLights.getPositionsX();
+    const float* pointLightsY = pointLights.getPositionsY();
+    const float* pointLightsZ = pointLights.getPositionsZ();
+    const float* pointLightsRadius = pointLights.getRadii();
+
+    lights.clear();
+    lights.x.resize(count);
+    lights.y.resize(count);
+    lights.z.resize(count);
+    lights.radius.resize(count);
+    lights.index.resize(count);
+    lights.count = count;
+
+    // same as in the light culling shaders
+    // radius comes from PointLightList::update
+    pool.parallelFor(count, 1024, [&](uint32_t begin, uint32_t end) {
+        for(uint32_t i = begin; i < end; i++)
+        {
+            const glm::vec4 position = viewMat * glm::vec4(pointLightsX[i], pointLightsY[i], pointLightsZ[i], 1.0f);
+            lights.x[i] = position.x;
+            lights.y[i] = position.y;
+            lights.z[i] = position.z;
+            lights.radius[i] = pointLightsRadius[i];
+            lights.index[i] = i;
+        }
+    });
+
+    lights.pad();
+}
+
+CPULightCulling::TileFrustum CPULightCulling::getTileFrustum(const glm::mat4& invProj,
+                                                             uint16_t screenWidth,
+                                                             uint16_t screenHeight,
+                                                             uint32_t tileX,
+                                                             uint32_t tileY,
+                                                             float tileWidth,
+                                                             float tileHeight) const
+{
+    // screen2Eye in util.sh
+    // the screen y axis depends on the shader language, the tile grid has to match gl_FragCoord
+    const bgfx::RendererType::Enum type = bgfx::getRendererType();
+    const bool glsl = type == bgfx::RendererType::OpenGL || type == bgfx::RendererType::OpenGLES;
+    auto screen2Eye = [&](float x, float y) {
+        glm::vec4 ndc(2.0f * x / screenWidth - 1.0f, 0.0f, 1.0f, 1.0f);
+        if(glsl)
+            ndc.y = 2.0f * y / screenHeight - 1.0f;
+        else
+            ndc.y = 2.0f * (screenHeight - y - 1.0f) / screenHeight - 1.0f; // y is flipped
+        glm::vec4 eye = invProj * ndc;
+        return glm::vec3(eye) / eye.w;
+    };
+
+    const glm::vec3 corners[4] = { screen2Eye((tileX + 0) * tileWidth, (tileY + 0) * tileHeight),
+                                   screen2Eye((tileX + 1) * tileWidth, (tileY + 0) * tileHeight),
+                                   screen2Eye((tileX + 1) * tileWidth, (tileY + 1) * tileHeight),
+                                   screen2Eye((tileX + 0) * tileWidth, (tileY + 1) * tileHeight) };
+
+    TileFrustum frustum;
+    for(int i = 0; i < 4; i++)
+    {
+        const glm::vec3 normal = glm::normalize(glm::cross(corners[i], corners[(i + 1) % 4]));
+        frustum.normals[i][0] = normal.x;
+        frustum.normals[i][1] = normal.y;
+        frustum.normals[i][2] = normal.z;
+    }
+    return frustum;
+}
+
+uint32_t CPULightCulling::cullLights(const LightsSoA& lights,
+                                     const TileFrustum* frustum,
+                                     float depthNear,
+                                     float depthFar,
+                                     uint32_t maxCount,
+                                     uint32_t* out)
+{
+    const vfloat vNear = vsplat(depthNear);
+    const vfloat vFar = vsplat(depthFar);
+    const vfloat vHalfZ = vsplat((depthNear + depthFar) / 2);
+
+    uint32_t count = 0;
+    const uint32_t size = (uint32_t)lights.index.size();
+    for(uint32_t i = 0; i < size && count < maxCount; i += SIMD_WIDTH)
+    {
+        const vfloat x = vload(&lights.x[i]);
+        const vfloat y = vload(&lights.y[i]);
+        const vfloat z = vload(&lights.z[i]);
+        const vfloat r = vload(&lights.radius[i]);
+
+        vfloat intersects = depthTest(z, r, vNear, vFar, vHalfZ);
+        if(frustum)
+        {
+            for(int p = 0; p < 4; p++)
+            {
+                const float* n = frustum->normals[p];
+                const vfloat distance =
+                    vadd(vadd(vmul(vsplat(n[0]), x), vmul(vsplat(n[1]), y)), vmul(vsplat(n[2]), z));
+                intersects = vand(intersects, vless(distance, r));
+            }
+        }
+
+        // keep the order of the light list, same as the shaders
+        uint32_t mask = vmask(intersects);
+        for(uint32_t lane = 0; mask != 0 && count < maxCount; lane++, mask >>= 1)
+        {
+            if(mask & 1)
+                out[count++] = lights.index[i + lane];
+        }
+    }
+    return count;
+}
+
+void CPULightCulling::cullLightsToSoA(const LightsSoA& lights,
+                                      const TileFrustum& frustum,
+                                      float depthNear,
+                                      float depthFar,
+                                      LightsSoA& out)
+{
+    // reuse cullLights to find the indices, the light list is already sorted by index
+    out.clear();
+    out.index.resize(lights.count);
+    out.count = cullLights(lights, &frustum, depthNear, depthFar, lights.count, out.index.data());
+    out.index.resize(out.count);
+
+    out.x.resize(out.count);
+    out.y.resize(out.count);
+    out.z.resize(out.count);
+    out.radius.resize(out.count);
+    for(uint32_t i = 0; i < out.count; i++)
+    {
+        // light list is not permuted, light index = position in the list
+        const uint32_t light = out.index[i];
+        out.x[i] = lights.x[light];
+        out.y[i] = lights.y[light];
+        out.z[i] = lights.z[light];
+        out.radius[i] = lights.radius[light];
+    }
+    out.pad();
+}
+
+void CPULightCulling::LightsSoA::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+    index.clear();
+    count = 0;
+}
+
+void CPULightCulling::LightsSoA::pad()
+{
+    // a negative radius fails every test, see cullLights
+    while(index.size() % SIMD_WIDTH != 0)
+    {
+        x.push_back(0.0f);
+        y.push_back(0.0f);
+        z.push_back(0.0f);
+        radius.push_back(-FLT_MAX);
+        index.push_back(0);
+    }
+}
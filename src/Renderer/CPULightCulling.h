@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Util/JobPool.h"
+#include <glm/matrix.hpp>
+#include <cstdint>
+#include <vector>
+
+class Scene;
+class LightShader;
+class PointLightList;
+
+// light culling on the CPU for the tiled and clustered renderers
+// produces the same light grid and light index layout as the compute shaders
+// so the lighting shaders don't need to know where it came from
+// see ClusterShader::updateLightGrid and TileShader::updateLightGrid
+class CPULightCulling
+{
+public:
+    // cluster grid, see clusters.sh
+    // lightIndices is a compacted list with at most maxLightIndices entries
+    // lightGrid holds offset and count for each cluster
+    void cullClusters(const LightShader& lightShader,
+                      const Scene* scene,
+                      const glm::mat4& viewMat,
+                      const glm::mat4& projMat,
+                      uint16_t screenWidth,
+                      uint16_t screenHeight,
+                      uint32_t clustersX,
+                      uint32_t clustersY,
+                      uint32_t clustersZ,
+                      uint32_t maxLightsPerCluster,
+                      uint32_t maxLightIndices);
+
+    // tile grid, see tiles.sh
+    // same layout as for clusters, compacted light indices and offset + count for each tile
+    void cullTiles(const LightShader& lightShader,
+                   const Scene* scene,
+                   const glm::mat4& viewMat,
+                   const glm::mat4& projMat,
+                   uint16_t screenWidth,
+                   uint16_t screenHeight,
+                   uint32_t tilePixelSizeX,
+                   uint32_t tilePixelSizeY,
+                   uint32_t maxLightsPerTile);
+
+    const std::vector<uint32_t>& getLightIndices() const { return lightIndices; }
+    const std::vector<uint32_t>& getLightGrid() const { return lightGrid; }
+
+    // CPU time of the last culling call in milliseconds
+    double getCullingTime() const { return cullingTime; }
+
+    // number of lights tested at once, depends on the instruction set (AVX2, SSE2 or none)
+    static uint32_t getSIMDWidth();
+
+    // jobs are this many tiles or cluster columns
+    static constexpr uint32_t TILES_PER_JOB = 8;
+
+private:
+    // side planes of a screen tile frustum, through the eye space origin
+    struct TileFrustum
+    {
+        float normals[4][3];
+    };
+
+    // lights in eye space, one array per component
+    // padded to a multiple of the SIMD width with lights that never intersect anything
+    struct LightsSoA
+    {
+        std::vector<float> x, y, z, radius;
+        std::vector<uint32_t> index;
+        // without padding
+        uint32_t count = 0;
+
+        void clear();
+        void pad();
+    };
+
+    void transformLights(const PointLightList& pointLights, const glm::mat4& viewMat);
+    TileFrustum getTileFrustum(const glm::mat4& invProj,
+                               uint16_t screenWidth,
+                               uint16_t screenHeight,
+                               uint32_t tileX,
+                               uint32_t tileY,
+                               float tileWidth,
+                               float tileHeight) const;
+    // append all lights intersecting the frustum between depthNear and depthFar to out
+    // count stops at maxCount, returns the number of lights added
+    static uint32_t cullLights(const LightsSoA& lights,
+                               const TileFrustum* frustum,
+                               float depthNear,
+                               float depthFar,
+                               uint32_t maxCount,
+                               uint32_t* out);
+    // same as cullLights but the result is another SoA list for the next step
+    // lights has to be the full light list, light index = position in the list
+    static void cullLightsToSoA(const LightsSoA& lights,
+                                const TileFrustum& frustum,
+                                float depthNear,
+                                float depthFar,
+                                LightsSoA& out);
+
+    JobPool pool;
+
+    LightsSoA lights;
+    // append the light index lists of all jobs to lightIndices
+    // returns the offset of each job's list, lists are cut off at maxLightIndices
+    std::vector<uint32_t> concatenateChunks(uint32_t chunkCount, uint32_t maxLightIndices);
+
+    // light indices of each job, offsets in lightGrid are relative to these until they're concatenated
+    std::vector<std::vector<uint32_t>> chunkIndices;
+
+    std::vector<uint32_t> lightIndices;
+    std::vector<uint32_t> lightGrid;
+
+    double cullingTime = 0.0;
+};
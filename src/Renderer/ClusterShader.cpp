@@ -1,10 +1,16 @@
 #include "ClusterShader.h"
 
 #include "Scene/Scene.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/LightShader.h"
 #include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
 #include <glm/common.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 bgfx::VertexLayout ClusterShader::ClusterVertex::layout;
 
@@ -21,10 +27,45 @@ void ClusterShader::initialize()
     clusterCountVecUniform = bgfx::createUniform("u_clusterCountVec", bgfx::UniformType::Vec4);
     clusterSizeVecUniform = bgfx::createUniform("u_clusterSizeVec", bgfx::UniformType::Vec4);
     zNearFarVecUniform = bgfx::createUniform("u_zNearFarVec", bgfx::UniformType::Vec4);
+    clusterClassVecUniform = bgfx::createUniform("u_clusterClassVec", bgfx::UniformType::Vec4);
+
+    depthSampler = bgfx::createUniform("s_texDepth", bgfx::UniformType::Sampler);
+    transparentDepthSampler = bgfx::createUniform("s_texTransparentDepth", bgfx::UniformType::Sampler);
+
+    countersBuffer = bgfx::createDynamicIndexBuffer(COUNTER_COUNT, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+    activeClustersIndirectBuffer = bgfx::createIndirectBuffer(1);
+
+    char csName[128];
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_activeclusters_flag.bin");
+    flagClustersComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_activeclusters_flag_transparent.bin");
+    flagClustersTransparentComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_activeclusters_compact.bin");
+    compactClustersComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_activeclusters_args.bin");
+    activeClustersArgsComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_lightscatter.bin");
+    scatterCountComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_lightscatter_allocate.bin");
+    scatterAllocateComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_lightscatter_allocate_active.bin");
+    scatterAllocateActiveComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_lightscatter_write.bin");
+    scatterWriteComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    readback.initialize();
 }
 
-void ClusterShader::updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenWidth, uint16_t screenHeight, bool clustersXYAsPixelSizes, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ)
+void ClusterShader::updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenWidth, uint16_t screenHeight, bool clustersXYAsPixelSizes, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ, GridLayout layout, bool adaptiveCapacity, float largeLightRadius)
 {
+    // without read back there's nothing to adapt to
+    adaptiveCapacity = adaptiveCapacity && CounterReadback::supported();
+
+    // the radius only goes into the uniforms, only turning radius classes on or off changes the buffers
+    this->largeLightRadius = largeLightRadius;
+    const bool radiusClasses = largeLightRadius > 0.0f;
+
     uint32_t actualClustersX;
     uint32_t actualClustersY;
 
@@ -40,7 +81,8 @@ void ClusterShader::updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenW
     }
 
     if(currentClustersXYAsPixelSizes == clustersXYAsPixelSizes && currentMaxLightsPerCluster == maxLightsPerCluster &&
-       currentClustersX == actualClustersX && currentClustersY == actualClustersY && currentClustersZ == clustersZ)
+       currentClustersX == actualClustersX && currentClustersY == actualClustersY && currentClustersZ == clustersZ &&
+       currentLayout == layout && currentAdaptiveCapacity == adaptiveCapacity && this->radiusClasses == radiusClasses)
     {
         return;
     }
@@ -50,6 +92,15 @@ void ClusterShader::updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenW
     currentClustersX = actualClustersX;
     currentClustersY = actualClustersY;
     currentClustersZ = clustersZ;
+    currentLayout = layout;
+    currentAdaptiveCapacity = adaptiveCapacity;
+    this->radiusClasses = radiusClasses;
+
+    lightIndicesCapacity.reset();
+    overflowedClusters = mostLightsPerCluster = 0;
+
+    // new buffer, cluster bounds need to be rebuilt
+    boundsValid = false;
 
     if(isValid(clustersBuffer))
     {
@@ -66,16 +117,176 @@ void ClusterShader::updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenW
         bgfx::destroy(lightGridBuffer);
     }
 
-    const auto currentClusterCount = currentClustersX * currentClustersY * currentClustersZ;
-    if((size_t)currentClusterCount * currentMaxLightsPerCluster > 4ull * 1024 * 1024 * 1024)
-        terminate();
+    if(isValid(clusterFlagsBuffer))
+    {
+        bgfx::destroy(clusterFlagsBuffer);
+    }
+
+    if(isValid(activeClustersBuffer))
+    {
+        bgfx::destroy(activeClustersBuffer);
+    }
+
+    if(isValid(lightCountsBuffer))
+    {
+        bgfx::destroy(lightCountsBuffer);
+    }
+
+    // every grid entry, including the padding of the swizzled layout and the coarse grid
+    // flags, active clusters and scatter counts only exist for the main grid
+    const auto currentClusterCount = getTotalClusterStorageCount();
+    const auto mainClusterCount = getClusterStorageCount();
+
+    // light indices are allocated from one global list instead of reserving
+    // maxLightsPerCluster slots for every cluster, most clusters only see a handful of lights
+    // the adaptive list starts from a guess and follows the usage read back from the GPU
+    // otherwise there's nothing to go by, so reserve enough for every cluster to fill its list
+    const uint32_t lightsPerCluster =
+        adaptiveCapacity ? std::min(currentMaxLightsPerCluster, (uint32_t)AVERAGE_LIGHTS_PER_CLUSTER)
+                         : currentMaxLightsPerCluster;
+    size_t maxLightIndices = (size_t)currentClusterCount * lightsPerCluster;
+    currentMaxLightIndices = (uint32_t)std::min(maxLightIndices, (size_t)MAX_LIGHT_INDICES);
 
     clustersBuffer =
         bgfx::createDynamicVertexBuffer(currentClusterCount, ClusterVertex::layout, BGFX_BUFFER_COMPUTE_READ_WRITE);
-    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(currentClusterCount * currentMaxLightsPerCluster,
+    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(std::max(currentMaxLightIndices, 1u),
                                                         BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
-    lightGridBuffer = bgfx::createDynamicIndexBuffer(currentClusterCount,
+    // offset and count for each cluster
+    lightGridBuffer = bgfx::createDynamicIndexBuffer(currentClusterCount * 2,
                                                      BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+
+    // flags are reset by the compaction shader after reading, they only need to be cleared once
+    const bgfx::Memory* flagsMem = bgfx::alloc(mainClusterCount * sizeof(uint32_t));
+    std::fill_n((uint32_t*)flagsMem->data, mainClusterCount, 0u);
+    clusterFlagsBuffer = bgfx::createDynamicIndexBuffer(flagsMem, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+    activeClustersBuffer = bgfx::createDynamicIndexBuffer(mainClusterCount,
+                                                          BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+
+    // same as the flags, the light-centric culling passes leave the counts at 0
+    const bgfx::Memory* countsMem = bgfx::alloc(mainClusterCount * sizeof(uint32_t));
+    std::fill_n((uint32_t*)countsMem->data, mainClusterCount, 0u);
+    lightCountsBuffer = bgfx::createDynamicIndexBuffer(countsMem, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+}
+
+void ClusterShader::resetCounters() const
+{
+    const bgfx::Memory* mem = bgfx::alloc(COUNTER_COUNT * sizeof(uint32_t));
+    std::fill_n((uint32_t*)mem->data, COUNTER_COUNT, 0u);
+    bgfx::update(countersBuffer, 0, mem);
+}
+
+void ClusterShader::requestCounters(bgfx::ViewId view, bgfx::ViewId blitView)
+{
+    // the overflow counters are shown in the stats even without adaptive capacity
+    if(CounterReadback::supported())
+        readback.request(view, blitView, countersBuffer, COUNTER_COUNT);
+}
+
+bool ClusterShader::adaptCapacity(uint32_t frame)
+{
+    if(!readback.ready(frame))
+        return false;
+
+    const uint32_t requiredLightIndices = readback.getValue(COUNTER_LIGHT_INDICES);
+    overflowedClusters = readback.getValue(COUNTER_OVERFLOWED_CLUSTERS);
+    mostLightsPerCluster = readback.getValue(COUNTER_MAX_LIGHTS);
+
+    if(!currentAdaptiveCapacity)
+        return false;
+
+    // clusters with a full list don't need more room in the index list, they're limited by maxLightsPerCluster
+    // the allocator counts all requested indices, even the ones that didn't fit
+    const uint32_t maxLightIndices =
+        lightIndicesCapacity.update(currentMaxLightIndices,
+                                    requiredLightIndices,
+                                    requiredLightIndices > currentMaxLightIndices,
+                                    MIN_LIGHT_INDICES,
+                                    MAX_LIGHT_INDICES);
+    if(maxLightIndices == currentMaxLightIndices)
+        return false;
+
+    currentMaxLightIndices = maxLightIndices;
+    bgfx::destroy(lightIndicesBuffer);
+    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(currentMaxLightIndices,
+                                                        BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+    return true;
+}
+
+void ClusterShader::detectActiveClusters(bgfx::ViewId view,
+                                         bgfx::TextureHandle depthTexture,
+                                         uint16_t screenWidth,
+                                         uint16_t screenHeight,
+                                         bgfx::TextureHandle transparentDepthTexture) const
+{
+    // flag clusters
+
+    const bool transparent = bgfx::isValid(transparentDepthTexture);
+    bgfx::setTexture(Samplers::DEFERRED_DEPTH, depthSampler, depthTexture);
+    if(transparent)
+        bgfx::setTexture(Samplers::TRANSPARENT_DEPTH, transparentDepthSampler, transparentDepthTexture);
+    bgfx::setBuffer(Samplers::CLUSTERS_FLAGS, clusterFlagsBuffer, bgfx::Access::ReadWrite);
+    bgfx::dispatch(view,
+                   transparent ? flagClustersTransparentComputeProgram : flagClustersComputeProgram,
+                   (uint32_t)std::ceil((float)screenWidth / FLAG_THREADS),
+                   (uint32_t)std::ceil((float)screenHeight / FLAG_THREADS),
+                   1);
+
+    // compact flagged clusters into a list
+
+    bgfx::setBuffer(Samplers::CLUSTERS_LIGHTGRID, lightGridBuffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::CLUSTERS_COUNTERS, countersBuffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::CLUSTERS_FLAGS, clusterFlagsBuffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::CLUSTERS_ACTIVECLUSTERS, activeClustersBuffer, bgfx::Access::ReadWrite);
+    bgfx::dispatch(view,
+                   compactClustersComputeProgram,
+                   (uint32_t)std::ceil((float)currentClustersX / CLUSTERS_X_THREADS),
+                   (uint32_t)std::ceil((float)currentClustersY / CLUSTERS_Y_THREADS),
+                   (uint32_t)std::ceil((float)currentClustersZ / CLUSTERS_Z_THREADS));
+
+    // indirect dispatch arguments for light culling
+
+    bgfx::setBuffer(Samplers::CLUSTERS_COUNTERS, countersBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::CLUSTERS_DISPATCHINDIRECT, activeClustersIndirectBuffer, bgfx::Access::Write);
+    bgfx::dispatch(view, activeClustersArgsComputeProgram, 1, 1, 1);
+}
+
+void ClusterShader::scatterLights(bgfx::ViewId view,
+                                  const LightShader& lights,
+                                  const Scene* scene,
+                                  bool activeClustersOnly) const
+{
+    assert(scene != nullptr);
+
+    const uint32_t lightCount = lights.getPointLights(scene).size();
+    const uint32_t lightGroups = LightShader::getLightDispatchGroups(lightCount, SCATTER_LIGHTS_THREADS);
+
+    // count lights per cluster
+
+    lights.bindLights(scene);
+    bindBuffers(false);
+    bgfx::dispatch(view, scatterCountComputeProgram, lightGroups, 1, 1);
+
+    // allocate light indices
+
+    bindBuffers(false);
+    if(activeClustersOnly)
+    {
+        bgfx::dispatch(view, scatterAllocateActiveComputeProgram, activeClustersIndirectBuffer);
+    }
+    else
+    {
+        bgfx::dispatch(view,
+                       scatterAllocateComputeProgram,
+                       (uint32_t)std::ceil((float)currentClustersX / CLUSTERS_X_THREADS),
+                       (uint32_t)std::ceil((float)currentClustersY / CLUSTERS_Y_THREADS),
+                       (uint32_t)std::ceil((float)currentClustersZ / CLUSTERS_Z_THREADS));
+    }
+
+    // write light indices
+
+    lights.bindLights(scene);
+    bindBuffers(false);
+    bgfx::dispatch(view, scatterWriteComputeProgram, lightGroups, 1, 1);
 }
 
 void ClusterShader::shutdown()
@@ -83,32 +294,76 @@ void ClusterShader::shutdown()
     bgfx::destroy(clusterCountVecUniform);
     bgfx::destroy(clusterSizeVecUniform);
     bgfx::destroy(zNearFarVecUniform);
+    bgfx::destroy(clusterClassVecUniform);
 
     bgfx::destroy(clustersBuffer);
     bgfx::destroy(lightIndicesBuffer);
     bgfx::destroy(lightGridBuffer);
+    bgfx::destroy(countersBuffer);
+    bgfx::destroy(clusterFlagsBuffer);
+    bgfx::destroy(activeClustersBuffer);
+    bgfx::destroy(activeClustersIndirectBuffer);
+    bgfx::destroy(depthSampler);
+    bgfx::destroy(transparentDepthSampler);
+
+    bgfx::destroy(flagClustersComputeProgram);
+    bgfx::destroy(flagClustersTransparentComputeProgram);
+    bgfx::destroy(compactClustersComputeProgram);
+    bgfx::destroy(activeClustersArgsComputeProgram);
+
+    bgfx::destroy(lightCountsBuffer);
+    bgfx::destroy(scatterCountComputeProgram);
+    bgfx::destroy(scatterAllocateComputeProgram);
+    bgfx::destroy(scatterAllocateActiveComputeProgram);
+    bgfx::destroy(scatterWriteComputeProgram);
 
-    clusterCountVecUniform = clusterSizeVecUniform = zNearFarVecUniform = BGFX_INVALID_HANDLE;
+    readback.shutdown();
+
+    clusterCountVecUniform = clusterSizeVecUniform = zNearFarVecUniform = clusterClassVecUniform = BGFX_INVALID_HANDLE;
     clustersBuffer = BGFX_INVALID_HANDLE;
-    lightIndicesBuffer = lightGridBuffer = BGFX_INVALID_HANDLE;
+    lightIndicesBuffer = lightGridBuffer = countersBuffer = BGFX_INVALID_HANDLE;
+    clusterFlagsBuffer = activeClustersBuffer = BGFX_INVALID_HANDLE;
+    activeClustersIndirectBuffer = BGFX_INVALID_HANDLE;
+    depthSampler = transparentDepthSampler = BGFX_INVALID_HANDLE;
+    flagClustersComputeProgram = flagClustersTransparentComputeProgram = compactClustersComputeProgram =
+        activeClustersArgsComputeProgram = BGFX_INVALID_HANDLE;
+    lightCountsBuffer = BGFX_INVALID_HANDLE;
+    scatterCountComputeProgram = scatterAllocateComputeProgram = scatterAllocateActiveComputeProgram =
+        scatterWriteComputeProgram = BGFX_INVALID_HANDLE;
 }
 
-void ClusterShader::setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight) const
+void ClusterShader::setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight, uint32_t grid) const
 {
     assert(scene != nullptr);
+    assert(grid < getGridCount());
+
+    // the coarse grid is always linear, its clusters cover RADIUS_CLASS_GRID_FACTOR^3 main clusters
+    const bool coarse = grid == 1;
+    const float factor = coarse ? (float)RADIUS_CLASS_GRID_FACTOR : 1.0f;
+    const auto clusterCount = getClusterCount(grid);
 
-    float clusterCountVec[4] = { (float)currentClustersX,
-                                 (float)currentClustersY,
-                                 (float)currentClustersZ };
+    float clusterCountVec[4] = { (float)std::get<0>(clusterCount),
+                                 (float)std::get<1>(clusterCount),
+                                 (float)std::get<2>(clusterCount),
+                                 (float)(coarse ? GridLayout::Linear : currentLayout) };
     bgfx::setUniform(clusterCountVecUniform, clusterCountVec);
 
-    float clusterSizesVec[4] = { std::ceil((float)screenWidth / (float)currentClustersX),
-                                 std::ceil((float)screenHeight / (float)currentClustersY),
-                                    (float)currentMaxLightsPerCluster };
+    float clusterSizesVec[4] = { std::ceil((float)screenWidth / (float)currentClustersX) * factor,
+                                 std::ceil((float)screenHeight / (float)currentClustersY) * factor,
+                                 (float)currentMaxLightsPerCluster,
+                                 (float)currentMaxLightIndices };
     bgfx::setUniform(clusterSizeVecUniform, clusterSizesVec);
 
     float zNearFarVec[4] = { scene->camera.zNear, scene->camera.zFar };
     bgfx::setUniform(zNearFarVecUniform, zNearFarVec);
+
+    // grid offset, coarse grid factor, radius range of the lights culled against this grid
+    const float noLimit = std::numeric_limits<float>::max();
+    float clusterClassVec[4] = { coarse ? (float)getClusterStorageCount() : 0.0f,
+                                 radiusClasses ? (float)RADIUS_CLASS_GRID_FACTOR : 0.0f,
+                                 coarse ? largeLightRadius : -1.0f,
+                                 radiusClasses && !coarse ? largeLightRadius : noLimit };
+    bgfx::setUniform(clusterClassVecUniform, clusterClassVec);
 }
 
 void ClusterShader::bindBuffers(bool lightingPass) const
@@ -118,12 +373,94 @@ void ClusterShader::bindBuffers(bool lightingPass) const
     if(!lightingPass)
     {
         bgfx::setBuffer(Samplers::CLUSTERS_CLUSTERS, clustersBuffer, access);
+        bgfx::setBuffer(Samplers::CLUSTERS_COUNTERS, countersBuffer, access);
+        bgfx::setBuffer(Samplers::CLUSTERS_ACTIVECLUSTERS, activeClustersBuffer, access);
+        bgfx::setBuffer(Samplers::CLUSTERS_LIGHTCOUNTS, lightCountsBuffer, access);
     }
     bgfx::setBuffer(Samplers::CLUSTERS_LIGHTINDICES, lightIndicesBuffer, access);
     bgfx::setBuffer(Samplers::CLUSTERS_LIGHTGRID, lightGridBuffer, access);
 }
 
-std::tuple<uint32_t, uint32_t, uint32_t> ClusterShader::getClusterCount() const
+void ClusterShader::updateLightGrid(const std::vector<uint32_t>& lightIndices,
+                                    const std::vector<uint32_t>& lightGrid) const
 {
+    // bgfx::update copies at the start of the frame, before any compute or draw calls
+    if(!lightIndices.empty())
+    {
+        bgfx::update(lightIndicesBuffer,
+                     0,
+                     bgfx::copy(lightIndices.data(), uint32_t(lightIndices.size() * sizeof(uint32_t))));
+    }
+    bgfx::update(lightGridBuffer, 0, bgfx::copy(lightGrid.data(), uint32_t(lightGrid.size() * sizeof(uint32_t))));
+}
+
+std::tuple<uint32_t, uint32_t, uint32_t> ClusterShader::getClusterCount(uint32_t grid) const
+{
+    if(grid == 1)
+    {
+        // same as getGridClusterIndex in clusters.sh
+        const uint32_t factor = RADIUS_CLASS_GRID_FACTOR;
+        return std::make_tuple((currentClustersX + factor - 1) / factor,
+                               (currentClustersY + factor - 1) / factor,
+                               (currentClustersZ + factor - 1) / factor);
+    }
     return std::make_tuple(currentClustersX, currentClustersY, currentClustersZ);
 }
+
+uint32_t ClusterShader::getClusterStorageCount() const
+{
+    // same as getClusterStorageCount in clusters.sh
+    if(currentLayout == GridLayout::Swizzled)
+    {
+        const uint32_t blocksX = (currentClustersX + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        const uint32_t blocksY = (currentClustersY + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        return blocksX * blocksY * BLOCK_SIZE * BLOCK_SIZE * currentClustersZ;
+    }
+    return currentClustersX * currentClustersY * currentClustersZ;
+}
+
+uint32_t ClusterShader::getTotalClusterStorageCount() const
+{
+    uint32_t count = getClusterStorageCount();
+    if(radiusClasses)
+    {
+        const auto coarseCount = getClusterCount(1);
+        count += std::get<0>(coarseCount) * std::get<1>(coarseCount) * std::get<2>(coarseCount);
+    }
+    return count;
+}
+
+bool ClusterShader::boundsOutdated(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight)
+{
+    assert(scene != nullptr);
+
+    // compare the parameters that go into the projection matrix instead of the matrix itself
+    // this way we can test for exact equality and don't have to worry about epsilons
+    ProjectionFingerprint fingerprint;
+    fingerprint.fov = scene->camera.fov;
+    fingerprint.aspect = float(screenWidth) / screenHeight;
+    fingerprint.zNear = scene->camera.zNear;
+    fingerprint.zFar = scene->camera.zFar;
+    fingerprint.screenWidth = screenWidth;
+    fingerprint.screenHeight = screenHeight;
+    fingerprint.clustersX = currentClustersX;
+    fingerprint.clustersY = currentClustersY;
+    fingerprint.clustersZ = currentClustersZ;
+
+    if(boundsValid && fingerprint == boundsFingerprint)
+    {
+        reusedBoundsFrames++;
+        return false;
+    }
+
+    boundsValid = true;
+    boundsFingerprint = fingerprint;
+    return true;
+}
+
+bool ClusterShader::ProjectionFingerprint::operator==(const ProjectionFingerprint& other) const
+{
+    return fov == other.fov && aspect == other.aspect && zNear == other.zNear && zFar == other.zFar &&
+           screenWidth == other.screenWidth && screenHeight == other.screenHeight && clustersX == other.clustersX &&
+           clustersY == other.clustersY && clustersZ == other.clustersZ;
+}
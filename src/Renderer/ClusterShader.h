@@ -1,23 +1,99 @@
 #pragma once
 
 #include <bgfx/bgfx.h>
+#include "Renderer/CounterReadback.h"
 #include <tuple>
+#include <vector>
 
 class Scene;
+class LightShader;
 
 class ClusterShader
 {
 public:
+    enum class LightCullingMode : int
+    {
+        // cluster-centric, each cluster tests all lights
+        Gather = 0,
+        // light-centric, each light adds itself to the clusters it overlaps
+        Scatter
+    };
+
+    // order of the clusters in the grid buffers, see clusters.sh
+    enum class GridLayout : int
+    {
+        // x, then y, then z
+        Linear = 0,
+        // 4x4 blocks per depth slice, Morton order inside each block
+        Swizzled
+    };
+
     ClusterShader();
 
     void initialize();
     void shutdown();
 
-    void setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight) const;
+    // grid is the grid that gets built or culled next (see getGridCount), the lighting pass uses 0
+    void setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight, uint32_t grid = 0) const;
     void bindBuffers(bool lightingPass = true) const;
-    void updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenWidth, uint16_t screenHeight, bool clustersXYAsPixelSizes, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ);
+    // with adaptiveCapacity, the size of the light index list follows the usage read back from the GPU (see adaptCapacity)
+    // with largeLightRadius > 0, lights with a larger radius are culled against a coarse second grid (radius classes)
+    // only cluster-centric culling on the GPU knows about radius classes
+    void updateBuffers(uint32_t maxLightsPerCluster, uint16_t screenWidth, uint16_t screenHeight, bool clustersXYAsPixelSizes, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ, GridLayout layout = GridLayout::Linear, bool adaptiveCapacity = false, float largeLightRadius = 0.0f);
+    // reset the light index allocator, call once per frame before light culling
+    void resetCounters() const;
+
+    // overflow counters and adaptive light index list
+    // request the counters written by this frame's light culling, call after light culling
+    // blitView has to come after view, see CounterReadback::request
+    void requestCounters(bgfx::ViewId view, bgfx::ViewId blitView);
+    // pick up counters from a previous frame once they arrived
+    // with adaptive capacity, also grow or shrink the light index list
+    // call before setUniforms, returns true if the list was recreated
+    bool adaptCapacity(uint32_t frame);
+    // from the last counters that arrived, clusters that dropped lights because their list
+    // or the light index list was full
+    uint32_t getOverflowedClusters() const { return overflowedClusters; }
+    uint32_t getMostLightsPerCluster() const { return mostLightsPerCluster; }
 
-    std::tuple<uint32_t, uint32_t, uint32_t> getClusterCount() const;
+    // flag clusters containing geometry and compact them into a list
+    // depthTexture holds the depth of opaque geometry (depth prepass or G-Buffer)
+    // transparentDepthTexture holds the closest transparent surface (see Renderer::renderTransparentDepth),
+    // pass it if the scene has transparent meshes so their clusters get flagged too
+    // afterwards, light culling can be dispatched indirectly with getActiveClustersIndirectBuffer()
+    void detectActiveClusters(bgfx::ViewId view,
+                              bgfx::TextureHandle depthTexture,
+                              uint16_t screenWidth,
+                              uint16_t screenHeight,
+                              bgfx::TextureHandle transparentDepthTexture = BGFX_INVALID_HANDLE) const;
+    bgfx::IndirectBufferHandle getActiveClustersIndirectBuffer() const { return activeClustersIndirectBuffer; }
+
+    // light-centric culling, replaces the light culling dispatch with 3 passes:
+    // count intersecting lights per cluster, allocate light indices, write light indices
+    // call after resetCounters (and detectActiveClusters if activeClustersOnly is set)
+    void scatterLights(bgfx::ViewId view, const LightShader& lights, const Scene* scene, bool activeClustersOnly) const;
+
+    // upload light indices and light grid calculated on the CPU (see CPULightCulling)
+    // replaces the light culling dispatch
+    void updateLightGrid(const std::vector<uint32_t>& lightIndices, const std::vector<uint32_t>& lightGrid) const;
+
+    // cluster building and light culling have to run for each grid
+    // the main grid, and the coarse grid for large lights with radius classes
+    uint32_t getGridCount() const { return radiusClasses ? 2 : 1; }
+    std::tuple<uint32_t, uint32_t, uint32_t> getClusterCount(uint32_t grid = 0) const;
+    // number of entries in the main grid, more than the cluster count with the swizzled layout
+    uint32_t getClusterStorageCount() const;
+    GridLayout getGridLayout() const { return currentLayout; }
+    uint32_t getMaxLightsPerCluster() const { return currentMaxLightsPerCluster; }
+    uint32_t getMaxLightIndices() const { return currentMaxLightIndices; }
+
+    // cluster bounds are saved in camera coordinates so they don't change with camera movement
+    // returns true if they need to be rebuilt because the projection or grid changed since the last call
+    bool boundsOutdated(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight);
+    // number of frames that reused the cluster bounds from a previous frame
+    uint64_t getReusedBoundsFrames() const { return reusedBoundsFrames; }
+    // for culling that doesn't build the cluster bounds, the next boundsOutdated call returns true
+    void invalidateBounds() { boundsValid = false; }
 
     //static constexpr uint32_t CLUSTERS_X = 16;
     //static constexpr uint32_t CLUSTERS_Y = 8;
@@ -29,11 +105,35 @@ public:
     static constexpr uint32_t CLUSTERS_Y_THREADS = 8;
     static constexpr uint32_t CLUSTERS_Z_THREADS = 4;
 
+    // workgroup size of the cluster flagging compute shader (one thread per pixel)
+    static constexpr uint32_t FLAG_THREADS = 16;
+    // workgroup size of the light-centric culling shaders (one thread per light)
+    static constexpr uint32_t SCATTER_LIGHTS_THREADS = 64;
+
     //static constexpr uint32_t CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
 
+    // block size of the swizzled layout, should be the same as in clusters.sh
+    static constexpr uint32_t BLOCK_SIZE = 4;
+
     static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 2048;
 
+    // the coarse grid of radius classes has this many times fewer clusters in each dimension
+    static constexpr uint32_t RADIUS_CLASS_GRID_FACTOR = 2;
+
+    // initial size of the adaptive light index list, per cluster on average
+    // clusters can hold more than this as long as the total fits
+    // without adaptive capacity, the list has room for maxLightsPerCluster in every cluster
+    static constexpr uint32_t AVERAGE_LIGHTS_PER_CLUSTER = 32;
+    // upper limit for the light index list size
+    // passed to the shader as a float, so it has to be exactly representable
+    static constexpr uint32_t MAX_LIGHT_INDICES = 1 << 24;
+    // lower limit for the adaptive light index list size
+    static constexpr uint32_t MIN_LIGHT_INDICES = 1 << 12;
+
 private:
+    // entries in the grid buffers, main grid followed by the coarse grid
+    uint32_t getTotalClusterStorageCount() const;
+
     struct ClusterVertex
     {
         // w is padding
@@ -58,13 +158,72 @@ private:
     uint32_t currentClustersX{};
     uint32_t currentClustersY{};
     uint32_t currentClustersZ{};
+    GridLayout currentLayout = GridLayout::Linear;
+    uint32_t currentMaxLightIndices{};
+    bool currentAdaptiveCapacity{};
+    bool radiusClasses{};
+    float largeLightRadius{};
+
+    CounterReadback readback;
+    AdaptiveCapacity lightIndicesCapacity;
+    uint32_t overflowedClusters = 0;
+    uint32_t mostLightsPerCluster = 0;
+
+    // everything the cluster bounds depend on
+    struct ProjectionFingerprint
+    {
+        float fov;
+        float aspect;
+        float zNear;
+        float zFar;
+        uint16_t screenWidth;
+        uint16_t screenHeight;
+        uint32_t clustersX;
+        uint32_t clustersY;
+        uint32_t clustersZ;
+
+        bool operator==(const ProjectionFingerprint& other) const;
+    };
+
+    bool boundsValid = false;
+    ProjectionFingerprint boundsFingerprint{};
+    uint64_t reusedBoundsFrames = 0;
 
     bgfx::UniformHandle clusterCountVecUniform = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle clusterSizeVecUniform = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle zNearFarVecUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle clusterClassVecUniform = BGFX_INVALID_HANDLE;
 
     // dynamic buffers can be created empty
     bgfx::DynamicVertexBufferHandle clustersBuffer = BGFX_INVALID_HANDLE;
     bgfx::DynamicIndexBufferHandle lightIndicesBuffer = BGFX_INVALID_HANDLE;
     bgfx::DynamicIndexBufferHandle lightGridBuffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle countersBuffer = BGFX_INVALID_HANDLE;
+
+    // active cluster detection
+    bgfx::DynamicIndexBufferHandle clusterFlagsBuffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle activeClustersBuffer = BGFX_INVALID_HANDLE;
+    bgfx::IndirectBufferHandle activeClustersIndirectBuffer = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle depthSampler = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle transparentDepthSampler = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle flagClustersComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle flagClustersTransparentComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle compactClustersComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeClustersArgsComputeProgram = BGFX_INVALID_HANDLE;
+
+    // light-centric culling
+    bgfx::DynamicIndexBufferHandle lightCountsBuffer = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle scatterCountComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle scatterAllocateComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle scatterAllocateActiveComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle scatterWriteComputeProgram = BGFX_INVALID_HANDLE;
+
+    // light indices, active clusters, overflowed clusters, most lights per cluster
+    // these should be the same as in clusters.sh
+    static constexpr uint32_t COUNTER_LIGHT_INDICES = 0;
+    static constexpr uint32_t COUNTER_OVERFLOWED_CLUSTERS = 2;
+    static constexpr uint32_t COUNTER_MAX_LIGHTS = 3;
+    static constexpr uint32_t COUNTER_COUNT = 4;
 };
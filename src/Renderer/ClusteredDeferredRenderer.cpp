@@ -6,64 +6,34 @@
 #include <bigg.hpp>
 #include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/ext/matrix_relational.hpp>
-
-ClusteredDeferredRenderer::ClusteredDeferredRenderer(const Scene* scene, const Config* config) :
-    Renderer(scene, config),
-    gBufferTextures { { BGFX_INVALID_HANDLE, "Diffuse + roughness" },
-                      { BGFX_INVALID_HANDLE, "Normal" },
-                      { BGFX_INVALID_HANDLE, "F0 + metallic" },
-                      { BGFX_INVALID_HANDLE, "Emissive + occlusion" },
-                      { BGFX_INVALID_HANDLE, "Depth" },
-                      { BGFX_INVALID_HANDLE, nullptr } },
-    gBufferTextureUnits { Samplers::DEFERRED_DIFFUSE_A,
-                          Samplers::DEFERRED_NORMAL,
-                          Samplers::DEFERRED_F0_METALLIC,
-                          Samplers::DEFERRED_EMISSIVE_OCCLUSION,
-                          Samplers::DEFERRED_DEPTH },
-    gBufferSamplerNames { "s_texDiffuseA", "s_texNormal", "s_texF0Metallic", "s_texEmissiveOcclusion", "s_texDepth" }
+
+ClusteredDeferredRenderer::ClusteredDeferredRenderer(const Scene* scene, const Config* config) : Renderer(scene, config)
 {
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        handle = BGFX_INVALID_HANDLE;
-    }
-    buffers = gBufferTextures;
+    buffers = gBuffer.getTextures();
 }
 
 bool ClusteredDeferredRenderer::supported()
 {
     const bgfx::Caps* caps = bgfx::getCaps();
-    bool supported = Renderer::supported() &&
+    return Renderer::supported() &&
            // compute shader
            (caps->supported & BGFX_CAPS_COMPUTE) != 0 &&
            // 32-bit index buffers, used for light grid structure
            (caps->supported & BGFX_CAPS_INDEX32) != 0 &&
            // blitting depth texture after geometry pass
            (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
-           // multiple render targets
-           // depth doesn't count as an attachment
-           caps->limits.maxFBAttachments >= GBufferAttachment::Count - 1;
-    if(!supported)
-        return false;
-
-    for(bgfx::TextureFormat::Enum format : gBufferAttachmentFormats)
-    {
-        if((caps->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) == 0)
-            return false;
-    }
-
-    return true;
+           GBuffer::supported();
 }
 
 void ClusteredDeferredRenderer::onInitialize()
 {
     // OpenGL backend: uniforms must be created before loading shaders
     clusters.initialize();
+    lightBVH.initialize();
+    zbins.initialize();
+    worldGrid.initialize();
 
-    for(size_t i = 0; i < BX_COUNTOF(gBufferSamplers); i++)
-    {
-        gBufferSamplers[i] = bgfx::createUniform(gBufferSamplerNames[i], bgfx::UniformType::Sampler);
-    }
+    gBuffer.initialize();
 
     char csName[128], vsName[128], fsName[128];
 
@@ -73,6 +43,15 @@ void ClusteredDeferredRenderer::onInitialize()
     bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling.bin");
     lightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
 
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active.bin");
+    activeLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_bvh.bin");
+    bvhLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active_bvh.bin");
+    activeBVHLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_deferred_geometry.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_deferred_geometry.bin");
     geometryProgram = bigg::loadProgram(vsName, fsName);
@@ -84,141 +63,203 @@ void ClusteredDeferredRenderer::onInitialize()
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_deferred.bin");
     debugVisFullscreenProgram = bigg::loadProgram(vsName, fsName);
 
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_deferred_fullscreen_zbin.bin");
+    zbinFullscreenProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_deferred_zbin.bin");
+    zbinDebugVisFullscreenProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_deferred_fullscreen_worldgrid.bin");
+    worldGridFullscreenProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_deferred_worldgrid.bin");
+    worldGridDebugVisFullscreenProgram = bigg::loadProgram(vsName, fsName);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_clustered_forward.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward.bin");
     transparencyProgram = bigg::loadProgram(vsName, fsName);
 
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward.bin");
     debugVisTransparencyProgram = bigg::loadProgram(vsName, fsName);
-}
 
-void ClusteredDeferredRenderer::onReset()
-{
-    if(!bgfx::isValid(gBuffer))
-    {
-        gBuffer = createGBuffer();
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward_zbin.bin");
+    zbinTransparencyProgram = bigg::loadProgram(vsName, fsName);
 
-        for(size_t i = 0; i < GBufferAttachment::Depth; i++)
-        {
-            gBufferTextures[i].handle = bgfx::getTexture(gBuffer, (uint8_t)i);
-        }
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward_zbin.bin");
+    zbinDebugVisTransparencyProgram = bigg::loadProgram(vsName, fsName);
 
-        // we can't use the G-Buffer's depth texture in the light pass framebuffer
-        // binding a texture for reading in the shader and attaching it to a framebuffer
-        // at the same time is undefined behaviour in most APIs
-        // https://www.khronos.org/opengl/wiki/Memory_Model#Framebuffer_objects
-        // we use a different depth texture and just blit it between the geometry and light pass
-        const uint64_t flags = BGFX_TEXTURE_BLIT_DST | gBufferSamplerFlags;
-        bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-        lightDepthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward_worldgrid.bin");
+    worldGridTransparencyProgram = bigg::loadProgram(vsName, fsName);
 
-        gBufferTextures[GBufferAttachment::Depth].handle = lightDepthTexture;
-    }
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward_worldgrid.bin");
+    worldGridDebugVisTransparencyProgram = bigg::loadProgram(vsName, fsName);
+}
 
-    if(!bgfx::isValid(accumFrameBuffer))
-    {
-        const bgfx::TextureHandle textures[2] = { bgfx::getTexture(frameBuffer, 0),
-                                                  bgfx::getTexture(gBuffer, GBufferAttachment::Depth) };
-        accumFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(textures), textures); // don't destroy textures
-    }
+void ClusteredDeferredRenderer::onReset()
+{
+    gBuffer.update(width, height, scene, config->thinGBuffer, false, bgfx::getTexture(frameBuffer, 0));
+    createTransparentDepth();
 }
 
 void ClusteredDeferredRenderer::onRender(float dt)
 {
     if(buffersNeedUpdate)
     {
+        // radius classes need cluster-centric culling on the GPU
+        // lightcuts would count lights twice, the virtual lights don't care about the classes
+        const bool radiusClasses = config->radiusClasses && !config->cpuLightCulling && !config->zBinning &&
+                                   !config->worldLightGrid &&
+                                   config->clusterLightCullingMode == ClusterShader::LightCullingMode::Gather &&
+                                   !(config->lightBVH && config->lightcuts);
         clusters.updateBuffers(config->maxLightsPerTileOrCluster,
                                width, height, config->treatClusterXYasPixelSize,
-                               config->clustersX, config->clustersY, config->clustersZ);
+                               config->clustersX, config->clustersY, config->clustersZ,
+                               // CPU light culling writes a linear grid
+                               config->cpuLightCulling ? ClusterShader::GridLayout::Linear : config->clusterGridLayout,
+                               config->adaptiveLightLists && !config->cpuLightCulling && !config->zBinning &&
+                                   !config->worldLightGrid,
+                               radiusClasses ? config->largeLightRadius : 0.0f);
         buffersNeedUpdate = false;
     }
 
     enum : bgfx::ViewId
     {
         vClusterBuilding = 0,
-        vLightCulling,
         vGeometry,          // write G-Buffer
+        vTransparentDepth,  // depth of transparent meshes for active cluster detection
+        vActiveClusters,    // flag clusters containing geometry
+        vLightBVH,
+        vLightCulling,
         vFullscreenLights,  // write ambient + emissive to output buffer
         vTransparent        // forward pass for transparency
     };
 
+    // light culling on the CPU replaces cluster building and light culling on the GPU
+    const bool cpuCulling = config->cpuLightCulling;
+
+    // z-binning replaces cluster building, light culling and the cluster light grid
+    const bool zBinning = config->zBinning && !cpuCulling;
+
+    // the world-space grid replaces them as well, it's only rebuilt when lights change
+    const bool worldLightGrid = config->worldLightGrid && !cpuCulling && !zBinning;
+
+    // light culling on the GPU reads back its overflow counters
+    // with adaptive light lists they also size the light index list
+    const bool gpuLightLists = !cpuCulling && !zBinning && !worldLightGrid;
+
+    // only cull lights for clusters that contain geometry
+    // uses the G-Buffer depth, light culling has to happen after the geometry pass
+    // the CPU doesn't see the depth buffer, it always culls all clusters
+    const bool activeClustersOnly = config->cullActiveClustersOnly && !cpuCulling && !zBinning && !worldLightGrid;
+
     const uint32_t BLACK = 0x000000FF;
 
+    // layout option or the scene's materials changed
+    gBuffer.update(width, height, scene, config->thinGBuffer, false, bgfx::getTexture(frameBuffer, 0));
+
     bgfx::setViewName(vClusterBuilding, "Cluster building pass (compute)");
     // set u_viewRect for screen2Eye to work correctly
     bgfx::setViewRect(vClusterBuilding, 0, 0, width, height);
 
-    bgfx::setViewName(vLightCulling, "Clustered light culling pass (compute)");
-    bgfx::setViewRect(vLightCulling, 0, 0, width, height);
-
     bgfx::setViewName(vGeometry, "Deferred clustered geometry pass");
     bgfx::setViewClear(vGeometry, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, BLACK, 1.0f);
     bgfx::setViewRect(vGeometry, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vGeometry, gBuffer);
+    bgfx::setViewFrameBuffer(vGeometry, gBuffer.getFrameBuffer());
     bgfx::touch(vGeometry);
 
+    bgfx::setViewName(vTransparentDepth, "Transparent depth pass");
+
+    bgfx::setViewName(vActiveClusters, "Active cluster detection pass (compute)");
+    bgfx::setViewRect(vActiveClusters, 0, 0, width, height);
+
+    bgfx::setViewName(vLightBVH, "Light BVH build pass (compute)");
+
+    bgfx::setViewName(vLightCulling, "Clustered light culling pass (compute)");
+    bgfx::setViewRect(vLightCulling, 0, 0, width, height);
+
     bgfx::setViewName(vFullscreenLights, "Deferred clustered light pass (point lights + ambient + emissive)");
     bgfx::setViewClear(vFullscreenLights, BGFX_CLEAR_COLOR, clearColor);
     bgfx::setViewRect(vFullscreenLights, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vFullscreenLights, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vFullscreenLights, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vFullscreenLights);
 
     bgfx::setViewName(vTransparent, "Transparent forward pass");
     bgfx::setViewClear(vTransparent, BGFX_CLEAR_NONE);
     bgfx::setViewRect(vTransparent, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vTransparent, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vTransparent, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vTransparent);
 
     if(!scene->loaded)
         return;
 
+    // counters from a previous frame, this changes u_maxLightIndices so do it before setUniforms
+    const bool capacityChanged = clusters.adaptCapacity(frameNumber);
     clusters.setUniforms(scene, width, height);
 
+    // skip building and culling if nothing changed since the last frame, the light grid is still valid
+    const bool updateLightLists = lightListsOutdated(capacityChanged);
+
     // cluster building needs u_invProj to transform screen coordinates to eye space
     setViewProjection(vClusterBuilding);
-    // light culling needs u_view to transform lights to eye space
-    setViewProjection(vLightCulling);
     setViewProjection(vGeometry);
+    // light BVH and light culling need u_view to transform lights to eye space
+    // light-centric culling also needs u_proj to find the clusters a light overlaps
+    setViewProjection(vLightBVH);
+    setViewProjection(vLightCulling);
     setViewProjection(vFullscreenLights);
     setViewProjection(vTransparent);
 
     // cluster building
 
     // only run this step if the camera parameters changed (aspect ratio, fov, near/far plane)
-    // cluster bounds are saved in camera coordinates so they don't change with camera movement
-
-    // ideally we'd compare the relative error here but a correct implementation would involve
-    // a bunch of costly matrix operations: https://floating-point-gui.de/errors/comparison/
-    // comparing the absolute error against a rather small epsilon here works as long as the values
-    // in the projection matrix aren't getting too large
+    // or the cluster grid was recreated
     const auto clusterCount = clusters.getClusterCount();
     const auto clustersX = std::get<0>(clusterCount);
     const auto clustersY = std::get<1>(clusterCount);
     const auto clustersZ = std::get<2>(clusterCount);
 
-    clusters.bindBuffers(false /*lightingPass*/); // write access, all buffers
-
-    bgfx::dispatch(vClusterBuilding,
-                   clusterBuildingComputeProgram,
-                   (uint32_t)std::ceil((float)clustersX / ClusterShader::CLUSTERS_X_THREADS),
-                   (uint32_t)std::ceil((float)clustersY / ClusterShader::CLUSTERS_Y_THREADS),
-                   (uint32_t)std::ceil((float)clustersZ / ClusterShader::CLUSTERS_Z_THREADS));
-
-    // light culling
-
-    lights.bindLights(scene);
-    clusters.bindBuffers(false);
-
-    bgfx::dispatch(vLightCulling,
-                   lightCullingComputeProgram,
-                   (uint32_t)std::ceil((float)clustersX / ClusterShader::CLUSTERS_X_THREADS),
-                   (uint32_t)std::ceil((float)clustersY / ClusterShader::CLUSTERS_Y_THREADS),
-                   (uint32_t)std::ceil((float)clustersZ / ClusterShader::CLUSTERS_Z_THREADS));
+    // compare every frame so the fingerprint and the reuse counter stay current
+    const bool boundsOutdated = clusters.boundsOutdated(scene, width, height);
+    if(cpuCulling || zBinning || worldLightGrid)
+    {
+        // these don't use the cluster bounds, rebuild them when switching back
+        clusters.invalidateBounds();
+    }
+    else if(boundsOutdated)
+    {
+        // one dispatch per grid, radius classes add a coarse grid with its own uniforms
+        for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+        {
+            const auto gridClusterCount = clusters.getClusterCount(grid);
+            clusters.setUniforms(scene, width, height, grid);
+            clusters.bindBuffers(false /*lightingPass*/); // write access, all buffers
+
+            bgfx::dispatch(vClusterBuilding,
+                           clusterBuildingComputeProgram,
+                           (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS),
+                           (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS),
+                           (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS));
+        }
+        // uniforms stick around for the following views (active cluster detection)
+        clusters.setUniforms(scene, width, height);
+    }
+    counters["Cluster bounds reused (frames)"] = (double)clusters.getReusedBoundsFrames();
+    counters["Light lists reused (frames)"] = (double)getReusedLightListFrames();
+    if(gpuLightLists)
+        counters["Light index list size"] = (double)clusters.getMaxLightIndices();
+    else
+        counters.erase("Light index list size");
+    if(gpuLightLists && CounterReadback::supported())
+        counters["Overflowed clusters"] = (double)clusters.getOverflowedClusters();
+    else
+        counters.erase("Overflowed clusters");
 
     // render geometry, write to G-Buffer
 
     const uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
 
+    gBuffer.setUniform();
+
     for(const Mesh& mesh : scene->meshes)
     {
         const Material& mat = scene->materials[mesh.material];
@@ -239,15 +280,142 @@ void ClusteredDeferredRenderer::onRender(float dt)
     // copy G-Buffer depth attachment to depth texture for sampling in the light pass
     // we can't attach it to the frame buffer and read it in the shader (unprojecting world position) at the same time
     // blit happens before any compute or draw calls
-    bgfx::blit(vFullscreenLights, lightDepthTexture, 0, 0, bgfx::getTexture(gBuffer, GBufferAttachment::Depth));
+    // active cluster detection reads it as well, so do it in the first view that needs it
+    // (views without any dispatches or draws might never run their blits)
+    gBuffer.blitDepth(activeClustersOnly && updateLightLists ? vActiveClusters : vFullscreenLights);
+
+    if(updateLightLists)
+        clusters.resetCounters();
+
+    // active cluster detection
+
+    if(activeClustersOnly && updateLightLists)
+    {
+        // transparent meshes aren't in the G-Buffer, without their depth
+        // clusters containing only those would be skipped and lose all point lights
+        bgfx::TextureHandle transparentDepth = BGFX_INVALID_HANDLE;
+        if(scene->transparentMeshes)
+        {
+            renderTransparentDepth(vTransparentDepth);
+            transparentDepth = transparentDepthTexture;
+        }
+        clusters.detectActiveClusters(vActiveClusters, gBuffer.getDepthTexture(), width, height, transparentDepth);
+    }
+
+    // otherwise keep the light grid and counters from the last update
+    if(updateLightLists)
+    {
+        if(cpuCulling)
+        {
+            cpuLightCulling.cullClusters(lights,
+                                         scene,
+                                         viewMat,
+                                         projMat,
+                                         width,
+                                         height,
+                                         clustersX,
+                                         clustersY,
+                                         clustersZ,
+                                         clusters.getMaxLightsPerCluster(),
+                                         clusters.getMaxLightIndices());
+            clusters.updateLightGrid(cpuLightCulling.getLightIndices(), cpuLightCulling.getLightGrid());
+            counters["CPU light culling (ms)"] = cpuLightCulling.getCullingTime();
+        }
+        else if(zBinning)
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // sort lights into depth bins on the CPU, build tile bitmasks on the GPU
+
+            zbins.update(lights, scene, viewMat, clustersX, clustersY);
+            counters["Z-binning sort (ms)"] = zbins.getSortTime();
+            zbins.buildTileMasks(vLightCulling, lights, scene);
+        }
+        else if(worldLightGrid)
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // assign lights to world-space cells on the CPU
+            // this only does work if the lights changed, the camera doesn't matter
+
+            worldGrid.update(lights, scene, config->worldGridCellSize);
+            counters["World grid build (ms)"] = worldGrid.getBuildTime();
+            counters["World grid reused (frames)"] = (double)worldGrid.getReusedFrames();
+        }
+        else
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // light BVH
+            // light-centric culling doesn't loop over all lights, it doesn't need the hierarchy
+
+            const bool scatter = config->clusterLightCullingMode == ClusterShader::LightCullingMode::Scatter;
+            const bool useBVH = config->lightBVH && !scatter;
+            // lightcuts pick virtual lights from the BVH per cluster
+            const float lightcutsErrorBound = useBVH ? getLightcutsErrorBound() : 0.0f;
+            if(useBVH)
+            {
+                lightBVH.update(vLightBVH, lights, scene, lightcutsErrorBound > 0.0f);
+                counters["Light BVH sort (ms)"] = lightBVH.getSortTime();
+            }
+
+            // light culling
+            // once per grid, only the main grid has a list of active clusters
+
+            for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+            {
+                clusters.setUniforms(scene, width, height, grid);
+                lights.bindLights(scene);
+                clusters.bindBuffers(false);
+                if(useBVH)
+                    lightBVH.bindBVH(lightcutsErrorBound);
+
+                if(scatter)
+                {
+                    clusters.scatterLights(vLightCulling, lights, scene, activeClustersOnly);
+                }
+                else if(activeClustersOnly && grid == 0)
+                {
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? activeBVHLightCullingComputeProgram : activeLightCullingComputeProgram,
+                                   clusters.getActiveClustersIndirectBuffer());
+                }
+                else
+                {
+                    const auto gridClusterCount = clusters.getClusterCount(grid);
+                    const auto groupsX =
+                        (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS);
+                    const auto groupsY =
+                        (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS);
+                    const auto groupsZ =
+                        (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS);
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? bvhLightCullingComputeProgram : lightCullingComputeProgram,
+                                   groupsX,
+                                   groupsY,
+                                   groupsZ);
+                }
+            }
+            // same for the lighting pass
+            clusters.setUniforms(scene, width, height);
+
+            // overflow counters for adaptCapacity, arrive a few frames later
+            clusters.requestCounters(vLightCulling, vFullscreenLights);
+        }
+    }
 
     // bind these once for all following submits
     // excluding BGFX_DISCARD_TEXTURE_SAMPLERS from the discard flags passed to submit makes sure
     // they don't get unbound
-    bindGBuffer();
+    gBuffer.bind();
     pbr.bindAlbedoLUT();
     lights.bindLights(scene);
-    clusters.bindBuffers(true);
+    if(zBinning)
+        zbins.bindBuffers();
+    else if(worldLightGrid)
+        worldGrid.bindBuffers();
+    else
+        clusters.bindBuffers(true);
 
     // point lights + ambient light + emissive
 
@@ -255,6 +423,10 @@ void ClusteredDeferredRenderer::onRender(float dt)
     // only render if the geometry is in front so we leave the background untouched
     bool debugVis = variables["DEBUG_VIS"] == "true";
     bgfx::ProgramHandle programFullscreen = debugVis ? debugVisFullscreenProgram : fullscreenProgram;
+    if(zBinning)
+        programFullscreen = debugVis ? zbinDebugVisFullscreenProgram : zbinFullscreenProgram;
+    else if(worldLightGrid)
+        programFullscreen = debugVis ? worldGridDebugVisFullscreenProgram : worldGridFullscreenProgram;
     bgfx::setVertexBuffer(0, blitTriangleBuffer);
     bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_GREATER | BGFX_STATE_CULL_CW);
     bgfx::submit(vFullscreenLights, programFullscreen, 0, ~BGFX_DISCARD_BINDINGS);
@@ -262,6 +434,10 @@ void ClusteredDeferredRenderer::onRender(float dt)
     // transparent
 
     bgfx::ProgramHandle programTransparency = debugVis ? debugVisTransparencyProgram : transparencyProgram;
+    if(zBinning)
+        programTransparency = debugVis ? zbinDebugVisTransparencyProgram : zbinTransparencyProgram;
+    else if(worldLightGrid)
+        programTransparency = debugVis ? worldGridDebugVisTransparencyProgram : worldGridTransparencyProgram;
     for(const Mesh& mesh : scene->meshes)
     {
         const Material& mat = scene->materials[mesh.material];
@@ -289,65 +465,35 @@ void ClusteredDeferredRenderer::onOptionsChanged()
 void ClusteredDeferredRenderer::onShutdown()
 {
     clusters.shutdown();
+    lightBVH.shutdown();
+    zbins.shutdown();
+    worldGrid.shutdown();
 
     bgfx::destroy(clusterBuildingComputeProgram);
     bgfx::destroy(lightCullingComputeProgram);
+    bgfx::destroy(activeLightCullingComputeProgram);
+    bgfx::destroy(bvhLightCullingComputeProgram);
+    bgfx::destroy(activeBVHLightCullingComputeProgram);
     bgfx::destroy(geometryProgram);
     bgfx::destroy(fullscreenProgram);
     bgfx::destroy(transparencyProgram);
     bgfx::destroy(debugVisFullscreenProgram);
     bgfx::destroy(debugVisTransparencyProgram);
-
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        bgfx::destroy(handle);
-        handle = BGFX_INVALID_HANDLE;
-    }
-    if(bgfx::isValid(lightDepthTexture))
-        bgfx::destroy(lightDepthTexture);
-    if(bgfx::isValid(gBuffer))
-        bgfx::destroy(gBuffer);
-    if(bgfx::isValid(accumFrameBuffer))
-        bgfx::destroy(accumFrameBuffer);
-
-    lightDepthTexture = BGFX_INVALID_HANDLE;
-    gBuffer = BGFX_INVALID_HANDLE;
-    accumFrameBuffer = BGFX_INVALID_HANDLE;
-
-    clusterBuildingComputeProgram = lightCullingComputeProgram = geometryProgram =
-        fullscreenProgram = transparencyProgram = debugVisFullscreenProgram = debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
-}
-
-bgfx::FrameBufferHandle ClusteredDeferredRenderer::createGBuffer()
-{
-    bgfx::TextureHandle textures[GBufferAttachment::Count];
-
-    const uint64_t flags = BGFX_TEXTURE_RT | gBufferSamplerFlags;
-
-    for(size_t i = 0; i < GBufferAttachment::Depth; i++)
-    {
-        assert(bgfx::isTextureValid(0, false, 1, gBufferAttachmentFormats[i], flags));
-        textures[i] = bgfx::createTexture2D(width, height, false, 1, gBufferAttachmentFormats[i], flags);
-    }
-
-    bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-    assert(depthFormat != bgfx::TextureFormat::Count);
-    textures[Depth] = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
-
-    bgfx::FrameBufferHandle gb = bgfx::createFrameBuffer((uint8_t)GBufferAttachment::Count, textures, true);
-
-    if(!bgfx::isValid(gb))
-        Log->error("Failed to create G-Buffer");
-    else
-        bgfx::setName(gb, "G-Buffer");
-
-    return gb;
+    bgfx::destroy(zbinFullscreenProgram);
+    bgfx::destroy(zbinTransparencyProgram);
+    bgfx::destroy(zbinDebugVisFullscreenProgram);
+    bgfx::destroy(zbinDebugVisTransparencyProgram);
+    bgfx::destroy(worldGridFullscreenProgram);
+    bgfx::destroy(worldGridTransparencyProgram);
+    bgfx::destroy(worldGridDebugVisFullscreenProgram);
+    bgfx::destroy(worldGridDebugVisTransparencyProgram);
+
+    gBuffer.shutdown();
+
+    clusterBuildingComputeProgram = lightCullingComputeProgram = activeLightCullingComputeProgram =
+        bvhLightCullingComputeProgram = activeBVHLightCullingComputeProgram = geometryProgram =
+        fullscreenProgram = transparencyProgram = debugVisFullscreenProgram = debugVisTransparencyProgram =
+        zbinFullscreenProgram = zbinTransparencyProgram = zbinDebugVisFullscreenProgram =
+        zbinDebugVisTransparencyProgram = worldGridFullscreenProgram = worldGridTransparencyProgram =
+        worldGridDebugVisFullscreenProgram = worldGridDebugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 }
-
-void ClusteredDeferredRenderer::bindGBuffer()
-{
-    for(size_t i = 0; i < GBufferAttachment::Count; i++)
-    {
-        bgfx::setTexture(gBufferTextureUnits[i], gBufferSamplers[i], gBufferTextures[i].handle);
-    }
-}
\ No newline at end of file
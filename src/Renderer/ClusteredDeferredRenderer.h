@@ -1,7 +1,12 @@
 #pragma once
 
 #include "Renderer.h"
+#include "GBuffer.h"
 #include "ClusterShader.h"
+#include "LightBVHShader.h"
+#include "CPULightCulling.h"
+#include "ZBinShader.h"
+#include "WorldGridShader.h"
 
 class ClusteredDeferredRenderer : public Renderer
 {
@@ -19,10 +24,11 @@ public:
 private:
     bool buffersNeedUpdate = true;
 
-    glm::mat4 oldProjMat = glm::mat4(0.0f);
-
     bgfx::ProgramHandle clusterBuildingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle bvhLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeBVHLightCullingComputeProgram = BGFX_INVALID_HANDLE;
 
     bgfx::ProgramHandle geometryProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle fullscreenProgram = BGFX_INVALID_HANDLE;
@@ -31,56 +37,23 @@ private:
     bgfx::ProgramHandle debugVisFullscreenProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 
-    ClusterShader clusters;
-
-    enum GBufferAttachment : size_t
-    {
-        // no world position
-        // gl_Fragcoord is enough to unproject
-
-        // RGB = diffuse
-        // A = a (remapped roughness)
-        Diffuse_A,
-
-        // RG = encoded normal
-        Normal,
-
-        // RGB = F0 (Fresnel at normal incidence)
-        // A = metallic
-        // TODO? don't use F0, calculate from diffuse and metallic in shader
-        //       where do we store metallic?
-        F0_Metallic,
+    // z-binning variants
+    bgfx::ProgramHandle zbinFullscreenProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle zbinTransparencyProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle zbinDebugVisFullscreenProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle zbinDebugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 
-        // RGB = emissive radiance
-        // A = occlusion multiplier
-        EmissiveOcclusion,
+    // world-space light grid variants
+    bgfx::ProgramHandle worldGridFullscreenProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle worldGridTransparencyProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle worldGridDebugVisFullscreenProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle worldGridDebugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 
-        Depth,
-
-        Count
-    };
-
-    static constexpr uint64_t gBufferSamplerFlags = BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
-                                                    BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP |
-                                                    BGFX_SAMPLER_V_CLAMP;
-
-    static constexpr bgfx::TextureFormat::Enum gBufferAttachmentFormats[GBufferAttachment::Count - 1] = {
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::RG16F,
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::BGRA8
-        // depth format is determined dynamically
-    };
-
-    TextureBuffer gBufferTextures[GBufferAttachment::Count + 1]; // includes depth, + null-terminated
-    uint8_t gBufferTextureUnits[GBufferAttachment::Count];
-    const char* gBufferSamplerNames[GBufferAttachment::Count];
-    bgfx::UniformHandle gBufferSamplers[GBufferAttachment::Count];
-    bgfx::FrameBufferHandle gBuffer = BGFX_INVALID_HANDLE;
-
-    bgfx::TextureHandle lightDepthTexture = BGFX_INVALID_HANDLE;
-    bgfx::FrameBufferHandle accumFrameBuffer = BGFX_INVALID_HANDLE;
+    ClusterShader clusters;
+    LightBVHShader lightBVH;
+    CPULightCulling cpuLightCulling;
+    ZBinShader zbins;
+    WorldGridShader worldGrid;
 
-    bgfx::FrameBufferHandle createGBuffer();
-    void bindGBuffer();
+    GBuffer gBuffer;
 };
@@ -5,7 +5,6 @@
 #include <bigg.hpp>
 #include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/ext/matrix_relational.hpp>
 
 ClusteredForwardRenderer::ClusteredForwardRenderer(const Scene* scene, const Config* config) : Renderer(scene, config) { }
 
@@ -23,6 +22,9 @@ void ClusteredForwardRenderer::onInitialize()
 {
     // OpenGL backend: uniforms must be created before loading shaders
     clusters.initialize();
+    lightBVH.initialize();
+    zbins.initialize();
+    worldGrid.initialize();
 
     char csName[128], vsName[128], fsName[128];
 
@@ -32,97 +34,325 @@ void ClusteredForwardRenderer::onInitialize()
     bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling.bin");
     lightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
 
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active.bin");
+    activeLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_bvh.bin");
+    bvhLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active_bvh.bin");
+    activeBVHLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_clustered_forward.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward.bin");
     lightingProgram = bigg::loadProgram(vsName, fsName);
 
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward.bin");
     debugVisProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward_zbin.bin");
+    zbinLightingProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward_zbin.bin");
+    zbinDebugVisProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward_worldgrid.bin");
+    worldGridLightingProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward_worldgrid.bin");
+    worldGridDebugVisProgram = bigg::loadProgram(vsName, fsName);
+}
+
+void ClusteredForwardRenderer::onReset()
+{
+    createDepthPrepass();
+    createTransparentDepth();
 }
 
 void ClusteredForwardRenderer::onRender(float dt)
 {
     if(buffersNeedUpdate)
     {
+        // radius classes need cluster-centric culling on the GPU
+        // lightcuts would count lights twice, the virtual lights don't care about the classes
+        const bool radiusClasses = config->radiusClasses && !config->cpuLightCulling && !config->zBinning &&
+                                   !config->worldLightGrid &&
+                                   config->clusterLightCullingMode == ClusterShader::LightCullingMode::Gather &&
+                                   !(config->lightBVH && config->lightcuts);
         clusters.updateBuffers(config->maxLightsPerTileOrCluster,
                                width, height, config->treatClusterXYasPixelSize,
-                               config->clustersX, config->clustersY, config->clustersZ);
+                               config->clustersX, config->clustersY, config->clustersZ,
+                               // CPU light culling writes a linear grid
+                               config->cpuLightCulling ? ClusterShader::GridLayout::Linear : config->clusterGridLayout,
+                               config->adaptiveLightLists && !config->cpuLightCulling && !config->zBinning &&
+                                   !config->worldLightGrid,
+                               radiusClasses ? config->largeLightRadius : 0.0f);
         buffersNeedUpdate = false;
     }
 
     enum : bgfx::ViewId
     {
         vClusterBuilding = 0,
+        vDepthPrepass,
+        vTransparentDepth,
+        vActiveClusters,
+        vLightBVH,
         vLightCulling,
         vLighting
     };
 
+    // light culling on the CPU replaces cluster building and light culling on the GPU
+    const bool cpuCulling = config->cpuLightCulling;
+
+    // z-binning replaces cluster building, light culling and the cluster light grid
+    const bool zBinning = config->zBinning && !cpuCulling;
+
+    // the world-space grid replaces them as well, it's only rebuilt when lights change
+    const bool worldLightGrid = config->worldLightGrid && !cpuCulling && !zBinning;
+
+    // light culling on the GPU reads back its overflow counters
+    // with adaptive light lists they also size the light index list
+    const bool gpuLightLists = !cpuCulling && !zBinning && !worldLightGrid;
+
+    // only cull lights for clusters that contain geometry
+    // this needs a depth prepass, the lighting pass can then reuse its depth buffer
+    // the CPU doesn't see the depth buffer, it always culls all clusters
+    const bool activeClustersOnly = config->cullActiveClustersOnly && !cpuCulling && !zBinning && !worldLightGrid;
+
     bgfx::setViewName(vClusterBuilding, "Cluster building pass (compute)");
     // set u_viewRect for screen2Eye to work correctly
     bgfx::setViewRect(vClusterBuilding, 0, 0, width, height);
 
+    bgfx::setViewName(vDepthPrepass, "Depth prepass");
+
+    bgfx::setViewName(vTransparentDepth, "Transparent depth pass");
+
+    bgfx::setViewName(vActiveClusters, "Active cluster detection pass (compute)");
+    bgfx::setViewRect(vActiveClusters, 0, 0, width, height);
+
+    bgfx::setViewName(vLightBVH, "Light BVH build pass (compute)");
+
     bgfx::setViewName(vLightCulling, "Clustered light culling pass (compute)");
     bgfx::setViewRect(vLightCulling, 0, 0, width, height);
 
     bgfx::setViewName(vLighting, "Clustered lighting pass");
-    bgfx::setViewClear(vLighting, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, clearColor, 1.0f, 0);
+    bgfx::setViewClear(vLighting, activeClustersOnly ? BGFX_CLEAR_COLOR : BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, clearColor, 1.0f, 0);
     bgfx::setViewRect(vLighting, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vLighting, frameBuffer);
+    bgfx::setViewFrameBuffer(vLighting, activeClustersOnly ? depthPrepassFrameBuffer : frameBuffer);
     bgfx::touch(vLighting);
 
     if(!scene->loaded)
         return;
 
+    // counters from a previous frame, this changes u_maxLightIndices so do it before setUniforms
+    const bool capacityChanged = clusters.adaptCapacity(frameNumber);
     clusters.setUniforms(scene, width, height);
 
+    // skip building and culling if nothing changed since the last frame, the light grid is still valid
+    const bool updateLightLists = lightListsOutdated(capacityChanged);
+
     // cluster building needs u_invProj to transform screen coordinates to eye space
     setViewProjection(vClusterBuilding);
-    // light culling needs u_view to transform lights to eye space
+    // light BVH and light culling need u_view to transform lights to eye space
+    // light-centric culling also needs u_proj to find the clusters a light overlaps
+    setViewProjection(vLightBVH);
     setViewProjection(vLightCulling);
     setViewProjection(vLighting);
 
     // cluster building
 
     // only run this step if the camera parameters changed (aspect ratio, fov, near/far plane)
-    // cluster bounds are saved in camera coordinates so they don't change with camera movement
-
-    // ideally we'd compare the relative error here but a correct implementation would involve
-    // a bunch of costly matrix operations: https://floating-point-gui.de/errors/comparison/
-    // comparing the absolute error against a rather small epsilon here works as long as the values
-    // in the projection matrix aren't getting too large
+    // or the cluster grid was recreated
     const auto clusterCount = clusters.getClusterCount();
     const auto clustersX = std::get<0>(clusterCount);
     const auto clustersY = std::get<1>(clusterCount);
     const auto clustersZ = std::get<2>(clusterCount);
 
-    clusters.bindBuffers(false /*lightingPass*/); // write access, all buffers
-
-    bgfx::dispatch(vClusterBuilding,
-                   clusterBuildingComputeProgram,
-                   (uint32_t)std::ceil((float)clustersX / ClusterShader::CLUSTERS_X_THREADS),
-                   (uint32_t)std::ceil((float)clustersY / ClusterShader::CLUSTERS_Y_THREADS),
-                   (uint32_t)std::ceil((float)clustersZ / ClusterShader::CLUSTERS_Z_THREADS));
-
-    // light culling
+    // compare every frame so the fingerprint and the reuse counter stay current
+    const bool boundsOutdated = clusters.boundsOutdated(scene, width, height);
+    if(cpuCulling || zBinning || worldLightGrid)
+    {
+        // these don't use the cluster bounds, rebuild them when switching back
+        clusters.invalidateBounds();
+    }
+    else if(boundsOutdated)
+    {
+        // one dispatch per grid, radius classes add a coarse grid with its own uniforms
+        for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+        {
+            const auto gridClusterCount = clusters.getClusterCount(grid);
+            clusters.setUniforms(scene, width, height, grid);
+            clusters.bindBuffers(false /*lightingPass*/); // write access, all buffers
+
+            bgfx::dispatch(vClusterBuilding,
+                           clusterBuildingComputeProgram,
+                           (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS),
+                           (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS),
+                           (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS));
+        }
+        // uniforms stick around for the following views (active cluster detection)
+        clusters.setUniforms(scene, width, height);
+    }
+    counters["Cluster bounds reused (frames)"] = (double)clusters.getReusedBoundsFrames();
+    counters["Light lists reused (frames)"] = (double)getReusedLightListFrames();
+    if(gpuLightLists)
+        counters["Light index list size"] = (double)clusters.getMaxLightIndices();
+    else
+        counters.erase("Light index list size");
+    if(gpuLightLists && CounterReadback::supported())
+        counters["Overflowed clusters"] = (double)clusters.getOverflowedClusters();
+    else
+        counters.erase("Overflowed clusters");
+
+    if(updateLightLists)
+        clusters.resetCounters();
+
+    // active cluster detection
+
+    if(activeClustersOnly)
+    {
+        // the lighting pass needs the prepass depth either way
+        renderDepthPrepass(vDepthPrepass);
+        if(updateLightLists)
+        {
+            // transparent meshes aren't in the prepass, without their depth
+            // clusters containing only those would be skipped and lose all point lights
+            bgfx::TextureHandle transparentDepth = BGFX_INVALID_HANDLE;
+            if(scene->transparentMeshes)
+            {
+                renderTransparentDepth(vTransparentDepth);
+                transparentDepth = transparentDepthTexture;
+            }
+            clusters.detectActiveClusters(vActiveClusters, depthPrepassTexture, width, height, transparentDepth);
+        }
+    }
 
-    lights.bindLights(scene);
-    clusters.bindBuffers(false);
+    // otherwise keep the light grid and counters from the last update
+    if(updateLightLists)
+    {
+        if(cpuCulling)
+        {
+            cpuLightCulling.cullClusters(lights,
+                                         scene,
+                                         viewMat,
+                                         projMat,
+                                         width,
+                                         height,
+                                         clustersX,
+                                         clustersY,
+                                         clustersZ,
+                                         clusters.getMaxLightsPerCluster(),
+                                         clusters.getMaxLightIndices());
+            clusters.updateLightGrid(cpuLightCulling.getLightIndices(), cpuLightCulling.getLightGrid());
+            counters["CPU light culling (ms)"] = cpuLightCulling.getCullingTime();
+        }
+        else if(zBinning)
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // sort lights into depth bins on the CPU, build tile bitmasks on the GPU
+
+            zbins.update(lights, scene, viewMat, clustersX, clustersY);
+            counters["Z-binning sort (ms)"] = zbins.getSortTime();
+            zbins.buildTileMasks(vLightCulling, lights, scene);
+        }
+        else if(worldLightGrid)
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // assign lights to world-space cells on the CPU
+            // this only does work if the lights changed, the camera doesn't matter
+
+            worldGrid.update(lights, scene, config->worldGridCellSize);
+            counters["World grid build (ms)"] = worldGrid.getBuildTime();
+            counters["World grid reused (frames)"] = (double)worldGrid.getReusedFrames();
+        }
+        else
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // light BVH
+            // light-centric culling doesn't loop over all lights, it doesn't need the hierarchy
+
+            const bool scatter = config->clusterLightCullingMode == ClusterShader::LightCullingMode::Scatter;
+            const bool useBVH = config->lightBVH && !scatter;
+            // lightcuts pick virtual lights from the BVH per cluster
+            const float lightcutsErrorBound = useBVH ? getLightcutsErrorBound() : 0.0f;
+            if(useBVH)
+            {
+                lightBVH.update(vLightBVH, lights, scene, lightcutsErrorBound > 0.0f);
+                counters["Light BVH sort (ms)"] = lightBVH.getSortTime();
+            }
+
+            // light culling
+            // once per grid, only the main grid has a list of active clusters
+
+            for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+            {
+                clusters.setUniforms(scene, width, height, grid);
+                lights.bindLights(scene);
+                clusters.bindBuffers(false);
+                if(useBVH)
+                    lightBVH.bindBVH(lightcutsErrorBound);
+
+                if(scatter)
+                {
+                    clusters.scatterLights(vLightCulling, lights, scene, activeClustersOnly);
+                }
+                else if(activeClustersOnly && grid == 0)
+                {
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? activeBVHLightCullingComputeProgram : activeLightCullingComputeProgram,
+                                   clusters.getActiveClustersIndirectBuffer());
+                }
+                else
+                {
+                    const auto gridClusterCount = clusters.getClusterCount(grid);
+                    const auto groupsX =
+                        (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS);
+                    const auto groupsY =
+                        (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS);
+                    const auto groupsZ =
+                        (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS);
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? bvhLightCullingComputeProgram : lightCullingComputeProgram,
+                                   groupsX,
+                                   groupsY,
+                                   groupsZ);
+                }
+            }
+            // same for the lighting pass
+            clusters.setUniforms(scene, width, height);
+
+            // overflow counters for adaptCapacity, arrive a few frames later
+            clusters.requestCounters(vLightCulling, vLighting);
+        }
+    }
 
-    bgfx::dispatch(vLightCulling,
-                   lightCullingComputeProgram,
-                   (uint32_t)std::ceil((float)clustersX / ClusterShader::CLUSTERS_X_THREADS),
-                   (uint32_t)std::ceil((float)clustersY / ClusterShader::CLUSTERS_Y_THREADS),
-                   (uint32_t)std::ceil((float)clustersZ / ClusterShader::CLUSTERS_Z_THREADS));
     // lighting
 
     bool debugVis = variables["DEBUG_VIS"] == "true";
     bgfx::ProgramHandle program = debugVis ? debugVisProgram : lightingProgram;
+    if(zBinning)
+        program = debugVis ? zbinDebugVisProgram : zbinLightingProgram;
+    else if(worldLightGrid)
+        program = debugVis ? worldGridDebugVisProgram : worldGridLightingProgram;
 
     uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
+    if(activeClustersOnly)
+    {
+        // depth is already filled by the prepass
+        state = (state & ~BGFX_STATE_DEPTH_TEST_MASK) | BGFX_STATE_DEPTH_TEST_LEQUAL;
+    }
 
     pbr.bindAlbedoLUT();
     lights.bindLights(scene);
-    clusters.bindBuffers(true /*lightingPass*/); // read access, only light grid and indices
+    if(zBinning)
+        zbins.bindBuffers();
+    else if(worldLightGrid)
+        worldGrid.bindBuffers();
+    else
+        clusters.bindBuffers(true /*lightingPass*/); // read access, only light grid and indices
 
     for(const Mesh& mesh : scene->meshes)
     {
@@ -149,11 +379,24 @@ void ClusteredForwardRenderer::onOptionsChanged()
 void ClusteredForwardRenderer::onShutdown()
 {
     clusters.shutdown();
+    lightBVH.shutdown();
+    zbins.shutdown();
+    worldGrid.shutdown();
 
     bgfx::destroy(clusterBuildingComputeProgram);
     bgfx::destroy(lightCullingComputeProgram);
+    bgfx::destroy(activeLightCullingComputeProgram);
+    bgfx::destroy(bvhLightCullingComputeProgram);
+    bgfx::destroy(activeBVHLightCullingComputeProgram);
     bgfx::destroy(lightingProgram);
     bgfx::destroy(debugVisProgram);
-
-    clusterBuildingComputeProgram = lightCullingComputeProgram = lightingProgram = debugVisProgram = BGFX_INVALID_HANDLE;
+    bgfx::destroy(zbinLightingProgram);
+    bgfx::destroy(zbinDebugVisProgram);
+    bgfx::destroy(worldGridLightingProgram);
+    bgfx::destroy(worldGridDebugVisProgram);
+
+    clusterBuildingComputeProgram = lightCullingComputeProgram = activeLightCullingComputeProgram =
+        bvhLightCullingComputeProgram = activeBVHLightCullingComputeProgram = lightingProgram =
+        debugVisProgram = zbinLightingProgram = zbinDebugVisProgram = worldGridLightingProgram =
+        worldGridDebugVisProgram = BGFX_INVALID_HANDLE;
 }
@@ -2,6 +2,10 @@
 
 #include "Renderer.h"
 #include "ClusterShader.h"
+#include "LightBVHShader.h"
+#include "CPULightCulling.h"
+#include "ZBinShader.h"
+#include "WorldGridShader.h"
 
 class ClusteredForwardRenderer : public Renderer
 {
@@ -12,18 +16,28 @@ public:
 
     virtual void onInitialize() override;
     virtual void onRender(float dt) override;
+    virtual void onReset() override;
     virtual void onOptionsChanged() override;
     virtual void onShutdown() override;
 
 private:
     bool buffersNeedUpdate = true;
 
-    glm::mat4 oldProjMat = glm::mat4(0.0f);
-
     bgfx::ProgramHandle clusterBuildingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle bvhLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeBVHLightCullingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightingProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle debugVisProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle zbinLightingProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle zbinDebugVisProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle worldGridLightingProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle worldGridDebugVisProgram = BGFX_INVALID_HANDLE;
 
     ClusterShader clusters;
+    LightBVHShader lightBVH;
+    CPULightCulling cpuLightCulling;
+    ZBinShader zbins;
+    WorldGridShader worldGrid;
 };
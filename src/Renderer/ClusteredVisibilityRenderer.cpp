@@ -0,0 +1,604 @@
+#include "ClusteredVisibilityRenderer.h"
+
+#include "Scene/Scene.h"
+#include "Config.h"
+#include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+bgfx::VertexLayout ClusteredVisibilityRenderer::DrawVertex::layout;
+
+ClusteredVisibilityRenderer::ClusteredVisibilityRenderer(const Scene* scene, const Config* config) :
+    Renderer(scene, config)
+{
+    buffers = textures;
+}
+
+bool ClusteredVisibilityRenderer::supported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    return Renderer::supported() &&
+           // compute shader
+           (caps->supported & BGFX_CAPS_COMPUTE) != 0 &&
+           // 32-bit index buffers, used for light grid structure and the scene's fetch buffers
+           (caps->supported & BGFX_CAPS_INDEX32) != 0 &&
+           // material depth pass
+           (caps->supported & BGFX_CAPS_FRAGMENT_DEPTH) != 0 &&
+#ifdef BGFX_CAPS_PRIMITIVE_ID
+           // triangle IDs, older bgfx versions don't report it
+           (caps->supported & BGFX_CAPS_PRIMITIVE_ID) != 0 &&
+#endif
+           (caps->formats[bgfx::TextureFormat::RGBA8] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) != 0;
+}
+
+void ClusteredVisibilityRenderer::onInitialize()
+{
+    DrawVertex::init();
+
+    // OpenGL backend: uniforms must be created before loading shaders
+    clusters.initialize();
+    lightBVH.initialize();
+
+    visibilityVecUniform = bgfx::createUniform("u_visibilityVec", bgfx::UniformType::Vec4);
+    visibilitySampler = bgfx::createUniform("s_texVisibility", bgfx::UniformType::Sampler);
+    depthSampler = bgfx::createUniform("s_texDepth", bgfx::UniformType::Sampler);
+
+    char csName[128], vsName[128], fsName[128];
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_clusterbuilding.bin");
+    clusterBuildingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling.bin");
+    lightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active.bin");
+    activeLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_bvh.bin");
+    bvhLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_clustered_lightculling_active_bvh.bin");
+    activeBVHLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_depth.bin");
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_visibility.bin");
+    visibilityProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_deferred_fullscreen.bin");
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_visibility_materialdepth.bin");
+    materialDepthProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_deferred.bin");
+    debugVisFullscreenProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_visibility_resolve.bin");
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_visibility_resolve.bin");
+    resolveProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_clustered_forward.bin");
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_forward.bin");
+    transparencyProgram = bigg::loadProgram(vsName, fsName);
+
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_clustered_debug_vis_forward.bin");
+    debugVisTransparencyProgram = bigg::loadProgram(vsName, fsName);
+}
+
+void ClusteredVisibilityRenderer::onReset()
+{
+    if(!bgfx::isValid(visibilityFrameBuffer))
+    {
+        const uint64_t flags = BGFX_TEXTURE_RT | BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
+                               BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+
+        bgfx::TextureHandle idTexture =
+            bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8, flags);
+
+        bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
+        assert(depthFormat != bgfx::TextureFormat::Count);
+        bgfx::TextureHandle depthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+
+        // sampled directly in the following passes, they never have it attached at the same time
+        const bgfx::TextureHandle visibilityTextures[2] = { idTexture, depthTexture };
+        visibilityFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(visibilityTextures), visibilityTextures, true);
+
+        if(!bgfx::isValid(visibilityFrameBuffer))
+            Log->error("Failed to create visibility buffer");
+        else
+            bgfx::setName(visibilityFrameBuffer, "Visibility buffer");
+
+        depthFormat = findDepthFormat(BGFX_TEXTURE_RT_WRITE_ONLY);
+        assert(depthFormat != bgfx::TextureFormat::Count);
+        bgfx::TextureHandle materialDepthTexture =
+            bgfx::createTexture2D(width, height, false, 1, depthFormat, BGFX_TEXTURE_RT_WRITE_ONLY);
+
+        // don't destroy textures, output belongs to frameBuffer
+        // the material depth texture is destroyed in destroyFrameBuffers
+        const bgfx::TextureHandle resolveTextures[2] = { bgfx::getTexture(frameBuffer, 0), materialDepthTexture };
+        resolveFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(resolveTextures), resolveTextures);
+
+        const bgfx::TextureHandle transparentTextures[2] = { bgfx::getTexture(frameBuffer, 0), depthTexture };
+        transparentFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(transparentTextures), transparentTextures);
+
+        textures[0].handle = idTexture;
+        textures[1].handle = depthTexture;
+    }
+
+    createTransparentDepth();
+}
+
+void ClusteredVisibilityRenderer::onRender(float dt)
+{
+    if(buffersNeedUpdate)
+    {
+        // radius classes need cluster-centric culling on the GPU
+        // lightcuts would count lights twice, the virtual lights don't care about the classes
+        const bool radiusClasses = config->radiusClasses && !config->cpuLightCulling &&
+                                   config->clusterLightCullingMode == ClusterShader::LightCullingMode::Gather &&
+                                   !(config->lightBVH && config->lightcuts);
+        clusters.updateBuffers(config->maxLightsPerTileOrCluster,
+                               width, height, config->treatClusterXYasPixelSize,
+                               config->clustersX, config->clustersY, config->clustersZ,
+                               // CPU light culling writes a linear grid
+                               config->cpuLightCulling ? ClusterShader::GridLayout::Linear : config->clusterGridLayout,
+                               config->adaptiveLightLists && !config->cpuLightCulling,
+                               radiusClasses ? config->largeLightRadius : 0.0f);
+        buffersNeedUpdate = false;
+    }
+
+    enum : bgfx::ViewId
+    {
+        vClusterBuilding = 0,
+        vVisibility,        // write triangle + draw IDs and depth
+        vMaterialDepth,     // write material as depth
+        vTransparentDepth,  // depth of transparent meshes for active cluster detection
+        vActiveClusters,    // flag clusters containing geometry
+        vLightBVH,
+        vLightCulling,
+        vResolve,           // one fullscreen triangle per material, point lights + ambient + emissive
+        vTransparent        // forward pass for transparency
+    };
+
+    // z-binning and the world-space light grid are not supported, the resolve shader only reads the cluster light grid
+
+    // light culling on the CPU replaces cluster building and light culling on the GPU
+    const bool cpuCulling = config->cpuLightCulling;
+
+    // light culling on the GPU reads back its overflow counters
+    // with adaptive light lists they also size the light index list
+    const bool gpuLightLists = !cpuCulling;
+
+    // only cull lights for clusters that contain geometry
+    // uses the visibility buffer depth, light culling has to happen after the visibility pass
+    // the CPU doesn't see the depth buffer, it always culls all clusters
+    const bool activeClustersOnly = config->cullActiveClustersOnly && !cpuCulling;
+
+    bgfx::setViewName(vClusterBuilding, "Cluster building pass (compute)");
+    // set u_viewRect for screen2Eye to work correctly
+    bgfx::setViewRect(vClusterBuilding, 0, 0, width, height);
+
+    bgfx::setViewName(vVisibility, "Visibility buffer pass");
+    // ID 0 is empty
+    bgfx::setViewClear(vVisibility, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x00000000, 1.0f);
+    bgfx::setViewRect(vVisibility, 0, 0, width, height);
+    bgfx::setViewFrameBuffer(vVisibility, visibilityFrameBuffer);
+    bgfx::touch(vVisibility);
+
+    bgfx::setViewName(vMaterialDepth, "Visibility material depth pass");
+    bgfx::setViewClear(vMaterialDepth, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, clearColor, 1.0f);
+    bgfx::setViewRect(vMaterialDepth, 0, 0, width, height);
+    bgfx::setViewFrameBuffer(vMaterialDepth, resolveFrameBuffer);
+    bgfx::touch(vMaterialDepth);
+
+    bgfx::setViewName(vTransparentDepth, "Transparent depth pass");
+
+    bgfx::setViewName(vActiveClusters, "Active cluster detection pass (compute)");
+    bgfx::setViewRect(vActiveClusters, 0, 0, width, height);
+
+    bgfx::setViewName(vLightBVH, "Light BVH build pass (compute)");
+
+    bgfx::setViewName(vLightCulling, "Clustered light culling pass (compute)");
+    bgfx::setViewRect(vLightCulling, 0, 0, width, height);
+
+    bgfx::setViewName(vResolve, "Visibility clustered resolve pass (point lights + ambient + emissive)");
+    bgfx::setViewClear(vResolve, BGFX_CLEAR_NONE);
+    bgfx::setViewRect(vResolve, 0, 0, width, height);
+    bgfx::setViewFrameBuffer(vResolve, resolveFrameBuffer);
+    bgfx::touch(vResolve);
+
+    bgfx::setViewName(vTransparent, "Transparent forward pass");
+    bgfx::setViewClear(vTransparent, BGFX_CLEAR_NONE);
+    bgfx::setViewRect(vTransparent, 0, 0, width, height);
+    bgfx::setViewFrameBuffer(vTransparent, transparentFrameBuffer);
+    bgfx::touch(vTransparent);
+
+    if(!scene->loaded)
+        return;
+
+    if(!drawsCreated)
+        createDraws();
+
+    // counters from a previous frame, this changes u_maxLightIndices so do it before setUniforms
+    const bool capacityChanged = clusters.adaptCapacity(frameNumber);
+    clusters.setUniforms(scene, width, height);
+
+    // skip building and culling if nothing changed since the last frame, the light grid is still valid
+    const bool updateLightLists = lightListsOutdated(capacityChanged);
+
+    // cluster building needs u_invProj to transform screen coordinates to eye space
+    setViewProjection(vClusterBuilding);
+    setViewProjection(vVisibility);
+    setViewProjection(vMaterialDepth);
+    // light BVH and light culling need u_view to transform lights to eye space
+    // light-centric culling also needs u_proj to find the clusters a light overlaps
+    setViewProjection(vLightBVH);
+    setViewProjection(vLightCulling);
+    setViewProjection(vResolve);
+    setViewProjection(vTransparent);
+
+    // cluster building
+
+    // only run this step if the camera parameters changed (aspect ratio, fov, near/far plane)
+    // or the cluster grid was recreated
+    const auto clusterCount = clusters.getClusterCount();
+    const auto clustersX = std::get<0>(clusterCount);
+    const auto clustersY = std::get<1>(clusterCount);
+    const auto clustersZ = std::get<2>(clusterCount);
+
+    // compare every frame so the fingerprint and the reuse counter stay current
+    const bool boundsOutdated = clusters.boundsOutdated(scene, width, height);
+    if(cpuCulling)
+    {
+        // CPU culling doesn't use the cluster bounds, rebuild them when switching back
+        clusters.invalidateBounds();
+    }
+    else if(boundsOutdated)
+    {
+        // one dispatch per grid, radius classes add a coarse grid with its own uniforms
+        for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+        {
+            const auto gridClusterCount = clusters.getClusterCount(grid);
+            clusters.setUniforms(scene, width, height, grid);
+            clusters.bindBuffers(false /*lightingPass*/); // write access, all buffers
+
+            bgfx::dispatch(vClusterBuilding,
+                           clusterBuildingComputeProgram,
+                           (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS),
+                           (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS),
+                           (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS));
+        }
+        // uniforms stick around for the following views (active cluster detection)
+        clusters.setUniforms(scene, width, height);
+    }
+    counters["Cluster bounds reused (frames)"] = (double)clusters.getReusedBoundsFrames();
+    counters["Light lists reused (frames)"] = (double)getReusedLightListFrames();
+    if(gpuLightLists)
+        counters["Light index list size"] = (double)clusters.getMaxLightIndices();
+    else
+        counters.erase("Light index list size");
+    if(gpuLightLists && CounterReadback::supported())
+        counters["Overflowed clusters"] = (double)clusters.getOverflowedClusters();
+    else
+        counters.erase("Overflowed clusters");
+    counters["Resolve passes (materials)"] = (double)resolveDraws.size();
+
+    // render geometry, write triangle + draw IDs
+    // no material textures or vertex attributes besides the position
+
+    const uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
+
+    uint32_t draw = 0;
+    for(const Mesh& mesh : scene->meshes)
+    {
+        const Material& mat = scene->materials[mesh.material];
+        // transparent materials are rendered in a separate forward pass (view vTransparent)
+        if(!mat.blend)
+        {
+            // out of IDs, see createDraws
+            if(draw >= visibilityDraws)
+                break;
+
+            glm::mat4 model = glm::identity<glm::mat4>();
+            bgfx::setTransform(glm::value_ptr(model));
+            bgfx::setVertexBuffer(0, mesh.vertexBuffer);
+            bgfx::setIndexBuffer(mesh.indexBuffer);
+            float visibilityVec[4] = { (float)triangleBits, (float)draw, 0.0f, 0.0f };
+            bgfx::setUniform(visibilityVecUniform, visibilityVec);
+            bgfx::setState(state | (mat.doubleSided ? 0 : BGFX_STATE_CULL_CW));
+            bgfx::submit(vVisibility, visibilityProgram);
+            draw++;
+        }
+    }
+
+    // material depth
+
+    if(bgfx::isValid(drawBuffer))
+    {
+        float visibilityVec[4] = { (float)triangleBits, 0.0f, 0.0f, 0.0f };
+        bgfx::setUniform(visibilityVecUniform, visibilityVec);
+        bgfx::setTexture(Samplers::VISIBILITY_IDS, visibilitySampler, textures[0].handle);
+        bgfx::setBuffer(Samplers::VISIBILITY_DRAWS, drawBuffer, bgfx::Access::Read);
+        bgfx::setVertexBuffer(0, blitTriangleBuffer);
+        bgfx::setState(BGFX_STATE_WRITE_Z | BGFX_STATE_DEPTH_TEST_ALWAYS);
+        bgfx::submit(vMaterialDepth, materialDepthProgram);
+    }
+
+    if(updateLightLists)
+        clusters.resetCounters();
+
+    // active cluster detection
+
+    if(activeClustersOnly && updateLightLists)
+    {
+        // transparent meshes aren't in the visibility buffer, without their depth
+        // clusters containing only those would be skipped and lose all point lights
+        bgfx::TextureHandle transparentDepth = BGFX_INVALID_HANDLE;
+        if(scene->transparentMeshes)
+        {
+            renderTransparentDepth(vTransparentDepth);
+            transparentDepth = transparentDepthTexture;
+        }
+        clusters.detectActiveClusters(vActiveClusters, textures[1].handle, width, height, transparentDepth);
+    }
+
+    // otherwise keep the light grid and counters from the last update
+    if(updateLightLists)
+    {
+        if(cpuCulling)
+        {
+            cpuLightCulling.cullClusters(lights,
+                                         scene,
+                                         viewMat,
+                                         projMat,
+                                         width,
+                                         height,
+                                         clustersX,
+                                         clustersY,
+                                         clustersZ,
+                                         clusters.getMaxLightsPerCluster(),
+                                         clusters.getMaxLightIndices());
+            clusters.updateLightGrid(cpuLightCulling.getLightIndices(), cpuLightCulling.getLightGrid());
+            counters["CPU light culling (ms)"] = cpuLightCulling.getCullingTime();
+        }
+        else
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // light BVH
+            // light-centric culling doesn't loop over all lights, it doesn't need the hierarchy
+
+            const bool scatter = config->clusterLightCullingMode == ClusterShader::LightCullingMode::Scatter;
+            const bool useBVH = config->lightBVH && !scatter;
+            // lightcuts pick virtual lights from the BVH per cluster
+            const float lightcutsErrorBound = useBVH ? getLightcutsErrorBound() : 0.0f;
+            if(useBVH)
+            {
+                lightBVH.update(vLightBVH, lights, scene, lightcutsErrorBound > 0.0f);
+                counters["Light BVH sort (ms)"] = lightBVH.getSortTime();
+            }
+
+            // light culling
+            // once per grid, only the main grid has a list of active clusters
+
+            for(uint32_t grid = 0; grid < clusters.getGridCount(); grid++)
+            {
+                clusters.setUniforms(scene, width, height, grid);
+                lights.bindLights(scene);
+                clusters.bindBuffers(false);
+                if(useBVH)
+                    lightBVH.bindBVH(lightcutsErrorBound);
+
+                if(scatter)
+                {
+                    clusters.scatterLights(vLightCulling, lights, scene, activeClustersOnly);
+                }
+                else if(activeClustersOnly && grid == 0)
+                {
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? activeBVHLightCullingComputeProgram : activeLightCullingComputeProgram,
+                                   clusters.getActiveClustersIndirectBuffer());
+                }
+                else
+                {
+                    const auto gridClusterCount = clusters.getClusterCount(grid);
+                    const auto groupsX =
+                        (uint32_t)std::ceil((float)std::get<0>(gridClusterCount) / ClusterShader::CLUSTERS_X_THREADS);
+                    const auto groupsY =
+                        (uint32_t)std::ceil((float)std::get<1>(gridClusterCount) / ClusterShader::CLUSTERS_Y_THREADS);
+                    const auto groupsZ =
+                        (uint32_t)std::ceil((float)std::get<2>(gridClusterCount) / ClusterShader::CLUSTERS_Z_THREADS);
+                    bgfx::dispatch(vLightCulling,
+                                   useBVH ? bvhLightCullingComputeProgram : lightCullingComputeProgram,
+                                   groupsX,
+                                   groupsY,
+                                   groupsZ);
+                }
+            }
+            // same for the lighting pass
+            clusters.setUniforms(scene, width, height);
+
+            // overflow counters for adaptCapacity, arrive a few frames later
+            clusters.requestCounters(vLightCulling, vResolve);
+        }
+    }
+
+    // bind these once for all following submits
+    // excluding BGFX_DISCARD_TEXTURE_SAMPLERS from the discard flags passed to submit makes sure
+    // they don't get unbound
+    // bindMaterial only replaces the material textures
+    pbr.bindAlbedoLUT();
+    lights.bindLights(scene);
+    clusters.bindBuffers(true);
+    bgfx::setTexture(Samplers::VISIBILITY_IDS, visibilitySampler, textures[0].handle);
+    bgfx::setTexture(Samplers::DEFERRED_DEPTH, depthSampler, textures[1].handle);
+    if(bgfx::isValid(drawBuffer))
+    {
+        bgfx::setBuffer(Samplers::VISIBILITY_VERTICES, scene->fetchVertexBuffer, bgfx::Access::Read);
+        bgfx::setBuffer(Samplers::VISIBILITY_INDICES, scene->fetchIndexBuffer, bgfx::Access::Read);
+        bgfx::setBuffer(Samplers::VISIBILITY_DRAWS, drawBuffer, bgfx::Access::Read);
+    }
+
+    // point lights + ambient light + emissive
+
+    bool debugVis = variables["DEBUG_VIS"] == "true";
+    if(debugVis)
+    {
+        // full screen triangle at the far plane, only where there's a material in front
+        bgfx::setVertexBuffer(0, blitTriangleBuffer);
+        bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_GREATER | BGFX_STATE_CULL_CW);
+        bgfx::submit(vResolve, debugVisFullscreenProgram, 0, ~BGFX_DISCARD_BINDINGS);
+    }
+    else
+    {
+        // full screen triangle at each material's depth
+        // the equal depth test only leaves that material's pixels
+        for(const ResolveDraw& resolve : resolveDraws)
+        {
+            pbr.bindMaterial(scene->materials[resolve.material]);
+            float visibilityVec[4] = { (float)triangleBits, 0.0f, resolve.materialDepth, 0.0f };
+            bgfx::setUniform(visibilityVecUniform, visibilityVec);
+            bgfx::setVertexBuffer(0, blitTriangleBuffer);
+            bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_EQUAL | BGFX_STATE_CULL_CW);
+            bgfx::submit(vResolve, resolveProgram, 0, ~BGFX_DISCARD_BINDINGS);
+        }
+    }
+
+    // transparent
+
+    bgfx::ProgramHandle programTransparency = debugVis ? debugVisTransparencyProgram : transparencyProgram;
+    for(const Mesh& mesh : scene->meshes)
+    {
+        const Material& mat = scene->materials[mesh.material];
+        if(mat.blend)
+        {
+            glm::mat4 model = glm::identity<glm::mat4>();
+            bgfx::setTransform(glm::value_ptr(model));
+            setNormalMatrix(model);
+            bgfx::setVertexBuffer(0, mesh.vertexBuffer);
+            bgfx::setIndexBuffer(mesh.indexBuffer);
+            uint64_t materialState = pbr.bindMaterial(mat);
+            bgfx::setState(state | materialState);
+            bgfx::submit(vTransparent, programTransparency, 0, ~BGFX_DISCARD_BINDINGS);
+        }
+    }
+
+    bgfx::discard(BGFX_DISCARD_ALL);
+}
+
+void ClusteredVisibilityRenderer::onOptionsChanged()
+{
+    buffersNeedUpdate = true;
+}
+
+void ClusteredVisibilityRenderer::onShutdown()
+{
+    clusters.shutdown();
+    lightBVH.shutdown();
+
+    bgfx::destroy(clusterBuildingComputeProgram);
+    bgfx::destroy(lightCullingComputeProgram);
+    bgfx::destroy(activeLightCullingComputeProgram);
+    bgfx::destroy(bvhLightCullingComputeProgram);
+    bgfx::destroy(activeBVHLightCullingComputeProgram);
+    bgfx::destroy(visibilityProgram);
+    bgfx::destroy(materialDepthProgram);
+    bgfx::destroy(resolveProgram);
+    bgfx::destroy(transparencyProgram);
+    bgfx::destroy(debugVisFullscreenProgram);
+    bgfx::destroy(debugVisTransparencyProgram);
+
+    bgfx::destroy(visibilityVecUniform);
+    bgfx::destroy(visibilitySampler);
+    bgfx::destroy(depthSampler);
+
+    destroyFrameBuffers();
+
+    if(bgfx::isValid(drawBuffer))
+        bgfx::destroy(drawBuffer);
+
+    clusterBuildingComputeProgram = lightCullingComputeProgram = activeLightCullingComputeProgram =
+        bvhLightCullingComputeProgram = activeBVHLightCullingComputeProgram = visibilityProgram =
+        materialDepthProgram = resolveProgram = transparencyProgram = debugVisFullscreenProgram =
+        debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
+    visibilityVecUniform = visibilitySampler = depthSampler = BGFX_INVALID_HANDLE;
+    drawBuffer = BGFX_INVALID_HANDLE;
+    drawsCreated = false;
+    resolveDraws.clear();
+}
+
+void ClusteredVisibilityRenderer::createDraws()
+{
+    drawsCreated = true;
+
+    // the largest mesh decides how many bits of the ID go to the triangle index
+    uint32_t maxTriangles = 0;
+    for(const Mesh& mesh : scene->meshes)
+    {
+        if(!scene->materials[mesh.material].blend)
+            maxTriangles = std::max(maxTriangles, mesh.indexCount / 3);
+    }
+    triangleBits = 0;
+    while(triangleBits < 31 && (uint64_t(1) << triangleBits) < maxTriangles)
+        triangleBits++;
+    // draw + 1 goes into the remaining bits, 0 is empty
+    const uint64_t maxDraws = (uint64_t(1) << (32 - triangleBits)) - 1;
+
+    // material depth for every material used by an opaque mesh
+    std::vector<float> materialDepths(scene->materials.size(), 0.0f);
+    std::vector<DrawVertex> drawVertices;
+    for(const Mesh& mesh : scene->meshes)
+    {
+        if(scene->materials[mesh.material].blend)
+            continue;
+
+        if(drawVertices.size() == maxDraws)
+        {
+            Log->error("Too many meshes for the visibility buffer IDs, skipping the rest");
+            break;
+        }
+
+        float& depth = materialDepths[mesh.material];
+        if(depth == 0.0f)
+        {
+            if(resolveDraws.size() == MAX_MATERIALS)
+            {
+                Log->error("Too many materials for the visibility buffer, skipping the rest");
+                break;
+            }
+            depth = (float)(resolveDraws.size() + 1) / 65536.0f;
+            resolveDraws.push_back({ mesh.material, depth });
+        }
+
+        drawVertices.push_back({ mesh.firstIndex, depth, { 0.0f, 0.0f } });
+    }
+    visibilityDraws = (uint32_t)drawVertices.size();
+
+    if(!drawVertices.empty())
+    {
+        drawBuffer =
+            bgfx::createVertexBuffer(bgfx::copy(drawVertices.data(), (uint32_t)(drawVertices.size() * sizeof(DrawVertex))),
+                                     DrawVertex::layout,
+                                     BGFX_BUFFER_COMPUTE_READ);
+    }
+}
+
+void ClusteredVisibilityRenderer::destroyFrameBuffers()
+{
+    // the transparent and resolve frame buffers don't own their attachments
+    if(bgfx::isValid(transparentFrameBuffer))
+        bgfx::destroy(transparentFrameBuffer);
+    if(bgfx::isValid(resolveFrameBuffer))
+    {
+        bgfx::destroy(bgfx::getTexture(resolveFrameBuffer, 1));
+        bgfx::destroy(resolveFrameBuffer);
+    }
+    // destroys the attachments too
+    if(bgfx::isValid(visibilityFrameBuffer))
+        bgfx::destroy(visibilityFrameBuffer);
+
+    visibilityFrameBuffer = resolveFrameBuffer = transparentFrameBuffer = BGFX_INVALID_HANDLE;
+    textures[0].handle = textures[1].handle = BGFX_INVALID_HANDLE;
+}
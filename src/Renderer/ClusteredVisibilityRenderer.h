@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Renderer.h"
+#include "ClusterShader.h"
+#include "LightBVHShader.h"
+#include "CPULightCulling.h"
+#include <vector>
+
+// visibility buffer, see visibility.sh
+// the geometry pass only writes a triangle + draw ID and depth
+// materials and clustered lighting are resolved in fullscreen passes that fetch vertex attributes
+// from Scene::fetchVertexBuffer and Scene::fetchIndexBuffer
+//
+// there's no bindless in bgfx, so the resolve is split by material:
+// a fullscreen pass writes each pixel's material as depth and every material
+// draws a fullscreen triangle at that depth with an equal depth test
+class ClusteredVisibilityRenderer : public Renderer
+{
+public:
+    ClusteredVisibilityRenderer(const Scene* scene, const Config* config);
+
+    static bool supported();
+
+    virtual void onInitialize() override;
+    virtual void onRender(float dt) override;
+    virtual void onReset() override;
+    virtual void onOptionsChanged() override;
+    virtual void onShutdown() override;
+
+private:
+    // per-draw data, see b_visibilityDraws in visibility.sh
+    struct DrawVertex
+    {
+        uint32_t firstIndex;
+        float materialDepth;
+        float padding[2];
+
+        static void init()
+        {
+            layout.begin().add(bgfx::Attrib::TexCoord0, 4, bgfx::AttribType::Float).end();
+        }
+        static bgfx::VertexLayout layout;
+    };
+
+    struct ResolveDraw
+    {
+        unsigned int material;
+        float materialDepth;
+    };
+
+    // draw table and triangle ID bits for the scene's opaque meshes
+    void createDraws();
+    void destroyFrameBuffers();
+
+    // materials are stored as depth (n + 1) / 2^16, exact in every depth format
+    static constexpr uint32_t MAX_MATERIALS = 65535;
+
+    bool buffersNeedUpdate = true;
+
+    bgfx::ProgramHandle clusterBuildingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle lightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle bvhLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle activeBVHLightCullingComputeProgram = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle visibilityProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle materialDepthProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle resolveProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle transparencyProgram = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle debugVisFullscreenProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
+
+    bgfx::UniformHandle visibilityVecUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle visibilitySampler = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle depthSampler = BGFX_INVALID_HANDLE;
+
+    // triangle + draw ID, depth
+    bgfx::FrameBufferHandle visibilityFrameBuffer = BGFX_INVALID_HANDLE;
+    // output color, material depth
+    bgfx::FrameBufferHandle resolveFrameBuffer = BGFX_INVALID_HANDLE;
+    // output color, visibility buffer depth
+    bgfx::FrameBufferHandle transparentFrameBuffer = BGFX_INVALID_HANDLE;
+
+    bool drawsCreated = false;
+    bgfx::VertexBufferHandle drawBuffer = BGFX_INVALID_HANDLE;
+    uint32_t triangleBits = 0;
+    // opaque meshes that fit into the ID, in scene order
+    uint32_t visibilityDraws = 0;
+    // one fullscreen triangle per material used by opaque meshes
+    std::vector<ResolveDraw> resolveDraws;
+
+    TextureBuffer textures[3] = { { BGFX_INVALID_HANDLE, "Visibility (draw + triangle ID)" },
+                                  { BGFX_INVALID_HANDLE, "Depth" },
+                                  { BGFX_INVALID_HANDLE, nullptr } };
+
+    ClusterShader clusters;
+    LightBVHShader lightBVH;
+    CPULightCulling cpuLightCulling;
+};
@@ -0,0 +1,133 @@
+#include "CounterReadback.h"
+
+#include "Renderer/Renderer.h"
+#include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+bool CounterReadback::supported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    return (caps->supported & BGFX_CAPS_COMPUTE) != 0 &&
+           (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
+           (caps->supported & BGFX_CAPS_TEXTURE_READ_BACK) != 0 &&
+           (caps->formats[bgfx::TextureFormat::R32F] & BGFX_CAPS_FORMAT_TEXTURE_IMAGE_WRITE) != 0;
+}
+
+void CounterReadback::initialize()
+{
+    // creating a read back texture fails without support
+    // request and ready turn into no-ops
+    if(!supported())
+        return;
+
+    readbackVecUniform = bgfx::createUniform("u_readbackVec", bgfx::UniformType::Vec4);
+
+    gpuTexture = bgfx::createTexture2D(
+        MAX_COUNTERS, 1, false, 1, bgfx::TextureFormat::R32F, BGFX_TEXTURE_COMPUTE_WRITE | BGFX_SAMPLER_POINT);
+    cpuTexture = bgfx::createTexture2D(
+        MAX_COUNTERS, 1, false, 1, bgfx::TextureFormat::R32F, BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK);
+
+    char csName[128];
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_counters_readback.bin");
+    copyComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+}
+
+void CounterReadback::shutdown()
+{
+    if(bgfx::isValid(copyComputeProgram))
+    {
+        bgfx::destroy(readbackVecUniform);
+        bgfx::destroy(gpuTexture);
+        bgfx::destroy(cpuTexture);
+        bgfx::destroy(copyComputeProgram);
+    }
+
+    readbackVecUniform = BGFX_INVALID_HANDLE;
+    gpuTexture = cpuTexture = BGFX_INVALID_HANDLE;
+    copyComputeProgram = BGFX_INVALID_HANDLE;
+
+    pending = false;
+}
+
+void CounterReadback::request(bgfx::ViewId view,
+                              bgfx::ViewId blitView,
+                              bgfx::DynamicIndexBufferHandle buffer,
+                              uint32_t count)
+{
+    assert(count <= MAX_COUNTERS);
+
+    if(pending || !bgfx::isValid(copyComputeProgram))
+        return;
+
+    float readbackVec[4] = { (float)count };
+    bgfx::setUniform(readbackVecUniform, readbackVec);
+    bgfx::setBuffer(Samplers::READBACK_COUNTERS, buffer, bgfx::Access::Read);
+    bgfx::setImage(Samplers::READBACK_IMAGE, gpuTexture, 0, bgfx::Access::Write);
+    bgfx::dispatch(view, copyComputeProgram, (uint32_t)std::ceil((float)count / READBACK_THREADS), 1, 1);
+
+    bgfx::blit(blitView, cpuTexture, 0, 0, gpuTexture);
+    readyFrame = bgfx::readTexture(cpuTexture, data);
+    pending = true;
+}
+
+bool CounterReadback::ready(uint32_t frame)
+{
+    // frame only ever lags behind bgfx's frame number, so at worst we wait a frame longer than needed
+    if(!pending || frame < readyFrame)
+        return false;
+
+    for(uint32_t i = 0; i < MAX_COUNTERS; i++)
+    {
+        // converting floats outside of the uint32_t range is undefined
+        // (float)UINT32_MAX rounds up to 2^32, anything at or above that saturates
+        const float value = data[i];
+        values[i] = value >= (float)UINT32_MAX ? UINT32_MAX : value > 0.0f ? (uint32_t)value : 0;
+    }
+    pending = false;
+    return true;
+}
+
+uint32_t AdaptiveCapacity::update(uint32_t capacity,
+                                  uint32_t required,
+                                  bool overflowed,
+                                  uint32_t minimum,
+                                  uint32_t maximum)
+{
+    auto nextPowerOfTwo = [](uint32_t value) {
+        uint32_t result = 1;
+        while(result < value && result < (1u << 31))
+            result <<= 1;
+        return result;
+    };
+    auto clampCapacity = [&](uint32_t value) {
+        return std::min(std::max(value, minimum), maximum);
+    };
+
+    if(overflowed || required > capacity)
+    {
+        lowReadbacks = 0;
+        // the required size is only a lower bound when lists got truncated
+        return clampCapacity(std::max(nextPowerOfTwo(required), capacity * 2));
+    }
+
+    if(required < capacity / 4)
+    {
+        lowReadbacks++;
+        if(lowReadbacks >= SHRINK_READBACKS)
+        {
+            lowReadbacks = 0;
+            // leave twice the required size as headroom
+            return clampCapacity(nextPowerOfTwo(required * 2));
+        }
+    }
+    else
+    {
+        lowReadbacks = 0;
+    }
+
+    return clampCapacity(capacity);
+}
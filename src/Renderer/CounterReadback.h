@@ -0,0 +1,63 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+#include <cstdint>
+
+// asynchronous readback of a few uint counters written by compute shaders
+// bgfx can only read back textures, so a compute shader copies the counters into a texture,
+// that gets blitted into a CPU readable texture and the values arrive a few frames later
+class CounterReadback
+{
+public:
+    static bool supported();
+
+    void initialize();
+    void shutdown();
+
+    // copy the first count values of buffer, count must be <= MAX_COUNTERS
+    // the copy is dispatched in view, the blit happens in blitView which has to come after view
+    // (blits run before any other work in a view)
+    // ignored while a previous request hasn't arrived yet
+    void request(bgfx::ViewId view, bgfx::ViewId blitView, bgfx::DynamicIndexBufferHandle buffer, uint32_t count);
+    // returns true once, when the values of the last request arrived
+    // frame is the current frame number, see Renderer::frameNumber
+    bool ready(uint32_t frame);
+    // values of the last request that arrived
+    uint32_t getValue(uint32_t index) const { return values[index]; }
+
+    static constexpr uint32_t MAX_COUNTERS = 16;
+
+    // should be the same as in cs_counters_readback.sc
+    static constexpr uint32_t READBACK_THREADS = 16;
+
+private:
+    bool pending = false;
+    uint32_t readyFrame = 0;
+
+    float data[MAX_COUNTERS] = {};
+    uint32_t values[MAX_COUNTERS] = {};
+
+    bgfx::UniformHandle readbackVecUniform = BGFX_INVALID_HANDLE;
+
+    bgfx::TextureHandle gpuTexture = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle cpuTexture = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle copyComputeProgram = BGFX_INVALID_HANDLE;
+};
+
+// capacity of a GPU list that adapts to the observed usage
+// grows right away when the list overflowed, shrinks after a few readbacks in a row that used
+// less than a quarter of it to avoid reallocating back and forth
+class AdaptiveCapacity
+{
+public:
+    // required is the largest size seen, overflowed is set if anything got dropped
+    // returns the new capacity (a power of two, clamped to [minimum, maximum])
+    uint32_t update(uint32_t capacity, uint32_t required, bool overflowed, uint32_t minimum, uint32_t maximum);
+    void reset() { lowReadbacks = 0; }
+
+    static constexpr uint32_t SHRINK_READBACKS = 4;
+
+private:
+    uint32_t lowReadbacks = 0;
+};
@@ -2,83 +2,88 @@
 
 #include "Scene/Scene.h"
 #include "Renderer/Samplers.h"
+#include "Renderer/LightPreCulling.h"
 #include <bigg.hpp>
 #include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
 
-constexpr bgfx::TextureFormat::Enum
-    DeferredRenderer::gBufferAttachmentFormats[DeferredRenderer::GBufferAttachment::Count - 1];
-
-DeferredRenderer::DeferredRenderer(const Scene* scene, const Config* config) :
-    Renderer(scene, config),
-    gBufferTextures { { BGFX_INVALID_HANDLE, "Diffuse + roughness" },
-                      { BGFX_INVALID_HANDLE, "Normal" },
-                      { BGFX_INVALID_HANDLE, "F0 + metallic" },
-                      { BGFX_INVALID_HANDLE, "Emissive + occlusion" },
-                      { BGFX_INVALID_HANDLE, "Depth" },
-                      { BGFX_INVALID_HANDLE, nullptr } },
-    gBufferTextureUnits { Samplers::DEFERRED_DIFFUSE_A,
-                          Samplers::DEFERRED_NORMAL,
-                          Samplers::DEFERRED_F0_METALLIC,
-                          Samplers::DEFERRED_EMISSIVE_OCCLUSION,
-                          Samplers::DEFERRED_DEPTH },
-    gBufferSamplerNames { "s_texDiffuseA", "s_texNormal", "s_texF0Metallic", "s_texEmissiveOcclusion", "s_texDepth" }
+DeferredRenderer::DeferredRenderer(const Scene* scene, const Config* config) : Renderer(scene, config)
 {
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        handle = BGFX_INVALID_HANDLE;
-    }
-    buffers = gBufferTextures;
+    buffers = gBuffer.getTextures();
 }
 
 bool DeferredRenderer::supported()
 {
     const bgfx::Caps* caps = bgfx::getCaps();
-    bool supported = Renderer::supported() &&
-                     // blitting depth texture after geometry pass
-                     (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
-                     // multiple render targets
-                     // depth doesn't count as an attachment
-                     caps->limits.maxFBAttachments >= GBufferAttachment::Count - 1;
-    if(!supported)
-        return false;
-
-    for(bgfx::TextureFormat::Enum format : gBufferAttachmentFormats)
-    {
-        if((caps->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) == 0)
-            return false;
-    }
-
-    return true;
+    return Renderer::supported() &&
+           // blitting depth texture after geometry pass
+           (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
+           GBuffer::supported();
 }
 
 void DeferredRenderer::onInitialize()
 {
-    for(size_t i = 0; i < BX_COUNTOF(gBufferSamplers); i++)
-    {
-        gBufferSamplers[i] = bgfx::createUniform(gBufferSamplerNames[i], bgfx::UniformType::Sampler);
-    }
-
-    // axis-aligned bounding box used as light geometry for light culling
-    constexpr float LEFT = -1.0f, RIGHT = 1.0f, BOTTOM = -1.0f, TOP = 1.0f, FRONT = -1.0f, BACK = 1.0f;
-    const PosVertex vertices[8] = {
-        { LEFT, BOTTOM, FRONT }, { RIGHT, BOTTOM, FRONT }, { LEFT, TOP, FRONT }, { RIGHT, TOP, FRONT },
-        { LEFT, BOTTOM, BACK },  { RIGHT, BOTTOM, BACK },  { LEFT, TOP, BACK },  { RIGHT, TOP, BACK },
-    };
-    const uint16_t indices[6 * 6] = {
-        // CCW
-        0, 1, 3, 3, 2, 0, // front
-        5, 4, 6, 6, 7, 5, // back
-        4, 0, 2, 2, 6, 4, // left
-        1, 5, 7, 7, 3, 1, // right
-        2, 3, 7, 7, 6, 2, // top
-        4, 5, 1, 1, 0, 4  // bottom
+    gBuffer.initialize();
+
+    // light volume proxies
+    // a unit cube has 1.9x the volume of the sphere it encloses, every fragment outside the sphere
+    // gets shaded for nothing
+    std::vector<PosVertex> vertices;
+    std::vector<uint16_t> indices;
+
+    // quad in billboard space (x = right, y = up)
+    // CW on screen like the back faces of the icospheres
+    const PosVertex quadVertices[4] = {
+        { -1.0f, -1.0f, 0.0f }, { 1.0f, -1.0f, 0.0f }, { -1.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }
     };
+    const uint16_t quadIndices[6] = { 1, 0, 2, 2, 3, 1 };
+    vertices.insert(vertices.end(), std::begin(quadVertices), std::end(quadVertices));
+    indices.insert(indices.end(), std::begin(quadIndices), std::end(quadIndices));
+    // covers the bounding square of the light's silhouette
+    lightProxies[LIGHT_PROXY_QUAD] = { 0, BX_COUNTOF(quadIndices), 4.0f };
+
+    lightProxies[LIGHT_PROXY_ICOSPHERE_LOW] = appendIcosphere(0, vertices, indices);
+    lightProxies[LIGHT_PROXY_ICOSPHERE_MEDIUM] = appendIcosphere(1, vertices, indices);
+    lightProxies[LIGHT_PROXY_ICOSPHERE_HIGH] = appendIcosphere(2, vertices, indices);
+
+    pointLightVertexBuffer = bgfx::createVertexBuffer(
+        bgfx::copy(vertices.data(), uint32_t(vertices.size() * sizeof(PosVertex))), PosVertex::layout);
+    pointLightIndexBuffer =
+        bgfx::createIndexBuffer(bgfx::copy(indices.data(), uint32_t(indices.size() * sizeof(uint16_t))));
 
-    pointLightVertexBuffer = bgfx::createVertexBuffer(bgfx::copy(&vertices, sizeof(vertices)), PosVertex::layout);
-    pointLightIndexBuffer = bgfx::createIndexBuffer(bgfx::copy(&indices, sizeof(indices)));
+    lightIndexLayout.begin().add(bgfx::Attrib::TexCoord7, 4, bgfx::AttribType::Float).end();
+    lightIndexCapacity = lightInstanceCapacity = 0;
 
-    char vsName[128], fsName[128];
+    char csName[128], vsName[128], fsName[128];
+
+    const bgfx::Caps* caps = bgfx::getCaps();
+    gpuLightInstances = (caps->supported & BGFX_CAPS_COMPUTE) != 0 && (caps->supported & BGFX_CAPS_DRAW_INDIRECT) != 0;
+    if(gpuLightInstances)
+    {
+        // OpenGL backend: uniforms must be created before loading shaders
+        lightCullPlanesUniform = bgfx::createUniform("u_lightCullPlanes", bgfx::UniformType::Vec4, 6);
+        lightProxyVecUniform = bgfx::createUniform("u_lightProxyVec", bgfx::UniformType::Vec4, 3);
+        lightProxyMeshesUniform =
+            bgfx::createUniform("u_lightProxyMeshes", bgfx::UniformType::Vec4, LIGHT_PROXY_COUNT);
+
+        lightInstanceCountBuffer = bgfx::createDynamicIndexBuffer(
+            LIGHT_INSTANCE_COUNTER_COUNT, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+        lightDrawIndirectBuffer = bgfx::createIndirectBuffer(LIGHT_PROXY_COUNT * (1 + STENCIL_LIGHT_BATCHES));
+
+        lightInstanceReadback.initialize();
+
+        bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_deferred_lightinstances_count.bin");
+        lightInstancesCountComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+        bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_deferred_lightinstances.bin");
+        lightInstancesComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+        bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_deferred_lightinstances_args.bin");
+        lightInstancesArgsComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    }
 
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_deferred_geometry.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_deferred_geometry.bin");
@@ -92,6 +97,9 @@ void DeferredRenderer::onInitialize()
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_deferred_pointlight.bin");
     pointLightProgram = bigg::loadProgram(vsName, fsName);
 
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_depth.bin");
+    pointLightStencilProgram = bigg::loadProgram(vsName, fsName);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_forward.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_forward.bin");
     transparencyProgram = bigg::loadProgram(vsName, fsName);
@@ -99,69 +107,75 @@ void DeferredRenderer::onInitialize()
 
 void DeferredRenderer::onReset()
 {
-    if(!bgfx::isValid(gBuffer))
-    {
-        gBuffer = createGBuffer();
-
-        for(size_t i = 0; i < GBufferAttachment::Depth; i++)
-        {
-            gBufferTextures[i].handle = bgfx::getTexture(gBuffer, (uint8_t)i);
-        }
-
-        // we can't use the G-Buffer's depth texture in the light pass framebuffer
-        // binding a texture for reading in the shader and attaching it to a framebuffer
-        // at the same time is undefined behaviour in most APIs
-        // https://www.khronos.org/opengl/wiki/Memory_Model#Framebuffer_objects
-        // we use a different depth texture and just blit it between the geometry and light pass
-        const uint64_t flags = BGFX_TEXTURE_BLIT_DST | gBufferSamplerFlags;
-        bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-        lightDepthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
-
-        gBufferTextures[GBufferAttachment::Depth].handle = lightDepthTexture;
-    }
-
-    if(!bgfx::isValid(accumFrameBuffer))
-    {
-        const bgfx::TextureHandle textures[2] = { bgfx::getTexture(frameBuffer, 0),
-                                                  bgfx::getTexture(gBuffer, GBufferAttachment::Depth) };
-        accumFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(textures), textures); // don't destroy textures
-    }
+    gBuffer.update(width, height, scene, config->thinGBuffer, true, bgfx::getTexture(frameBuffer, 0));
 }
 
 void DeferredRenderer::onRender(float dt)
 {
     enum : bgfx::ViewId
     {
-        vGeometry = 0,    // write G-Buffer
-        vFullscreenLight, // write ambient + emissive to output buffer
-        vLight,           // render lights to output buffer
-        vTransparent      // forward pass for transparency
+        vLightInstances = 0, // cull light volumes, write instances (compute)
+        vGeometry,           // write G-Buffer
+        vFullscreenLight,    // write ambient + emissive to output buffer
+        vLightBatches,       // for each batch: mark pixels inside light volumes, render lights to output buffer
+        vTransparent = vLightBatches + 2 * STENCIL_LIGHT_BATCHES // forward pass for transparency
     };
 
     const uint32_t BLACK = 0x000000FF;
 
+    // layout option or the scene's materials changed
+    gBuffer.update(width, height, scene, config->thinGBuffer, true, bgfx::getTexture(frameBuffer, 0));
+
+    bgfx::setViewName(vLightInstances, "Light volume culling pass (compute)");
+
     bgfx::setViewName(vGeometry, "Deferred geometry pass");
     bgfx::setViewClear(vGeometry, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, BLACK, 1.0f);
     bgfx::setViewRect(vGeometry, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vGeometry, gBuffer);
+    bgfx::setViewFrameBuffer(vGeometry, gBuffer.getFrameBuffer());
     bgfx::touch(vGeometry);
 
     bgfx::setViewName(vFullscreenLight, "Deferred light pass (ambient + emissive)");
     bgfx::setViewClear(vFullscreenLight, BGFX_CLEAR_COLOR, clearColor);
     bgfx::setViewRect(vFullscreenLight, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vFullscreenLight, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vFullscreenLight, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vFullscreenLight);
 
-    bgfx::setViewName(vLight, "Deferred light pass (point lights)");
-    bgfx::setViewClear(vLight, BGFX_CLEAR_NONE);
-    bgfx::setViewRect(vLight, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vLight, accumFrameBuffer);
-    bgfx::touch(vLight);
+    // with stencil light volumes, every batch of light volumes is masked by a stencil pass of its own
+    // otherwise all of them are rendered in the first light view
+    const bool stencilLightVolumes = config->stencilLightVolumes && gBuffer.hasStencil();
+    // GPU light instances split the visible instances in the args shader, only the batch count comes from here
+    const uint32_t lightCount = lights.getPointLights(scene).size();
+    if(stencilLightVolumes && lightCount > 0)
+    {
+        lightBatchSize = (lightCount + STENCIL_LIGHT_BATCHES - 1) / STENCIL_LIGHT_BATCHES;
+        lightBatchCount = (lightCount + lightBatchSize - 1) / lightBatchSize;
+    }
+    else
+        lightBatchSize = lightBatchCount = 0;
+
+    for(uint32_t batch = 0; batch < std::max(lightBatchCount, 1u); batch++)
+    {
+        const bgfx::ViewId vLightStencil = vLightBatches + 2 * batch;
+        const bgfx::ViewId vLight = vLightStencil + 1;
+
+        bgfx::setViewName(vLightStencil, "Deferred light stencil pass");
+        bgfx::setViewClear(vLightStencil, BGFX_CLEAR_STENCIL, 0, 1.0f, 0);
+        bgfx::setViewRect(vLightStencil, 0, 0, width, height);
+        bgfx::setViewFrameBuffer(vLightStencil, gBuffer.getAccumFrameBuffer());
+        if(stencilLightVolumes)
+            bgfx::touch(vLightStencil);
+
+        bgfx::setViewName(vLight, "Deferred light pass (point lights)");
+        bgfx::setViewClear(vLight, BGFX_CLEAR_NONE);
+        bgfx::setViewRect(vLight, 0, 0, width, height);
+        bgfx::setViewFrameBuffer(vLight, gBuffer.getAccumFrameBuffer());
+        bgfx::touch(vLight);
+    }
 
     bgfx::setViewName(vTransparent, "Transparent forward pass");
     bgfx::setViewClear(vTransparent, BGFX_CLEAR_NONE);
     bgfx::setViewRect(vTransparent, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vTransparent, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vTransparent, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vTransparent);
 
     if(!scene->loaded)
@@ -169,13 +183,19 @@ void DeferredRenderer::onRender(float dt)
 
     setViewProjection(vGeometry);
     setViewProjection(vFullscreenLight);
-    setViewProjection(vLight);
+    for(uint32_t batch = 0; batch < std::max(lightBatchCount, 1u); batch++)
+    {
+        setViewProjection(vLightBatches + 2 * batch);
+        setViewProjection(vLightBatches + 2 * batch + 1);
+    }
     setViewProjection(vTransparent);
 
     // render geometry, write to G-Buffer
 
     const uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
 
+    gBuffer.setUniform();
+
     for(const Mesh& mesh : scene->meshes)
     {
         const Material& mat = scene->materials[mesh.material];
@@ -196,12 +216,19 @@ void DeferredRenderer::onRender(float dt)
     // copy G-Buffer depth attachment to depth texture for sampling in the light pass
     // we can't attach it to the frame buffer and read it in the shader (unprojecting world position) at the same time
     // blit happens before any compute or draw calls
-    bgfx::blit(vFullscreenLight, lightDepthTexture, 0, 0, bgfx::getTexture(gBuffer, GBufferAttachment::Depth));
+    gBuffer.blitDepth(vFullscreenLight);
+
+    // light volume instances
+    // the CPU never touches per-light data, lights outside the view frustum aren't drawn
+    // dispatches discard bindings, so this has to happen before binding anything for the light pass
+
+    if(gpuLightInstances)
+        generateLightInstances(vLightInstances, vGeometry);
 
     // bind these once for all following submits
     // excluding BGFX_DISCARD_TEXTURE_SAMPLERS from the discard flags passed to submit makes sure
     // they don't get unbound
-    bindGBuffer();
+    gBuffer.bind();
     pbr.bindAlbedoLUT();
     lights.bindLights(scene);
 
@@ -215,36 +242,51 @@ void DeferredRenderer::onRender(float dt)
 
     // point lights
 
-    bgfx::setVertexBuffer(0, pointLightVertexBuffer);
-    bgfx::setIndexBuffer(pointLightIndexBuffer);
-
-    const uint16_t instanceStride = 64 + 16; // 64 bytes for mat4x4 and 16 for vec4 (lightIndex)
-    // use instancing
-    bgfx::InstanceDataBuffer idb{};
-    const auto lightsCount = static_cast<uint32_t>(scene->pointLights.lights.size());
-    const auto drawnLights = static_cast<uint32_t>(bgfx::getAvailInstanceDataBuffer(lightsCount, instanceStride));
-    bgfx::allocInstanceDataBuffer(&idb, drawnLights, instanceStride);
-    uint8_t* instanceData = idb.data;
-    for(size_t i = 0; i < drawnLights; i++)
+    // back faces of the light volumes behind the geometry
+    // this alone still shades pixels where the geometry is in front of the volume
+    const uint64_t lightState = BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_GEQUAL | BGFX_STATE_CULL_CCW |
+                                BGFX_STATE_BLEND_ADD;
+
+    if(stencilLightVolumes)
     {
-        const PointLight& light = scene->pointLights.lights[i];
-        float radius = light.calculateRadius();
-        glm::mat4 scale = glm::scale(glm::identity<glm::mat4>(), glm::vec3(radius));
-        glm::mat4 translate = glm::translate(glm::identity<glm::mat4>(), light.position);
-        glm::mat4 model = translate * scale;
-        float lightIndexVec[4] = { (float)i };
-        std::memcpy(instanceData + instanceStride * i, glm::value_ptr(model), 64);
-        std::memcpy(instanceData + instanceStride * i + 64, lightIndexVec, 16);
+        // mark pixels inside any light volume of the batch (z-fail)
+        // front faces behind the geometry decrement, back faces behind the geometry increment
+        // pixels inside a volume end up != 0, pixels in front of or behind it cancel out
+        // near plane clipping only removes faces in front of the geometry, so the camera can be inside a volume
+        // the mask is the union of the batch's volumes, we can't afford one stencil pass per light
+        // so big overlapping volumes still shade pixels for the other lights of their batch
+        // wrapping ops so the order of the faces doesn't matter
+        const uint32_t stencilFront = BGFX_STENCIL_TEST_ALWAYS | BGFX_STENCIL_FUNC_REF(0) |
+                                      BGFX_STENCIL_FUNC_RMASK(0xFF) | BGFX_STENCIL_OP_FAIL_S_KEEP |
+                                      BGFX_STENCIL_OP_FAIL_Z_DECR | BGFX_STENCIL_OP_PASS_Z_KEEP;
+        const uint32_t stencilBack = BGFX_STENCIL_TEST_ALWAYS | BGFX_STENCIL_FUNC_REF(0) |
+                                     BGFX_STENCIL_FUNC_RMASK(0xFF) | BGFX_STENCIL_OP_FAIL_S_KEEP |
+                                     BGFX_STENCIL_OP_FAIL_Z_INCR | BGFX_STENCIL_OP_PASS_Z_KEEP;
+        const uint32_t lightStencil = BGFX_STENCIL_TEST_NOTEQUAL | BGFX_STENCIL_FUNC_REF(0) |
+                                      BGFX_STENCIL_FUNC_RMASK(0xFF) | BGFX_STENCIL_OP_FAIL_S_KEEP |
+                                      BGFX_STENCIL_OP_FAIL_Z_KEEP | BGFX_STENCIL_OP_PASS_Z_KEEP;
+
+        // the stencil view of each batch starts with a cleared mask
+        for(uint32_t batch = 0; batch < lightBatchCount; batch++)
+        {
+            // the volumes are CCW seen from the outside
+            bgfx::setState(BGFX_STATE_DEPTH_TEST_LESS | BGFX_STATE_FRONT_CCW);
+            bgfx::setStencil(stencilFront, stencilBack);
+            submitLightVolumes(vLightBatches + 2 * batch, pointLightStencilProgram, batch);
+
+            bgfx::setState(lightState);
+            bgfx::setStencil(lightStencil);
+            submitLightVolumes(vLightBatches + 2 * batch + 1, pointLightProgram, batch);
+        }
+        counters["Stencil light batches"] = (double)lightBatchCount;
+    }
+    else
+    {
+        bgfx::setState(lightState);
+        bgfx::setStencil(BGFX_STENCIL_NONE);
+        submitLightVolumes(vLightBatches + 1, pointLightProgram);
+        counters.erase("Stencil light batches");
     }
-
-    bgfx::setInstanceDataBuffer(&idb);
-
-    bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_GEQUAL | BGFX_STATE_CULL_CCW |
-                   BGFX_STATE_BLEND_ADD);
-    bgfx::submit(vLight,
-                 pointLightProgram,
-                 0,
-                 ~(BGFX_DISCARD_VERTEX_STREAMS | BGFX_DISCARD_INDEX_BUFFER | BGFX_DISCARD_BINDINGS));
 
     // transparent
 
@@ -271,60 +313,288 @@ void DeferredRenderer::onShutdown()
 {
     bgfx::destroy(geometryProgram);
     bgfx::destroy(pointLightProgram);
+    bgfx::destroy(pointLightStencilProgram);
     bgfx::destroy(fullscreenProgram);
     bgfx::destroy(transparencyProgram);
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        bgfx::destroy(handle);
-        handle = BGFX_INVALID_HANDLE;
-    }
+    gBuffer.shutdown();
     bgfx::destroy(pointLightVertexBuffer);
     bgfx::destroy(pointLightIndexBuffer);
-    if(bgfx::isValid(lightDepthTexture))
-        bgfx::destroy(lightDepthTexture);
-    if(bgfx::isValid(gBuffer))
-        bgfx::destroy(gBuffer);
-    if(bgfx::isValid(accumFrameBuffer))
-        bgfx::destroy(accumFrameBuffer);
+    if(bgfx::isValid(lightIndexBuffer))
+        bgfx::destroy(lightIndexBuffer);
+    if(gpuLightInstances)
+    {
+        lightInstanceReadback.shutdown();
+        if(bgfx::isValid(lightInstanceBuffer))
+            bgfx::destroy(lightInstanceBuffer);
+        bgfx::destroy(lightInstanceCountBuffer);
+        bgfx::destroy(lightDrawIndirectBuffer);
+        bgfx::destroy(lightCullPlanesUniform);
+        bgfx::destroy(lightProxyVecUniform);
+        bgfx::destroy(lightProxyMeshesUniform);
+        bgfx::destroy(lightInstancesCountComputeProgram);
+        bgfx::destroy(lightInstancesComputeProgram);
+        bgfx::destroy(lightInstancesArgsComputeProgram);
+    }
 
     geometryProgram = fullscreenProgram = pointLightProgram = transparencyProgram = BGFX_INVALID_HANDLE;
+    pointLightStencilProgram = BGFX_INVALID_HANDLE;
     pointLightVertexBuffer = BGFX_INVALID_HANDLE;
     pointLightIndexBuffer = BGFX_INVALID_HANDLE;
-    lightDepthTexture = BGFX_INVALID_HANDLE;
-    gBuffer = BGFX_INVALID_HANDLE;
-    accumFrameBuffer = BGFX_INVALID_HANDLE;
+    lightIndexBuffer = BGFX_INVALID_HANDLE;
+    lightIndexCapacity = 0;
+    lightInstanceBuffer = BGFX_INVALID_HANDLE;
+    lightInstanceCapacity = 0;
+    lightInstanceCountBuffer = BGFX_INVALID_HANDLE;
+    lightDrawIndirectBuffer = BGFX_INVALID_HANDLE;
+    lightCullPlanesUniform = lightProxyVecUniform = lightProxyMeshesUniform = BGFX_INVALID_HANDLE;
+    lightInstancesCountComputeProgram = BGFX_INVALID_HANDLE;
+    lightInstancesComputeProgram = lightInstancesArgsComputeProgram = BGFX_INVALID_HANDLE;
+    gpuLightInstances = false;
+}
+
+void DeferredRenderer::updateLightIndices(uint32_t count)
+{
+    if(count <= lightIndexCapacity)
+        return;
+
+    // grow in powers of two, same as the light buffer
+    uint32_t capacity = std::max(lightIndexCapacity, 1024u);
+    while(capacity < count)
+        capacity *= 2;
+
+    if(bgfx::isValid(lightIndexBuffer))
+        bgfx::destroy(lightIndexBuffer);
+    lightIndexBuffer = bgfx::createDynamicVertexBuffer(capacity, lightIndexLayout);
+    lightIndexCapacity = capacity;
+
+    // float is exact up to 2^24, way more lights than we can handle
+    for(uint32_t first = 0; first < capacity; first += LIGHT_INDEX_CHUNK_SIZE)
+    {
+        const uint32_t chunkCount = std::min(capacity - first, (uint32_t)LIGHT_INDEX_CHUNK_SIZE);
+        const bgfx::Memory* mem = bgfx::alloc(chunkCount * lightIndexLayout.getStride());
+        float* data = (float*)mem->data;
+        for(uint32_t i = 0; i < chunkCount; i++)
+        {
+            data[4 * i + 0] = (float)(first + i);
+            data[4 * i + 1] = data[4 * i + 2] = data[4 * i + 3] = 0.0f;
+        }
+        bgfx::update(lightIndexBuffer, first, mem);
+    }
 }
 
-bgfx::FrameBufferHandle DeferredRenderer::createGBuffer()
+void DeferredRenderer::updateLightInstances(uint32_t count)
 {
-    bgfx::TextureHandle textures[GBufferAttachment::Count];
+    if(count <= lightInstanceCapacity)
+        return;
 
-    const uint64_t flags = BGFX_TEXTURE_RT | gBufferSamplerFlags;
+    // grow in powers of two, same as the light buffer
+    // the compute shader fills it every frame, no need to upload anything
+    uint32_t capacity = std::max(lightInstanceCapacity, 1024u);
+    while(capacity < count)
+        capacity *= 2;
 
-    for(size_t i = 0; i < GBufferAttachment::Depth; i++)
+    if(bgfx::isValid(lightInstanceBuffer))
+        bgfx::destroy(lightInstanceBuffer);
+    lightInstanceBuffer = bgfx::createDynamicVertexBuffer(capacity, lightIndexLayout, BGFX_BUFFER_COMPUTE_WRITE);
+    lightInstanceCapacity = capacity;
+}
+
+void DeferredRenderer::generateLightInstances(bgfx::ViewId view, bgfx::ViewId blitView)
+{
+    const uint32_t lightCount = lights.getPointLights(scene).size();
+    updateLightInstances(lightCount);
+
+    const bgfx::Memory* mem = bgfx::alloc(LIGHT_INSTANCE_COUNTER_COUNT * sizeof(uint32_t));
+    std::fill_n((uint32_t*)mem->data, LIGHT_INSTANCE_COUNTER_COUNT, 0u);
+    bgfx::update(lightInstanceCountBuffer, 0, mem);
+
+    // cull against the view frustum and pick a proxy for each light
+    // same test as light pre-culling, but on the GPU so it sees lights animated there
+    // the first pass counts the lights per proxy, the second one writes the instances
+    // into each proxy's range so every proxy is one contiguous indirect draw
+
+    glm::vec4 planes[6];
+    LightPreCulling::getFrustumPlanes(projMat * viewMat, bgfx::getCaps()->homogeneousDepth, planes);
+    bgfx::setUniform(lightCullPlanesUniform, planes, 6);
+
+    const float cubeArea = 6.0f;
+    glm::vec4 lightProxyVec[3] = {
+        // projected radius in pixels = scale * radius / sqrt(distance^2 - radius^2)
+        glm::vec4(projMat[1][1] * height * 0.5f,
+                  LIGHT_PROXY_QUAD_MAX_RADIUS,
+                  LIGHT_PROXY_LOW_MAX_RADIUS,
+                  LIGHT_PROXY_MEDIUM_MAX_RADIUS),
+        glm::vec4(lightProxies[LIGHT_PROXY_QUAD].projectedArea,
+                  lightProxies[LIGHT_PROXY_ICOSPHERE_LOW].projectedArea,
+                  lightProxies[LIGHT_PROXY_ICOSPHERE_MEDIUM].projectedArea,
+                  lightProxies[LIGHT_PROXY_ICOSPHERE_HIGH].projectedArea),
+        // a volume can't cover more fragments than there are pixels
+        glm::vec4((float)width * height, cubeArea, (float)lightBatchCount, 0.0f)
+    };
+    bgfx::setUniform(lightProxyVecUniform, lightProxyVec, 3);
+
+    const uint32_t groups = LightShader::getLightDispatchGroups(lightCount, LIGHT_INSTANCE_THREADS);
+
+    if(lightCount > 0)
     {
-        assert(bgfx::isTextureValid(0, false, 1, gBufferAttachmentFormats[i], flags));
-        textures[i] = bgfx::createTexture2D(width, height, false, 1, gBufferAttachmentFormats[i], flags);
+        lights.bindLights(scene);
+        bgfx::setBuffer(Samplers::DEFERRED_LIGHTINSTANCECOUNT, lightInstanceCountBuffer, bgfx::Access::ReadWrite);
+        bgfx::dispatch(view, lightInstancesCountComputeProgram, groups, 1, 1);
     }
 
-    bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-    assert(depthFormat != bgfx::TextureFormat::Count);
-    textures[Depth] = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+    // indirect draw arguments, one draw per proxy and one per proxy and stencil batch
+    // also turns the counts into write cursors
 
-    bgfx::FrameBufferHandle gb = bgfx::createFrameBuffer((uint8_t)GBufferAttachment::Count, textures, true);
+    glm::vec4 lightProxyMeshes[LIGHT_PROXY_COUNT];
+    for(uint32_t i = 0; i < LIGHT_PROXY_COUNT; i++)
+    {
+        lightProxyMeshes[i] =
+            glm::vec4((float)lightProxies[i].indexCount, (float)lightProxies[i].firstIndex, 0.0f, 0.0f);
+    }
+    bgfx::setUniform(lightProxyMeshesUniform, lightProxyMeshes, LIGHT_PROXY_COUNT);
+    bgfx::setBuffer(Samplers::DEFERRED_LIGHTINSTANCECOUNT, lightInstanceCountBuffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::DEFERRED_DRAWINDIRECT, lightDrawIndirectBuffer, bgfx::Access::Write);
+    bgfx::dispatch(view, lightInstancesArgsComputeProgram, 1, 1, 1);
 
-    if(!bgfx::isValid(gb))
-        Log->error("Failed to create G-Buffer");
-    else
-        bgfx::setName(gb, "G-Buffer");
+    if(lightCount > 0)
+    {
+        lights.bindLights(scene);
+        bgfx::setBuffer(Samplers::DEFERRED_LIGHTINSTANCES, lightInstanceBuffer, bgfx::Access::Write);
+        bgfx::setBuffer(Samplers::DEFERRED_LIGHTINSTANCECOUNT, lightInstanceCountBuffer, bgfx::Access::ReadWrite);
+        bgfx::dispatch(view, lightInstancesComputeProgram, groups, 1, 1);
+    }
+
+    // stats
 
-    return gb;
+    lightInstanceReadback.request(view, blitView, lightInstanceCountBuffer, LIGHT_INSTANCE_COUNTER_COUNT);
+    if(lightInstanceReadback.ready(frameNumber))
+    {
+        counters["Light proxies (quad)"] = lightInstanceReadback.getValue(LIGHT_PROXY_QUAD);
+        counters["Light proxies (low)"] = lightInstanceReadback.getValue(LIGHT_PROXY_ICOSPHERE_LOW);
+        counters["Light proxies (medium)"] = lightInstanceReadback.getValue(LIGHT_PROXY_ICOSPHERE_MEDIUM);
+        counters["Light proxies (high)"] = lightInstanceReadback.getValue(LIGHT_PROXY_ICOSPHERE_HIGH);
+        // estimated from the projected areas, there's no portable way to query fragment shader invocations
+        const double savedLow = lightInstanceReadback.getValue(LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS + 0);
+        const double savedHigh = lightInstanceReadback.getValue(LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS + 1);
+        counters["Light fragments saved (est.)"] = savedHigh * 4294967296.0 + savedLow;
+    }
 }
 
-void DeferredRenderer::bindGBuffer()
+void DeferredRenderer::submitLightVolumes(bgfx::ViewId view, bgfx::ProgramHandle program, uint32_t batch)
 {
-    for(size_t i = 0; i < GBufferAttachment::Count; i++)
+    // use instancing, the shader reads position and radius from the light buffer
+    // with GPU light instances, the instance counts come from the indirect draw arguments
+    bgfx::setVertexBuffer(0, pointLightVertexBuffer);
+    const uint8_t discardFlags =
+        (uint8_t)~(BGFX_DISCARD_VERTEX_STREAMS | BGFX_DISCARD_INDEX_BUFFER | BGFX_DISCARD_BINDINGS);
+    if(gpuLightInstances)
     {
-        bgfx::setTexture(gBufferTextureUnits[i], gBufferSamplers[i], gBufferTextures[i].handle);
+        // the indirect draws select the index range and the instances of each proxy
+        // the draws of a batch are clipped to its instance range
+        const uint32_t firstDraw = batch == ALL_LIGHT_BATCHES ? 0 : LIGHT_PROXY_COUNT * (1 + batch);
+        bgfx::setIndexBuffer(pointLightIndexBuffer);
+        bgfx::setInstanceDataBuffer(lightInstanceBuffer, 0, lightInstanceCapacity);
+        bgfx::submit(view, program, lightDrawIndirectBuffer, (uint16_t)firstDraw, LIGHT_PROXY_COUNT, 0, discardFlags);
     }
+    else
+    {
+        const LightProxyMesh& proxy = lightProxies[LIGHT_PROXY_ICOSPHERE_MEDIUM];
+        const uint32_t lightCount = lights.getPointLights(scene).size();
+        updateLightIndices(lightCount);
+        uint32_t first = 0;
+        uint32_t count = lightCount;
+        if(batch != ALL_LIGHT_BATCHES)
+        {
+            first = std::min(batch * lightBatchSize, lightCount);
+            count = std::min(lightBatchSize, lightCount - first);
+        }
+        bgfx::setIndexBuffer(pointLightIndexBuffer, proxy.firstIndex, proxy.indexCount);
+        bgfx::setInstanceDataBuffer(lightIndexBuffer, first, count);
+        bgfx::submit(view, program, 0, discardFlags);
+    }
+}
+
+DeferredRenderer::LightProxyMesh DeferredRenderer::appendIcosphere(uint32_t subdivisions,
+                                                                   std::vector<PosVertex>& vertices,
+                                                                   std::vector<uint16_t>& indices)
+{
+    // icosahedron
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> positions = {
+        glm::vec3(-1.0f, t, 0.0f), glm::vec3(1.0f, t, 0.0f),   glm::vec3(-1.0f, -t, 0.0f), glm::vec3(1.0f, -t, 0.0f),
+        glm::vec3(0.0f, -1.0f, t), glm::vec3(0.0f, 1.0f, t),   glm::vec3(0.0f, -1.0f, -t), glm::vec3(0.0f, 1.0f, -t),
+        glm::vec3(t, 0.0f, -1.0f), glm::vec3(t, 0.0f, 1.0f),   glm::vec3(-t, 0.0f, -1.0f), glm::vec3(-t, 0.0f, 1.0f)
+    };
+    std::vector<uint16_t> triangles = { 0, 11, 5, 0, 5,  1,  0,  1, 7, 0, 7,  10, 0, 10, 11, 1, 5, 9, 5, 11,
+                                        4, 11, 10, 2, 10, 7, 6, 7, 1, 8, 3, 9,  4,  3, 4,  2,  3, 2, 6, 3,
+                                        6, 8,  3, 8, 9,  4, 9, 5, 2, 4, 11, 6,  2,  10, 8, 6,  7, 9, 8, 1 };
+    for(glm::vec3& position : positions)
+    {
+        position = glm::normalize(position);
+    }
+
+    // split every triangle into 4, new vertices are pushed out onto the sphere
+    for(uint32_t s = 0; s < subdivisions; s++)
+    {
+        std::map<std::pair<uint16_t, uint16_t>, uint16_t> midpoints;
+        auto midpoint = [&](uint16_t a, uint16_t b) {
+            const std::pair<uint16_t, uint16_t> key = { std::min(a, b), std::max(a, b) };
+            auto it = midpoints.find(key);
+            if(it != midpoints.end())
+                return it->second;
+            const uint16_t index = (uint16_t)positions.size();
+            positions.push_back(glm::normalize(positions[a] + positions[b]));
+            midpoints[key] = index;
+            return index;
+        };
+
+        std::vector<uint16_t> subdivided;
+        for(size_t i = 0; i < triangles.size(); i += 3)
+        {
+            const uint16_t a = triangles[i + 0], b = triangles[i + 1], c = triangles[i + 2];
+            const uint16_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            subdivided.insert(subdivided.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+        }
+        triangles = std::move(subdivided);
+    }
+
+    // the vertices lie on the unit sphere, the faces cut into it
+    // scale it up so the closest face touches the sphere
+    float minDistance = 1.0f;
+    for(size_t i = 0; i < triangles.size(); i += 3)
+    {
+        const glm::vec3 a = positions[triangles[i + 0]], b = positions[triangles[i + 1]], c = positions[triangles[i + 2]];
+        const glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+        minDistance = std::min(minDistance, std::abs(glm::dot(normal, a)));
+    }
+    const float scale = 1.0f / minDistance;
+
+    LightProxyMesh mesh;
+    mesh.firstIndex = (uint32_t)indices.size();
+    mesh.indexCount = (uint32_t)triangles.size();
+
+    const uint16_t baseVertex = (uint16_t)vertices.size();
+    for(const glm::vec3& position : positions)
+    {
+        const glm::vec3 scaled = position * scale;
+        vertices.push_back({ scaled.x, scaled.y, scaled.z });
+    }
+
+    // mean projected area of a convex body is a quarter of its surface area (Cauchy)
+    float area = 0.0f;
+    for(size_t i = 0; i < triangles.size(); i += 3)
+    {
+        uint16_t a = triangles[i + 0], b = triangles[i + 1], c = triangles[i + 2];
+        const glm::vec3 pa = positions[a] * scale, pb = positions[b] * scale, pc = positions[c] * scale;
+        const glm::vec3 cross = glm::cross(pb - pa, pc - pa);
+        area += 0.5f * glm::length(cross);
+        // same winding as the old cube, cross(b - a, c - a) points inside
+        if(glm::dot(cross, pa + pb + pc) > 0.0f)
+            std::swap(b, c);
+        indices.insert(indices.end(),
+                       { (uint16_t)(baseVertex + a), (uint16_t)(baseVertex + b), (uint16_t)(baseVertex + c) });
+    }
+    mesh.projectedArea = area / 4.0f;
+
+    return mesh;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Renderer.h"
+#include "Renderer/GBuffer.h"
+#include "Renderer/CounterReadback.h"
+#include <vector>
 
 class DeferredRenderer : public Renderer
 {
@@ -15,62 +18,110 @@ public:
     virtual void onShutdown() override;
 
 private:
-    bgfx::VertexBufferHandle pointLightVertexBuffer = BGFX_INVALID_HANDLE;
-    bgfx::IndexBufferHandle pointLightIndexBuffer = BGFX_INVALID_HANDLE;
-
-    enum GBufferAttachment : size_t
+    // light volume proxies, all in one vertex and index buffer
+    // the icospheres enclose the unit sphere, the quad is turned into a camera-facing billboard
+    // by the vertex shader (instance data y = 1)
+    // with GPU light instances each light picks one by its projected size, otherwise every light
+    // uses the medium icosphere
+    static constexpr uint32_t LIGHT_PROXY_QUAD = 0;
+    static constexpr uint32_t LIGHT_PROXY_ICOSPHERE_LOW = 1;
+    static constexpr uint32_t LIGHT_PROXY_ICOSPHERE_MEDIUM = 2;
+    static constexpr uint32_t LIGHT_PROXY_ICOSPHERE_HIGH = 3;
+    static constexpr uint32_t LIGHT_PROXY_COUNT = 4;
+
+    // stencil light volumes split the light volume instances into up to this many batches
+    // each batch gets its own stencil mask, overlapping volumes only share a mask within a batch
+    // every batch needs two views (stencil and light pass)
+    static constexpr uint32_t STENCIL_LIGHT_BATCHES = 16;
+    // submitLightVolumes without a batch draws all light volumes
+    static constexpr uint32_t ALL_LIGHT_BATCHES = UINT32_MAX;
+
+    // largest projected light radius in pixels for each proxy, bigger lights use the high icosphere
+    static constexpr float LIGHT_PROXY_QUAD_MAX_RADIUS = 4.0f;
+    static constexpr float LIGHT_PROXY_LOW_MAX_RADIUS = 32.0f;
+    static constexpr float LIGHT_PROXY_MEDIUM_MAX_RADIUS = 128.0f;
+
+    struct LightProxyMesh
     {
-        // no world position
-        // gl_Fragcoord is enough to unproject
-
-        // RGB = diffuse
-        // A = a (remapped roughness)
-        Diffuse_A,
-
-        // RG = encoded normal
-        Normal,
-
-        // RGB = F0 (Fresnel at normal incidence)
-        // A = metallic
-        // TODO? don't use F0, calculate from diffuse and metallic in shader
-        //       where do we store metallic?
-        F0_Metallic,
-
-        // RGB = emissive radiance
-        // A = occlusion multiplier
-        EmissiveOcclusion,
-
-        Depth,
-
-        Count
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        // projected area of the back faces in units of the projected light radius squared
+        // for estimating the fragments saved compared to the old cube (6)
+        float projectedArea;
     };
+    LightProxyMesh lightProxies[LIGHT_PROXY_COUNT];
 
-    static constexpr uint64_t gBufferSamplerFlags = BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
-                                                    BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP |
-                                                    BGFX_SAMPLER_V_CLAMP;
-
-    static constexpr bgfx::TextureFormat::Enum gBufferAttachmentFormats[GBufferAttachment::Count - 1] = {
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::RG16F,
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::BGRA8
-        // depth format is determined dynamically
-    };
-
-    TextureBuffer gBufferTextures[GBufferAttachment::Count + 1]; // includes depth, + null-terminated
-    uint8_t gBufferTextureUnits[GBufferAttachment::Count];
-    const char* gBufferSamplerNames[GBufferAttachment::Count];
-    bgfx::UniformHandle gBufferSamplers[GBufferAttachment::Count];
-    bgfx::FrameBufferHandle gBuffer = BGFX_INVALID_HANDLE;
+    bgfx::VertexBufferHandle pointLightVertexBuffer = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle pointLightIndexBuffer = BGFX_INVALID_HANDLE;
 
-    bgfx::TextureHandle lightDepthTexture = BGFX_INVALID_HANDLE;
-    bgfx::FrameBufferHandle accumFrameBuffer = BGFX_INVALID_HANDLE;
+    // instance data for the light volumes, one vec4 per light with the light index in x
+    // transient instance data is limited in size, this has room for any number of lights
+    // the indices never change so it only gets written when it grows
+    // only used without GPU light instances
+    bgfx::VertexLayout lightIndexLayout;
+    bgfx::DynamicVertexBufferHandle lightIndexBuffer = BGFX_INVALID_HANDLE;
+    uint32_t lightIndexCapacity = 0;
+
+    // lights per bgfx::update call when growing lightIndexBuffer
+    static constexpr uint32_t LIGHT_INDEX_CHUNK_SIZE = 65536;
+
+    // GPU light instances (needs compute and indirect draws)
+    // compute shaders write the index of every light inside the view frustum to lightInstanceBuffer
+    // (same layout as lightIndexBuffer), grouped by proxy, and one indirect draw per proxy
+    // followed by one indirect draw per proxy for every stencil batch
+    bool gpuLightInstances = false;
+    bgfx::DynamicVertexBufferHandle lightInstanceBuffer = BGFX_INVALID_HANDLE;
+    uint32_t lightInstanceCapacity = 0;
+    bgfx::DynamicIndexBufferHandle lightInstanceCountBuffer = BGFX_INVALID_HANDLE;
+    bgfx::IndirectBufferHandle lightDrawIndirectBuffer = BGFX_INVALID_HANDLE;
+
+    // lightInstanceCountBuffer layout, should be the same as in deferred_lightinstances.sh
+    // instances per proxy, then the write cursor of each proxy, then the estimated saved fragments
+    // as a 64-bit value (low, high)
+    static constexpr uint32_t LIGHT_INSTANCE_COUNTER_CURSORS = LIGHT_PROXY_COUNT;
+    static constexpr uint32_t LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS = 2 * LIGHT_PROXY_COUNT;
+    static constexpr uint32_t LIGHT_INSTANCE_COUNTER_COUNT = 2 * LIGHT_PROXY_COUNT + 2;
+
+    // light volume instances per stencil batch, 0 without stencil light volumes
+    // with GPU light instances, the batch size comes from the visible instance count instead
+    // (see cs_deferred_lightinstances_args.sc)
+    uint32_t lightBatchSize = 0;
+    uint32_t lightBatchCount = 0;
+
+    // proxy counts and saved fragments for the stats, arrive a few frames late
+    CounterReadback lightInstanceReadback;
+
+    bgfx::UniformHandle lightCullPlanesUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle lightProxyVecUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle lightProxyMeshesUniform = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle lightInstancesCountComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle lightInstancesComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle lightInstancesArgsComputeProgram = BGFX_INVALID_HANDLE;
+
+    // should be the same as in deferred_lightinstances.sh
+    static constexpr uint32_t LIGHT_INSTANCE_THREADS = 64;
+
+    // stencil light volumes need a stencil channel in the G-Buffer depth (D24S8)
+    // always requested so toggling the option doesn't recreate the G-Buffer
+    GBuffer gBuffer;
 
     bgfx::ProgramHandle geometryProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle fullscreenProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle pointLightProgram = BGFX_INVALID_HANDLE;
+    // light volumes without shading for the stencil pass
+    bgfx::ProgramHandle pointLightStencilProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle transparencyProgram = BGFX_INVALID_HANDLE;
 
-    bgfx::FrameBufferHandle createGBuffer();
-    void bindGBuffer();
+    // append an icosphere enclosing the unit sphere
+    static LightProxyMesh appendIcosphere(uint32_t subdivisions,
+                                          std::vector<PosVertex>& vertices,
+                                          std::vector<uint16_t>& indices);
+
+    void updateLightIndices(uint32_t count);
+    void updateLightInstances(uint32_t count);
+    // cull the light volumes on the GPU and write the instances and indirect draw arguments
+    void generateLightInstances(bgfx::ViewId view, bgfx::ViewId blitView);
+    // submit all light volumes or those of one stencil batch, state and stencil must be set
+    void submitLightVolumes(bgfx::ViewId view, bgfx::ProgramHandle program, uint32_t batch = ALL_LIGHT_BATCHES);
 };
@@ -0,0 +1,228 @@
+#include "GBuffer.h"
+
+#include "Scene/Scene.h"
+#include "Renderer/Samplers.h"
+#include <cassert>
+
+constexpr bgfx::TextureFormat::Enum GBuffer::classicFormats[GBuffer::MAX_ATTACHMENTS];
+constexpr bgfx::TextureFormat::Enum GBuffer::thinFormats[GBuffer::MAX_ATTACHMENTS - 1];
+
+GBuffer::GBuffer() :
+    textures { { BGFX_INVALID_HANDLE, nullptr },
+               { BGFX_INVALID_HANDLE, nullptr },
+               { BGFX_INVALID_HANDLE, nullptr },
+               { BGFX_INVALID_HANDLE, nullptr },
+               { BGFX_INVALID_HANDLE, nullptr },
+               { BGFX_INVALID_HANDLE, nullptr } }
+{
+    for(size_t i = 0; i < Sampler::Count; i++)
+    {
+        samplerTextures[i] = BGFX_INVALID_HANDLE;
+        samplers[i] = BGFX_INVALID_HANDLE;
+    }
+}
+
+bool GBuffer::supported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    // multiple render targets
+    // depth doesn't count as an attachment
+    if(caps->limits.maxFBAttachments < MAX_ATTACHMENTS)
+        return false;
+
+    for(bgfx::TextureFormat::Enum format : classicFormats)
+    {
+        if((caps->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+bool GBuffer::thinSupported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    for(bgfx::TextureFormat::Enum format : thinFormats)
+    {
+        if((caps->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+void GBuffer::initialize()
+{
+    const char* samplerNames[Sampler::Count] = {
+        "s_texDiffuseA", "s_texNormal", "s_texF0Metallic", "s_texEmissiveOcclusion", "s_texDepth"
+    };
+    for(size_t i = 0; i < Sampler::Count; i++)
+    {
+        samplers[i] = bgfx::createUniform(samplerNames[i], bgfx::UniformType::Sampler);
+    }
+    gBufferVecUniform = bgfx::createUniform("u_gBufferVec", bgfx::UniformType::Vec4);
+}
+
+void GBuffer::shutdown()
+{
+    for(bgfx::UniformHandle& handle : samplers)
+    {
+        bgfx::destroy(handle);
+        handle = BGFX_INVALID_HANDLE;
+    }
+    bgfx::destroy(gBufferVecUniform);
+    gBufferVecUniform = BGFX_INVALID_HANDLE;
+
+    destroy();
+}
+
+bool GBuffer::update(uint16_t width,
+                     uint16_t height,
+                     const Scene* scene,
+                     bool thin,
+                     bool stencil,
+                     bgfx::TextureHandle output)
+{
+    const uint64_t flags = BGFX_TEXTURE_RT | SAMPLER_FLAGS;
+    const uint64_t blitFlags = BGFX_TEXTURE_BLIT_DST | SAMPLER_FLAGS;
+
+    thin = thin && thinSupported();
+    const bool emissiveOcclusion = !thin || usesEmissiveOcclusion(scene);
+    // both depth textures need the same format for the blit
+    stencil = stencil && Renderer::depthStencilSupported(flags) && Renderer::depthStencilSupported(blitFlags);
+
+    if(bgfx::isValid(frameBuffer) && thin == this->thin && emissiveOcclusion == this->emissiveOcclusion &&
+       stencil == this->stencil)
+        return false;
+
+    destroy();
+    this->thin = thin;
+    this->emissiveOcclusion = emissiveOcclusion;
+    this->stencil = stencil;
+
+    const bgfx::TextureFormat::Enum* formats = thin ? thinFormats : classicFormats;
+    attachments = thin ? (emissiveOcclusion ? 3 : 2) : MAX_ATTACHMENTS;
+
+    bgfx::TextureHandle handles[MAX_ATTACHMENTS + 1];
+    for(uint8_t i = 0; i < attachments; i++)
+    {
+        assert(bgfx::isTextureValid(0, false, 1, formats[i], flags));
+        handles[i] = bgfx::createTexture2D(width, height, false, 1, formats[i], flags);
+    }
+
+    bgfx::TextureFormat::Enum depthFormat = Renderer::findDepthFormat(flags, stencil);
+    assert(depthFormat != bgfx::TextureFormat::Count);
+    const bgfx::TextureHandle depthAttachment = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+    handles[attachments] = depthAttachment;
+
+    frameBuffer = bgfx::createFrameBuffer(attachments + 1, handles, true);
+
+    if(!bgfx::isValid(frameBuffer))
+        Log->error("Failed to create G-Buffer");
+    else
+        bgfx::setName(frameBuffer, "G-Buffer");
+
+    // we can't use the G-Buffer's depth texture in the light pass framebuffer
+    // binding a texture for reading in the shader and attaching it to a framebuffer
+    // at the same time is undefined behaviour in most APIs
+    // https://www.khronos.org/opengl/wiki/Memory_Model#Framebuffer_objects
+    // we use a different depth texture and just blit it between the geometry and light pass
+    depthFormat = Renderer::findDepthFormat(blitFlags, stencil);
+    depthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, blitFlags);
+
+    const bgfx::TextureHandle accumTextures[2] = { output, depthAttachment };
+    accumFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(accumTextures), accumTextures); // don't destroy textures
+
+    // textures for the samplers in gbuffer.sh
+    // unused samplers get a valid texture anyway, the shader doesn't read them
+    samplerTextures[Diffuse_A] = handles[0];
+    samplerTextures[Normal] = handles[1];
+    if(thin)
+    {
+        samplerTextures[F0_Metallic] = handles[0];
+        samplerTextures[EmissiveOcclusion] = emissiveOcclusion ? handles[2] : handles[0];
+    }
+    else
+    {
+        samplerTextures[F0_Metallic] = handles[2];
+        samplerTextures[EmissiveOcclusion] = handles[3];
+    }
+    samplerTextures[Depth] = depthTexture;
+
+    // debug output
+    const char* classicNames[MAX_ATTACHMENTS] = {
+        "Diffuse + roughness", "Normal", "F0 + metallic", "Emissive + occlusion"
+    };
+    const char* thinNames[MAX_ATTACHMENTS - 1] = { "Base color + metallic", "Normal + roughness", "Emissive + occlusion" };
+    for(uint8_t i = 0; i < attachments; i++)
+    {
+        textures[i] = { handles[i], thin ? thinNames[i] : classicNames[i] };
+    }
+    textures[attachments] = { depthTexture, "Depth" };
+    textures[attachments + 1] = { BGFX_INVALID_HANDLE, nullptr };
+
+    return true;
+}
+
+void GBuffer::blitDepth(bgfx::ViewId view) const
+{
+    bgfx::blit(view, depthTexture, 0, 0, bgfx::getTexture(frameBuffer, attachments));
+}
+
+void GBuffer::bind() const
+{
+    const uint8_t units[Sampler::Count] = { Samplers::DEFERRED_DIFFUSE_A,
+                                            Samplers::DEFERRED_NORMAL,
+                                            Samplers::DEFERRED_F0_METALLIC,
+                                            Samplers::DEFERRED_EMISSIVE_OCCLUSION,
+                                            Samplers::DEFERRED_DEPTH };
+    for(size_t i = 0; i < Sampler::Count; i++)
+    {
+        bgfx::setTexture(units[i], samplers[i], samplerTextures[i]);
+    }
+    setUniform();
+}
+
+void GBuffer::setUniform() const
+{
+    float gBufferVec[4] = { thin ? 1.0f : 0.0f, emissiveOcclusion ? 1.0f : 0.0f };
+    bgfx::setUniform(gBufferVecUniform, gBufferVec);
+}
+
+void GBuffer::destroy()
+{
+    if(bgfx::isValid(accumFrameBuffer))
+        bgfx::destroy(accumFrameBuffer);
+    // destroys the attachments too
+    if(bgfx::isValid(frameBuffer))
+        bgfx::destroy(frameBuffer);
+    if(bgfx::isValid(depthTexture))
+        bgfx::destroy(depthTexture);
+
+    frameBuffer = accumFrameBuffer = BGFX_INVALID_HANDLE;
+    depthTexture = BGFX_INVALID_HANDLE;
+    for(bgfx::TextureHandle& handle : samplerTextures)
+    {
+        handle = BGFX_INVALID_HANDLE;
+    }
+    for(Renderer::TextureBuffer& texture : textures)
+    {
+        texture = { BGFX_INVALID_HANDLE, nullptr };
+    }
+    attachments = 0;
+}
+
+bool GBuffer::usesEmissiveOcclusion(const Scene* scene)
+{
+    if(!scene->loaded)
+        return true;
+
+    // transparent materials are rendered in a forward pass
+    for(const Material& mat : scene->materials)
+    {
+        if(!mat.blend && (bgfx::isValid(mat.emissiveTexture) || mat.emissiveFactor != glm::vec3(0.0f) ||
+                          bgfx::isValid(mat.occlusionTexture)))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Renderer.h"
+
+class Scene;
+
+// G-Buffer shared by the deferred renderers, see gbuffer.sh
+// also owns the depth copy sampled in the light pass and the light accumulation frame buffer
+//
+// classic layout:
+//   diffuse + a (remapped roughness), spheremap normal (RG16F), F0 + metallic, emissive + occlusion
+// thin layout:
+//   base color + metallic, octahedral normal + perceptual roughness (RGB10A2),
+//   emissive + occlusion only if a material in the scene uses them
+//   diffuse color and F0 are derived from base color and metallic when reading
+class GBuffer
+{
+public:
+    GBuffer();
+
+    // classic layout can be rendered to, the thin layout falls back to it if unsupported
+    static bool supported();
+    static bool thinSupported();
+
+    void initialize();
+    void shutdown();
+
+    // (re)create the G-Buffer if the layout changed or it doesn't exist yet
+    // accumulation combines output with the G-Buffer depth, for the light passes
+    // stencil adds a stencil channel to depth if supported
+    // returns true if anything was created
+    bool update(uint16_t width,
+                uint16_t height,
+                const Scene* scene,
+                bool thin,
+                bool stencil,
+                bgfx::TextureHandle output);
+
+    // copy the depth attachment to the depth texture sampled in the light pass
+    // blits happen before any compute or draw calls in view
+    void blitDepth(bgfx::ViewId view) const;
+    // bind the G-Buffer textures for reading, sets the uniform as well
+    // excluding BGFX_DISCARD_TEXTURE_SAMPLERS from the discard flags keeps them bound
+    void bind() const;
+    // layout for the geometry pass
+    void setUniform() const;
+
+    bgfx::FrameBufferHandle getFrameBuffer() const { return frameBuffer; }
+    // depth + output color, for the light passes
+    bgfx::FrameBufferHandle getAccumFrameBuffer() const { return accumFrameBuffer; }
+    // copy of the depth attachment, can be sampled while the attachment is bound
+    bgfx::TextureHandle getDepthTexture() const { return depthTexture; }
+    bool isThin() const { return thin; }
+    bool hasStencil() const { return stencil; }
+
+    // for Renderer::buffers, null-terminated
+    Renderer::TextureBuffer* getTextures() { return textures; }
+
+    static constexpr uint64_t SAMPLER_FLAGS = BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
+                                              BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP |
+                                              BGFX_SAMPLER_V_CLAMP;
+
+    // color attachments of the classic layout, the thin one uses fewer
+    static constexpr uint8_t MAX_ATTACHMENTS = 4;
+
+private:
+    void destroy();
+    // any material with emissive or occlusion, assumes yes while loading
+    static bool usesEmissiveOcclusion(const Scene* scene);
+
+    // sampler slots in gbuffer.sh
+    enum Sampler : size_t
+    {
+        // classic: RGB = diffuse, A = a
+        // thin:    RGB = base color, A = metallic
+        Diffuse_A,
+
+        // classic: RG = spheremap normal
+        // thin:    RG = octahedral normal, B = perceptual roughness
+        Normal,
+
+        // classic: RGB = F0, A = metallic
+        // thin:    unused
+        F0_Metallic,
+
+        // RGB = emissive radiance, A = occlusion multiplier
+        EmissiveOcclusion,
+
+        Depth,
+
+        Count
+    };
+
+    static constexpr bgfx::TextureFormat::Enum classicFormats[MAX_ATTACHMENTS] = {
+        bgfx::TextureFormat::BGRA8,
+        bgfx::TextureFormat::RG16F,
+        bgfx::TextureFormat::BGRA8,
+        bgfx::TextureFormat::BGRA8
+        // depth format is determined dynamically
+    };
+
+    static constexpr bgfx::TextureFormat::Enum thinFormats[MAX_ATTACHMENTS - 1] = {
+        bgfx::TextureFormat::BGRA8,
+        bgfx::TextureFormat::RGB10A2,
+        bgfx::TextureFormat::BGRA8
+    };
+
+    bool thin = false;
+    bool emissiveOcclusion = true;
+    bool stencil = false;
+    uint8_t attachments = 0;
+
+    // texture bound to each sampler, color attachments and the depth copy
+    bgfx::TextureHandle samplerTextures[Sampler::Count];
+    bgfx::UniformHandle samplers[Sampler::Count];
+    bgfx::UniformHandle gBufferVecUniform = BGFX_INVALID_HANDLE;
+
+    Renderer::TextureBuffer textures[Sampler::Count + 1]; // + null-terminated
+
+    bgfx::FrameBufferHandle frameBuffer = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle depthTexture = BGFX_INVALID_HANDLE;
+    bgfx::FrameBufferHandle accumFrameBuffer = BGFX_INVALID_HANDLE;
+};
@@ -0,0 +1,103 @@
+#include "ImageDifference.h"
+
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+bool ImageDifference::supported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    return (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 && (caps->supported & BGFX_CAPS_TEXTURE_READ_BACK) != 0;
+}
+
+void ImageDifference::shutdown()
+{
+    destroyTextures();
+    state = State::Idle;
+}
+
+void ImageDifference::destroyTextures()
+{
+    if(bgfx::isValid(referenceTexture))
+    {
+        bgfx::destroy(referenceTexture);
+        bgfx::destroy(testTexture);
+    }
+    referenceTexture = testTexture = BGFX_INVALID_HANDLE;
+    textureWidth = textureHeight = 0;
+}
+
+void ImageDifference::start()
+{
+    if(state == State::Idle && supported())
+        state = State::Reference;
+}
+
+void ImageDifference::capture(bgfx::ViewId view, bgfx::TextureHandle frame, uint16_t width, uint16_t height)
+{
+    if(state != State::Reference && state != State::Test)
+        return;
+
+    if(state == State::Reference && (width != textureWidth || height != textureHeight))
+    {
+        destroyTextures();
+        textureWidth = width;
+        textureHeight = height;
+        const uint64_t flags = BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK;
+        referenceTexture = bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA16F, flags);
+        testTexture = bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA16F, flags);
+        referenceData.resize((size_t)width * height * 4);
+        testData.resize((size_t)width * height * 4);
+    }
+    // resized in between, start over
+    if(width != textureWidth || height != textureHeight)
+    {
+        state = State::Reference;
+        return;
+    }
+
+    if(state == State::Reference)
+    {
+        bgfx::blit(view, referenceTexture, 0, 0, frame);
+        bgfx::readTexture(referenceTexture, referenceData.data());
+        state = State::Test;
+    }
+    else
+    {
+        bgfx::blit(view, testTexture, 0, 0, frame);
+        // reads finish in order, the test frame arrives last
+        readyFrame = bgfx::readTexture(testTexture, testData.data());
+        state = State::Waiting;
+    }
+}
+
+bool ImageDifference::ready(uint32_t frame)
+{
+    if(state != State::Waiting || frame < readyFrame)
+        return false;
+
+    auto map = [](uint16_t half) {
+        const float value = std::max(glm::unpackHalf1x16(half), 0.0f);
+        // NaN and infinity from the render target count as fully white
+        return std::isfinite(value) ? value / (1.0f + value) : 1.0f;
+    };
+
+    double sum = 0.0;
+    const size_t pixels = (size_t)textureWidth * textureHeight;
+    for(size_t i = 0; i < pixels; i++)
+    {
+        for(size_t channel = 0; channel < 3; channel++)
+        {
+            const double difference = map(referenceData[4 * i + channel]) - map(testData[4 * i + channel]);
+            sum += difference * difference;
+        }
+    }
+
+    const double mse = sum / (double)(pixels * 3);
+    rmse = std::sqrt(mse);
+    psnr = mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+
+    state = State::Idle;
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+#include <cstdint>
+#include <vector>
+
+// compares two rendered frames on the CPU: a reference frame and a test frame rendered right after it
+// used to measure the error of approximate lighting (lightcuts) against exact shading
+// frames are blitted into CPU readable textures and arrive a few frames later, like CounterReadback
+class ImageDifference
+{
+public:
+    static bool supported();
+
+    void shutdown();
+
+    // the next captured frame becomes the reference, the one after that is compared against it
+    // ignored while a measurement is running
+    void start();
+    // the current frame is captured as the reference (render it exactly)
+    bool wantsReference() const { return state == State::Reference; }
+    // the reference or test frame is being rendered, the scene has to stay the same for both
+    bool capturing() const { return state == State::Reference || state == State::Test; }
+
+    // copy the frame if a measurement needs it
+    // the blit happens at the start of view, which has to come after everything rendering to frame
+    // frame has to be RGBA16F
+    void capture(bgfx::ViewId view, bgfx::TextureHandle frame, uint16_t width, uint16_t height);
+    // returns true once, when both frames arrived and the difference was calculated
+    // frame is the current frame number, see Renderer::frameNumber
+    bool ready(uint32_t frame);
+
+    // root mean square error and peak signal-to-noise ratio in dB of the last measurement
+    // colors are mapped to [0, 1) with x / (1 + x) first so HDR values don't dominate
+    double getRMSE() const { return rmse; }
+    double getPSNR() const { return psnr; }
+
+private:
+    enum class State
+    {
+        Idle,
+        Reference,
+        Test,
+        Waiting
+    };
+
+    void destroyTextures();
+
+    State state = State::Idle;
+    uint32_t readyFrame = 0;
+
+    uint16_t textureWidth = 0;
+    uint16_t textureHeight = 0;
+
+    // half floats, 4 per pixel
+    std::vector<uint16_t> referenceData;
+    std::vector<uint16_t> testData;
+
+    bgfx::TextureHandle referenceTexture = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle testTexture = BGFX_INVALID_HANDLE;
+
+    double rmse = 0.0;
+    double psnr = 0.0;
+};
@@ -0,0 +1,218 @@
+#include "LightBVHShader.h"
+
+#include "Scene/Scene.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/LightShader.h"
+#include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
+#include <glm/common.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <cassert>
+
+bgfx::VertexLayout LightBVHShader::NodeVertex::layout;
+
+// spread the lower 10 bits of v so there are 2 zero bits between each bit
+static uint32_t expandBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code for a point in the unit cube
+static uint32_t morton3D(glm::vec3 p)
+{
+    glm::vec3 q = glm::clamp(p * 1024.0f, 0.0f, 1023.0f);
+    return (expandBits((uint32_t)q.x) << 2) | (expandBits((uint32_t)q.y) << 1) | expandBits((uint32_t)q.z);
+}
+
+void LightBVHShader::initialize()
+{
+    NodeVertex::init();
+
+    lightBVHVecUniform = bgfx::createUniform("u_lightBVHVec", bgfx::UniformType::Vec4);
+    lightcutsVecUniform = bgfx::createUniform("u_lightcutsVec", bgfx::UniformType::Vec4);
+
+    // valid (empty) buffers so we can always bind them
+    nodesBuffer = bgfx::createDynamicVertexBuffer(1, NodeVertex::layout, BGFX_BUFFER_COMPUTE_READ_WRITE);
+    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(1, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+
+    char csName[128];
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_lightbvh_leaves.bin");
+    leavesComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_lightbvh_nodes.bin");
+    nodesComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_lightbvh_virtual.bin");
+    virtualLightsComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+}
+
+void LightBVHShader::shutdown()
+{
+    bgfx::destroy(lightBVHVecUniform);
+    bgfx::destroy(lightcutsVecUniform);
+    bgfx::destroy(nodesBuffer);
+    bgfx::destroy(lightIndicesBuffer);
+    bgfx::destroy(leavesComputeProgram);
+    bgfx::destroy(nodesComputeProgram);
+    bgfx::destroy(virtualLightsComputeProgram);
+
+    lightBVHVecUniform = lightcutsVecUniform = BGFX_INVALID_HANDLE;
+    nodesBuffer = BGFX_INVALID_HANDLE;
+    lightIndicesBuffer = BGFX_INVALID_HANDLE;
+    leavesComputeProgram = nodesComputeProgram = virtualLightsComputeProgram = BGFX_INVALID_HANDLE;
+
+    currentLightCount = leafCount = depth = 0;
+    virtualLights = false;
+}
+
+uint32_t LightBVHShader::getLeafCount(uint32_t lightCount)
+{
+    // complete binary tree, round the leaf count up to a power of two
+    const uint32_t usedLeaves = (lightCount + LEAF_SIZE - 1) / LEAF_SIZE;
+    uint32_t leaves = usedLeaves > 0 ? 1 : 0;
+    while(leaves < usedLeaves)
+        leaves *= 2;
+    return leaves;
+}
+
+uint32_t LightBVHShader::getNodeCount(uint32_t lightCount)
+{
+    const uint32_t leaves = getLeafCount(lightCount);
+    return leaves > 0 ? 2 * leaves - 1 : 0;
+}
+
+void LightBVHShader::update(bgfx::ViewId view, const LightShader& lights, const Scene* scene, bool writeVirtualLights)
+{
+    assert(scene != nullptr);
+
+    // the lights move a little every frame, but sorting is expensive
+    // the order stays good enough (moving lights rotate around the scene center)
+    // and refitting keeps the bounds correct no matter how the lights move
+    const PointLightList& pointLights = lights.getPointLights(scene);
+    if(pointLights.size() != currentLightCount)
+        sortLights(pointLights);
+
+    // the light buffer needs room for them, see PointLightList::setVirtualCapacity
+    virtualLights = writeVirtualLights && pointLights.getVirtualCapacity() >= getNodeCount(currentLightCount);
+
+    if(leafCount == 0)
+        return;
+
+    // with virtual lights the node spheres grow to contain them, see bvh.sh
+    // uniforms persist, so this also covers the inner node dispatches
+    float lightcutsVec[4] = { 0.0f, virtualLights ? 1.0f : 0.0f };
+    bgfx::setUniform(lightcutsVecUniform, lightcutsVec);
+
+    // leaves
+
+    lights.bindLights(scene);
+    setUniform(0, 0);
+    bgfx::setBuffer(Samplers::LIGHTS_BVHNODES, nodesBuffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::LIGHTS_BVHLIGHTINDICES, lightIndicesBuffer, bgfx::Access::Read);
+    bgfx::dispatch(view, leavesComputeProgram, (uint32_t)std::ceil((float)leafCount / BUILD_THREADS), 1, 1);
+
+    // inner nodes, bottom-up one level at a time
+    // a level with n nodes starts at node n - 1
+
+    for(uint32_t levelCount = leafCount / 2; levelCount > 0; levelCount /= 2)
+    {
+        setUniform(levelCount - 1, levelCount);
+        bgfx::setBuffer(Samplers::LIGHTS_BVHNODES, nodesBuffer, bgfx::Access::ReadWrite);
+        bgfx::dispatch(view, nodesComputeProgram, (uint32_t)std::ceil((float)levelCount / BUILD_THREADS), 1, 1);
+    }
+
+    // virtual lights for lightcuts
+    // needs u_invView to get back to world space
+
+    if(virtualLights)
+    {
+        const uint32_t nodeCount = getNodeCount(currentLightCount);
+        lights.bindLights(scene);
+        bgfx::setBuffer(Samplers::LIGHTS_POINTLIGHTS, pointLights.buffer, bgfx::Access::ReadWrite);
+        setUniform(0, 0);
+        bgfx::setBuffer(Samplers::LIGHTS_BVHNODES, nodesBuffer, bgfx::Access::Read);
+        bgfx::dispatch(view, virtualLightsComputeProgram, (uint32_t)std::ceil((float)nodeCount / BUILD_THREADS), 1, 1);
+    }
+}
+
+void LightBVHShader::bindBVH(float lightcutsErrorBound) const
+{
+    float lightcutsVec[4] = { virtualLights ? lightcutsErrorBound : 0.0f };
+    bgfx::setUniform(lightcutsVecUniform, lightcutsVec);
+    setUniform(0, 0);
+    bgfx::setBuffer(Samplers::LIGHTS_BVHNODES, nodesBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::LIGHTS_BVHLIGHTINDICES, lightIndicesBuffer, bgfx::Access::Read);
+}
+
+void LightBVHShader::sortLights(const PointLightList& lights)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    currentLightCount = lights.size();
+
+    const uint32_t newLeafCount = getLeafCount(currentLightCount);
+    depth = 0;
+    while((2u << depth) <= newLeafCount)
+        depth++;
+
+    // sort along a Morton curve inside the light bounds
+
+    glm::vec3 minBounds(std::numeric_limits<float>::max());
+    glm::vec3 maxBounds(std::numeric_limits<float>::lowest());
+    for(uint32_t i = 0; i < currentLightCount; i++)
+    {
+        minBounds = glm::min(minBounds, lights.getPosition(i));
+        maxBounds = glm::max(maxBounds, lights.getPosition(i));
+    }
+    const glm::vec3 extent = glm::max(maxBounds - minBounds, glm::vec3(1e-6f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> codes(currentLightCount);
+    for(uint32_t i = 0; i < currentLightCount; i++)
+    {
+        codes[i] = { morton3D((lights.getPosition(i) - minBounds) / extent), i };
+    }
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<uint32_t> sortedIndices(currentLightCount);
+    for(uint32_t i = 0; i < currentLightCount; i++)
+    {
+        sortedIndices[i] = codes[i].second;
+    }
+
+    // upload
+
+    bgfx::destroy(lightIndicesBuffer);
+    if(currentLightCount > 0)
+    {
+        const bgfx::Memory* mem = bgfx::copy(sortedIndices.data(), currentLightCount * sizeof(uint32_t));
+        lightIndicesBuffer = bgfx::createDynamicIndexBuffer(mem, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    }
+    else
+    {
+        lightIndicesBuffer = bgfx::createDynamicIndexBuffer(1, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    }
+
+    if(newLeafCount != leafCount)
+    {
+        leafCount = newLeafCount;
+        bgfx::destroy(nodesBuffer);
+        nodesBuffer = bgfx::createDynamicVertexBuffer(
+            std::max(2 * leafCount - 1, 1u), NodeVertex::layout, BGFX_BUFFER_COMPUTE_READ_WRITE);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    sortTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void LightBVHShader::setUniform(uint32_t levelFirst, uint32_t levelCount) const
+{
+    float lightBVHVec[4] = { (float)leafCount, (float)depth, (float)levelFirst, (float)levelCount };
+    bgfx::setUniform(lightBVHVecUniform, lightBVHVec);
+}
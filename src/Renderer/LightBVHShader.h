@@ -0,0 +1,78 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+
+class Scene;
+class PointLightList;
+class LightShader;
+
+// bounding volume hierarchy over the point lights for light culling
+// see bvh.sh for the layout
+class LightBVHShader
+{
+public:
+    void initialize();
+    void shutdown();
+
+    // sort lights along a Morton curve if the light count changed
+    // and refit the node bounds on the GPU
+    // needs u_view, node bounds are in view space
+    // with writeVirtualLights, every node also gets a virtual light (lightcuts, see bvh.sh)
+    // this is skipped if the light buffer has no room for them
+    // node bounds then also contain the virtual light spheres so culling doesn't cut them off
+    void update(bgfx::ViewId view, const LightShader& lights, const Scene* scene, bool writeVirtualLights = false);
+    // bind for traversal in the light culling compute shaders
+    // lightcutsErrorBound > 0 lets the clustered light culling pick virtual lights (ignored without them)
+    // a node is picked when the spread of its lights is below errorBound * distance to the cluster
+    void bindBVH(float lightcutsErrorBound = 0.0f) const;
+
+    // number of leaves and nodes for lightCount lights
+    // the light buffer needs room for getNodeCount virtual lights for lightcuts
+    static uint32_t getLeafCount(uint32_t lightCount);
+    static uint32_t getNodeCount(uint32_t lightCount);
+
+    // CPU time of the last sort in milliseconds
+    double getSortTime() const { return sortTime; }
+
+    // these should be the same as in bvh.sh
+    static constexpr uint32_t LEAF_SIZE = 8;
+    static constexpr uint32_t BUILD_THREADS = 64;
+
+private:
+    struct NodeVertex
+    {
+        // center xyz, radius w
+        float sphere[4];
+        // intensity sum xyz, spread of the light positions w
+        float cut[4];
+
+        static void init()
+        {
+            layout.begin()
+                .add(bgfx::Attrib::TexCoord0, 4, bgfx::AttribType::Float)
+                .add(bgfx::Attrib::TexCoord1, 4, bgfx::AttribType::Float)
+                .end();
+        }
+        static bgfx::VertexLayout layout;
+    };
+
+    void sortLights(const PointLightList& lights);
+    void setUniform(uint32_t levelFirst, uint32_t levelCount) const;
+
+    uint32_t currentLightCount = 0;
+    uint32_t leafCount = 0;
+    uint32_t depth = 0;
+    double sortTime = 0.0;
+    // virtual lights were written by the last update
+    bool virtualLights = false;
+
+    bgfx::UniformHandle lightBVHVecUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle lightcutsVecUniform = BGFX_INVALID_HANDLE;
+
+    bgfx::DynamicVertexBufferHandle nodesBuffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle lightIndicesBuffer = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle leavesComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle nodesComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle virtualLightsComputeProgram = BGFX_INVALID_HANDLE;
+};
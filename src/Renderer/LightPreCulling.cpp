@@ -0,0 +1,101 @@
+#include "LightPreCulling.h"
+
+#include "Scene/LightList.h"
+#include "Util/SIMD.h"
+#include <glm/geometric.hpp>
+#include <chrono>
+
+using namespace simd;
+
+void LightPreCulling::cull(const PointLightList& lights, const glm::mat4& viewProjMat, bool homogeneousDepth)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // a light is outside if its center is further than its radius behind any plane
+    glm::vec4 planes[6];
+    getFrustumPlanes(viewProjMat, homogeneousDepth, planes);
+
+    const uint32_t count = lights.size();
+    const float* lightsX = lights.getPositionsX();
+    const float* lightsY = lights.getPositionsY();
+    const float* lightsZ = lights.getPositionsZ();
+    const float* lightsRadius = lights.getRadii();
+
+    const uint32_t chunkCount = (count + LIGHTS_PER_JOB - 1) / LIGHTS_PER_JOB;
+    if(chunkIndices.size() < chunkCount)
+        chunkIndices.resize(chunkCount);
+
+    pool.parallelFor(count, LIGHTS_PER_JOB, [&](uint32_t begin, uint32_t end) {
+        std::vector<uint32_t>& out = chunkIndices[begin / LIGHTS_PER_JOB];
+        out.clear();
+
+        uint32_t i = begin;
+        for(; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+        {
+            const vfloat x = vload(lightsX + i);
+            const vfloat y = vload(lightsY + i);
+            const vfloat z = vload(lightsZ + i);
+            const vfloat negRadius = vsub(vsplat(0.0f), vload(lightsRadius + i));
+
+            auto insidePlane = [&](const glm::vec4& plane) {
+                const vfloat distance = vadd(vadd(vmul(x, vsplat(plane.x)), vmul(y, vsplat(plane.y))),
+                                             vadd(vmul(z, vsplat(plane.z)), vsplat(plane.w)));
+                return vless(negRadius, distance);
+            };
+            vfloat inside = insidePlane(planes[0]);
+            for(uint32_t p = 1; p < 6; p++)
+            {
+                inside = vand(inside, insidePlane(planes[p]));
+            }
+
+            uint32_t mask = vmask(inside);
+            while(mask != 0)
+            {
+                uint32_t lane = 0;
+                while((mask & (1u << lane)) == 0)
+                    lane++;
+                out.push_back(i + lane);
+                mask &= mask - 1;
+            }
+        }
+
+        for(; i < end; i++)
+        {
+            const glm::vec3 position(lightsX[i], lightsY[i], lightsZ[i]);
+            bool inside = true;
+            for(const glm::vec4& plane : planes)
+            {
+                inside = inside && glm::dot(glm::vec3(plane), position) + plane.w > -lightsRadius[i];
+            }
+            if(inside)
+                out.push_back(i);
+        }
+    });
+
+    // chunks cover increasing index ranges, so this keeps the original order
+
+    visibleIndices.clear();
+    for(uint32_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        visibleIndices.insert(visibleIndices.end(), chunkIndices[chunk].begin(), chunkIndices[chunk].end());
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    cullingTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void LightPreCulling::getFrustumPlanes(const glm::mat4& viewProjMat, bool homogeneousDepth, glm::vec4 planes[6])
+{
+    // Gribb/Hartmann
+    const glm::mat4 m = glm::transpose(viewProjMat);
+    planes[0] = m[3] + m[0]; // left
+    planes[1] = m[3] - m[0]; // right
+    planes[2] = m[3] + m[1]; // bottom
+    planes[3] = m[3] - m[1]; // top
+    planes[4] = homogeneousDepth ? m[3] + m[2] : m[2]; // near, z in [-w, w] or [0, w]
+    planes[5] = m[3] - m[2]; // far
+    for(uint32_t i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
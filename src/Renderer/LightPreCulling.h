@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Util/JobPool.h"
+#include <glm/matrix.hpp>
+#include <cstdint>
+#include <vector>
+
+class PointLightList;
+
+// sphere vs. view frustum test for every point light on the CPU
+// the renderers only upload and cull the lights that passed, see LightShader::update
+class LightPreCulling
+{
+public:
+    // viewProjMat is projection * view, homogeneousDepth is bgfx::Caps::homogeneousDepth
+    void cull(const PointLightList& lights, const glm::mat4& viewProjMat, bool homogeneousDepth);
+
+    // indices of the lights that might be visible, in their original order
+    const std::vector<uint32_t>& getVisibleIndices() const { return visibleIndices; }
+
+    // world space frustum planes, normals point inside
+    // (xyz is the normal, w the distance so that dot(normal, p) + w >= 0 for points inside)
+    static void getFrustumPlanes(const glm::mat4& viewProjMat, bool homogeneousDepth, glm::vec4 planes[6]);
+
+    // CPU time of the last cull call in milliseconds
+    double getCullingTime() const { return cullingTime; }
+
+    // jobs are this many lights
+    static constexpr uint32_t LIGHTS_PER_JOB = 4096;
+
+private:
+    JobPool pool;
+
+    // visible light indices of each job, concatenated into visibleIndices
+    std::vector<std::vector<uint32_t>> chunkIndices;
+    std::vector<uint32_t> visibleIndices;
+
+    double cullingTime = 0.0;
+};
@@ -1,35 +1,134 @@
 #include "LightShader.h"
 
 #include "Scene/Scene.h"
+#include "Renderer/Renderer.h"
 #include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <cassert>
+#include <cmath>
 
 void LightShader::initialize()
 {
+    visibleLights.init();
+
     lightCountVecUniform = bgfx::createUniform("u_lightCountVec", bgfx::UniformType::Vec4);
     ambientLightIrradianceUniform = bgfx::createUniform("u_ambientLightIrradiance", bgfx::UniformType::Vec4);
+
+    if(animationSupported())
+    {
+        animationVecUniform = bgfx::createUniform("u_lightAnimationVec", bgfx::UniformType::Vec4);
+
+        char csName[128];
+        bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_lights_animate.bin");
+        animationComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    }
 }
 
 void LightShader::shutdown()
 {
+    visibleLights.shutdown();
+    visibleLights.clear();
+    preCulling = false;
+
     bgfx::destroy(lightCountVecUniform);
     bgfx::destroy(ambientLightIrradianceUniform);
+    if(bgfx::isValid(animationComputeProgram))
+    {
+        bgfx::destroy(animationVecUniform);
+        bgfx::destroy(animationComputeProgram);
+    }
 
-    lightCountVecUniform = ambientLightIrradianceUniform = BGFX_INVALID_HANDLE;
+    lightCountVecUniform = ambientLightIrradianceUniform = animationVecUniform = BGFX_INVALID_HANDLE;
+    animationComputeProgram = BGFX_INVALID_HANDLE;
 }
 
-void LightShader::bindLights(const Scene* scene) const
+void LightShader::update(const Scene* scene, bool preCull, const glm::mat4& viewProjMat)
+{
+    assert(scene != nullptr);
+
+    const bool wasPreCulling = preCulling;
+    preCulling = preCull;
+    if(!preCulling)
+        return;
+
+    // same camera and lights, the visible lights stay the same
+    // nothing gets uploaded, so renderers can keep their light lists (see Renderer::lightListsOutdated)
+    // the scene lights aren't uploaded while pre-culling, check what changed instead
+    if(wasPreCulling && viewProjMat == preCullViewProjMat && scene->pointLights.getUpdatedCount() == 0 &&
+       scene->pointLights.size() == preCullLightCount)
+    {
+        visibleLights.update();
+        return;
+    }
+    preCullViewProjMat = viewProjMat;
+    preCullLightCount = scene->pointLights.size();
+
+    // the whole list is uploaded again whenever something changed
+    // still a lot less than all lights if most of them are off-screen
+    preCuller.cull(scene->pointLights, viewProjMat, bgfx::getCaps()->homogeneousDepth);
+    visibleLights.assign(scene->pointLights, preCuller.getVisibleIndices());
+    // fewer lights need fewer virtual lights, so this is always enough
+    visibleLights.setVirtualCapacity(scene->pointLights.getVirtualCapacity());
+    visibleLights.update();
+}
+
+const PointLightList& LightShader::getPointLights(const Scene* scene) const
 {
     assert(scene != nullptr);
+    return preCulling ? visibleLights : scene->pointLights;
+}
+
+void LightShader::bindLights(const Scene* scene) const
+{
+    const PointLightList& pointLights = getPointLights(scene);
 
-    // a 32-bit IEEE 754 float can represent all integers up to 2^24 (~16.7 million) correctly
-    // should be enough for this use case (comparison in for loop)
-    float lightCountVec[4] = { (float)scene->pointLights.lights.size() };
+    float lightCountVec[4] = {};
+    packLightCount(pointLights.size(), lightCountVec);
     bgfx::setUniform(lightCountVecUniform, lightCountVec);
 
     glm::vec4 ambientLightIrradiance(scene->ambientLight.irradiance, 1.0f);
     bgfx::setUniform(ambientLightIrradianceUniform, glm::value_ptr(ambientLightIrradiance));
 
-    bgfx::setBuffer(Samplers::LIGHTS_POINTLIGHTS, scene->pointLights.buffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::LIGHTS_POINTLIGHTS, pointLights.buffer, bgfx::Access::Read);
+}
+
+void LightShader::packLightCount(uint32_t count, float* out)
+{
+    // a 32-bit IEEE 754 float can only represent all integers up to 2^24 (~16.7 million) correctly
+    // bgfx has no integer uniforms, so split the count into two halves that are always exact
+    out[0] = (float)(count >> 16);
+    out[1] = (float)(count & 0xFFFF);
+}
+
+uint32_t LightShader::getLightDispatchGroups(uint32_t count, uint32_t threads)
+{
+    return std::min((count + threads - 1) / threads, (uint32_t)MAX_LIGHT_DISPATCH_GROUPS);
+}
+
+bool LightShader::animationSupported()
+{
+    const bgfx::Caps* caps = bgfx::getCaps();
+    return (caps->supported & BGFX_CAPS_COMPUTE) != 0;
+}
+
+void LightShader::animateLights(bgfx::ViewId view, const Scene* scene, float dt) const
+{
+    assert(scene != nullptr);
+    assert(bgfx::isValid(animationComputeProgram));
+
+    const uint32_t lightCount = scene->pointLights.size();
+    if(lightCount == 0)
+        return;
+
+    // always the scene lights, pre-culling turns off GPU animation
+    float lightCountVec[4] = {};
+    packLightCount(lightCount, lightCountVec);
+    bgfx::setUniform(lightCountVecUniform, lightCountVec);
+    float animationVec[4] = { dt };
+    bgfx::setUniform(animationVecUniform, animationVec);
+    bgfx::setBuffer(Samplers::LIGHTS_POINTLIGHTS, scene->pointLights.buffer, bgfx::Access::ReadWrite);
+    bgfx::setBuffer(Samplers::LIGHTS_MOTION, scene->pointLights.motionBuffer, bgfx::Access::Read);
+    bgfx::dispatch(view, animationComputeProgram, getLightDispatchGroups(lightCount, ANIMATION_THREADS), 1, 1);
 }
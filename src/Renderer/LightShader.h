@@ -1,6 +1,9 @@
 #pragma once
 
 #include <bgfx/bgfx.h>
+#include "Renderer/LightPreCulling.h"
+#include "Scene/LightList.h"
+#include <glm/matrix.hpp>
 
 class Scene;
 
@@ -10,9 +13,46 @@ public:
     void initialize();
     void shutdown();
 
+    // with preCull, only the lights inside the view frustum are kept for this frame
+    // they're copied into a compact list that bindLights and getPointLights use instead of the scene lights
+    void update(const Scene* scene, bool preCull, const glm::mat4& viewProjMat);
+
     void bindLights(const Scene* scene) const;
 
+    // the lights the renderers should cull and shade, either the scene lights or the pre-culled list
+    // indices in there are only indices into the scene lights without pre-culling
+    const PointLightList& getPointLights(const Scene* scene) const;
+
+    bool preCulled() const { return preCulling; }
+    double getPreCullingTime() const { return preCulling ? preCuller.getCullingTime() : 0.0; }
+
+    // move the point lights along their motion in place (see PointLightList::animate)
+    static bool animationSupported();
+    void animateLights(bgfx::ViewId view, const Scene* scene, float dt) const;
+
+    // should be the same as in cs_lights_animate.sc
+    static constexpr uint32_t ANIMATION_THREADS = 64;
+
+    // light counts are passed as two floats with 16 bits each, see u_pointLightCount in lights.sh
+    static void packLightCount(uint32_t count, float* out);
+    // work groups for a 1D dispatch over count lights, capped at MAX_LIGHT_DISPATCH_GROUPS
+    // shaders have to loop over the lights, see lights.sh
+    static uint32_t getLightDispatchGroups(uint32_t count, uint32_t threads);
+
+    // should be the same as in lights.sh
+    static constexpr uint32_t MAX_LIGHT_DISPATCH_GROUPS = 65535;
+
 private:
+    LightPreCulling preCuller;
+    PointLightList visibleLights;
+    bool preCulling = false;
+    // view projection and scene light count of the last pre-culling
+    glm::mat4 preCullViewProjMat = glm::mat4(1.0f);
+    uint32_t preCullLightCount = 0;
+
     bgfx::UniformHandle lightCountVecUniform = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle ambientLightIrradianceUniform = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle animationVecUniform = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle animationComputeProgram = BGFX_INVALID_HANDLE;
 };
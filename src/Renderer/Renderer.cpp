@@ -1,6 +1,7 @@
 #include "Renderer.h"
 
 #include "Scene/Scene.h"
+#include "Config.h"
 #include <bigg.hpp>
 #include <bx/macros.h>
 #include <bx/string.h>
@@ -36,14 +37,29 @@ void Renderer::initialize()
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_tonemap.bin");
     blitProgram = bigg::loadProgram(vsName, fsName);
 
+    bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_depth.bin");
+    bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_depth.bin");
+    depthProgram = bigg::loadProgram(vsName, fsName);
+
     pbr.initialize();
     pbr.generateAlbedoLUT();
     lights.initialize();
 
+    // move the light animation view to the front so all passes see the new positions
+    // the subclasses number their views from 0
+    bgfx::ViewId viewOrder[MAX_VIEW + 1];
+    viewOrder[0] = LIGHT_ANIMATION_VIEW;
+    for(bgfx::ViewId i = 0; i < LIGHT_ANIMATION_VIEW; i++)
+    {
+        viewOrder[i + 1] = i;
+    }
+    viewOrder[MAX_VIEW] = MAX_VIEW;
+    bgfx::setViewOrder(0, MAX_VIEW + 1, viewOrder);
+
     onInitialize();
 
     // finish any queued precomputations before rendering the scene
-    bgfx::frame();
+    frameNumber = bgfx::frame();
 }
 
 void Renderer::reset(uint16_t width, uint16_t height)
@@ -89,11 +105,45 @@ void Renderer::render(float dt)
     else
         clearColor = 0x303030FF; // gray
 
+    // pre-culling happens before any renderer uses the lights
+    const bool preCull = preCullsLights();
+    if(preCull)
+        updateViewProjection();
+    lights.update(scene, preCull, projMat * viewMat);
+
+    if(animatesLights())
+    {
+        bgfx::setViewName(LIGHT_ANIMATION_VIEW, "Light animation pass (compute)");
+        lights.animateLights(LIGHT_ANIMATION_VIEW, scene, dt);
+    }
+
     onRender(dt);
+
+    // the blit to the screen reads frameBuffer, so it's complete by then
+    imageDifference.capture(MAX_VIEW, bgfx::getTexture(frameBuffer), width, height);
+    if(imageDifference.ready(frameNumber))
+    {
+        counters["Lightcuts RMSE"] = imageDifference.getRMSE();
+        counters["Lightcuts PSNR (dB)"] = imageDifference.getPSNR();
+    }
+
     blitToScreen(MAX_VIEW);
 
+    if(lights.preCulled())
+    {
+        counters["Visible lights"] = (double)lights.getPointLights(scene).size();
+        counters["Light pre-culling (ms)"] = lights.getPreCullingTime();
+    }
+    else
+    {
+        counters.erase("Visible lights");
+        counters.erase("Light pre-culling (ms)");
+    }
+
     // bigg doesn't do this
     bgfx::setViewName(MAX_VIEW + 1, "imgui");
+
+    frameNumber++;
 }
 
 void Renderer::shutdown()
@@ -102,8 +152,10 @@ void Renderer::shutdown()
 
     pbr.shutdown();
     lights.shutdown();
+    imageDifference.shutdown();
 
     bgfx::destroy(blitProgram);
+    bgfx::destroy(depthProgram);
     bgfx::destroy(blitSampler);
     bgfx::destroy(camPosUniform);
     bgfx::destroy(normalMatrixUniform);
@@ -112,13 +164,24 @@ void Renderer::shutdown()
     bgfx::destroy(blitTriangleBuffer);
     if(bgfx::isValid(frameBuffer))
         bgfx::destroy(frameBuffer);
-
-    blitProgram = BGFX_INVALID_HANDLE;
+    if(bgfx::isValid(depthPrepassFrameBuffer))
+        bgfx::destroy(depthPrepassFrameBuffer);
+    if(bgfx::isValid(depthOnlyFrameBuffer))
+        bgfx::destroy(depthOnlyFrameBuffer);
+    if(bgfx::isValid(depthPrepassTexture))
+        bgfx::destroy(depthPrepassTexture);
+    if(bgfx::isValid(transparentDepthFrameBuffer))
+        bgfx::destroy(transparentDepthFrameBuffer);
+
+    blitProgram = depthProgram = BGFX_INVALID_HANDLE;
     blitSampler = camPosUniform = normalMatrixUniform = exposureVecUniform = tonemappingModeVecUniform =
         BGFX_INVALID_HANDLE;
     blitTriangleBuffer = BGFX_INVALID_HANDLE;
-    frameBuffer = BGFX_INVALID_HANDLE;
+    frameBuffer = depthPrepassFrameBuffer = depthOnlyFrameBuffer = transparentDepthFrameBuffer = BGFX_INVALID_HANDLE;
+    depthPrepassTexture = transparentDepthTexture = BGFX_INVALID_HANDLE;
 
+    // default order
+    bgfx::setViewOrder();
     for(bgfx::ViewId i = 0; i < MAX_VIEW; i++)
     {
         bgfx::resetView(i);
@@ -157,7 +220,103 @@ bool Renderer::supported()
         (caps->formats[bgfx::TextureFormat::RGBA16F] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) != 0;
 }
 
+bool Renderer::animatesLights() const
+{
+    return config->movingLights && scene->loaded && LightShader::animationSupported() &&
+           !config->cpuLightCulling && !config->zBinning && !config->worldLightGrid && !config->lightPreCulling;
+}
+
+bool Renderer::preCullsLights() const
+{
+    return config->lightPreCulling && scene->loaded;
+}
+
+void Renderer::measureLightcutsError()
+{
+    imageDifference.start();
+}
+
+float Renderer::getLightcutsErrorBound() const
+{
+    if(!config->lightcuts || imageDifference.wantsReference())
+        return 0.0f;
+    return config->lightcutsErrorBound;
+}
+
+bool Renderer::lightListsOutdated(bool invalidate)
+{
+    updateViewProjection();
+
+    const PointLightList& pointLights = lights.getPointLights(scene);
+
+    LightListFingerprint fingerprint;
+    fingerprint.viewMat = viewMat;
+    fingerprint.projMat = projMat;
+    fingerprint.width = width;
+    fingerprint.height = height;
+    fingerprint.lightCount = pointLights.size();
+    fingerprint.lightcutsErrorBound = getLightcutsErrorBound();
+    fingerprint.gpuLightAnimation = animatesLights();
+    fingerprint.maxLightsPerTileOrCluster = config->maxLightsPerTileOrCluster;
+    fingerprint.tilePixelSizeX = config->tilePixelSizeX;
+    fingerprint.tilePixelSizeY = config->tilePixelSizeY;
+    fingerprint.treatClusterXYasPixelSize = config->treatClusterXYasPixelSize;
+    fingerprint.clustersX = config->clustersX;
+    fingerprint.clustersY = config->clustersY;
+    fingerprint.clustersZ = config->clustersZ;
+    fingerprint.adaptiveLightLists = config->adaptiveLightLists;
+    fingerprint.cullActiveClustersOnly = config->cullActiveClustersOnly;
+    fingerprint.clusterLightCullingMode = (int)config->clusterLightCullingMode;
+    fingerprint.clusterGridLayout = (int)config->clusterGridLayout;
+    fingerprint.tileDepthBounds = (int)config->tileDepthBounds;
+    fingerprint.zBinning = config->zBinning;
+    fingerprint.worldLightGrid = config->worldLightGrid;
+    fingerprint.worldGridCellSize = config->worldGridCellSize;
+    fingerprint.lightBVH = config->lightBVH;
+    fingerprint.lightcuts = config->lightcuts;
+    fingerprint.radiusClasses = config->radiusClasses;
+    fingerprint.largeLightRadius = config->largeLightRadius;
+    fingerprint.cpuLightCulling = config->cpuLightCulling;
+    fingerprint.lightPreCulling = config->lightPreCulling;
+
+    // lights changed on the CPU get uploaded, lights animated on the GPU change every frame
+    const bool lightsChanged = pointLights.getUploadedCount() > 0 || animatesLights();
+
+    if(lightListsValid && !invalidate && !lightsChanged && fingerprint == lightListFingerprint)
+    {
+        reusedLightListFrames++;
+        return false;
+    }
+
+    lightListsValid = true;
+    lightListFingerprint = fingerprint;
+    return true;
+}
+
+bool Renderer::LightListFingerprint::operator==(const LightListFingerprint& other) const
+{
+    return viewMat == other.viewMat && projMat == other.projMat && width == other.width && height == other.height &&
+           lightCount == other.lightCount && lightcutsErrorBound == other.lightcutsErrorBound &&
+           gpuLightAnimation == other.gpuLightAnimation &&
+           maxLightsPerTileOrCluster == other.maxLightsPerTileOrCluster && tilePixelSizeX == other.tilePixelSizeX &&
+           tilePixelSizeY == other.tilePixelSizeY && treatClusterXYasPixelSize == other.treatClusterXYasPixelSize &&
+           clustersX == other.clustersX && clustersY == other.clustersY && clustersZ == other.clustersZ &&
+           adaptiveLightLists == other.adaptiveLightLists && cullActiveClustersOnly == other.cullActiveClustersOnly &&
+           clusterLightCullingMode == other.clusterLightCullingMode && clusterGridLayout == other.clusterGridLayout &&
+           tileDepthBounds == other.tileDepthBounds && zBinning == other.zBinning && worldLightGrid == other.worldLightGrid &&
+           worldGridCellSize == other.worldGridCellSize && lightBVH == other.lightBVH &&
+           lightcuts == other.lightcuts && radiusClasses == other.radiusClasses &&
+           largeLightRadius == other.largeLightRadius && cpuLightCulling == other.cpuLightCulling &&
+           lightPreCulling == other.lightPreCulling;
+}
+
 void Renderer::setViewProjection(bgfx::ViewId view)
+{
+    updateViewProjection();
+    bgfx::setViewTransform(view, glm::value_ptr(viewMat), glm::value_ptr(projMat));
+}
+
+void Renderer::updateViewProjection()
 {
     // view matrix
     viewMat = scene->camera.matrix();
@@ -169,7 +328,6 @@ void Renderer::setViewProjection(bgfx::ViewId view)
                 scene->camera.zFar,
                 bgfx::getCaps()->homogeneousDepth,
                 bx::Handness::Left);
-    bgfx::setViewTransform(view, glm::value_ptr(viewMat), glm::value_ptr(projMat));
 }
 
 void Renderer::setNormalMatrix(const glm::mat4& modelMat)
@@ -207,6 +365,18 @@ void Renderer::blitToScreen(bgfx::ViewId view)
 }
 
 bgfx::TextureFormat::Enum Renderer::findDepthFormat(uint64_t textureFlags, bool stencil)
+{
+    bgfx::TextureFormat::Enum depthFormat = findSupportedDepthFormat(textureFlags, stencil);
+    assert(depthFormat != bgfx::TextureFormat::Enum::Count);
+    return depthFormat;
+}
+
+bool Renderer::depthStencilSupported(uint64_t textureFlags)
+{
+    return findSupportedDepthFormat(textureFlags, true) != bgfx::TextureFormat::Count;
+}
+
+bgfx::TextureFormat::Enum Renderer::findSupportedDepthFormat(uint64_t textureFlags, bool stencil)
 {
     const bgfx::TextureFormat::Enum depthFormats[] = { bgfx::TextureFormat::D16, bgfx::TextureFormat::D32 };
 
@@ -225,8 +395,6 @@ bgfx::TextureFormat::Enum Renderer::findDepthFormat(uint64_t textureFlags, bool
         }
     }
 
-    assert(depthFormat != bgfx::TextureFormat::Enum::Count);
-
     return depthFormat;
 }
 
@@ -260,6 +428,76 @@ bgfx::FrameBufferHandle Renderer::createFrameBuffer(bool hdr, bool depth)
     return fb;
 }
 
+void Renderer::createDepthPrepass()
+{
+    if(bgfx::isValid(depthPrepassFrameBuffer))
+        return;
+
+    const uint64_t flags = BGFX_TEXTURE_RT | BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
+                           BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+    bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
+    depthPrepassTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+
+    depthOnlyFrameBuffer = bgfx::createFrameBuffer(1, &depthPrepassTexture); // don't destroy texture
+    bgfx::setName(depthOnlyFrameBuffer, "Depth prepass framebuffer");
+
+    const bgfx::TextureHandle textures[2] = { bgfx::getTexture(frameBuffer, 0), depthPrepassTexture };
+    depthPrepassFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(textures), textures); // don't destroy textures
+}
+
+void Renderer::renderDepthPrepass(bgfx::ViewId view)
+{
+    renderDepth(view, depthOnlyFrameBuffer, false);
+}
+
+void Renderer::createTransparentDepth()
+{
+    if(bgfx::isValid(transparentDepthFrameBuffer))
+        return;
+
+    const uint64_t flags = BGFX_TEXTURE_RT | BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
+                           BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+    bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
+    transparentDepthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
+
+    transparentDepthFrameBuffer = bgfx::createFrameBuffer(1, &transparentDepthTexture, true);
+    bgfx::setName(transparentDepthFrameBuffer, "Transparent depth framebuffer");
+}
+
+void Renderer::renderTransparentDepth(bgfx::ViewId view)
+{
+    renderDepth(view, transparentDepthFrameBuffer, true);
+}
+
+void Renderer::renderDepth(bgfx::ViewId view, bgfx::FrameBufferHandle depthFrameBuffer, bool transparent)
+{
+    bgfx::setViewClear(view, BGFX_CLEAR_DEPTH, 0, 1.0f);
+    bgfx::setViewRect(view, 0, 0, width, height);
+    bgfx::setViewFrameBuffer(view, depthFrameBuffer);
+    bgfx::touch(view);
+
+    if(!scene->loaded)
+        return;
+
+    setViewProjection(view);
+
+    const uint64_t state = BGFX_STATE_WRITE_Z | BGFX_STATE_DEPTH_TEST_LESS;
+
+    for(const Mesh& mesh : scene->meshes)
+    {
+        // transparent meshes don't write depth in the prepass
+        if(scene->materials[mesh.material].blend != transparent)
+            continue;
+
+        glm::mat4 model = glm::identity<glm::mat4>();
+        bgfx::setTransform(glm::value_ptr(model));
+        bgfx::setVertexBuffer(0, mesh.vertexBuffer);
+        bgfx::setIndexBuffer(mesh.indexBuffer);
+        bgfx::setState(state);
+        bgfx::submit(view, depthProgram);
+    }
+}
+
 const char* Renderer::shaderDir()
 {
     const char* path = "???";
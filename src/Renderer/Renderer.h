@@ -3,8 +3,10 @@
 #include <bgfx/bgfx.h>
 #include "Renderer/PBRShader.h"
 #include "Renderer/LightShader.h"
+#include "Renderer/ImageDifference.h"
 #include <glm/matrix.hpp>
 #include <unordered_map>
+#include <map>
 #include <string>
 
 class Scene;
@@ -44,6 +46,23 @@ public:
     static bool supported();
     static const char* shaderDir();
 
+    static bgfx::TextureFormat::Enum findDepthFormat(uint64_t textureFlags, bool stencil = false);
+    // true if findDepthFormat finds a depth format with stencil
+    static bool depthStencilSupported(uint64_t textureFlags);
+
+    // moving lights are animated in a compute shader instead of on the CPU
+    // CPU light culling, z-binning, the world-space light grid and light pre-culling need the light positions on the CPU
+    bool animatesLights() const;
+    // shaders read a list of the lights in the view frustum instead of the scene lights (see LightShader::update)
+    bool preCullsLights() const;
+
+    // render the next frame without lightcuts and compare the one after it against it
+    // the error shows up in counters a few frames later
+    void measureLightcutsError();
+    // the two measured frames have to show the same scene
+    // the camera and the lights shouldn't move while this is true
+    bool freezesMotion() const { return imageDifference.capturing(); }
+
     // subclasses should override these
 
     // the first reset happens before initialize
@@ -64,6 +83,9 @@ public:
 
     TextureBuffer* buffers = nullptr;
 
+    // renderer specific counters (display in the UI)
+    std::map<std::string, double> counters;
+
     // final output
     // used for tonemapping
     bgfx::FrameBufferHandle frameBuffer = BGFX_INVALID_HANDLE;
@@ -84,15 +106,43 @@ protected:
     };
 
     static constexpr bgfx::ViewId MAX_VIEW = 199; // imgui in bigg uses view 200
+    // runs before every other view (see setViewOrder in initialize)
+    static constexpr bgfx::ViewId LIGHT_ANIMATION_VIEW = MAX_VIEW - 1;
 
     void setViewProjection(bgfx::ViewId view);
+    // only calculate viewMat and projMat
+    void updateViewProjection();
     void setNormalMatrix(const glm::mat4& modelMat);
 
     void blitToScreen(bgfx::ViewId view = MAX_VIEW);
 
-    static bgfx::TextureFormat::Enum findDepthFormat(uint64_t textureFlags, bool stencil = false);
+    // lightcuts error bound for this frame, 0 if lightcuts are off
+    // (also for the exact reference frame of measureLightcutsError)
+    float getLightcutsErrorBound() const;
+
+    // tile/cluster light lists only depend on the camera, the lights and the light culling options
+    // returns true if they need to be rebuilt because any of these changed since the last call
+    // otherwise renderers skip building and culling and keep using the light lists in their buffers
+    // invalidate forces a rebuild (e.g. light list buffers were recreated)
+    bool lightListsOutdated(bool invalidate = false);
+    // number of frames that reused the light lists from a previous frame
+    uint64_t getReusedLightListFrames() const { return reusedLightListFrames; }
+
     bgfx::FrameBufferHandle createFrameBuffer(bool hdr = true, bool depth = true);
 
+    // depth prepass for forward renderers
+    // depthPrepassTexture can be sampled (e.g. in compute shaders) after the prepass
+    // depthPrepassFrameBuffer shares its color attachment with frameBuffer and uses the prepass depth,
+    // render to it with BGFX_STATE_DEPTH_TEST_LEQUAL without clearing depth
+    void createDepthPrepass();
+    void renderDepthPrepass(bgfx::ViewId view);
+
+    // depth of the closest transparent surface, cleared to 1
+    // transparent meshes aren't in the depth prepass or G-Buffer, active cluster detection and tile depth bounds
+    // use this to cover everything between it and the opaque depth
+    void createTransparentDepth();
+    void renderTransparentDepth(bgfx::ViewId view);
+
     std::unordered_map<std::string, std::string> variables;
 
     TonemappingMode tonemappingMode = TonemappingMode::NONE;
@@ -108,17 +158,79 @@ protected:
 
     PBRShader pbr;
     LightShader lights;
+    ImageDifference imageDifference;
 
     uint32_t clearColor = 0;
     float time = 0.0f;
 
-    // set by setViewProjection()
+    // bgfx frame number of the frame being rendered, for comparing against bgfx::readTexture
+    // bigg calls bgfx::frame after every render, this lags behind if anyone else calls it
+    uint32_t frameNumber = 0;
+
+    // set by setViewProjection() and updateViewProjection()
     glm::mat4 viewMat = glm::mat4(1.0);
     glm::mat4 projMat = glm::mat4(1.0);
 
     bgfx::VertexBufferHandle blitTriangleBuffer = BGFX_INVALID_HANDLE;
 
+    bgfx::TextureHandle depthPrepassTexture = BGFX_INVALID_HANDLE;
+    bgfx::FrameBufferHandle depthPrepassFrameBuffer = BGFX_INVALID_HANDLE;
+
+    bgfx::TextureHandle transparentDepthTexture = BGFX_INVALID_HANDLE;
+
 private:
+    // depth of opaque or transparent meshes only
+    void renderDepth(bgfx::ViewId view, bgfx::FrameBufferHandle depthFrameBuffer, bool transparent);
+
+    // bgfx::TextureFormat::Count if there is none
+    static bgfx::TextureFormat::Enum findSupportedDepthFormat(uint64_t textureFlags, bool stencil);
+
+    // everything the light lists depend on, except for the light data itself
+    struct LightListFingerprint
+    {
+        glm::mat4 viewMat;
+        glm::mat4 projMat;
+        uint16_t width;
+        uint16_t height;
+        uint32_t lightCount;
+        float lightcutsErrorBound;
+        // switching GPU animation off rebuilds the lists from the synced CPU copy
+        bool gpuLightAnimation;
+
+        // Config
+        int maxLightsPerTileOrCluster;
+        int tilePixelSizeX;
+        int tilePixelSizeY;
+        bool treatClusterXYasPixelSize;
+        int clustersX;
+        int clustersY;
+        int clustersZ;
+        bool adaptiveLightLists;
+        bool cullActiveClustersOnly;
+        int clusterLightCullingMode;
+        int clusterGridLayout;
+        int tileDepthBounds;
+        bool zBinning;
+        bool worldLightGrid;
+        float worldGridCellSize;
+        bool lightBVH;
+        bool lightcuts;
+        bool radiusClasses;
+        float largeLightRadius;
+        bool cpuLightCulling;
+        bool lightPreCulling;
+
+        bool operator==(const LightListFingerprint& other) const;
+    };
+
+    bool lightListsValid = false;
+    LightListFingerprint lightListFingerprint{};
+    uint64_t reusedLightListFrames = 0;
+
+    bgfx::ProgramHandle depthProgram = BGFX_INVALID_HANDLE;
+    bgfx::FrameBufferHandle depthOnlyFrameBuffer = BGFX_INVALID_HANDLE;
+    bgfx::FrameBufferHandle transparentDepthFrameBuffer = BGFX_INVALID_HANDLE;
+
     bgfx::ProgramHandle blitProgram = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle blitSampler = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle camPosUniform = BGFX_INVALID_HANDLE;
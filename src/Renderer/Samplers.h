@@ -17,6 +17,21 @@ public:
 
     static const uint8_t LIGHTS_POINTLIGHTS = 6;
 
+    // compute only, these share slots with the material textures
+    static const uint8_t LIGHTS_BVHNODES = 1;
+    static const uint8_t LIGHTS_BVHLIGHTINDICES = 2;
+    // counter readback (see CounterReadback)
+    static const uint8_t READBACK_COUNTERS = 1;
+    static const uint8_t READBACK_IMAGE = 2;
+    // light animation (see LightShader::animateLights)
+    static const uint8_t LIGHTS_MOTION = 1;
+    // deferred light volume instances (see DeferredRenderer)
+    static const uint8_t DEFERRED_LIGHTINSTANCES = 1;
+    static const uint8_t DEFERRED_LIGHTINSTANCECOUNT = 2;
+    static const uint8_t DEFERRED_DRAWINDIRECT = 3;
+    // depth of the closest transparent surface (see Renderer::renderTransparentDepth)
+    static const uint8_t TRANSPARENT_DEPTH = 1;
+
     static const uint8_t DEFERRED_DIFFUSE_A = 7;
     static const uint8_t DEFERRED_NORMAL = 8;
     static const uint8_t DEFERRED_F0_METALLIC = 9;
@@ -26,8 +41,34 @@ public:
     static const uint8_t TILES_TILES = 12;
     static const uint8_t TILES_LIGHTINDICES = 13;
     static const uint8_t TILES_LIGHTGRID = 14;
+    static const uint8_t TILES_DEPTHBOUNDS = 15;
 
     static const uint8_t CLUSTERS_CLUSTERS = 12;
     static const uint8_t CLUSTERS_LIGHTINDICES = 13;
     static const uint8_t CLUSTERS_LIGHTGRID = 14;
+    static const uint8_t CLUSTERS_COUNTERS = 15;
+
+    // compute only, these share slots with the G-Buffer
+    static const uint8_t CLUSTERS_FLAGS = 7;
+    static const uint8_t CLUSTERS_ACTIVECLUSTERS = 8;
+    static const uint8_t CLUSTERS_DISPATCHINDIRECT = 9;
+    static const uint8_t CLUSTERS_LIGHTCOUNTS = 10;
+    static const uint8_t TILES_COUNTERS = 7;
+
+    // visibility buffer (see ClusteredVisibilityRenderer), these share slots with the G-Buffer
+    static const uint8_t VISIBILITY_IDS = 7;
+    static const uint8_t VISIBILITY_VERTICES = 8;
+    static const uint8_t VISIBILITY_INDICES = 9;
+    static const uint8_t VISIBILITY_DRAWS = 10;
+
+    // z-binning replaces the cluster light grid, these share its slots
+    static const uint8_t ZBIN_TILEMASKS = 12;
+    static const uint8_t ZBIN_LIGHTINDICES = 13;
+    static const uint8_t ZBIN_BINS = 14;
+
+    // the world-space light grid replaces the cluster light grid as well
+    static const uint8_t WORLDGRID_LIGHTINDICES = 13;
+    static const uint8_t WORLDGRID_BUCKETS = 14;
+    static const uint8_t WORLDGRID_MOVING_LIGHTINDICES = 12;
+    static const uint8_t WORLDGRID_MOVING_BUCKETS = 15;
 };
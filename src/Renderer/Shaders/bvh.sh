@@ -0,0 +1,134 @@
+#ifndef BVH_SH_HEADER_GUARD
+#define BVH_SH_HEADER_GUARD
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+#include "lights.sh"
+
+// bounding volume hierarchy over the point lights
+// implicit complete binary tree (heap layout):
+// - node 0 is the root, children of node i are 2i+1 and 2i+2
+// - the last u_bvhLeafCount nodes are the leaves, each leaf holds up to BVH_LEAF_SIZE lights
+// - leaves reference lights through an index list sorted along a Morton curve
+//   so lights in the same subtree are close to each other
+// node bounds are spheres in view space, refit every frame
+// lightcuts: every node is also a virtual light that stands in for all lights below it,
+// stored after the real lights in the light buffer (index pointLightCount() + node)
+// the virtual light's radius comes from the summed intensity and can be larger than the node bounds,
+// so with virtual lights the node spheres also contain the virtual light spheres of their subtree
+
+#define BVH_LEAF_SIZE 8
+#define BVH_BUILD_THREADS 64
+#define BVH_END 0xFFFFFFFFu
+
+uniform vec4 u_lightBVHVec;
+
+#define u_bvhLeafCount  ((uint)u_lightBVHVec.x)
+#define u_bvhDepth      ((uint)u_lightBVHVec.y)
+// only used while building
+#define u_bvhLevelFirst ((uint)u_lightBVHVec.z)
+#define u_bvhLevelCount ((uint)u_lightBVHVec.w)
+
+uniform vec4 u_lightcutsVec;
+
+// 0 disables lightcuts
+#define u_lightcutsErrorBound u_lightcutsVec.x
+// only used while building, node spheres contain the virtual lights
+#define u_bvhVirtualLights (u_lightcutsVec.y != 0.0)
+
+#ifdef WRITE_BVH
+    #define BVH_BUFFER BUFFER_RW
+#else
+    #define BVH_BUFFER BUFFER_RO
+#endif
+
+// for each node:
+//   vec4 center (xyz) and radius (w) of the light spheres, empty nodes have a negative radius
+//   vec4 sum of the light intensities (xyz) and radius of the light positions around the center (w)
+BVH_BUFFER(b_bvhNodes, vec4, SAMPLER_LIGHTS_BVHNODES);
+// light indices in Morton order
+BUFFER_RO(b_bvhLightIndices, uint, SAMPLER_LIGHTS_BVHLIGHTINDICES);
+
+// node bounds as a light so we can use the same intersection tests
+// radius is negative for empty nodes
+PointLight getBVHNodeBounds(uint node)
+{
+    vec4 sphere = b_bvhNodes[2 * node + 0];
+    PointLight bounds;
+    bounds.position = sphere.xyz;
+    bounds._padding = 0.0;
+    bounds.intensity = vec3_splat(0.0);
+    bounds.radius = sphere.w;
+    return bounds;
+}
+
+vec3 getBVHNodeIntensity(uint node)
+{
+    return b_bvhNodes[2 * node + 1].xyz;
+}
+
+// how far the lights are spread out around the node center
+// this is the error of replacing them with one light at the center
+float getBVHNodeSpread(uint node)
+{
+    return b_bvhNodes[2 * node + 1].w;
+}
+
+// radius of the virtual light for a node with this intensity sum
+// goes through the same packing as cs_lightbvh_virtual.sc so it matches getPointLight
+float bvhVirtualLightRadius(vec3 intensity)
+{
+    return pointLightRadius(unpackRGB9E5(packRGB9E5(intensity)));
+}
+
+uint getBVHLightIndex(uint sortedIndex)
+{
+    return b_bvhLightIndices[sortedIndex];
+}
+
+uint bvhNodeCount()
+{
+    return u_bvhLeafCount > 0 ? 2 * u_bvhLeafCount - 1 : 0;
+}
+
+// index of the virtual light of a node in the light buffer
+uint bvhVirtualLightIndex(uint node)
+{
+    return pointLightCount() + node;
+}
+
+// first node of the traversal, BVH_END if there are no lights
+uint bvhRoot()
+{
+    return u_bvhLeafCount > 0 ? 0 : BVH_END;
+}
+
+bool bvhIsLeaf(uint node)
+{
+    return node >= u_bvhLeafCount - 1;
+}
+
+uint bvhLeftChild(uint node)
+{
+    return 2 * node + 1;
+}
+
+// range of sorted light indices in a leaf node
+void bvhLeafLights(uint node, out uint first, out uint end)
+{
+    uint leaf = node - (u_bvhLeafCount - 1);
+    first = leaf * BVH_LEAF_SIZE;
+    end = min(first + BVH_LEAF_SIZE, pointLightCount());
+}
+
+// stackless depth-first traversal of the subtree at root
+// returns the next node after skipping the subtree of node, BVH_END when done
+// left children have odd indices, we go up until we find one and continue with its right sibling
+uint bvhSkip(uint node, uint root)
+{
+    while(node != root && (node & 1) == 0)
+        node = (node - 1) / 2;
+    return node == root ? BVH_END : node + 1;
+}
+
+#endif // BVH_SH_HEADER_GUARD
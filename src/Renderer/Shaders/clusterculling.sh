@@ -0,0 +1,111 @@
+#ifndef CLUSTERCULLING_SH_HEADER_GUARD
+#define CLUSTERCULLING_SH_HEADER_GUARD
+
+// light-cluster intersection, shared by the cluster-centric (gather)
+// and light-centric (scatter) light culling shaders
+// expects WRITE_CLUSTERS to be defined
+
+#include <bgfx_compute.sh>
+#include "lights.sh"
+#include "clusters.sh"
+
+// workgroup size of the light-centric culling shaders (one thread per light)
+#define SCATTER_LIGHTS_THREADS 64
+
+float getSignedDistanceFromPlane(vec3 p, vec4 eqn)
+{
+    return dot(eqn.xyz, p);
+}
+
+bool pointLightIntersectsCluster(PointLight light, Cluster cluster, float halfZ)
+{
+    vec3 center = light.position;
+    float r = light.radius;
+    float near = cluster.depthNearFar.x;
+    float far = cluster.depthNearFar.y;
+    if(
+        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[0]) < r) &&
+        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[1]) < r) &&
+        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[2]) < r) &&
+        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[3]) < r)
+    )
+    {
+        if(-center.z + near < r && center.z - halfZ < r)
+            return true;
+        if(-center.z + halfZ < r && center.z - far < r)
+            return true;
+    }
+
+    return false;
+}
+
+/*bool pointLightIntersectsCluster(PointLight light, Cluster cluster)
+{
+    // NOTE: expects light.position to be in view space like the cluster bounds
+    // global light list has world space coordinates, but we transform the
+    // coordinates in the shared array of lights after copying
+
+    // get closest point to sphere center
+    vec3 closest = max(cluster.minBounds, min(light.position, cluster.maxBounds));
+    // check if point is inside the sphere
+    vec3 dist = closest - light.position;
+    return dot(dist, dist) <= (light.radius * light.radius);
+}*/
+
+// range of clusters (inclusive) that the light's bounding sphere can overlap
+// expects light.position to be in view space
+// returns false if the light is completely outside the view frustum
+bool getLightClusterRange(PointLight light, out uvec3 minCluster, out uvec3 maxCluster)
+{
+    minCluster = uvec3(0, 0, 0);
+    maxCluster = uvec3(0, 0, 0);
+
+    vec3 center = light.position;
+    float r = light.radius;
+
+    // clip the depth range to the near and far plane
+    // this also makes sure all corners below are in front of the camera
+    float zMin = max(center.z - r, u_zNear);
+    float zMax = min(center.z + r, u_zFar);
+    if(zMin > zMax)
+        return false;
+
+    // project the corners of the (clipped) view space bounding box
+    // the projected box contains the projected sphere
+    vec2 ndcMin = vec2_splat( 1e30);
+    vec2 ndcMax = vec2_splat(-1e30);
+    for(uint i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? center.x + r : center.x - r,
+                           (i & 2) != 0 ? center.y + r : center.y - r,
+                           (i & 4) != 0 ? zMax : zMin);
+        vec4 clip = mul(u_proj, vec4(corner, 1.0));
+        vec2 ndc = clip.xy / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    if(any(greaterThan(ndcMin, vec2_splat(1.0))) || any(lessThan(ndcMax, vec2_splat(-1.0))))
+        return false;
+
+    ndcMin = clamp(ndcMin, -1.0, 1.0);
+    ndcMax = clamp(ndcMax, -1.0, 1.0);
+
+    // -> screen coordinates, same convention as gl_FragCoord (see screen2Eye)
+#if BGFX_SHADER_LANGUAGE_GLSL
+    vec2 screenMin = (ndcMin * 0.5 + 0.5) * u_viewRect.zw;
+    vec2 screenMax = (ndcMax * 0.5 + 0.5) * u_viewRect.zw;
+#else
+    // y is flipped
+    vec2 screenMin = vec2(ndcMin.x * 0.5 + 0.5, 0.5 - ndcMax.y * 0.5) * u_viewRect.zw;
+    vec2 screenMax = vec2(ndcMax.x * 0.5 + 0.5, 0.5 - ndcMin.y * 0.5) * u_viewRect.zw;
+#endif
+
+    uvec3 lastCluster = u_clusterCount - uvec3(1, 1, 1);
+    minCluster = min(uvec3(uvec2(screenMin / u_clusterSize.xy), getClusterZIndexEye(zMin)), lastCluster);
+    maxCluster = min(uvec3(uvec2(screenMax / u_clusterSize.xy), getClusterZIndexEye(zMax)), lastCluster);
+
+    return true;
+}
+
+#endif // CLUSTERCULLING_SH_HEADER_GUARD
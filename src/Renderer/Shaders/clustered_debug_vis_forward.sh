@@ -0,0 +1,43 @@
+#include <bgfx_shader.sh>
+#include "clusters.sh"
+#ifdef ZBINNING
+#include "zbin.sh"
+#endif
+#ifdef WORLDGRID
+#include "worldgrid.sh"
+#endif
+#include "colormap.sh"
+
+void main()
+{
+    // show light count per cluster
+
+#if defined(ZBINNING)
+    uint tile = getZBinTileIndex(gl_FragCoord);
+    ZBin zbin = getZBin(getZBinIndex(screen2EyeDepth(gl_FragCoord.z, u_zNear, u_zFar)));
+    uint lightCount = 0;
+    for(uint word = zbin.first / 32; word <= zbin.last / 32; word++)
+    {
+        lightCount += countBits(getZBinTileWord(tile, word, zbin));
+    }
+    // no upper limit, clamp to the same color scale
+    lightCount = min(lightCount, u_maxLightsPerCluster);
+#elif defined(WORLDGRID)
+    // lights in the fragment's buckets, no upper limit either
+    uint lightCount = min(getWorldGridLightCount(v_worldpos), u_maxLightsPerCluster);
+#else
+    // lights from all grids (radius classes), can go past the limit
+    uint lightCount = 0;
+    for(uint grid = 0; grid < getClusterGridCount(); grid++)
+    {
+        lightCount += getLightGridCount(getGridClusterIndex(gl_FragCoord, grid));
+    }
+    lightCount = min(lightCount, u_maxLightsPerCluster);
+#endif
+
+    if(lightCount == u_maxLightsPerCluster)
+        ++lightCount;
+
+    vec3 lightCountColor = turboColormap(float(lightCount) / u_maxLightsPerCluster);
+    gl_FragColor = vec4(lightCountColor, 1.0);
+}
@@ -0,0 +1,112 @@
+#define READ_MATERIAL
+
+#include <bgfx_shader.sh>
+#include <bgfx_compute.sh>
+#include "util.sh"
+#include "pbr.sh"
+#include "lights.sh"
+#include "clusters.sh"
+#ifdef ZBINNING
+#include "zbin.sh"
+#endif
+#ifdef WORLDGRID
+#include "worldgrid.sh"
+#endif
+#include "colormap.sh"
+
+uniform vec4 u_camPos;
+
+vec3 pointLightRadiance(uint lightIndex, vec3 fragPos, vec3 V, vec3 N, float NoV, PBRMaterial mat, vec3 msFactor)
+{
+    PointLight light = getPointLight(lightIndex);
+    float dist = distance(light.position, fragPos);
+    float attenuation = smoothAttenuation(dist, light.radius);
+    if(attenuation > 0.0)
+    {
+        vec3 L = normalize(light.position - fragPos);
+        vec3 radianceIn = light.intensity * attenuation;
+        float NoL = saturate(dot(N, L));
+        return BRDF(V, L, N, NoV, NoL, mat) * msFactor * radianceIn * NoL;
+    }
+    return vec3_splat(0.0);
+}
+
+void main()
+{
+    // the clustered shading fragment shader is almost identical to forward shading
+    // first we determine the cluster id from the fragment's window coordinates
+    // light count is read from the grid instead of a uniform
+    // light indices are read and looped over starting from the grid offset
+
+    PBRMaterial mat = pbrMaterial(v_texcoord0);
+    vec3 N = convertTangentNormal(v_normal, v_tangent, mat.normal);
+    mat.a = specularAntiAliasing(N, mat.a);
+
+    vec3 camPos = u_camPos.xyz;
+    vec3 fragPos = v_worldpos;
+
+    vec3 V = normalize(camPos - fragPos);
+    float NoV = abs(dot(N, V)) + 1e-5;
+
+    if(whiteFurnaceEnabled())
+    {
+        mat.F0 = vec3_splat(1.0);
+        vec3 msFactor = multipleScatteringFactor(mat, NoV);
+        vec3 radianceOut = whiteFurnace(NoV, mat) * msFactor;
+        gl_FragColor = vec4(radianceOut, 1.0);
+        return;
+    }
+
+    vec3 msFactor = multipleScatteringFactor(mat, NoV);
+
+    vec3 radianceOut = vec3_splat(0.0);
+
+#if defined(ZBINNING)
+    // z-binning: walk the words of the tile bitmask inside the depth bin's light range
+    uint tile = getZBinTileIndex(gl_FragCoord);
+    ZBin zbin = getZBin(getZBinIndex(screen2EyeDepth(gl_FragCoord.z, u_zNear, u_zFar)));
+    // empty bins have first > last, the loop doesn't run
+    for(uint word = zbin.first / 32; word <= zbin.last / 32; word++)
+    {
+        uint mask = getZBinTileWord(tile, word, zbin);
+        while(mask != 0)
+        {
+            uint bit = lowestBit(mask);
+            mask &= mask - 1;
+            uint lightIndex = getZBinLightIndex(word * 32 + bit);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+#elif defined(WORLDGRID)
+    // world-space grid: the bucket of the cell containing the fragment
+    // static and moving lights have separate grids
+    for(uint layer = 0; layer < getWorldGridLayerCount(); layer++)
+    {
+        WorldGridBucket bucket = getWorldGridBucket(fragPos, layer);
+        for(uint i = 0; i < bucket.pointLights; i++)
+        {
+            uint lightIndex = getWorldGridLightIndex(bucket, i);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+#else
+    // with radius classes, large lights are in a second, coarser grid
+    for(uint grid = 0; grid < getClusterGridCount(); grid++)
+    {
+        uint cluster = getGridClusterIndex(gl_FragCoord, grid);
+        uint clusterOffset = getGridLightClusterOffset(cluster);
+        uint lightCount = getLightGridCount(cluster);
+        for(uint i = 0; i < lightCount; i++)
+        {
+            uint lightIndex = getGridLightIndex(clusterOffset, i);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+#endif
+
+    radianceOut += getAmbientLight().irradiance * mat.diffuseColor * mat.occlusion;
+    radianceOut += mat.emissive;
+
+    gl_FragColor.rgb = radianceOut;
+    gl_FragColor.a = mat.albedo.a;
+}
@@ -14,32 +14,79 @@
 #define CLUSTERS_X_THREADS 16
 #define CLUSTERS_Y_THREADS 8
 #define CLUSTERS_Z_THREADS 4
+#define CLUSTERS_GROUP_SIZE (CLUSTERS_X_THREADS * CLUSTERS_Y_THREADS * CLUSTERS_Z_THREADS)
 
 uniform vec4 u_clusterCountVec; // clusters count
 uniform vec4 u_clusterSizeVec; // cluster size in screen coordinates (pixels)
 uniform vec4 u_zNearFarVec;
+uniform vec4 u_clusterClassVec; // radius classes
 
 #define u_maxLightsPerCluster ((uint)u_clusterSizeVec.z)
+#define u_maxLightIndices     ((uint)u_clusterSizeVec.w)
 #define u_clusterCount        ((uvec3)u_clusterCountVec.xyz)
+#define u_clusterLayout       ((uint)u_clusterCountVec.w)
 #define u_clusterSize         ((uvec2)u_clusterSizeVec.xy)
 #define u_zNear               u_zNearFarVec.x
 #define u_zFar                u_zNearFarVec.y
 
+// radius classes, see ClusterShader::updateBuffers
+// large lights are culled against a coarse grid so they don't end up in lots of small clusters
+// the coarse grid comes after the (fine) main grid in the same buffers
+// building and culling run once per grid, with the uniforms above describing that grid
+// the lighting pass gets the main grid's uniforms and derives the coarse grid from the factor
+#define u_clusterGridOffset   ((uint)u_clusterClassVec.x)
+#define u_coarseClusterFactor ((uint)u_clusterClassVec.y) // 0 without radius classes
+#define u_clusterMinRadius    u_clusterClassVec.z         // exclusive
+#define u_clusterMaxRadius    u_clusterClassVec.w         // inclusive
+
+// memory layout of the cluster grid, see ClusterShader::GridLayout
+// linear: x, then y, then z
+// swizzled: each depth slice is split into 4x4 blocks stored one after another,
+// clusters inside a block are in Morton order so neighbouring fragments hit nearby grid entries
+// the grid is padded to whole blocks, so there are more entries than clusters
+#define CLUSTER_LAYOUT_LINEAR 0
+#define CLUSTER_LAYOUT_SWIZZLED 1
+#define CLUSTER_BLOCK_SIZE 4
+
 #ifdef WRITE_CLUSTERS
     #define CLUSTER_BUFFER BUFFER_RW
 #else
     #define CLUSTER_BUFFER BUFFER_RO
 #endif
 
+// z-binning (see zbin.sh) only uses the cluster grid dimensions, not the light grid
+// the world-space grid (see worldgrid.sh) doesn't use either
+#if !defined(ZBINNING) && !defined(WORLDGRID)
 // light indices belonging to clusters
+// compacted global list, each cluster owns a contiguous range
 CLUSTER_BUFFER(b_clusterLightIndices, uint, SAMPLER_CLUSTERS_LIGHTINDICES);
-// for each cluster: number of point lights
+// for each cluster: offset into the light index list and number of point lights
+// 2 uints each, see LightGrid
 CLUSTER_BUFFER(b_clusterLightGrid, uint, SAMPLER_CLUSTERS_LIGHTGRID);
+#endif
 
 // these are only needed for building clusters and light culling, not in the fragment shader
 #ifdef WRITE_CLUSTERS
 // list of clusters (5 vec4's each, frustrum planes and depthNearFar)
 CLUSTER_BUFFER(b_clusters, vec4, SAMPLER_CLUSTERS_CLUSTERS);
+// atomic counters, reset to 0 every frame
+// index 0: number of allocated light indices
+// index 1: number of active clusters
+// index 2: number of clusters with a full light list or that ran out of light indices
+// index 3: most lights found in a single cluster
+// 0, 2 and 3 are read back by ClusterShader to adapt the light index list size
+CLUSTER_BUFFER(b_clusterCounters, uint, SAMPLER_CLUSTERS_COUNTERS);
+#define CLUSTER_COUNTER_LIGHT_INDICES 0
+#define CLUSTER_COUNTER_ACTIVE_CLUSTERS 1
+#define CLUSTER_COUNTER_OVERFLOWED_CLUSTERS 2
+#define CLUSTER_COUNTER_MAX_LIGHTS 3
+// for each cluster: 1 if it contains visible geometry
+CLUSTER_BUFFER(b_clusterFlags, uint, SAMPLER_CLUSTERS_FLAGS);
+// compacted list of flagged cluster indices
+CLUSTER_BUFFER(b_activeClusters, uint, SAMPLER_CLUSTERS_ACTIVECLUSTERS);
+// for each cluster: number of intersecting lights, only used by light-centric (scatter) culling
+// counted up by the first pass and back down to 0 while writing the indices
+CLUSTER_BUFFER(b_clusterLightCounts, uint, SAMPLER_CLUSTERS_LIGHTCOUNTS);
 #endif
 
 struct Cluster
@@ -54,20 +101,67 @@ struct LightGrid
     uint pointLights;
 };
 
+uvec2 getClusterBlockCount()
+{
+    return (u_clusterCount.xy + uvec2(CLUSTER_BLOCK_SIZE - 1, CLUSTER_BLOCK_SIZE - 1)) / CLUSTER_BLOCK_SIZE;
+}
+
+// number of entries in the cluster grid buffers
+uint getClusterStorageCount()
+{
+    if(u_clusterLayout == CLUSTER_LAYOUT_SWIZZLED)
+    {
+        uvec2 blocks = getClusterBlockCount();
+        return blocks.x * blocks.y * CLUSTER_BLOCK_SIZE * CLUSTER_BLOCK_SIZE * u_clusterCount.z;
+    }
+    return u_clusterCount.x * u_clusterCount.y * u_clusterCount.z;
+}
+
+// grid index from 3D cluster coordinates, expects them to be in range
+uint getClusterGridIndex(uvec3 indices)
+{
+    if(u_clusterLayout == CLUSTER_LAYOUT_SWIZZLED)
+    {
+        uvec2 blocks = getClusterBlockCount();
+        uvec2 block = indices.xy / CLUSTER_BLOCK_SIZE;
+        uvec2 local = indices.xy % CLUSTER_BLOCK_SIZE;
+        uint blockIndex = (indices.z * blocks.y + block.y) * blocks.x + block.x;
+        // interleave the 2 bits of x and y
+        uint morton = (local.x & 1) | ((local.y & 1) << 1) | ((local.x & 2) << 1) | ((local.y & 2) << 2);
+        return blockIndex * (CLUSTER_BLOCK_SIZE * CLUSTER_BLOCK_SIZE) + morton;
+    }
+    return u_clusterCount.x * u_clusterCount.y * indices.z +
+           u_clusterCount.x * indices.y +
+           indices.x;
+}
+
 #ifdef WRITE_CLUSTERS
 bool isClusterValid(uint clusterIndex)
 {
-    return clusterIndex < u_clusterCount.x * u_clusterCount.y * u_clusterCount.z;
+    return clusterIndex >= u_clusterGridOffset && clusterIndex < u_clusterGridOffset + getClusterStorageCount();
+}
+
+// true if the light belongs to the radius class of the grid that's being culled
+bool lightInClusterGrid(float radius)
+{
+    return radius > u_clusterMinRadius && radius <= u_clusterMaxRadius;
+}
+
+// cluster index for a thread of a 1D dispatch over the active cluster list
+// returns an invalid index for threads past the end of the list
+uint getActiveClusterIndex(uint activeIndex)
+{
+    uint clusterIndex = getClusterStorageCount();
+    if(activeIndex < b_clusterCounters[CLUSTER_COUNTER_ACTIVE_CLUSTERS])
+        clusterIndex = b_activeClusters[activeIndex];
+    return clusterIndex;
 }
 
 uint getComputeIndex(uvec3 clusterIndex3D)
 {
-    uint clusterIndex = clusterIndex3D.z * u_clusterCount.x * u_clusterCount.y +
-                        clusterIndex3D.y * u_clusterCount.x +
-                        clusterIndex3D.x;
     if(clusterIndex3D.x >= u_clusterCount.x || clusterIndex3D.y >= u_clusterCount.y || clusterIndex3D.z >= u_clusterCount.z)
-        return u_clusterCount.x * u_clusterCount.y * u_clusterCount.z;
-    return clusterIndex;
+        return u_clusterGridOffset + getClusterStorageCount();
+    return u_clusterGridOffset + getClusterGridIndex(clusterIndex3D);
 }
 
 Cluster getCluster(uint index)
@@ -93,43 +187,113 @@ Cluster getCluster(uint index)
 }
 #endif
 
+#if !defined(ZBINNING) && !defined(WORLDGRID)
+LightGrid getLightGrid(uint cluster)
+{
+    LightGrid grid;
+    grid.offset = b_clusterLightGrid[2 * cluster + 0];
+    grid.pointLights = b_clusterLightGrid[2 * cluster + 1];
+    return grid;
+}
+
+#ifdef WRITE_CLUSTERS
+void setLightGrid(uint cluster, LightGrid grid)
+{
+    b_clusterLightGrid[2 * cluster + 0] = grid.offset;
+    b_clusterLightGrid[2 * cluster + 1] = grid.pointLights;
+}
+
+// reserve a contiguous range of count light indices in the global list
+// returns the number of indices that actually fit
+uint allocateLightIndices(uint count, out uint offset)
+{
+    atomicFetchAndAdd(b_clusterCounters[CLUSTER_COUNTER_LIGHT_INDICES], count, offset);
+    uint fit = offset >= u_maxLightIndices ? 0 : min(count, u_maxLightIndices - offset);
+    // the list ran out, this cluster drops lights
+    // full light lists are already counted by recordClusterLightCount
+    if(fit < count && count < u_maxLightsPerCluster)
+        atomicAdd(b_clusterCounters[CLUSTER_COUNTER_OVERFLOWED_CLUSTERS], 1);
+    return fit;
+}
+
+// count is the number of intersecting lights found before culling stopped
+// a full list counts as overflowed, we can't tell if any lights were dropped
+void recordClusterLightCount(uint count)
+{
+    if(count >= u_maxLightsPerCluster)
+        atomicAdd(b_clusterCounters[CLUSTER_COUNTER_OVERFLOWED_CLUSTERS], 1);
+    atomicMax(b_clusterCounters[CLUSTER_COUNTER_MAX_LIGHTS], count);
+}
+#endif
+
 uint getLightGridCount(uint cluster)
 {
-    return b_clusterLightGrid[cluster];
+    return b_clusterLightGrid[2 * cluster + 1];
 }
 
 uint getGridLightClusterOffset(uint cluster)
 {
-    return cluster * u_maxLightsPerCluster;
+    return b_clusterLightGrid[2 * cluster + 0];
 }
 
 uint getGridLightIndex(uint clusterOffset, uint offset)
 {
     return b_clusterLightIndices[clusterOffset + offset];
 }
+#endif
 
-// cluster depth index from depth in screen coordinates (gl_FragCoord.z)
-uint getClusterZIndex(float screenDepth)
+// cluster depth index from depth in eye space, for a grid with the given number of depth slices
+uint getClusterZIndexEyeSlices(float eyeDepth, uint slices)
 {
     // this can be calculated on the CPU and passed as a uniform
     // only leaving it here to keep most of the relevant code in the shaders for learning purposes
-    float scale = float(u_clusterCount.z) / log(u_zFar / u_zNear);
-    float bias = -(float(u_clusterCount.z) * log(u_zNear) / log(u_zFar / u_zNear));
+    float scale = float(slices) / log(u_zFar / u_zNear);
+    float bias = -(float(slices) * log(u_zNear) / log(u_zFar / u_zNear));
 
-    float eyeDepth = screen2EyeDepth(screenDepth, u_zNear, u_zFar);
     uint zIndex = uint(max(log(eyeDepth) * scale + bias, 0.0));
     return zIndex;
 }
 
+// cluster depth index from depth in eye space
+uint getClusterZIndexEye(float eyeDepth)
+{
+    return getClusterZIndexEyeSlices(eyeDepth, u_clusterCount.z);
+}
+
+// cluster depth index from depth in screen coordinates (gl_FragCoord.z)
+uint getClusterZIndex(float screenDepth)
+{
+    float eyeDepth = screen2EyeDepth(screenDepth, u_zNear, u_zFar);
+    return getClusterZIndexEye(eyeDepth);
+}
+
 // cluster index from fragment position in window coordinates (gl_FragCoord)
 uint getClusterIndex(vec4 fragCoord)
 {
     uint zIndex = getClusterZIndex(fragCoord.z);
     uvec3 indices = uvec3(uvec2(fragCoord.xy / u_clusterSize.xy), zIndex);
-    uint cluster = u_clusterCount.x * u_clusterCount.y * indices.z +
-                   u_clusterCount.x * indices.y +
-                   indices.x;
-    return cluster;
+    return getClusterGridIndex(indices);
+}
+
+// number of grids the lighting pass has to walk, 2 with radius classes
+uint getClusterGridCount()
+{
+    return u_coarseClusterFactor != 0 ? 2 : 1;
+}
+
+// cluster index in the main (0) or coarse (1) grid from fragment position in window coordinates
+// the coarse grid is always linear, see ClusterShader::setUniforms
+uint getGridClusterIndex(vec4 fragCoord, uint grid)
+{
+    if(grid == 0)
+        return getClusterIndex(fragCoord);
+
+    uint factor = u_coarseClusterFactor;
+    uvec3 count = (u_clusterCount + uvec3(factor - 1, factor - 1, factor - 1)) / factor;
+    float eyeDepth = screen2EyeDepth(fragCoord.z, u_zNear, u_zFar);
+    uvec3 indices = uvec3(uvec2(fragCoord.xy / (u_clusterSize.xy * factor)),
+                          getClusterZIndexEyeSlices(eyeDepth, count.z));
+    return getClusterStorageCount() + count.x * count.y * indices.z + count.x * indices.y + indices.x;
 }
 
 #endif // CLUSTERS_SH_HEADER_GUARD
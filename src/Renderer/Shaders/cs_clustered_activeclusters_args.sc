@@ -0,0 +1,17 @@
+#define WRITE_CLUSTERS
+
+#include <bgfx_compute.sh>
+#include "clusters.sh"
+
+// compute shader to write the indirect dispatch arguments for light culling
+// one workgroup per CLUSTERS_GROUP_SIZE active clusters
+
+BUFFER_WR(b_dispatchIndirect, uvec4, SAMPLER_CLUSTERS_DISPATCHINDIRECT);
+
+NUM_THREADS(1, 1, 1)
+void main()
+{
+    uint activeClusters = b_clusterCounters[CLUSTER_COUNTER_ACTIVE_CLUSTERS];
+    uint groups = (activeClusters + CLUSTERS_GROUP_SIZE - 1) / CLUSTERS_GROUP_SIZE;
+    dispatchIndirect(b_dispatchIndirect, 0, groups, 1, 1);
+}
@@ -0,0 +1,33 @@
+#define WRITE_CLUSTERS
+
+#include <bgfx_compute.sh>
+#include "clusters.sh"
+
+// compute shader to compact the flagged clusters into a list of active clusters
+// also resets the flags for the next frame and empties the light grid of inactive clusters
+
+// each thread handles one cluster
+NUM_THREADS(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
+void main()
+{
+    uint clusterIndex = getComputeIndex(gl_GlobalInvocationID);
+    if(!isClusterValid(clusterIndex))
+        return;
+
+    if(b_clusterFlags[clusterIndex] != 0)
+    {
+        uint activeIndex;
+        atomicFetchAndAdd(b_clusterCounters[CLUSTER_COUNTER_ACTIVE_CLUSTERS], 1, activeIndex);
+        b_activeClusters[activeIndex] = clusterIndex;
+        b_clusterFlags[clusterIndex] = 0;
+    }
+    else
+    {
+        // light culling skips this cluster
+        // the fragment shader might still read it for transparent surfaces
+        LightGrid grid;
+        grid.offset = 0;
+        grid.pointLights = 0;
+        setLightGrid(clusterIndex, grid);
+    }
+}
@@ -0,0 +1,66 @@
+#define WRITE_CLUSTERS
+
+#include <bgfx_compute.sh>
+#include "clusters.sh"
+
+// compute shader to flag clusters that contain visible geometry
+// reads the depth of opaque geometry (depth prepass or G-Buffer depth)
+// with TRANSPARENT_DEPTH, it also reads the depth of the closest transparent surface
+// and flags every cluster between it and the opaque surface, further transparent surfaces can be anywhere in there
+
+SAMPLER2D(s_texDepth, SAMPLER_DEFERRED_DEPTH);
+#ifdef TRANSPARENT_DEPTH
+SAMPLER2D(s_texTransparentDepth, SAMPLER_TRANSPARENT_DEPTH);
+#endif
+
+#define FLAG_THREADS 16
+
+void flagCluster(uint clusterIndex)
+{
+    if(!isClusterValid(clusterIndex))
+        return;
+
+    // most pixels of a workgroup end up in the same few clusters
+    // check before writing to avoid hammering the same address
+    if(b_clusterFlags[clusterIndex] == 0)
+        b_clusterFlags[clusterIndex] = 1;
+}
+
+// each thread handles one pixel
+NUM_THREADS(FLAG_THREADS, FLAG_THREADS, 1)
+void main()
+{
+    uvec2 pixel = gl_GlobalInvocationID.xy;
+    if(pixel.x >= uint(u_viewRect.z) || pixel.y >= uint(u_viewRect.w))
+        return;
+
+    vec2 fragCoord = vec2(pixel) + vec2_splat(0.5);
+    float depth = texelFetch(s_texDepth, ivec2(pixel), 0).x;
+
+#ifdef TRANSPARENT_DEPTH
+    float transparentDepth = texelFetch(s_texTransparentDepth, ivec2(pixel), 0).x;
+    // transparent surfaces behind the opaque one are hidden
+    if(transparentDepth < depth)
+    {
+        // without opaque geometry, transparent surfaces can go all the way to the far plane
+        uint lastZ = u_clusterCount.z - 1;
+        uint firstZ = min(getClusterZIndex(transparentDepth), lastZ);
+        if(depth < 1.0)
+            lastZ = min(getClusterZIndex(depth), lastZ);
+
+        uvec2 xy = uvec2(fragCoord / u_clusterSize.xy);
+        for(uint z = firstZ; z <= lastZ; z++)
+        {
+            flagCluster(getClusterGridIndex(uvec3(xy, z)));
+        }
+        return;
+    }
+#endif
+
+    // background, no geometry
+    if(depth >= 1.0)
+        return;
+
+    // same calculation as in the fragment shader
+    flagCluster(getClusterIndex(vec4(fragCoord, depth, 1.0)));
+}
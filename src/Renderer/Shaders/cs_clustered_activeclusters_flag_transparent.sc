@@ -0,0 +1,6 @@
+// active cluster detection that also flags clusters covered by transparent meshes
+// see cs_clustered_activeclusters_flag.sc
+
+#define TRANSPARENT_DEPTH
+
+#include "cs_clustered_activeclusters_flag.sc"
@@ -1,55 +1,92 @@
 #define WRITE_CLUSTERS
 
 #include <bgfx_compute.sh>
-#include "lights.sh"
-#include "clusters.sh"
+#include "clusterculling.sh"
+#ifdef LIGHT_BVH
+#include "bvh.sh"
+#endif
 
 // compute shader to cull lights against cluster bounds
 // builds a light grid that holds indices of lights for each cluster
 // largely inspired by http://www.aortiz.me/2018/12/21/CG.html
 
-float getSignedDistanceFromPlane(vec3 p, vec4 eqn)
-{
-    return dot(eqn.xyz, p);
-}
+//#define gl_WorkGroupSize uvec3(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
+#define GROUP_SIZE (CLUSTERS_X_THREADS * CLUSTERS_Y_THREADS * CLUSTERS_Z_THREADS)
 
-bool pointLightIntersectsCluster(PointLight light, Cluster cluster, float halfZ)
+#ifdef LIGHT_BVH
+
+// lower bound for the distance between a view space point and the cluster
+// the cluster is convex, so the distance to any of its planes works
+float distanceToCluster(vec3 position, Cluster cluster)
 {
-    vec3 center = light.position;
-    float r = light.radius;
-    float near = cluster.depthNearFar.x;
-    float far = cluster.depthNearFar.y;
-    if(
-        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[0]) < r) &&
-        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[1]) < r) &&
-        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[2]) < r) &&
-        (getSignedDistanceFromPlane(center, cluster.frustrumPlanes[3]) < r)
-    )
+    float d = max(-position.z + cluster.depthNearFar.x, position.z - cluster.depthNearFar.y);
+    for(uint i = 0; i < 4; i++)
     {
-        if(-center.z + near < r && center.z - halfZ < r)
-            return true;
-        if(-center.z + halfZ < r && center.z - far < r)
-            return true;
+        d = max(d, getSignedDistanceFromPlane(position, cluster.frustrumPlanes[i]));
     }
+    return max(d, 0.0);
+}
 
-    return false;
+// lightcuts: use the virtual light of a node instead of its lights if they're close together
+// compared to the distance to the cluster
+bool lightcutsAcceptsNode(uint node, vec3 center, Cluster cluster)
+{
+    return getBVHNodeSpread(node) < u_lightcutsErrorBound * distanceToCluster(center, cluster);
 }
 
-/*bool pointLightIntersectsCluster(PointLight light, Cluster cluster)
+// tests the lights against the cluster by traversing the light BVH
+// only counts intersecting lights if writeIndices is false, otherwise writes up to maxCount
+// indices starting at clusterOffset
+// no shared memory, each thread traverses on its own
+uint cullLights(uint clusterIndex, Cluster cluster, float halfZ, bool writeIndices, uint clusterOffset, uint maxCount)
 {
-    // NOTE: expects light.position to be in view space like the cluster bounds
-    // global light list has world space coordinates, but we transform the
-    // coordinates in the shared array of lights after copying
+    uint visibleCount = 0;
 
-    // get closest point to sphere center
-    vec3 closest = max(cluster.minBounds, min(light.position, cluster.maxBounds));
-    // check if point is inside the sphere
-    vec3 dist = closest - light.position;
-    return dot(dist, dist) <= (light.radius * light.radius);
-}*/
+    uint node = isClusterValid(clusterIndex) ? bvhRoot() : BVH_END;
+    while(node != BVH_END && visibleCount < maxCount)
+    {
+        PointLight bounds = getBVHNodeBounds(node);
+        if(bounds.radius >= 0.0 && pointLightIntersectsCluster(bounds, cluster, halfZ))
+        {
+            if(u_lightcutsErrorBound > 0.0 && lightcutsAcceptsNode(node, bounds.position, cluster))
+            {
+                if(writeIndices)
+                    b_clusterLightIndices[clusterOffset + visibleCount] = bvhVirtualLightIndex(node);
+                visibleCount++;
+                node = bvhSkip(node, 0);
+                continue;
+            }
 
-//#define gl_WorkGroupSize uvec3(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
-#define GROUP_SIZE (CLUSTERS_X_THREADS * CLUSTERS_Y_THREADS * CLUSTERS_Z_THREADS)
+            if(!bvhIsLeaf(node))
+            {
+                node = bvhLeftChild(node);
+                continue;
+            }
+
+            uint first;
+            uint end;
+            bvhLeafLights(node, first, end);
+            for(uint i = first; i < end && visibleCount < maxCount; i++)
+            {
+                uint lightIndex = getBVHLightIndex(i);
+                PointLight light = getPointLight(lightIndex);
+                light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+                if(lightInClusterGrid(light.radius) && pointLightIntersectsCluster(light, cluster, halfZ))
+                {
+                    if(writeIndices)
+                        b_clusterLightIndices[clusterOffset + visibleCount] = lightIndex;
+                    visibleCount++;
+                }
+            }
+        }
+
+        node = bvhSkip(node, 0);
+    }
+
+    return visibleCount;
+}
+
+#else
 
 // light cache for the current workgroup
 // group shared memory has lower latency than global memory
@@ -58,23 +95,21 @@ bool pointLightIntersectsCluster(PointLight light, Cluster cluster, float halfZ)
 // as a guideline the minimum value of GL_MAX_COMPUTE_SHARED_MEMORY_SIZE is 32KB
 // with a workgroup size of 16*8*4 this is 64 bytes per light
 // however, using all available memory would limit the compute shader invocation to only 1 workgroup
-SHARED PointLight lights[GROUP_SIZE];
-
-// each thread handles one cluster
-NUM_THREADS(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
-void main()
+// culling only needs position and radius, 16 bytes per light
+// so the cache holds two lights per thread in the same memory a full PointLight per thread would need
+#define LIGHT_CACHE_SIZE (2 * GROUP_SIZE)
+SHARED vec4 lights[LIGHT_CACHE_SIZE];
+
+// tests all lights against the cluster, using the shared light cache
+// only counts intersecting lights if writeIndices is false, otherwise writes up to maxCount
+// indices starting at clusterOffset
+// must be called by all threads of the workgroup (barriers)
+uint cullLights(uint clusterIndex, Cluster cluster, float halfZ, bool writeIndices, uint clusterOffset, uint maxCount)
 {
     uint visibleCount = 0;
 
-    // the way we calculate the index doesn't really matter here since we write to the same index in the light grid as we read from the cluster buffer
-    uint clusterIndex = getComputeIndex(gl_GlobalInvocationID);
-    uint clusterOffset = getGridLightClusterOffset(clusterIndex);
-    Cluster cluster = getCluster(clusterIndex);
-
-    float halfZ = (cluster.depthNearFar.x + cluster.depthNearFar.y) / 2;
-
-    // we have a cache of GROUP_SIZE lights
-    // have to run this loop several times if we have more than GROUP_SIZE lights
+    // we have a cache of LIGHT_CACHE_SIZE lights
+    // have to run this loop several times if we have more than LIGHT_CACHE_SIZE lights
     uint lightCount = pointLightCount();
     uint lightOffset = 0;
     while(lightOffset < lightCount)
@@ -83,45 +118,85 @@ void main()
         // copies are required
         barrier();
 
-        // read GROUP_SIZE lights into shared memory
-        // each thread copies one light
-        uint batchSize = min(GROUP_SIZE, lightCount - lightOffset);
+        // read LIGHT_CACHE_SIZE lights into shared memory
+        // each thread copies two lights
+        uint batchSize = min(LIGHT_CACHE_SIZE, lightCount - lightOffset);
 
-        if(uint(gl_LocalInvocationIndex) < batchSize)
+        for(uint cacheIndex = gl_LocalInvocationIndex; cacheIndex < batchSize; cacheIndex += GROUP_SIZE)
         {
-            uint lightIndex = lightOffset + gl_LocalInvocationIndex;
-            PointLight light = getPointLight(lightIndex);
+            PointLight light = getPointLight(lightOffset + cacheIndex);
             // transform to view space (expected by pointLightAffectsCluster)
             // do it here once rather than for each cluster later
-            light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
-            lights[gl_LocalInvocationIndex] = light;
+            lights[cacheIndex] = vec4(mul(u_view, vec4(light.position, 1.0)).xyz, light.radius);
         }
 
         // wait for all threads to finish copying
         barrier();
 
         // each thread is one cluster and checks against all lights in the cache
-        for(uint i = 0; i < batchSize && isClusterValid(clusterIndex); i++)
+        for(uint i = 0; i < batchSize && isClusterValid(clusterIndex) && visibleCount < maxCount; i++)
         {
-            if(pointLightIntersectsCluster(lights[i], cluster, halfZ))
+            PointLight light;
+            light.position = lights[i].xyz;
+            light._padding = 0.0;
+            light.intensity = vec3_splat(0.0);
+            light.radius = lights[i].w;
+            if(lightInClusterGrid(light.radius) && pointLightIntersectsCluster(light, cluster, halfZ))
             {
-                b_clusterLightIndices[clusterOffset + visibleCount] = lightOffset + i;
+                if(writeIndices)
+                    b_clusterLightIndices[clusterOffset + visibleCount] = lightOffset + i;
                 visibleCount++;
             }
-
-            if(visibleCount >= u_maxLightsPerCluster)
-                break;
         }
 
         lightOffset += batchSize;
     }
 
+    return visibleCount;
+}
+
+#endif // LIGHT_BVH
+
+// each thread handles one cluster
+NUM_THREADS(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
+void main()
+{
+#ifdef ACTIVE_CLUSTERS_ONLY
+    // 1D dispatch over the list of clusters that contain geometry
+    uint clusterIndex = getActiveClusterIndex(gl_WorkGroupID.x * GROUP_SIZE + gl_LocalInvocationIndex);
+#else
+    // the way we calculate the index doesn't really matter here since we write to the same index in the light grid as we read from the cluster buffer
+    uint clusterIndex = getComputeIndex(gl_GlobalInvocationID);
+#endif
+    Cluster cluster = getCluster(clusterIndex);
+
+    float halfZ = (cluster.depthNearFar.x + cluster.depthNearFar.y) / 2;
+
+    // the light index list is compacted, clusters don't have a fixed number of slots
+    // first pass counts the visible lights so we can reserve exactly that many indices,
+    // second pass writes them into the reserved range
+    // this trades a second round of intersection tests for a lot less memory
+
+    uint visibleCount = cullLights(clusterIndex, cluster, halfZ, false, 0, u_maxLightsPerCluster);
+
+    LightGrid grid;
+    grid.offset = 0;
+    grid.pointLights = 0;
+    if(isClusterValid(clusterIndex))
+    {
+        recordClusterLightCount(visibleCount);
+        if(visibleCount > 0)
+            grid.pointLights = allocateLightIndices(visibleCount, grid.offset);
+    }
+
+    cullLights(clusterIndex, cluster, halfZ, true, grid.offset, grid.pointLights);
+
     // wait for all threads to finish checking lights
     barrier();
 
     if(isClusterValid(clusterIndex))
     {
         // write light grid for this cluster
-        b_clusterLightGrid[clusterIndex] = visibleCount;
+        setLightGrid(clusterIndex, grid);
     }
 }
@@ -0,0 +1,6 @@
+// light culling for active clusters only (clusters that contain visible geometry)
+// dispatched indirectly, see cs_clustered_activeclusters_args.sc
+
+#define ACTIVE_CLUSTERS_ONLY
+
+#include "cs_clustered_lightculling.sc"
@@ -0,0 +1,7 @@
+// light culling for active clusters only, using the light BVH
+// dispatched indirectly, see cs_clustered_activeclusters_args.sc
+
+#define ACTIVE_CLUSTERS_ONLY
+#define LIGHT_BVH
+
+#include "cs_clustered_lightculling.sc"
@@ -0,0 +1,69 @@
+#define WRITE_CLUSTERS
+
+#include <bgfx_compute.sh>
+#include "clusterculling.sh"
+
+// light-centric alternative to cs_clustered_lightculling
+// instead of testing every light for every cluster, each light only visits the
+// clusters covered by its projected bounding sphere
+
+// runs twice:
+// - first pass counts the intersecting lights per cluster
+// - cs_clustered_lightscatter_allocate reserves that many indices for each cluster
+// - second pass (SCATTER_WRITE) writes the light indices
+// the second pass counts back down, leaving the per-cluster counts at 0 for the next frame
+
+void scatterLight(uint lightIndex)
+{
+    PointLight light = getPointLight(lightIndex);
+    // transform to view space (expected by pointLightIntersectsCluster)
+    light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+
+    uvec3 minCluster;
+    uvec3 maxCluster;
+    if(!getLightClusterRange(light, minCluster, maxCluster))
+        return;
+
+    for(uint z = minCluster.z; z <= maxCluster.z; z++)
+    {
+        for(uint y = minCluster.y; y <= maxCluster.y; y++)
+        {
+            for(uint x = minCluster.x; x <= maxCluster.x; x++)
+            {
+                uint clusterIndex = getComputeIndex(uvec3(x, y, z));
+                Cluster cluster = getCluster(clusterIndex);
+                float halfZ = (cluster.depthNearFar.x + cluster.depthNearFar.y) / 2;
+
+                // the range is only a conservative estimate, do the exact test
+                if(!pointLightIntersectsCluster(light, cluster, halfZ))
+                    continue;
+
+#ifdef SCATTER_WRITE
+                // adding 0xFFFFFFFF decrements the count
+                // the returned count is 1 past our slot in the cluster's range
+                uint count;
+                atomicFetchAndAdd(b_clusterLightCounts[clusterIndex], 0xFFFFFFFFu, count);
+
+                LightGrid grid = getLightGrid(clusterIndex);
+                uint slot = count - 1;
+                // lights that don't fit are dropped, same as in cs_clustered_lightculling
+                if(slot < grid.pointLights)
+                    b_clusterLightIndices[grid.offset + slot] = lightIndex;
+#else
+                atomicAdd(b_clusterLightCounts[clusterIndex], 1);
+#endif
+            }
+        }
+    }
+}
+
+// each thread handles one light, or several with more lights than MAX_LIGHT_DISPATCH_GROUPS groups can cover
+NUM_THREADS(SCATTER_LIGHTS_THREADS, 1, 1)
+void main()
+{
+    for(uint lightIndex = gl_GlobalInvocationID.x; lightIndex < pointLightCount();
+        lightIndex += MAX_LIGHT_DISPATCH_GROUPS * SCATTER_LIGHTS_THREADS)
+    {
+        scatterLight(lightIndex);
+    }
+}
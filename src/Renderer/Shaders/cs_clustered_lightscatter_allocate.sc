@@ -0,0 +1,36 @@
+#define WRITE_CLUSTERS
+
+#include <bgfx_compute.sh>
+#include "clusters.sh"
+
+// reserves a range in the light index list for each cluster
+// runs between the two passes of cs_clustered_lightscatter
+
+// each thread handles one cluster
+NUM_THREADS(CLUSTERS_X_THREADS, CLUSTERS_Y_THREADS, CLUSTERS_Z_THREADS)
+void main()
+{
+#ifdef ACTIVE_CLUSTERS_ONLY
+    // 1D dispatch over the list of clusters that contain geometry
+    // the light grid of all other clusters was already emptied
+    uint clusterIndex = getActiveClusterIndex(gl_WorkGroupID.x * CLUSTERS_GROUP_SIZE + gl_LocalInvocationIndex);
+#else
+    uint clusterIndex = getComputeIndex(gl_GlobalInvocationID);
+#endif
+    if(!isClusterValid(clusterIndex))
+        return;
+
+    // exact count, the first pass doesn't stop at u_maxLightsPerCluster
+    recordClusterLightCount(b_clusterLightCounts[clusterIndex]);
+    uint count = min(b_clusterLightCounts[clusterIndex], u_maxLightsPerCluster);
+
+    LightGrid grid;
+    grid.offset = 0;
+    grid.pointLights = 0;
+    if(count > 0)
+    {
+        grid.pointLights = allocateLightIndices(count, grid.offset);
+    }
+
+    setLightGrid(clusterIndex, grid);
+}
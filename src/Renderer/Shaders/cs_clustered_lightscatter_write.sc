@@ -0,0 +1,6 @@
+// second pass of light-centric culling, writes the light indices
+// into the ranges reserved by cs_clustered_lightscatter_allocate.sc
+
+#define SCATTER_WRITE
+
+#include "cs_clustered_lightscatter.sc"
@@ -0,0 +1,70 @@
+#define ZBINNING
+#define WRITE_ZBINS
+
+#include <bgfx_compute.sh>
+#include "lights.sh"
+#include "zbin.sh"
+#include "util.sh"
+
+// compute shader to build the light bitmask of each screen tile for z-binning
+// only tests against the tile's side planes, depth is handled by the z-bins
+// lights are in sorted order, bit i of the mask belongs to sorted light i
+
+vec4 createPlaneEquation(vec4 b, vec4 c)
+{
+    return vec4(normalize(cross(b.xyz, c.xyz)), 0.0);
+}
+
+float getSignedDistanceFromPlane(vec3 p, vec4 eqn)
+{
+    return dot(eqn.xyz, p);
+}
+
+// each thread handles one word (32 lights) of one tile
+// x: words, y and z: tiles
+// y is MAX_LIGHT_DISPATCH_GROUPS wide if there are more tiles than that, see ZBinShader::buildTileMasks
+NUM_THREADS(ZBIN_TILE_MASK_THREADS, 1, 1)
+void main()
+{
+    uint word = gl_GlobalInvocationID.x;
+    uint tile = gl_GlobalInvocationID.z * MAX_LIGHT_DISPATCH_GROUPS + gl_GlobalInvocationID.y;
+
+    if(word * 32 >= u_zbinLightCount || tile >= u_clusterCount.x * u_clusterCount.y)
+        return;
+
+    // same as the side planes of the cluster column, see cs_clustered_clusterbuilding.sc
+    uvec2 tile2D = uvec2(tile % u_clusterCount.x, tile / u_clusterCount.x);
+
+    vec4 frustrum[4];
+    frustrum[0] = screen2Eye(vec4((tile2D + vec2(0, 0)) * u_clusterSize.xy, 1.0, 1.0));
+    frustrum[1] = screen2Eye(vec4((tile2D + vec2(1, 0)) * u_clusterSize.xy, 1.0, 1.0));
+    frustrum[2] = screen2Eye(vec4((tile2D + vec2(1, 1)) * u_clusterSize.xy, 1.0, 1.0));
+    frustrum[3] = screen2Eye(vec4((tile2D + vec2(0, 1)) * u_clusterSize.xy, 1.0, 1.0));
+
+    vec4 planes[4];
+    planes[0] = createPlaneEquation(frustrum[0], frustrum[1]);
+    planes[1] = createPlaneEquation(frustrum[1], frustrum[2]);
+    planes[2] = createPlaneEquation(frustrum[2], frustrum[3]);
+    planes[3] = createPlaneEquation(frustrum[3], frustrum[0]);
+
+    uint lightEnd = min(word * 32 + 32, u_zbinLightCount);
+
+    uint mask = 0;
+    for(uint i = word * 32; i < lightEnd; i++)
+    {
+        PointLight light = getPointLight(getZBinLightIndex(i));
+        vec3 center = mul(u_view, vec4(light.position, 1.0)).xyz;
+        float r = light.radius;
+        if(
+            (getSignedDistanceFromPlane(center, planes[0]) < r) &&
+            (getSignedDistanceFromPlane(center, planes[1]) < r) &&
+            (getSignedDistanceFromPlane(center, planes[2]) < r) &&
+            (getSignedDistanceFromPlane(center, planes[3]) < r)
+        )
+        {
+            mask |= 1u << (i - word * 32);
+        }
+    }
+
+    b_zbinTileMasks[tile * u_zbinWordCount + word] = mask;
+}
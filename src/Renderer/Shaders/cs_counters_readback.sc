@@ -0,0 +1,24 @@
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+
+// compute shader to copy a few uint counters into a texture
+// bgfx can only read back textures, see CounterReadback
+
+#define READBACK_THREADS 16
+
+uniform vec4 u_readbackVec;
+
+#define u_readbackCount ((uint)u_readbackVec.x)
+
+BUFFER_RO(b_readbackCounters, uint, SAMPLER_READBACK_COUNTERS);
+// stored as float, exact up to 2^24 which is plenty for counts
+// uint images aren't supported by every backend
+IMAGE2D_WR(i_readbackCounters, r32f, SAMPLER_READBACK_IMAGE);
+
+NUM_THREADS(READBACK_THREADS, 1, 1)
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if(index < u_readbackCount)
+        imageStore(i_readbackCounters, ivec2(index, 0), vec4(float(b_readbackCounters[index]), 0.0, 0.0, 0.0));
+}
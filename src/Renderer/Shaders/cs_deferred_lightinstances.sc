@@ -0,0 +1,33 @@
+#include "deferred_lightinstances.sh"
+
+// compute shader to write the instance list for the deferred light volumes
+// lights outside the view frustum are left out, see DeferredRenderer::generateLightInstances
+// runs after cs_deferred_lightinstances_count and cs_deferred_lightinstances_args which set up the
+// range of each proxy
+
+// for each instance: light index in x, 1 in y for the quad proxy
+// same layout as the CPU-written instance data
+BUFFER_WR(b_lightInstances, vec4, SAMPLER_DEFERRED_LIGHTINSTANCES);
+// write cursor of each proxy
+BUFFER_RW(b_lightInstanceCount, uint, SAMPLER_DEFERRED_LIGHTINSTANCECOUNT);
+
+// each thread handles one light, or several with more lights than MAX_LIGHT_DISPATCH_GROUPS groups can cover
+NUM_THREADS(LIGHT_INSTANCE_THREADS, 1, 1)
+void main()
+{
+    for(uint lightIndex = gl_GlobalInvocationID.x; lightIndex < pointLightCount();
+        lightIndex += MAX_LIGHT_DISPATCH_GROUPS * LIGHT_INSTANCE_THREADS)
+    {
+        PointLight light = getPointLight(lightIndex);
+        // same decisions as in the count pass
+        if(lightInFrustum(light))
+        {
+            uint proxy = getLightProxy(lightPixelRadius(light));
+            uint instance;
+            atomicFetchAndAdd(b_lightInstanceCount[LIGHT_INSTANCE_COUNTER_CURSORS + proxy], 1, instance);
+            // float is exact up to 2^24, way more lights than we can handle
+            float quad = proxy == LIGHT_PROXY_QUAD ? 1.0 : 0.0;
+            b_lightInstances[instance] = vec4(float(lightIndex), quad, 0.0, 0.0);
+        }
+    }
+}
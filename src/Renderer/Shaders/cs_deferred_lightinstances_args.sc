@@ -0,0 +1,56 @@
+#include "deferred_lightinstances.sh"
+
+// compute shader to write the indirect draw arguments for the deferred light volumes
+// one draw per proxy, the instances of each proxy are stored right after the previous one's
+// followed by one draw per proxy for every stencil batch, clipped to the batch's instance range
+// the batches split the instances that survived culling, not all lights
+
+// x = index count, y = first index
+uniform vec4 u_lightProxyMeshes[LIGHT_PROXY_COUNT];
+
+// instance counts in, write cursors out
+BUFFER_RW(b_lightInstanceCount, uint, SAMPLER_DEFERRED_LIGHTINSTANCECOUNT);
+BUFFER_WR(b_drawIndirect, uvec4, SAMPLER_DEFERRED_DRAWINDIRECT);
+
+NUM_THREADS(1, 1, 1)
+void main()
+{
+    uint firstInstance = 0;
+    for(uint proxy = 0; proxy < LIGHT_PROXY_COUNT; proxy++)
+    {
+        uint count = b_lightInstanceCount[proxy];
+        drawIndexedIndirect(b_drawIndirect,
+                            proxy,
+                            uint(u_lightProxyMeshes[proxy].x),
+                            count,
+                            uint(u_lightProxyMeshes[proxy].y),
+                            0,
+                            firstInstance);
+        b_lightInstanceCount[LIGHT_INSTANCE_COUNTER_CURSORS + proxy] = firstInstance;
+        firstInstance += count;
+    }
+
+    // firstInstance is the total instance count now
+    uint batchCount = max(u_lightBatchCount, 1u);
+    uint batchSize = (firstInstance + batchCount - 1u) / batchCount;
+    for(uint batch = 0; batch < u_lightBatchCount; batch++)
+    {
+        uint batchBegin = batch * batchSize;
+        uint batchEnd = batchBegin + batchSize;
+        uint proxyBegin = 0;
+        for(uint proxy = 0; proxy < LIGHT_PROXY_COUNT; proxy++)
+        {
+            uint proxyEnd = proxyBegin + b_lightInstanceCount[proxy];
+            uint begin = max(proxyBegin, batchBegin);
+            uint end = min(proxyEnd, batchEnd);
+            drawIndexedIndirect(b_drawIndirect,
+                                LIGHT_PROXY_COUNT * (batch + 1u) + proxy,
+                                uint(u_lightProxyMeshes[proxy].x),
+                                end > begin ? end - begin : 0u,
+                                uint(u_lightProxyMeshes[proxy].y),
+                                0,
+                                begin);
+            proxyBegin = proxyEnd;
+        }
+    }
+}
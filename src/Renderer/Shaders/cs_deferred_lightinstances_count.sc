@@ -0,0 +1,31 @@
+#include "deferred_lightinstances.sh"
+
+// compute shader to count the deferred light volume instances of each proxy
+// lights outside the view frustum are left out, see DeferredRenderer::generateLightInstances
+
+// instances per proxy, cursors, saved fragments, reset to 0 every frame
+BUFFER_RW(b_lightInstanceCount, uint, SAMPLER_DEFERRED_LIGHTINSTANCECOUNT);
+
+// each thread handles one light, or several with more lights than MAX_LIGHT_DISPATCH_GROUPS groups can cover
+NUM_THREADS(LIGHT_INSTANCE_THREADS, 1, 1)
+void main()
+{
+    for(uint lightIndex = gl_GlobalInvocationID.x; lightIndex < pointLightCount();
+        lightIndex += MAX_LIGHT_DISPATCH_GROUPS * LIGHT_INSTANCE_THREADS)
+    {
+        PointLight light = getPointLight(lightIndex);
+        if(lightInFrustum(light))
+        {
+            float pixelRadius = lightPixelRadius(light);
+            uint proxy = getLightProxy(pixelRadius);
+            atomicAdd(b_lightInstanceCount[proxy], 1);
+
+            // 64-bit sum, carry into the high word when the low word wraps around
+            uint saved = lightSavedFragments(pixelRadius, proxy);
+            uint previous;
+            atomicFetchAndAdd(b_lightInstanceCount[LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS], saved, previous);
+            if(previous + saved < previous)
+                atomicAdd(b_lightInstanceCount[LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS + 1u], 1);
+        }
+    }
+}
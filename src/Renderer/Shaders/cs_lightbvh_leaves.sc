@@ -0,0 +1,64 @@
+#define WRITE_BVH
+
+#include <bgfx_compute.sh>
+#include "bvh.sh"
+
+// compute shader to calculate the bounding spheres of the light BVH leaves
+// see cs_lightbvh_nodes.sc for the rest of the tree
+
+// each thread handles one leaf
+NUM_THREADS(BVH_BUILD_THREADS, 1, 1)
+void main()
+{
+    uint leaf = gl_GlobalInvocationID.x;
+    if(leaf >= u_bvhLeafCount)
+        return;
+
+    uint node = u_bvhLeafCount - 1 + leaf;
+    uint first;
+    uint end;
+    bvhLeafLights(node, first, end);
+
+    // padding leaves at the end of the tree stay empty
+    vec4 bounds = vec4(0.0, 0.0, 0.0, -1.0);
+    vec4 cut = vec4_splat(0.0);
+
+    if(first < end)
+    {
+        // center of the bounding box of all light spheres
+        vec3 minBounds = vec3_splat( 1e30);
+        vec3 maxBounds = vec3_splat(-1e30);
+        for(uint i = first; i < end; i++)
+        {
+            PointLight light = getPointLight(getBVHLightIndex(i));
+            vec3 position = mul(u_view, vec4(light.position, 1.0)).xyz;
+            minBounds = min(minBounds, position - light.radius);
+            maxBounds = max(maxBounds, position + light.radius);
+        }
+        vec3 center = (minBounds + maxBounds) * 0.5;
+
+        // radius that contains all light spheres
+        // and the total intensity for lightcuts
+        float radius = 0.0;
+        float spread = 0.0;
+        vec3 intensity = vec3_splat(0.0);
+        for(uint i = first; i < end; i++)
+        {
+            PointLight light = getPointLight(getBVHLightIndex(i));
+            vec3 position = mul(u_view, vec4(light.position, 1.0)).xyz;
+            radius = max(radius, distance(center, position) + light.radius);
+            spread = max(spread, distance(center, position));
+            intensity += light.intensity;
+        }
+
+        // the virtual light sits at the center, the culling has to find it everywhere it reaches
+        if(u_bvhVirtualLights)
+            radius = max(radius, bvhVirtualLightRadius(intensity));
+
+        bounds = vec4(center, radius);
+        cut = vec4(intensity, spread);
+    }
+
+    b_bvhNodes[2 * node + 0] = bounds;
+    b_bvhNodes[2 * node + 1] = cut;
+}
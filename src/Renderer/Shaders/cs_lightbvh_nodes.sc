@@ -0,0 +1,63 @@
+#define WRITE_BVH
+
+#include <bgfx_compute.sh>
+#include "bvh.sh"
+
+// compute shader to calculate the bounding spheres of one level of inner BVH nodes
+// dispatched once per level, bottom-up, after cs_lightbvh_leaves.sc
+
+// smallest sphere containing both spheres
+vec4 mergeSpheres(vec4 a, vec4 b)
+{
+    if(b.w < 0.0)
+        return a;
+    if(a.w < 0.0)
+        return b;
+
+    float d = distance(a.xyz, b.xyz);
+    // one sphere contains the other
+    if(d + b.w <= a.w)
+        return a;
+    if(d + a.w <= b.w)
+        return b;
+
+    float radius = (d + a.w + b.w) * 0.5;
+    vec3 center = a.xyz + (b.xyz - a.xyz) * ((radius - a.w) / d);
+    return vec4(center, radius);
+}
+
+// each thread handles one node of the current level
+NUM_THREADS(BVH_BUILD_THREADS, 1, 1)
+void main()
+{
+    if(gl_GlobalInvocationID.x >= u_bvhLevelCount)
+        return;
+
+    uint node = u_bvhLevelFirst + gl_GlobalInvocationID.x;
+    uint left = bvhLeftChild(node);
+    uint right = left + 1;
+    vec4 leftSphere = b_bvhNodes[2 * left + 0];
+    vec4 rightSphere = b_bvhNodes[2 * right + 0];
+    vec4 sphere = mergeSpheres(leftSphere, rightSphere);
+
+    // intensities add up, the spread has to contain both children
+    vec3 intensity = vec3_splat(0.0);
+    float spread = 0.0;
+    if(leftSphere.w >= 0.0)
+    {
+        intensity += getBVHNodeIntensity(left);
+        spread = max(spread, distance(sphere.xyz, leftSphere.xyz) + getBVHNodeSpread(left));
+    }
+    if(rightSphere.w >= 0.0)
+    {
+        intensity += getBVHNodeIntensity(right);
+        spread = max(spread, distance(sphere.xyz, rightSphere.xyz) + getBVHNodeSpread(right));
+    }
+
+    // same for the virtual light, children already contain theirs
+    if(u_bvhVirtualLights && sphere.w >= 0.0)
+        sphere.w = max(sphere.w, bvhVirtualLightRadius(intensity));
+
+    b_bvhNodes[2 * node + 0] = sphere;
+    b_bvhNodes[2 * node + 1] = vec4(intensity, spread);
+}
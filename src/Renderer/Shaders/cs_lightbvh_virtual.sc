@@ -0,0 +1,24 @@
+#define WRITE_LIGHTS
+
+#include <bgfx_compute.sh>
+#include "bvh.sh"
+
+// compute shader to write a virtual light for every BVH node after the real lights (lightcuts)
+// dispatched after the node bounds are refit
+// the virtual light sits at the node center and has the total intensity of all lights in the subtree
+
+// each thread handles one node
+NUM_THREADS(BVH_BUILD_THREADS, 1, 1)
+void main()
+{
+    uint node = gl_GlobalInvocationID.x;
+    if(node >= bvhNodeCount())
+        return;
+
+    vec4 sphere = b_bvhNodes[2 * node + 0];
+    // node bounds are in view space, lights are in world space
+    vec3 position = mul(u_invView, vec4(sphere.xyz, 1.0)).xyz;
+    // empty nodes get no intensity, culling never picks them anyway
+    uint intensity = sphere.w >= 0.0 ? packRGB9E5(getBVHNodeIntensity(node)) : 0u;
+    b_pointLights[bvhVirtualLightIndex(node)] = vec4(position, uintBitsToFloat(intensity));
+}
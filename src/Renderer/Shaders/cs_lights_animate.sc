@@ -0,0 +1,48 @@
+#define WRITE_LIGHTS
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+#include "lights.sh"
+
+// compute shader to move point lights along their motion path, in place
+// same as PointLightList::animate
+
+#define ANIMATION_THREADS 64
+
+uniform vec4 u_lightAnimationVec;
+
+#define u_animationDeltaTime u_lightAnimationVec.x
+
+// for each light:
+//   vec4 center + angular velocity (xyz is center, w is angular velocity in radians per second)
+//   vec4 axis (w is padding)
+BUFFER_RO(b_pointLightMotion, vec4, SAMPLER_LIGHTS_MOTION);
+
+void animateLight(uint lightIndex)
+{
+    vec4 centerVelocity = b_pointLightMotion[2 * lightIndex + 0];
+    vec3 axis = b_pointLightMotion[2 * lightIndex + 1].xyz;
+    vec3 center = centerVelocity.xyz;
+    float angle = centerVelocity.w * u_animationDeltaTime;
+
+    // Rodrigues' rotation formula
+    vec4 positionIntensity = b_pointLights[lightIndex];
+    vec3 v = positionIntensity.xyz - center;
+    float c = cos(angle);
+    float s = sin(angle);
+    vec3 rotated = v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+
+    // w holds the packed intensity bits, move it without touching it
+    b_pointLights[lightIndex] = vec4(center + rotated, positionIntensity.w);
+}
+
+// each thread handles one light, or several with more lights than MAX_LIGHT_DISPATCH_GROUPS groups can cover
+NUM_THREADS(ANIMATION_THREADS, 1, 1)
+void main()
+{
+    for(uint lightIndex = gl_GlobalInvocationID.x; lightIndex < pointLightCount();
+        lightIndex += MAX_LIGHT_DISPATCH_GROUPS * ANIMATION_THREADS)
+    {
+        animateLight(lightIndex);
+    }
+}
@@ -0,0 +1,121 @@
+#define WRITE_TILES
+
+#include <bgfx_compute.sh>
+#include "tiles.sh"
+#include "util.sh"
+
+// compute shader to find the depth range of geometry in each tile
+// reads the depth prepass or G-Buffer depth
+// with TRANSPARENT_DEPTH, like active cluster detection, it also reads the depth of the closest transparent surface
+// and covers everything between it and the opaque surface, further transparent surfaces can be anywhere in there
+
+SAMPLER2D(s_texDepth, SAMPLER_DEFERRED_DEPTH);
+#ifdef TRANSPARENT_DEPTH
+SAMPLER2D(s_texTransparentDepth, SAMPLER_TRANSPARENT_DEPTH);
+#endif
+
+// eye space depth is positive, the uint bits sort the same way as the floats
+SHARED uint sharedMinDepth;
+SHARED uint sharedMaxDepth;
+SHARED uint sharedDepthMask;
+
+// eye space depth range of the geometry in a pixel, returns false for background
+bool getPixelDepthRange(uint x, uint y, out float nearDepth, out float farDepth)
+{
+    float depth = texelFetch(s_texDepth, ivec2(x, y), 0).x;
+    nearDepth = farDepth = screen2EyeDepth(depth, u_zNear, u_zFar);
+
+#ifdef TRANSPARENT_DEPTH
+    float transparentDepth = texelFetch(s_texTransparentDepth, ivec2(x, y), 0).x;
+    // transparent surfaces behind the opaque one are hidden
+    if(transparentDepth < depth)
+    {
+        nearDepth = screen2EyeDepth(transparentDepth, u_zNear, u_zFar);
+        // without opaque geometry, transparent surfaces can go all the way to the far plane
+        if(depth >= 1.0)
+            farDepth = u_zFar;
+        return true;
+    }
+#endif
+
+    return depth < 1.0;
+}
+
+// one work group per tile, each thread handles every 16th pixel in both directions
+NUM_THREADS(TILES_X_THREADS, TILES_Y_THREADS, 1)
+void main()
+{
+    uint tileIndex = getComputeIndex(gl_WorkGroupID.xy);
+
+    if(gl_LocalInvocationIndex == 0)
+    {
+        sharedMinDepth = 0xFFFFFFFF;
+        sharedMaxDepth = 0;
+        sharedDepthMask = 0;
+    }
+
+    barrier();
+
+    uvec2 tileStart = gl_WorkGroupID.xy * u_tileSize;
+    uvec2 tileEnd = min(tileStart + u_tileSize, uvec2(u_viewRect.zw));
+
+    for(uint y = tileStart.y + gl_LocalInvocationID.y; y < tileEnd.y; y += TILES_Y_THREADS)
+    {
+        for(uint x = tileStart.x + gl_LocalInvocationID.x; x < tileEnd.x; x += TILES_X_THREADS)
+        {
+            float nearDepth;
+            float farDepth;
+            // background, no geometry
+            if(getPixelDepthRange(x, y, nearDepth, farDepth))
+            {
+                atomicMin(sharedMinDepth, floatBitsToUint(nearDepth));
+                atomicMax(sharedMaxDepth, floatBitsToUint(farDepth));
+            }
+        }
+    }
+
+    barrier();
+
+    bool empty = sharedMaxDepth == 0;
+    TileDepth tileDepth;
+    tileDepth.minDepth = empty ? 0.0 : uintBitsToFloat(sharedMinDepth);
+    tileDepth.maxDepth = empty ? 0.0 : uintBitsToFloat(sharedMaxDepth);
+    tileDepth.sliceScale = getTileDepthSliceScale(tileDepth.minDepth, tileDepth.maxDepth);
+    tileDepth.mask = 0;
+
+    // 2.5D culling: set a bit for each depth slice containing geometry
+    if(u_tileDepthBounds == TILE_DEPTH_BOUNDS_MASK && !empty)
+    {
+        uint mask = 0;
+        for(uint y = tileStart.y + gl_LocalInvocationID.y; y < tileEnd.y; y += TILES_Y_THREADS)
+        {
+            for(uint x = tileStart.x + gl_LocalInvocationID.x; x < tileEnd.x; x += TILES_X_THREADS)
+            {
+                float nearDepth;
+                float farDepth;
+                if(getPixelDepthRange(x, y, nearDepth, farDepth))
+                {
+                    // every slice in the pixel's range, only one for opaque geometry
+                    uint first = getTileDepthSlice(nearDepth, tileDepth);
+                    uint last = getTileDepthSlice(farDepth, tileDepth);
+                    mask |= (0xFFFFFFFF >> (31 - last)) & (0xFFFFFFFF << first);
+                }
+            }
+        }
+        // one atomic per thread instead of one per pixel
+        atomicOr(sharedDepthMask, mask);
+    }
+
+    barrier();
+
+    if(gl_LocalInvocationIndex == 0 && isTileValid(tileIndex))
+    {
+        uint mask = sharedDepthMask;
+        if(u_tileDepthBounds != TILE_DEPTH_BOUNDS_MASK)
+            mask = empty ? 0 : 0xFFFFFFFF;
+
+        b_tileDepthBounds[3 * tileIndex + 0] = floatBitsToUint(tileDepth.minDepth);
+        b_tileDepthBounds[3 * tileIndex + 1] = floatBitsToUint(tileDepth.maxDepth);
+        b_tileDepthBounds[3 * tileIndex + 2] = mask;
+    }
+}
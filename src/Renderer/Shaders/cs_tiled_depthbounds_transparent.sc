@@ -0,0 +1,6 @@
+// tile depth bounds that also cover transparent meshes
+// see cs_tiled_depthbounds.sc
+
+#define TRANSPARENT_DEPTH
+
+#include "cs_tiled_depthbounds.sc"
@@ -3,13 +3,16 @@
 #include <bgfx_compute.sh>
 #include "lights.sh"
 #include "tiles.sh"
+#ifdef LIGHT_BVH
+#include "bvh.sh"
+#endif
 
 float getSignedDistanceFromPlane(vec3 p, vec4 eqn)
 {
     return dot(eqn.xyz, p);
 }
 
-bool pointLightIntersectsTile(PointLight light, Tile tile, float halfZ)
+bool pointLightIntersectsTile(PointLight light, Tile tile, TileDepth depth)
 {
     vec3 center = light.position;
     float r = light.radius;
@@ -20,16 +23,14 @@ bool pointLightIntersectsTile(PointLight light, Tile tile, float halfZ)
         (getSignedDistanceFromPlane(center, tile.frustrumPlanes[3]) < r)
     )
     {
-        if(-center.z + u_zNear < r && center.z - halfZ < r)
-            return true;
-        if(-center.z + halfZ < r && center.z - u_zFar < r)
-            return true;
+        return sphereIntersectsTileDepth(center, r, depth);
     }
 
     return false;
 }
 
 #define NUM_THREADS_PER_TILE (TILES_X_THREADS * TILES_Y_THREADS)
+#define NUM_THREADS_PER_TILE_LOG2 8 // log2(16 * 16)
 
 SHARED uint sharedVisibleCount;
 
@@ -39,9 +40,10 @@ void main()
     uint tileIndex = getComputeIndex(gl_WorkGroupID.xy);
 
     Tile tile = getTile(tileIndex);
-    uint tileOffset = getGridLightTileOffset(tileIndex);
+    uint tileOffset = getTileLightIndicesOffset(tileIndex);
 
-    float halfZ = (u_zNear + u_zFar) / 2;
+    // camera near/far or the depth bounds of the tile's geometry
+    TileDepth depth = getTileDepth(tileIndex);
 
     if(gl_LocalInvocationIndex == 0)
     {
@@ -50,6 +52,48 @@ void main()
 
     barrier();
 
+#ifdef LIGHT_BVH
+    // each thread traverses one subtree of the light BVH
+    // pick the deepest level with at most one node per thread
+    uint subtreeLevel = min(u_bvhDepth, NUM_THREADS_PER_TILE_LOG2);
+    uint subtreeCount = u_bvhLeafCount > 0 ? (1u << subtreeLevel) : 0;
+    uint root = (1u << subtreeLevel) - 1 + gl_LocalInvocationIndex;
+    uint node = gl_LocalInvocationIndex < subtreeCount ? root : BVH_END;
+    bool full = false;
+    while(node != BVH_END && !full)
+    {
+        PointLight bounds = getBVHNodeBounds(node);
+        if(bounds.radius >= 0.0 && pointLightIntersectsTile(bounds, tile, depth))
+        {
+            if(!bvhIsLeaf(node))
+            {
+                node = bvhLeftChild(node);
+                continue;
+            }
+
+            uint first;
+            uint end;
+            bvhLeafLights(node, first, end);
+            for(uint i = first; i < end && !full; i++)
+            {
+                uint lightIndex = getBVHLightIndex(i);
+                PointLight light = getPointLight(lightIndex);
+                light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+                if(pointLightIntersectsTile(light, tile, depth))
+                {
+                    uint offset;
+                    atomicFetchAndAdd(sharedVisibleCount, 1, offset);
+                    if(offset >= u_maxLightsPerTile)
+                        full = true;
+                    else
+                        b_tileLightIndices[tileOffset + offset] = lightIndex;
+                }
+            }
+        }
+
+        node = bvhSkip(node, root);
+    }
+#else
     uint lightCount = pointLightCount();
     uint lightCountPerThread = (lightCount + NUM_THREADS_PER_TILE - 1) / NUM_THREADS_PER_TILE;
     uint threadLightStart = lightCountPerThread * (gl_LocalInvocationIndex + 0);
@@ -61,7 +105,7 @@ void main()
         PointLight light = getPointLight(lightIndex);
         light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
         //light.radius = length(mul(u_view, vec4(light.radius, 0.0, 0.0, 0.0)));
-        if(pointLightIntersectsTile(light, tile, halfZ))
+        if(pointLightIntersectsTile(light, tile, depth))
         {
             uint offset;
             atomicFetchAndAdd(sharedVisibleCount, 1, offset);
@@ -71,11 +115,14 @@ void main()
             b_tileLightIndices[tileOffset + offset] = lightIndex;
         }
     }
+#endif
 
     barrier();
 
     if(gl_LocalInvocationIndex == 0)
     {
-        b_tileLightGrid[tileIndex] = min(sharedVisibleCount, u_maxLightsPerTile);
+        // threads stop once the list is full, past that this is only a lower bound
+        recordTileLightCount(sharedVisibleCount);
+        setLightGrid(tileIndex, tileOffset, min(sharedVisibleCount, u_maxLightsPerTile));
     }
 }
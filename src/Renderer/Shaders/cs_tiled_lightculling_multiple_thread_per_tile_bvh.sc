@@ -0,0 +1,6 @@
+// light culling using the light BVH instead of testing every light
+// see bvh.sh and LightBVHShader
+
+#define LIGHT_BVH
+
+#include "cs_tiled_lightculling_multiple_thread_per_tile.sc"
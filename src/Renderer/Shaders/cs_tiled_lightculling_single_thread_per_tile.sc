@@ -3,13 +3,16 @@
 #include <bgfx_compute.sh>
 #include "lights.sh"
 #include "tiles.sh"
+#ifdef LIGHT_BVH
+#include "bvh.sh"
+#endif
 
 float getSignedDistanceFromPlane(vec3 p, vec4 eqn)
 {
     return dot(eqn.xyz, p);
 }
 
-bool pointLightIntersectsTile(PointLight light, Tile tile, float halfZ)
+bool pointLightIntersectsTile(PointLight light, Tile tile, TileDepth depth)
 {
     vec3 center = light.position;
     float r = light.radius;
@@ -20,10 +23,7 @@ bool pointLightIntersectsTile(PointLight light, Tile tile, float halfZ)
         (getSignedDistanceFromPlane(center, tile.frustrumPlanes[3]) < r)
     )
     {
-        if(-center.z + u_zNear < r && center.z - halfZ < r)
-            return true;
-        if(-center.z + halfZ < r && center.z - u_zFar < r)
-            return true;
+        return sphereIntersectsTileDepth(center, r, depth);
     }
 
     return false;
@@ -39,17 +39,51 @@ void main()
         return;
 
     Tile tile = getTile(tileIndex);
-    uint tileOffset = getGridLightTileOffset(tileIndex);
+    uint tileOffset = getTileLightIndicesOffset(tileIndex);
 
-    float halfZ = (u_zNear + u_zFar) / 2;
+    // camera near/far or the depth bounds of the tile's geometry
+    TileDepth depth = getTileDepth(tileIndex);
 
+#ifdef LIGHT_BVH
+    // traverse the light BVH, skipping subtrees that don't intersect the tile
+    uint node = bvhRoot();
+    while(node != BVH_END && visibleCount < u_maxLightsPerTile)
+    {
+        PointLight bounds = getBVHNodeBounds(node);
+        if(bounds.radius >= 0.0 && pointLightIntersectsTile(bounds, tile, depth))
+        {
+            if(!bvhIsLeaf(node))
+            {
+                node = bvhLeftChild(node);
+                continue;
+            }
+
+            uint first;
+            uint end;
+            bvhLeafLights(node, first, end);
+            for(uint i = first; i < end && visibleCount < u_maxLightsPerTile; i++)
+            {
+                uint lightIndex = getBVHLightIndex(i);
+                PointLight light = getPointLight(lightIndex);
+                light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+                if(pointLightIntersectsTile(light, tile, depth))
+                {
+                    b_tileLightIndices[tileOffset + visibleCount] = lightIndex;
+                    visibleCount++;
+                }
+            }
+        }
+
+        node = bvhSkip(node, 0);
+    }
+#else
     uint lightCount = pointLightCount();
     for(int lightIndex = 0; lightIndex < lightCount; lightIndex++)
     {
         PointLight light = getPointLight(lightIndex);
         light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
         //light.radius = length(mul(u_view, vec4(light.radius, 0.0, 0.0, 0.0)));
-        if(pointLightIntersectsTile(light, tile, halfZ))
+        if(pointLightIntersectsTile(light, tile, depth))
         {
             b_tileLightIndices[tileOffset + visibleCount] = lightIndex;
             visibleCount++;
@@ -58,6 +92,8 @@ void main()
         if(visibleCount >= u_maxLightsPerTile)
             break;
     }
+#endif
 
-    b_tileLightGrid[tileIndex] = visibleCount;
+    recordTileLightCount(visibleCount);
+    setLightGrid(tileIndex, tileOffset, visibleCount);
 }
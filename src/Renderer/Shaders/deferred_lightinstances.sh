@@ -0,0 +1,94 @@
+#ifndef DEFERRED_LIGHTINSTANCES_SH_HEADER_GUARD
+#define DEFERRED_LIGHTINSTANCES_SH_HEADER_GUARD
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+#include "lights.sh"
+
+// view frustum culling and proxy selection for the deferred light volumes
+// see DeferredRenderer::generateLightInstances
+
+#define LIGHT_INSTANCE_THREADS 64
+
+// should be the same as in DeferredRenderer.h
+#define LIGHT_PROXY_QUAD 0u
+#define LIGHT_PROXY_ICOSPHERE_LOW 1u
+#define LIGHT_PROXY_ICOSPHERE_MEDIUM 2u
+#define LIGHT_PROXY_ICOSPHERE_HIGH 3u
+#define LIGHT_PROXY_COUNT 4u
+
+// b_lightInstanceCount layout
+// instances per proxy, write cursor per proxy, saved fragments (low, high)
+#define LIGHT_INSTANCE_COUNTER_CURSORS LIGHT_PROXY_COUNT
+#define LIGHT_INSTANCE_COUNTER_SAVED_FRAGMENTS (2u * LIGHT_PROXY_COUNT)
+
+uniform vec4 u_camPos;
+
+// world space frustum planes, normals point inside (see LightPreCulling::getFrustumPlanes)
+uniform vec4 u_lightCullPlanes[6];
+
+// [0]: projected radius scale, largest projected radius (pixels) of quad, low and medium icosphere
+// [1]: projected area per squared projected radius for each proxy
+// [2]: x = screen pixel count, y = projected area per squared projected radius of the old cube
+//      z = stencil batch count (0 without stencil light volumes)
+uniform vec4 u_lightProxyVec[3];
+
+#define u_lightProxyRadiusScale (u_lightProxyVec[0].x)
+#define u_lightProxyMaxRadius (u_lightProxyVec[0].yzw)
+#define u_lightProxyArea (u_lightProxyVec[1])
+#define u_lightProxyScreenPixels (u_lightProxyVec[2].x)
+#define u_lightProxyCubeArea (u_lightProxyVec[2].y)
+#define u_lightBatchCount (uint(u_lightProxyVec[2].z))
+
+bool lightInFrustum(PointLight light)
+{
+    for(uint i = 0; i < 6; i++)
+    {
+        if(dot(u_lightCullPlanes[i].xyz, light.position) + u_lightCullPlanes[i].w <= -light.radius)
+            return false;
+    }
+    return true;
+}
+
+// projected light radius in pixels
+// uses the angular radius of the sphere so it doesn't depend on where on screen the light is
+float lightPixelRadius(PointLight light)
+{
+    vec3 toLight = light.position - u_camPos.xyz;
+    float distanceSquared = dot(toLight, toLight);
+    float radiusSquared = light.radius * light.radius;
+    // camera (almost) inside the light
+    if(distanceSquared <= radiusSquared * 1.01)
+        return 1e30;
+    return u_lightProxyRadiusScale * light.radius / sqrt(distanceSquared - radiusSquared);
+}
+
+uint getLightProxy(float pixelRadius)
+{
+    if(pixelRadius <= u_lightProxyMaxRadius.x)
+        return LIGHT_PROXY_QUAD;
+    if(pixelRadius <= u_lightProxyMaxRadius.y)
+        return LIGHT_PROXY_ICOSPHERE_LOW;
+    if(pixelRadius <= u_lightProxyMaxRadius.z)
+        return LIGHT_PROXY_ICOSPHERE_MEDIUM;
+    return LIGHT_PROXY_ICOSPHERE_HIGH;
+}
+
+// estimated number of fragments covered by a volume on screen
+// projected area (mean over all orientations) times the squared projected radius, at most the whole screen
+float lightScreenCoverage(float area, float pixelRadius)
+{
+    return min(area * pixelRadius * pixelRadius, u_lightProxyScreenPixels);
+}
+
+// estimated number of fragments saved compared to the unit cube
+// both volumes are clamped to the screen first, with the camera inside a light they both cover
+// the whole screen and nothing is saved
+uint lightSavedFragments(float pixelRadius, uint proxy)
+{
+    float cube = lightScreenCoverage(u_lightProxyCubeArea, pixelRadius);
+    float proxyCoverage = lightScreenCoverage(u_lightProxyArea[proxy], pixelRadius);
+    return uint(max(cube - proxyCoverage, 0.0));
+}
+
+#endif // DEFERRED_LIGHTINSTANCES_SH_HEADER_GUARD
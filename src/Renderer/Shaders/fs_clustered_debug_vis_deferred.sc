@@ -1,6 +1,12 @@
 #include <bgfx_shader.sh>
 #include "samplers.sh"
 #include "clusters.sh"
+#ifdef ZBINNING
+#include "zbin.sh"
+#endif
+#ifdef WORLDGRID
+#include "worldgrid.sh"
+#endif
 #include "lights.sh"
 #include "colormap.sh"
 
@@ -18,8 +24,28 @@ void main()
 
     // show light count per cluster
 
-    uint cluster = getClusterIndex(screen);
-    uint lightCount = getLightGridCount(cluster);
+#if defined(ZBINNING)
+    uint tile = getZBinTileIndex(screen);
+    ZBin zbin = getZBin(getZBinIndex(screen2EyeDepth(screen.z, u_zNear, u_zFar)));
+    uint lightCount = 0;
+    for(uint word = zbin.first / 32; word <= zbin.last / 32; word++)
+    {
+        lightCount += countBits(getZBinTileWord(tile, word, zbin));
+    }
+    // no upper limit, clamp to the same color scale
+    lightCount = min(lightCount, u_maxLightsPerCluster);
+#elif defined(WORLDGRID)
+    // lights in the fragment's buckets, no upper limit either
+    uint lightCount = min(getWorldGridLightCount(mul(u_invView, screen2Eye(screen)).xyz), u_maxLightsPerCluster);
+#else
+    // lights from all grids (radius classes), can go past the limit
+    uint lightCount = 0;
+    for(uint grid = 0; grid < getClusterGridCount(); grid++)
+    {
+        lightCount += getLightGridCount(getGridClusterIndex(screen, grid));
+    }
+    lightCount = min(lightCount, u_maxLightsPerCluster);
+#endif
 
     if(lightCount == u_maxLightsPerCluster)
         ++lightCount;
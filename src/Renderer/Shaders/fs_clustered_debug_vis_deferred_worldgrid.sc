@@ -0,0 +1,3 @@
+// world-space light grid instead of the cluster light grid, see worldgrid.sh
+#define WORLDGRID
+#include "fs_clustered_debug_vis_deferred.sc"
@@ -0,0 +1,3 @@
+// z-binning instead of the cluster light grid, see zbin.sh
+#define ZBINNING
+#include "fs_clustered_debug_vis_deferred.sc"
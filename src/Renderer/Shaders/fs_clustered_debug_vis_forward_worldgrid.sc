@@ -0,0 +1,5 @@
+$input v_worldpos, v_normal, v_tangent, v_texcoord0
+
+// world-space light grid instead of the cluster light grid, see worldgrid.sh
+#define WORLDGRID
+#include "clustered_debug_vis_forward.sh"
@@ -4,21 +4,39 @@
 #include "lights.sh"
 #include "util.sh"
 #include "clusters.sh"
+#include "gbuffer.sh"
+#ifdef ZBINNING
+#include "zbin.sh"
+#endif
+#ifdef WORLDGRID
+#include "worldgrid.sh"
+#endif
 
-// G-Buffer
-SAMPLER2D(s_texDiffuseA,          SAMPLER_DEFERRED_DIFFUSE_A);
-SAMPLER2D(s_texNormal,            SAMPLER_DEFERRED_NORMAL);
-SAMPLER2D(s_texF0Metallic,        SAMPLER_DEFERRED_F0_METALLIC);
-SAMPLER2D(s_texEmissiveOcclusion, SAMPLER_DEFERRED_EMISSIVE_OCCLUSION);
-SAMPLER2D(s_texDepth,             SAMPLER_DEFERRED_DEPTH);
+// rendering happens in view space
+vec3 pointLightRadiance(uint lightIndex, vec3 fragPos, vec3 V, vec3 N, float NoV, PBRMaterial mat, vec3 msFactor)
+{
+    PointLight light = getPointLight(lightIndex);
+
+    light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+
+    float dist = distance(light.position, fragPos);
+    float attenuation = smoothAttenuation(dist, light.radius);
+    if(attenuation > 0.0)
+    {
+        vec3 L = normalize(light.position - fragPos);
+        vec3 radianceIn = light.intensity * attenuation;
+        float NoL = saturate(dot(N, L));
+        return BRDF(V, L, N, NoV, NoL, mat) * msFactor * radianceIn * NoL;
+    }
+    return vec3_splat(0.0);
+}
 
 void main()
 {
     vec2 texcoord = gl_FragCoord.xy / u_viewRect.zw;
-    vec4 diffuseA = texture2D(s_texDiffuseA, texcoord);
-    vec3 N = unpackNormal(texture2D(s_texNormal, texcoord).xy);
-    vec4 F0Metallic = texture2D(s_texF0Metallic, texcoord);
-    vec4 emissiveOcclusion = texture2D(s_texEmissiveOcclusion, texcoord);
+    PBRMaterial mat = gBufferMaterial(texcoord);
+    vec3 N = gBufferNormal(texcoord);
+    vec4 emissiveOcclusion = gBufferEmissiveOcclusion(texcoord);
     vec3 emissive = emissiveOcclusion.xyz;
     float occlusion = emissiveOcclusion.w;
 
@@ -26,16 +44,9 @@ void main()
 
     vec3 radianceOut = vec3_splat(0.0);
 
-    radianceOut += getAmbientLight().irradiance * diffuseA.xyz * occlusion;
+    radianceOut += getAmbientLight().irradiance * mat.diffuseColor * occlusion;
     radianceOut += emissive;
 
-    // unpack material parameters used by the PBR BRDF function
-    PBRMaterial mat;
-    mat.diffuseColor = diffuseA.xyz;
-    mat.a = diffuseA.w;
-    mat.F0 = F0Metallic.xyz;
-    mat.metallic = F0Metallic.w;
-
     // get fragment position
     // rendering happens in view space
     vec4 screen = gl_FragCoord;
@@ -48,26 +59,49 @@ void main()
 
     // point lights
 
-    uint cluster = getClusterIndex(screen);
-    uint clusterOffset = getGridLightClusterOffset(cluster);
-    uint lightCount = getLightGridCount(cluster);
-    for(uint i = 0; i < lightCount; i++)
+#if defined(ZBINNING)
+    // z-binning: walk the words of the tile bitmask inside the depth bin's light range
+    uint tile = getZBinTileIndex(screen);
+    ZBin zbin = getZBin(getZBinIndex(fragPos.z));
+    // empty bins have first > last, the loop doesn't run
+    for(uint word = zbin.first / 32; word <= zbin.last / 32; word++)
     {
-        uint lightIndex = getGridLightIndex(clusterOffset, i);
-        PointLight light = getPointLight(lightIndex);
-
-        light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
-
-        float dist = distance(light.position, fragPos);
-        float attenuation = smoothAttenuation(dist, light.radius);
-        if(attenuation > 0.0)
+        uint mask = getZBinTileWord(tile, word, zbin);
+        while(mask != 0)
+        {
+            uint bit = lowestBit(mask);
+            mask &= mask - 1;
+            uint lightIndex = getZBinLightIndex(word * 32 + bit);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+#elif defined(WORLDGRID)
+    // world-space grid: the bucket of the cell containing the fragment
+    // static and moving lights have separate grids
+    vec3 worldPos = mul(u_invView, vec4(fragPos, 1.0)).xyz;
+    for(uint layer = 0; layer < getWorldGridLayerCount(); layer++)
+    {
+        WorldGridBucket bucket = getWorldGridBucket(worldPos, layer);
+        for(uint i = 0; i < bucket.pointLights; i++)
+        {
+            uint lightIndex = getWorldGridLightIndex(bucket, i);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+#else
+    // with radius classes, large lights are in a second, coarser grid
+    for(uint grid = 0; grid < getClusterGridCount(); grid++)
+    {
+        uint cluster = getGridClusterIndex(screen, grid);
+        uint clusterOffset = getGridLightClusterOffset(cluster);
+        uint lightCount = getLightGridCount(cluster);
+        for(uint i = 0; i < lightCount; i++)
         {
-            vec3 L = normalize(light.position - fragPos);
-            vec3 radianceIn = light.intensity * attenuation;
-            float NoL = saturate(dot(N, L));
-            radianceOut += BRDF(V, L, N, NoV, NoL, mat) * msFactor * radianceIn * NoL;
+            uint lightIndex = getGridLightIndex(clusterOffset, i);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
         }
     }
+#endif
 
     gl_FragColor = vec4(radianceOut, 1.0);
 }
@@ -0,0 +1,3 @@
+// world-space light grid instead of the cluster light grid, see worldgrid.sh
+#define WORLDGRID
+#include "fs_clustered_deferred_fullscreen.sc"
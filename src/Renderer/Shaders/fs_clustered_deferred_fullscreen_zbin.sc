@@ -0,0 +1,3 @@
+// z-binning instead of the cluster light grid, see zbin.sh
+#define ZBINNING
+#include "fs_clustered_deferred_fullscreen.sc"
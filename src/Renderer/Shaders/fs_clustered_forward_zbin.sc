@@ -0,0 +1,5 @@
+$input v_worldpos, v_normal, v_tangent, v_texcoord0
+
+// z-binning instead of the cluster light grid, see zbin.sh
+#define ZBINNING
+#include "clustered_forward.sh"
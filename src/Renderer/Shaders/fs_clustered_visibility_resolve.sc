@@ -0,0 +1,101 @@
+#define READ_MATERIAL
+#define PBR_TEXCOORD_GRAD
+
+#include <bgfx_shader.sh>
+#include "samplers.sh"
+#include "pbr.sh"
+#include "lights.sh"
+#include "util.sh"
+#include "clusters.sh"
+#include "visibility.sh"
+
+SAMPLER2D(s_texDepth, SAMPLER_DEFERRED_DEPTH);
+
+// rendering happens in view space
+vec3 pointLightRadiance(uint lightIndex, vec3 fragPos, vec3 V, vec3 N, float NoV, PBRMaterial mat, vec3 msFactor)
+{
+    PointLight light = getPointLight(lightIndex);
+
+    light.position = mul(u_view, vec4(light.position, 1.0)).xyz;
+
+    float dist = distance(light.position, fragPos);
+    float attenuation = smoothAttenuation(dist, light.radius);
+    if(attenuation > 0.0)
+    {
+        vec3 L = normalize(light.position - fragPos);
+        vec3 radianceIn = light.intensity * attenuation;
+        float NoL = saturate(dot(N, L));
+        return BRDF(V, L, N, NoV, NoL, mat) * msFactor * radianceIn * NoL;
+    }
+    return vec3_splat(0.0);
+}
+
+void main()
+{
+    // the material depth test made sure this pixel's triangle uses the bound material
+
+    uint id = getVisibilityId(gl_FragCoord.xy);
+    uint firstIndex = floatBitsToUint(getVisibilityDrawData(getVisibilityDraw(id)).x) + getVisibilityTriangle(id) * 3u;
+
+    VisibilityVertex v0 = getVisibilityVertex(firstIndex + 0u);
+    VisibilityVertex v1 = getVisibilityVertex(firstIndex + 1u);
+    VisibilityVertex v2 = getVisibilityVertex(firstIndex + 2u);
+
+    // model matrix is the identity for all meshes
+    VisibilityBarycentrics bary = visibilityBarycentrics(mul(u_viewProj, vec4(v0.position, 1.0)),
+                                                         mul(u_viewProj, vec4(v1.position, 1.0)),
+                                                         mul(u_viewProj, vec4(v2.position, 1.0)),
+                                                         screen2Ndc(gl_FragCoord.xy));
+
+    // interpolate vertex attributes
+    // there are no varyings and no helper lanes, so texture gradients are calculated from the barycentrics
+    vec2 texcoord = interpolateVisibility(bary.lambda, v0.texcoord, v1.texcoord, v2.texcoord);
+    vec2 texcoordDx = interpolateVisibility(bary.ddx, v0.texcoord, v1.texcoord, v2.texcoord);
+    vec2 texcoordDy = interpolateVisibility(bary.ddy, v0.texcoord, v1.texcoord, v2.texcoord);
+    vec3 normal = interpolateVisibility(bary.lambda, v0.normal, v1.normal, v2.normal);
+    vec3 tangent = interpolateVisibility(bary.lambda, v0.tangent, v1.tangent, v2.tangent);
+
+    PBRMaterial mat = pbrMaterial(texcoord, texcoordDx, texcoordDy);
+    vec3 N = convertTangentNormal(normal, tangent, mat.normal);
+    // uses the derivatives of the vertex normal, the deferred renderers include the normal map
+    mat.a = specularAntiAliasingGrad(interpolateVisibility(bary.ddx, v0.normal, v1.normal, v2.normal),
+                                     interpolateVisibility(bary.ddy, v0.normal, v1.normal, v2.normal),
+                                     mat.a);
+
+    // same space as the deferred renderers
+    N = mul(u_view, vec4(N, 0.0)).xyz;
+
+    // ambient light + occlusion
+
+    vec3 radianceOut = vec3_splat(0.0);
+
+    radianceOut += getAmbientLight().irradiance * mat.diffuseColor * mat.occlusion;
+    radianceOut += mat.emissive;
+
+    // get fragment position
+    // gl_FragCoord.z is the material depth, read the visibility buffer's depth instead
+    vec4 screen = gl_FragCoord;
+    screen.z = texture2D(s_texDepth, gl_FragCoord.xy / u_viewRect.zw).x;
+    vec3 fragPos = screen2Eye(screen).xyz;
+
+    vec3 V = normalize(-fragPos);
+    float NoV = abs(dot(N, V)) + 1e-5;
+    vec3 msFactor = multipleScatteringFactor(mat, NoV);
+
+    // point lights
+
+    // with radius classes, large lights are in a second, coarser grid
+    for(uint grid = 0; grid < getClusterGridCount(); grid++)
+    {
+        uint cluster = getGridClusterIndex(screen, grid);
+        uint clusterOffset = getGridLightClusterOffset(cluster);
+        uint lightCount = getLightGridCount(cluster);
+        for(uint i = 0; i < lightCount; i++)
+        {
+            uint lightIndex = getGridLightIndex(clusterOffset, i);
+            radianceOut += pointLightRadiance(lightIndex, fragPos, V, N, NoV, mat, msFactor);
+        }
+    }
+
+    gl_FragColor = vec4(radianceOut, 1.0);
+}
@@ -1,10 +1,12 @@
 $input v_normal, v_tangent, v_texcoord0
 
 #define READ_MATERIAL
+#define WRITE_GBUFFER
 
 #include <bgfx_shader.sh>
 #include "util.sh"
 #include "pbr.sh"
+#include "gbuffer.sh"
 
 void main()
 {
@@ -20,8 +22,19 @@ void main()
     N = mul(u_view, vec4(N, 0.0)).xyz;
 
     // pack G-Buffer
-    gl_FragData[0] = vec4(mat.diffuseColor, mat.a);
-    gl_FragData[1] = vec4(packNormal(N), 0.0, 0.0);
-    gl_FragData[2] = vec4(mat.F0, mat.metallic);
-    gl_FragData[3] = vec4(mat.emissive, mat.occlusion);
+    if(u_thinGBuffer)
+    {
+        // store perceptual roughness, a is squared again when reading
+        // writes to missing attachments are dropped
+        gl_FragData[0] = vec4(mat.albedo.rgb, mat.metallic);
+        gl_FragData[1] = vec4(packNormalOctahedral(N), sqrt(mat.a), 0.0);
+        gl_FragData[2] = vec4(mat.emissive, mat.occlusion);
+    }
+    else
+    {
+        gl_FragData[0] = vec4(mat.diffuseColor, mat.a);
+        gl_FragData[1] = vec4(packNormal(N), 0.0, 0.0);
+        gl_FragData[2] = vec4(mat.F0, mat.metallic);
+        gl_FragData[3] = vec4(mat.emissive, mat.occlusion);
+    }
 }
@@ -5,29 +5,16 @@ $input v_lightIndex
 #include "pbr.sh"
 #include "lights.sh"
 #include "util.sh"
-
-// G-Buffer
-SAMPLER2D(s_texDiffuseA,          SAMPLER_DEFERRED_DIFFUSE_A);
-SAMPLER2D(s_texNormal,            SAMPLER_DEFERRED_NORMAL);
-SAMPLER2D(s_texF0Metallic,        SAMPLER_DEFERRED_F0_METALLIC);
-SAMPLER2D(s_texDepth,             SAMPLER_DEFERRED_DEPTH);
+#include "gbuffer.sh"
 
 #define lightIndex uint(v_lightIndex.x)
 
 void main()
 {
     vec2 texcoord = gl_FragCoord.xy / u_viewRect.zw;
-    
-    vec4 diffuseA = texture2D(s_texDiffuseA, texcoord);
-    vec3 N = unpackNormal(texture2D(s_texNormal, texcoord).xy);
-    vec4 F0Metallic = texture2D(s_texF0Metallic, texcoord);
-
-    // unpack material parameters used by the PBR BRDF function
-    PBRMaterial mat;
-    mat.diffuseColor = diffuseA.xyz;
-    mat.a = diffuseA.w;
-    mat.F0 = F0Metallic.xyz;
-    mat.metallic = F0Metallic.w;
+
+    PBRMaterial mat = gBufferMaterial(texcoord);
+    vec3 N = gBufferNormal(texcoord);
 
     // get fragment position
     // rendering happens in view space
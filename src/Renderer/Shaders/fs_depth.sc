@@ -0,0 +1,8 @@
+#include <bgfx_shader.sh>
+
+// depth only, color writes are disabled
+
+void main()
+{
+    gl_FragColor = vec4_splat(0.0);
+}
@@ -4,21 +4,14 @@
 #include "lights.sh"
 #include "util.sh"
 #include "tiles.sh"
-
-// G-Buffer
-SAMPLER2D(s_texDiffuseA,          SAMPLER_DEFERRED_DIFFUSE_A);
-SAMPLER2D(s_texNormal,            SAMPLER_DEFERRED_NORMAL);
-SAMPLER2D(s_texF0Metallic,        SAMPLER_DEFERRED_F0_METALLIC);
-SAMPLER2D(s_texEmissiveOcclusion, SAMPLER_DEFERRED_EMISSIVE_OCCLUSION);
-SAMPLER2D(s_texDepth,             SAMPLER_DEFERRED_DEPTH);
+#include "gbuffer.sh"
 
 void main()
 {
     vec2 texcoord = gl_FragCoord.xy / u_viewRect.zw;
-    vec4 diffuseA = texture2D(s_texDiffuseA, texcoord);
-    vec3 N = unpackNormal(texture2D(s_texNormal, texcoord).xy);
-    vec4 F0Metallic = texture2D(s_texF0Metallic, texcoord);
-    vec4 emissiveOcclusion = texture2D(s_texEmissiveOcclusion, texcoord);
+    PBRMaterial mat = gBufferMaterial(texcoord);
+    vec3 N = gBufferNormal(texcoord);
+    vec4 emissiveOcclusion = gBufferEmissiveOcclusion(texcoord);
     vec3 emissive = emissiveOcclusion.xyz;
     float occlusion = emissiveOcclusion.w;
 
@@ -26,16 +19,9 @@ void main()
 
     vec3 radianceOut = vec3_splat(0.0);
 
-    radianceOut += getAmbientLight().irradiance * diffuseA.xyz * occlusion;
+    radianceOut += getAmbientLight().irradiance * mat.diffuseColor * occlusion;
     radianceOut += emissive;
 
-    // unpack material parameters used by the PBR BRDF function
-    PBRMaterial mat;
-    mat.diffuseColor = diffuseA.xyz;
-    mat.a = diffuseA.w;
-    mat.F0 = F0Metallic.xyz;
-    mat.metallic = F0Metallic.w;
-
     // get fragment position
     // rendering happens in view space
     vec4 screen = gl_FragCoord;
@@ -0,0 +1,9 @@
+#include <bgfx_shader.sh>
+#include "visibility.sh"
+
+void main()
+{
+    // gl_PrimitiveID counts triangles from the start of the draw call
+    // that's the triangle's position in the mesh's index buffer
+    gl_FragColor = packVisibility(u_visibilityDraw, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,17 @@
+#include <bgfx_shader.sh>
+#include "visibility.sh"
+
+// write each pixel's material as depth
+// the resolve pass draws one fullscreen triangle per material with an equal depth test
+// so every pixel is shaded exactly once, by its material's program state
+
+void main()
+{
+    uint id = getVisibilityId(gl_FragCoord.xy);
+    // background keeps the cleared depth (1.0), no material gets drawn there
+    if(id == 0u)
+        discard;
+
+    gl_FragDepth = getVisibilityDrawData(getVisibilityDraw(id)).y;
+    gl_FragColor = vec4_splat(0.0);
+}
@@ -0,0 +1,66 @@
+#ifndef GBUFFER_SH_HEADER_GUARD
+#define GBUFFER_SH_HEADER_GUARD
+
+#include "samplers.sh"
+#include "pbr.sh"
+#include "util.sh"
+
+// G-Buffer layout, see GBuffer.h
+// picked at runtime so we don't need a second set of shaders for every deferred renderer
+uniform vec4 u_gBufferVec;
+#define u_thinGBuffer          (u_gBufferVec.x != 0.0)
+#define u_hasEmissiveOcclusion (u_gBufferVec.y != 0.0)
+
+// define WRITE_GBUFFER in the geometry pass
+// the G-Buffer samplers clash with the material samplers
+#ifndef WRITE_GBUFFER
+
+SAMPLER2D(s_texDiffuseA,          SAMPLER_DEFERRED_DIFFUSE_A);
+SAMPLER2D(s_texNormal,            SAMPLER_DEFERRED_NORMAL);
+SAMPLER2D(s_texF0Metallic,        SAMPLER_DEFERRED_F0_METALLIC);
+SAMPLER2D(s_texEmissiveOcclusion, SAMPLER_DEFERRED_EMISSIVE_OCCLUSION);
+SAMPLER2D(s_texDepth,             SAMPLER_DEFERRED_DEPTH);
+
+// unpack material parameters used by the PBR BRDF function
+PBRMaterial gBufferMaterial(vec2 texcoord)
+{
+    PBRMaterial mat;
+    vec4 diffuseA = texture2D(s_texDiffuseA, texcoord);
+    if(u_thinGBuffer)
+    {
+        // base color + metallic, derive the rest like the forward renderers
+        mat.albedo = vec4(diffuseA.xyz, 1.0);
+        mat.metallic = diffuseA.w;
+        mat.roughness = texture2D(s_texNormal, texcoord).z;
+        mat = pbrInitMaterial(mat);
+    }
+    else
+    {
+        vec4 F0Metallic = texture2D(s_texF0Metallic, texcoord);
+        mat.diffuseColor = diffuseA.xyz;
+        mat.a = diffuseA.w;
+        mat.F0 = F0Metallic.xyz;
+        mat.metallic = F0Metallic.w;
+    }
+    return mat;
+}
+
+// view space normal
+vec3 gBufferNormal(vec2 texcoord)
+{
+    vec2 encoded = texture2D(s_texNormal, texcoord).xy;
+    return u_thinGBuffer ? unpackNormalOctahedral(encoded) : unpackNormal(encoded);
+}
+
+// RGB = emissive radiance, A = occlusion multiplier
+vec4 gBufferEmissiveOcclusion(vec2 texcoord)
+{
+    if(u_hasEmissiveOcclusion)
+        return texture2D(s_texEmissiveOcclusion, texcoord);
+    else
+        return vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+#endif // WRITE_GBUFFER
+
+#endif // GBUFFER_SH_HEADER_GUARD
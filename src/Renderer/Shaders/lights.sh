@@ -5,14 +5,25 @@
 #include "samplers.sh"
 
 uniform vec4 u_lightCountVec;
-#define u_pointLightCount uint(u_lightCountVec.x)
+// split into 16 bit halves, floats are only exact up to 2^24
+// see LightShader::packLightCount
+#define u_pointLightCount (uint(u_lightCountVec.x) * 65536u + uint(u_lightCountVec.y))
+
+// 1D dispatches over all lights use at most this many work groups (the smallest limit of all backends)
+// each thread handles every (MAX_LIGHT_DISPATCH_GROUPS * group size)-th light
+// see LightShader::getLightDispatchGroups
+#define MAX_LIGHT_DISPATCH_GROUPS 65535u
 
 uniform vec4 u_ambientLightIrradiance;
 
 // for each light:
-//   vec4 position (w is padding)
-//   vec4 intensity + radius (xyz is intensity, w is radius)
+//   vec4 position + intensity (xyz is position, w is the intensity packed as RGB9E5 bits)
+// see PointLightVertex
+#ifdef WRITE_LIGHTS
+BUFFER_RW(b_pointLights, vec4, SAMPLER_LIGHTS_POINTLIGHTS);
+#else
 BUFFER_RO(b_pointLights, vec4, SAMPLER_LIGHTS_POINTLIGHTS);
+#endif
 
 struct PointLight
 {
@@ -57,13 +68,51 @@ uint pointLightCount()
     return u_pointLightCount;
 }
 
+// 9 bit mantissa for each channel, shared 5 bit exponent with a bias of 15
+// same as packRGB9E5 in LightList.cpp
+vec3 unpackRGB9E5(uint packed)
+{
+    float scale = exp2(float(int(packed >> 27) - 15 - 9));
+    return vec3(uvec3(packed, packed >> 9, packed >> 18) & uvec3(0x1ff, 0x1ff, 0x1ff)) * scale;
+}
+
+// same as packRGB9E5 in LightList.cpp
+uint packRGB9E5(vec3 rgb)
+{
+    // largest value that fits: 511/512 * 2^16
+    rgb = clamp(rgb, vec3_splat(0.0), vec3_splat(65408.0));
+    float maxChannel = max(rgb.x, max(rgb.y, rgb.z));
+    if(maxChannel <= 0.0)
+        return 0u;
+
+    int exponent = max(-16, int(floor(log2(maxChannel)))) + 1 + 15;
+    float scale = exp2(float(exponent - 15 - 9));
+    // rounding can overflow the mantissa
+    if(uint(floor(maxChannel / scale + 0.5)) == 512u)
+    {
+        scale *= 2.0;
+        exponent++;
+    }
+
+    uvec3 mantissa = uvec3(floor(rgb / scale + 0.5));
+    return mantissa.x | (mantissa.y << 9) | (mantissa.z << 18) | (uint(exponent) << 27);
+}
+
+// same as PointLight::calculateRadius and PointLightList::packVertices
+float pointLightRadius(vec3 intensity)
+{
+    float maxIntensity = max(intensity.x, max(intensity.y, intensity.z));
+    return sqrt(maxIntensity / max(1.0, 0.05 * maxIntensity));
+}
+
 PointLight getPointLight(uint i)
 {
+    vec4 positionIntensity = b_pointLights[i];
     PointLight light;
-    light.position = b_pointLights[2 * i + 0].xyz;
-    vec4 intensityRadiusVec = b_pointLights[2 * i + 1];
-    light.intensity = intensityRadiusVec.xyz;
-    light.radius = intensityRadiusVec.w;
+    light.position = positionIntensity.xyz;
+    light._padding = 0.0;
+    light.intensity = unpackRGB9E5(floatBitsToUint(positionIntensity.w));
+    light.radius = pointLightRadius(light.intensity);
     return light;
 }
 
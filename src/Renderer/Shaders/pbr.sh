@@ -35,6 +35,18 @@ uniform vec4 u_hasTextures;
 #define u_occlusionStrength       (u_metallicRoughnessNormalOcclusionFactor.w)
 #define u_emissiveFactor          (u_emissiveFactorVec.xyz)
 
+// define PBR_TEXCOORD_GRAD to sample with explicit texture coordinate gradients
+// for shaders where screen-space derivatives don't work (visibility buffer resolve)
+#ifdef PBR_TEXCOORD_GRAD
+#define PBR_TEXCOORD vec2 texcoord, vec2 texcoordDx, vec2 texcoordDy
+#define PBR_TEXCOORD_ARGS texcoord, texcoordDx, texcoordDy
+#define pbrTexture2D(_sampler, _coord) texture2DGrad(_sampler, _coord, texcoordDx, texcoordDy)
+#else
+#define PBR_TEXCOORD vec2 texcoord
+#define PBR_TEXCOORD_ARGS texcoord
+#define pbrTexture2D(_sampler, _coord) texture2D(_sampler, _coord)
+#endif
+
 #endif
 
 uniform vec4 u_multipleScatteringVec;
@@ -63,11 +75,11 @@ struct PBRMaterial
 
 #ifdef READ_MATERIAL
 
-vec4 pbrBaseColor(vec2 texcoord)
+vec4 pbrBaseColor(PBR_TEXCOORD)
 {
     if(u_hasBaseColorTexture)
     {
-        return texture2D(s_texBaseColor, texcoord) * u_baseColorFactor;
+        return pbrTexture2D(s_texBaseColor, texcoord) * u_baseColorFactor;
     }
     else
     {
@@ -75,11 +87,11 @@ vec4 pbrBaseColor(vec2 texcoord)
     }
 }
 
-vec2 pbrMetallicRoughness(vec2 texcoord)
+vec2 pbrMetallicRoughness(PBR_TEXCOORD)
 {
     if(u_hasMetallicRoughnessTexture)
     {
-        return texture2D(s_texMetallicRoughness, texcoord).bg * u_metallicRoughnessFactor;
+        return pbrTexture2D(s_texMetallicRoughness, texcoord).bg * u_metallicRoughnessFactor;
     }
     else
     {
@@ -87,13 +99,13 @@ vec2 pbrMetallicRoughness(vec2 texcoord)
     }
 }
 
-vec3 pbrNormal(vec2 texcoord)
+vec3 pbrNormal(PBR_TEXCOORD)
 {
     if(u_hasNormalTexture)
     {
         // the normal scale can cause problems and serves no real purpose
         // normal compression and BRDF calculations assume unit length
-        return normalize((texture2D(s_texNormal, texcoord).rgb * 2.0) - 1.0); // * u_normalScale;
+        return normalize((pbrTexture2D(s_texNormal, texcoord).rgb * 2.0) - 1.0); // * u_normalScale;
     }
     else
     {
@@ -103,12 +115,12 @@ vec3 pbrNormal(vec2 texcoord)
     }
 }
 
-float pbrOcclusion(vec2 texcoord)
+float pbrOcclusion(PBR_TEXCOORD)
 {
     if(u_hasOcclusionTexture)
     {
         // occludedColor = lerp(color, color * <sampled occlusion texture value>, <occlusion strength>)
-        float occlusion = texture2D(s_texOcclusion, texcoord).r;
+        float occlusion = pbrTexture2D(s_texOcclusion, texcoord).r;
         return occlusion + (1.0 - occlusion) * (1.0 - u_occlusionStrength);
     }
     else
@@ -117,11 +129,11 @@ float pbrOcclusion(vec2 texcoord)
     }
 }
 
-vec3 pbrEmissive(vec2 texcoord)
+vec3 pbrEmissive(PBR_TEXCOORD)
 {
     if(u_hasEmissiveTexture)
     {
-        return texture2D(s_texEmissive, texcoord).rgb * u_emissiveFactor;
+        return pbrTexture2D(s_texEmissive, texcoord).rgb * u_emissiveFactor;
     }
     else
     {
@@ -131,19 +143,19 @@ vec3 pbrEmissive(vec2 texcoord)
 
 PBRMaterial pbrInitMaterial(PBRMaterial mat);
 
-PBRMaterial pbrMaterial(vec2 texcoord)
+PBRMaterial pbrMaterial(PBR_TEXCOORD)
 {
     PBRMaterial mat;
 
     // Read textures/uniforms
 
-    mat.albedo = pbrBaseColor(texcoord);
-    vec2 metallicRoughness = pbrMetallicRoughness(texcoord);
+    mat.albedo = pbrBaseColor(PBR_TEXCOORD_ARGS);
+    vec2 metallicRoughness = pbrMetallicRoughness(PBR_TEXCOORD_ARGS);
     mat.metallic  = metallicRoughness.r;
     mat.roughness = metallicRoughness.g;
-    mat.normal = pbrNormal(texcoord);
-    mat.occlusion = pbrOcclusion(texcoord);
-    mat.emissive = pbrEmissive(texcoord);
+    mat.normal = pbrNormal(PBR_TEXCOORD_ARGS);
+    mat.occlusion = pbrOcclusion(PBR_TEXCOORD_ARGS);
+    mat.emissive = pbrEmissive(PBR_TEXCOORD_ARGS);
 
     mat = pbrInitMaterial(mat);
 
@@ -172,14 +184,12 @@ PBRMaterial pbrInitMaterial(PBRMaterial mat)
     return mat;
 }
 
-// no screenspace derivatives in vertex or compute
-#if BGFX_SHADER_TYPE_FRAGMENT
-
 // Reduce specular aliasing by producing a modified roughness value
 
 // Tokuyoshi et al. 2019. Improved Geometric Specular Antialiasing.
 // http://www.jp.square-enix.com/tech/library/pdf/ImprovedGeometricSpecularAA.pdf
-float specularAntiAliasing(vec3 N, float a)
+// takes the screen-space derivatives of the normal
+float specularAntiAliasingGrad(vec3 dndu, vec3 dndv, float a)
 {
     // normal-based isotropic filtering
     // this is originally meant for deferred rendering but is a bit simpler to implement than the forward version
@@ -188,13 +198,19 @@ float specularAntiAliasing(vec3 N, float a)
     const float SIGMA2 = 0.25; // squared std dev of pixel filter kernel (in pixels)
     const float KAPPA  = 0.18; // clamping threshold
 
-    vec3 dndu = dFdx(N);
-    vec3 dndv = dFdy(N);
     float variance = SIGMA2 * (dot(dndu, dndu) + dot(dndv, dndv));
     float kernelRoughness2 = min(2.0 * variance, KAPPA);
     return saturate(a + kernelRoughness2);
 }
 
+// no screenspace derivatives in vertex or compute
+#if BGFX_SHADER_TYPE_FRAGMENT
+
+float specularAntiAliasing(vec3 N, float a)
+{
+    return specularAntiAliasingGrad(dFdx(N), dFdy(N), a);
+}
+
 #endif
 
 // Physically based shading
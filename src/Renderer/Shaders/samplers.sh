@@ -13,6 +13,21 @@
 
 #define SAMPLER_LIGHTS_POINTLIGHTS 6
 
+// compute only, these share slots with the material textures
+#define SAMPLER_LIGHTS_BVHNODES 1
+#define SAMPLER_LIGHTS_BVHLIGHTINDICES 2
+// counter readback (see CounterReadback)
+#define SAMPLER_READBACK_COUNTERS 1
+#define SAMPLER_READBACK_IMAGE 2
+// light animation (see LightShader::animateLights)
+#define SAMPLER_LIGHTS_MOTION 1
+// deferred light volume instances (see DeferredRenderer)
+#define SAMPLER_DEFERRED_LIGHTINSTANCES 1
+#define SAMPLER_DEFERRED_LIGHTINSTANCECOUNT 2
+#define SAMPLER_DEFERRED_DRAWINDIRECT 3
+// depth of the closest transparent surface (see Renderer::renderTransparentDepth)
+#define SAMPLER_TRANSPARENT_DEPTH 1
+
 // per renderer
 
 #define SAMPLER_DEFERRED_DIFFUSE_A 7
@@ -24,9 +39,35 @@
 #define SAMPLER_CLUSTERS_CLUSTERS 12
 #define SAMPLER_CLUSTERS_LIGHTINDICES 13
 #define SAMPLER_CLUSTERS_LIGHTGRID 14
+#define SAMPLER_CLUSTERS_COUNTERS 15
+
+// compute only, these share slots with the G-Buffer
+#define SAMPLER_CLUSTERS_FLAGS 7
+#define SAMPLER_CLUSTERS_ACTIVECLUSTERS 8
+#define SAMPLER_CLUSTERS_DISPATCHINDIRECT 9
+#define SAMPLER_CLUSTERS_LIGHTCOUNTS 10
+#define SAMPLER_TILES_COUNTERS 7
+
+// visibility buffer (see ClusteredVisibilityRenderer), these share slots with the G-Buffer
+#define SAMPLER_VISIBILITY_IDS 7
+#define SAMPLER_VISIBILITY_VERTICES 8
+#define SAMPLER_VISIBILITY_INDICES 9
+#define SAMPLER_VISIBILITY_DRAWS 10
+
+// z-binning replaces the cluster light grid, these share its slots
+#define SAMPLER_ZBIN_TILEMASKS 12
+#define SAMPLER_ZBIN_LIGHTINDICES 13
+#define SAMPLER_ZBIN_BINS 14
+
+// the world-space light grid replaces the cluster light grid as well
+#define SAMPLER_WORLDGRID_LIGHTINDICES 13
+#define SAMPLER_WORLDGRID_BUCKETS 14
+#define SAMPLER_WORLDGRID_MOVING_LIGHTINDICES 12
+#define SAMPLER_WORLDGRID_MOVING_BUCKETS 15
 
 #define SAMPLER_TILES_TILES 12
 #define SAMPLER_TILES_LIGHTINDICES 13
 #define SAMPLER_TILES_LIGHTGRID 14
+#define SAMPLER_TILES_DEPTHBOUNDS 15
 
 #endif // SAMPLERS_SH_HEADER_GUARD
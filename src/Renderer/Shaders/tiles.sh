@@ -13,6 +13,7 @@ uniform vec4 u_tileCountVec; // count of tiles
 uniform vec4 u_zNearFarVec;
 
 #define u_maxLightsPerTile   ((uint)u_tileSizeVec.z)
+#define u_tileDepthBounds    ((uint)u_tileSizeVec.w)
 #define u_tileSize           ((uvec2)u_tileSizeVec.xy)
 #define u_tileCount          ((uvec2)u_tileCountVec.xy)
 #define u_zNear              u_zNearFarVec.x
@@ -26,20 +27,48 @@ uniform vec4 u_zNearFarVec;
 
 // light indices belonging to tiles
 TILE_BUFFER(b_tileLightIndices, uint, SAMPLER_TILES_LIGHTINDICES);
-// for each tile: number of point lights
+// for each tile: offset into the light index list and number of point lights
+// light culling on the GPU reserves u_maxLightsPerTile indices for each tile
+// light culling on the CPU uploads a compacted list
 TILE_BUFFER(b_tileLightGrid, uint, SAMPLER_TILES_LIGHTGRID);
 
 // these are only needed for building tiles and light culling, not in the fragment shader
 #ifdef WRITE_TILES
 // list of tiles (4 vec4's each, frustrum planes)
 TILE_BUFFER(b_tiles, vec4, SAMPLER_TILES_TILES);
+// for each tile: eye space min and max depth of opaque geometry (as uint bits) and depth slice mask
+// 3 uints each, see TileDepth
+TILE_BUFFER(b_tileDepthBounds, uint, SAMPLER_TILES_DEPTHBOUNDS);
+// overflow statistics, reset to 0 every frame and read back by TileShader
+// index 0: number of tiles with a full light list
+// index 1: most lights found in a single tile
+TILE_BUFFER(b_tileCounters, uint, SAMPLER_TILES_COUNTERS);
+#define TILE_COUNTER_OVERFLOWED_TILES 0
+#define TILE_COUNTER_MAX_LIGHTS 1
 #endif
 
+// see TileShader::DepthBoundsMode
+#define TILE_DEPTH_BOUNDS_OFF 0
+#define TILE_DEPTH_BOUNDS_MINMAX 1
+#define TILE_DEPTH_BOUNDS_MASK 2
+
+// 2.5D culling splits the depth bounds of a tile into slices
+// the mask has one bit per slice containing geometry
+#define TILE_DEPTH_SLICES 32
+
 struct Tile
 {
     vec4 frustrumPlanes[4];
 };
 
+struct TileDepth
+{
+    float minDepth;
+    float maxDepth;
+    float sliceScale;
+    uint mask;
+};
+
 #ifdef WRITE_TILES
 bool isTileValid(uint tileIndex)
 {
@@ -73,16 +102,84 @@ Tile getTile(uint index)
     }
     return tile;
 }
+
+float getTileDepthSliceScale(float minDepth, float maxDepth)
+{
+    return float(TILE_DEPTH_SLICES) / max(maxDepth - minDepth, 0.0001);
+}
+
+uint getTileDepthSlice(float eyeDepth, TileDepth depth)
+{
+    return uint(clamp((eyeDepth - depth.minDepth) * depth.sliceScale, 0.0, float(TILE_DEPTH_SLICES - 1)));
+}
+
+// depth range to cull lights against
+// without depth bounds this is the whole view frustum
+TileDepth getTileDepth(uint index)
+{
+    TileDepth depth;
+    if(u_tileDepthBounds == TILE_DEPTH_BOUNDS_OFF || !isTileValid(index))
+    {
+        depth.minDepth = u_zNear;
+        depth.maxDepth = u_zFar;
+        depth.mask = 0xFFFFFFFF;
+    }
+    else
+    {
+        depth.minDepth = uintBitsToFloat(b_tileDepthBounds[3 * index + 0]);
+        depth.maxDepth = uintBitsToFloat(b_tileDepthBounds[3 * index + 1]);
+        depth.mask = b_tileDepthBounds[3 * index + 2];
+    }
+    depth.sliceScale = getTileDepthSliceScale(depth.minDepth, depth.maxDepth);
+    return depth;
+}
+
+// depth test for a light's bounding sphere in eye space
+bool sphereIntersectsTileDepth(vec3 center, float radius, TileDepth depth)
+{
+    float lightMin = center.z - radius;
+    float lightMax = center.z + radius;
+    if(lightMax <= depth.minDepth || lightMin >= depth.maxDepth)
+        return false;
+
+    // compare the slices covered by the light with the slices containing geometry
+    // empty tiles have no bits set
+    uint first = getTileDepthSlice(lightMin, depth);
+    uint last = getTileDepthSlice(lightMax, depth);
+    uint lightMask = (0xFFFFFFFF >> (31 - last)) & (0xFFFFFFFF << first);
+    return (lightMask & depth.mask) != 0;
+}
+
+// offset of the light indices reserved for a tile
+uint getTileLightIndicesOffset(uint tile)
+{
+    return tile * u_maxLightsPerTile;
+}
+
+void setLightGrid(uint tile, uint offset, uint count)
+{
+    b_tileLightGrid[2 * tile + 0] = offset;
+    b_tileLightGrid[2 * tile + 1] = count;
+}
+
+// count is the number of intersecting lights found before culling stopped
+// a full list counts as overflowed, we can't tell if any lights were dropped
+void recordTileLightCount(uint count)
+{
+    if(count >= u_maxLightsPerTile)
+        atomicAdd(b_tileCounters[TILE_COUNTER_OVERFLOWED_TILES], 1);
+    atomicMax(b_tileCounters[TILE_COUNTER_MAX_LIGHTS], count);
+}
 #endif
 
 uint getLightGridCount(uint tile)
 {
-    return b_tileLightGrid[tile];
+    return b_tileLightGrid[2 * tile + 1];
 }
 
 uint getGridLightTileOffset(uint tile)
 {
-    return tile * u_maxLightsPerTile;
+    return b_tileLightGrid[2 * tile + 0];
 }
 
 uint getGridLightIndex(uint tileOffset, uint offset)
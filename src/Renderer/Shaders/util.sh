@@ -84,4 +84,30 @@ vec3 unpackNormal(vec2 encoded)
     return vec3(fenc * g, -(1.0 - f * 0.5));
 }
 
+// octahedral normal encoding
+// works for any direction so the normal doesn't have to be in view space
+// and spreads precision evenly, good enough for 10 bit unorm channels
+// https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+
+vec2 octahedralWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 packNormalOctahedral(vec3 normal)
+{
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    vec2 encoded = normal.z >= 0.0 ? normal.xy : octahedralWrap(normal.xy);
+    return encoded * 0.5 + 0.5;
+}
+
+vec3 unpackNormalOctahedral(vec2 encoded)
+{
+    encoded = encoded * 2.0 - 1.0;
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = saturate(-normal.z);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+    return normalize(normal);
+}
+
 #endif // UTIL_SH_HEADER_GUARD
@@ -0,0 +1,162 @@
+#ifndef VISIBILITY_SH_HEADER_GUARD
+#define VISIBILITY_SH_HEADER_GUARD
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+
+// visibility buffer, see ClusteredVisibilityRenderer
+// every pixel stores a 32-bit ID: (draw + 1) << triangle bits | triangle
+// 0 is empty (background)
+// bgfx has no integer render targets so it's split into the bytes of an RGBA8 target
+
+uniform vec4 u_visibilityVec;
+#define u_triangleBits   (uint(u_visibilityVec.x))
+#define u_visibilityDraw (uint(u_visibilityVec.y)) // geometry pass
+#define u_materialDepth  (u_visibilityVec.z)       // resolve pass, see vs_visibility_resolve.sc
+
+SAMPLER2D(s_texVisibility, SAMPLER_VISIBILITY_IDS);
+
+// Scene::fetchVertexBuffer, 3 vec4 per vertex
+// see Mesh::FetchVertex
+BUFFER_RO(b_visibilityVertices, vec4, SAMPLER_VISIBILITY_VERTICES);
+// Scene::fetchIndexBuffer
+BUFFER_RO(b_visibilityIndices, uint, SAMPLER_VISIBILITY_INDICES);
+// for each draw:
+//   x = first index in b_visibilityIndices (uint bits)
+//   y = material depth
+BUFFER_RO(b_visibilityDraws, vec4, SAMPLER_VISIBILITY_DRAWS);
+
+struct VisibilityVertex
+{
+    vec3 position;
+    vec3 normal;
+    vec3 tangent;
+    vec2 texcoord;
+};
+
+// perspective-correct barycentric coordinates and their screen-space derivatives
+struct VisibilityBarycentrics
+{
+    vec3 lambda;
+    vec3 ddx;
+    vec3 ddy;
+};
+
+vec4 packVisibility(uint draw, uint triangle)
+{
+    uint id = ((draw + 1u) << u_triangleBits) | triangle;
+    uvec4 bytes = uvec4(id, id >> 8u, id >> 16u, id >> 24u) & uvec4(255u, 255u, 255u, 255u);
+    return vec4(bytes) / 255.0;
+}
+
+uint unpackVisibility(vec4 packed)
+{
+    uvec4 bytes = uvec4(packed * 255.0 + 0.5);
+    return bytes.x | (bytes.y << 8u) | (bytes.z << 16u) | (bytes.w << 24u);
+}
+
+uint getVisibilityId(vec2 fragCoord)
+{
+    return unpackVisibility(texture2D(s_texVisibility, fragCoord / u_viewRect.zw));
+}
+
+// only valid for id != 0
+uint getVisibilityDraw(uint id)
+{
+    return (id >> u_triangleBits) - 1u;
+}
+
+uint getVisibilityTriangle(uint id)
+{
+    return id & ((1u << u_triangleBits) - 1u);
+}
+
+vec4 getVisibilityDrawData(uint draw)
+{
+    return b_visibilityDraws[draw];
+}
+
+VisibilityVertex getVisibilityVertex(uint index)
+{
+    uint vertex = b_visibilityIndices[index];
+    vec4 positionU = b_visibilityVertices[vertex * 3u + 0u];
+    vec4 normalV   = b_visibilityVertices[vertex * 3u + 1u];
+    vec4 tangent   = b_visibilityVertices[vertex * 3u + 2u];
+
+    VisibilityVertex result;
+    result.position = positionU.xyz;
+    result.normal = normalV.xyz;
+    result.tangent = tangent.xyz;
+    result.texcoord = vec2(positionU.w, normalV.w);
+    return result;
+}
+
+// from screen coordinates (gl_FragCoord) to NDC
+vec2 screen2Ndc(vec2 coord)
+{
+    vec2 ndc = 2.0 * (coord - u_viewRect.xy) / u_viewRect.zw - 1.0;
+#if !BGFX_SHADER_LANGUAGE_GLSL
+    // y is flipped
+    ndc.y = -ndc.y;
+#endif
+    return ndc;
+}
+
+// Schied, Dachsbacher. 2015. Deferred Attribute Interpolation for Memory-Efficient Deferred Shading.
+// http://cg.ivd.kit.edu/publications/2015/dais/DAIS.pdf
+// analytical version from
+// http://filmicworlds.com/blog/visibility-buffer-rendering-with-material-graphs/
+// pt0-2 are the triangle's vertices in clip space
+VisibilityBarycentrics visibilityBarycentrics(vec4 pt0, vec4 pt1, vec4 pt2, vec2 pixelNdc)
+{
+    VisibilityBarycentrics result;
+
+    vec3 invW = 1.0 / vec3(pt0.w, pt1.w, pt2.w);
+
+    vec2 ndc0 = pt0.xy * invW.x;
+    vec2 ndc1 = pt1.xy * invW.y;
+    vec2 ndc2 = pt2.xy * invW.z;
+
+    float invDet = 1.0 / ((ndc2.x - ndc1.x) * (ndc0.y - ndc1.y) - (ndc2.y - ndc1.y) * (ndc0.x - ndc1.x));
+    vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float ddxSum = dot(ddx, vec3_splat(1.0));
+    float ddySum = dot(ddy, vec3_splat(1.0));
+
+    vec2 deltaVec = pixelNdc - ndc0;
+    float interpInvW = invW.x + deltaVec.x * ddxSum + deltaVec.y * ddySum;
+    float interpW = 1.0 / interpInvW;
+
+    result.lambda = interpW * (vec3(invW.x, 0.0, 0.0) + deltaVec.x * ddx + deltaVec.y * ddy);
+
+    // NDC to pixels
+    vec2 ndcPerPixel = 2.0 / u_viewRect.zw;
+#if !BGFX_SHADER_LANGUAGE_GLSL
+    ndcPerPixel.y = -ndcPerPixel.y;
+#endif
+    ddx *= ndcPerPixel.x;
+    ddy *= ndcPerPixel.y;
+    ddxSum *= ndcPerPixel.x;
+    ddySum *= ndcPerPixel.y;
+
+    float interpW_ddx = 1.0 / (interpInvW + ddxSum);
+    float interpW_ddy = 1.0 / (interpInvW + ddySum);
+
+    result.ddx = interpW_ddx * (result.lambda * interpInvW + ddx) - result.lambda;
+    result.ddy = interpW_ddy * (result.lambda * interpInvW + ddy) - result.lambda;
+
+    return result;
+}
+
+// works for derivatives too, pass ddx or ddy instead of lambda
+vec2 interpolateVisibility(vec3 lambda, vec2 v0, vec2 v1, vec2 v2)
+{
+    return v0 * lambda.x + v1 * lambda.y + v2 * lambda.z;
+}
+
+vec3 interpolateVisibility(vec3 lambda, vec3 v0, vec3 v1, vec3 v2)
+{
+    return v0 * lambda.x + v1 * lambda.y + v2 * lambda.z;
+}
+
+#endif // VISIBILITY_SH_HEADER_GUARD
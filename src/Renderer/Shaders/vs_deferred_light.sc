@@ -1,13 +1,38 @@
-$input a_position, i_data0, i_data1, i_data2, i_data3, i_data4
+$input a_position, i_data0
 $output v_lightIndex
 
 #include <bgfx_shader.sh>
+#include "lights.sh"
+
+uniform vec4 u_camPos;
 
 void main()
 {
-    mat4 model = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    // position and radius come from the light buffer instead of a model matrix
+    // so lights animated on the GPU don't need the CPU to know where they are
+    PointLight light = getPointLight(uint(i_data0.x));
+
+    vec3 worldPos;
+    if(i_data0.y > 0.5)
+    {
+        // screen-space quad for small lights
+        // perpendicular to the view ray at the back of the light, big enough to cover its silhouette
+        // only used when the camera is far outside the light, see deferred_lightinstances.sh
+        vec3 toLight = light.position - u_camPos.xyz;
+        float dist = length(toLight);
+        vec3 dir = toLight / dist;
+        vec3 camUp = mul(u_invView, vec4(0.0, 1.0, 0.0, 0.0)).xyz;
+        vec3 right = normalize(cross(camUp, dir));
+        vec3 up = cross(dir, right);
+        float back = dist + light.radius;
+        float size = back * light.radius / sqrt(max(dist * dist - light.radius * light.radius, 1e-6));
+        worldPos = u_camPos.xyz + dir * back + (right * a_position.x + up * a_position.y) * size;
+    }
+    else
+    {
+        worldPos = light.position + a_position * light.radius;
+    }
 
-    vec4 worldPos = mul(model, vec4(a_position, 1.0));
-    gl_Position = mul(u_viewProj, worldPos);
-    v_lightIndex = i_data4;
+    gl_Position = mul(u_viewProj, vec4(worldPos, 1.0));
+    v_lightIndex = i_data0;
 }
@@ -0,0 +1,15 @@
+$input a_position
+
+#include <bgfx_shader.sh>
+#include "visibility.sh"
+
+void main()
+{
+    // fullscreen triangle at the depth of the material we're resolving
+    // this is a multiple of 2^-16, exact in clip space and in the depth buffer
+    float depth = u_materialDepth;
+#if BGFX_SHADER_LANGUAGE_GLSL
+    depth = 2.0 * depth - 1.0; // -> [-1, 1]
+#endif
+    gl_Position = vec4(a_position.xy, depth, 1.0);
+}
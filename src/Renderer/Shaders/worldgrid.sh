@@ -0,0 +1,94 @@
+#ifndef WORLDGRID_SH_HEADER_GUARD
+#define WORLDGRID_SH_HEADER_GUARD
+
+// camera-independent light lists: lights are assigned to the cells of a uniform grid in world space
+// only occupied cells matter, so cells are hashed into a fixed number of buckets
+// each bucket has a light list, a fragment looks up the bucket of the cell containing its world position
+// hash collisions only add lights that don't reach the fragment, the attenuation takes care of them
+// the grid only changes when lights change, moving the camera doesn't need any culling
+// there are two grids (layers) with their own buckets, one for static lights and one for moving lights
+// so animating lights doesn't rebuild the static one, see WorldGridShader
+
+// WORLDGRID has to be defined before including clusters.sh, the cluster light grid shares slots with these buffers
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+
+uniform vec4 u_worldGridVec;
+
+#define u_worldGridCellSize          u_worldGridVec.x
+// power of two
+#define u_worldGridBucketCount       ((uint)u_worldGridVec.y)
+#define u_worldGridMovingBucketCount ((uint)u_worldGridVec.z)
+
+// light indices belonging to buckets
+// compacted global list, each bucket owns a contiguous range
+BUFFER_RO(b_worldGridLightIndices, uint, SAMPLER_WORLDGRID_LIGHTINDICES);
+// for each bucket: offset into the light index list and number of point lights
+// 2 uints each like the cluster light grid
+BUFFER_RO(b_worldGridBuckets, uint, SAMPLER_WORLDGRID_BUCKETS);
+// same for moving lights
+BUFFER_RO(b_worldGridMovingLightIndices, uint, SAMPLER_WORLDGRID_MOVING_LIGHTINDICES);
+BUFFER_RO(b_worldGridMovingBuckets, uint, SAMPLER_WORLDGRID_MOVING_BUCKETS);
+
+#define WORLDGRID_LAYER_STATIC 0
+#define WORLDGRID_LAYER_MOVING 1
+
+struct WorldGridBucket
+{
+    uint layer;
+    uint offset;
+    uint pointLights;
+};
+
+uint getWorldGridLayerCount()
+{
+    return 2;
+}
+
+// must match WorldGridShader::getBucket
+uint getWorldGridBucketIndex(vec3 worldPos, uint bucketCount)
+{
+    uvec3 cell = uvec3(ivec3(floor(worldPos / u_worldGridCellSize)));
+    uint hash = (cell.x * 73856093u) ^ (cell.y * 19349663u) ^ (cell.z * 83492791u);
+    return hash & (bucketCount - 1u);
+}
+
+WorldGridBucket getWorldGridBucket(vec3 worldPos, uint layer)
+{
+    WorldGridBucket result;
+    result.layer = layer;
+    if(layer == WORLDGRID_LAYER_STATIC)
+    {
+        uint bucket = getWorldGridBucketIndex(worldPos, u_worldGridBucketCount);
+        result.offset = b_worldGridBuckets[2 * bucket + 0];
+        result.pointLights = b_worldGridBuckets[2 * bucket + 1];
+    }
+    else
+    {
+        uint bucket = getWorldGridBucketIndex(worldPos, u_worldGridMovingBucketCount);
+        result.offset = b_worldGridMovingBuckets[2 * bucket + 0];
+        result.pointLights = b_worldGridMovingBuckets[2 * bucket + 1];
+    }
+    return result;
+}
+
+uint getWorldGridLightIndex(WorldGridBucket bucket, uint offset)
+{
+    if(bucket.layer == WORLDGRID_LAYER_STATIC)
+        return b_worldGridLightIndices[bucket.offset + offset];
+    return b_worldGridMovingLightIndices[bucket.offset + offset];
+}
+
+// lights in the buckets of all layers
+uint getWorldGridLightCount(vec3 worldPos)
+{
+    uint lightCount = 0;
+    for(uint layer = 0; layer < getWorldGridLayerCount(); layer++)
+    {
+        lightCount += getWorldGridBucket(worldPos, layer).pointLights;
+    }
+    return lightCount;
+}
+
+#endif // WORLDGRID_SH_HEADER_GUARD
@@ -0,0 +1,103 @@
+#ifndef ZBIN_SH_HEADER_GUARD
+#define ZBIN_SH_HEADER_GUARD
+
+// decoupled light lists: lights sorted by view depth, 1D depth bins and 2D screen tiles
+// a fragment's lights are the tile's bitmask ANDed with the range of lights in its depth bin
+// memory is O(tiles * lights / 32 + bins) instead of O(clusters * max lights per cluster)
+// this is the z-binning scheme from Call of Duty
+// (Drobot, Improved Culling for Tiled and Clustered Rendering, SIGGRAPH 2017)
+
+// tiles are the x/y cluster grid, uniforms like u_clusterSize and u_zNear come from clusters.sh
+// ZBINNING has to be defined before including clusters.sh, the cluster light grid shares slots with these buffers
+
+#include <bgfx_compute.sh>
+#include "samplers.sh"
+#include "clusters.sh"
+
+// workgroup size of the tile bitmask compute shader (one thread per 32-bit word)
+#define ZBIN_TILE_MASK_THREADS 64
+
+uniform vec4 u_zbinVec;
+
+#define u_zbinCount      ((uint)u_zbinVec.x)
+// words per tile bitmask, large enough for all lights in the scene
+#define u_zbinWordCount  ((uint)u_zbinVec.y)
+// number of sorted lights, lights outside the depth range are left out
+#define u_zbinLightCount ((uint)u_zbinVec.z)
+
+#ifdef WRITE_ZBINS
+    #define ZBIN_BUFFER BUFFER_RW
+#else
+    #define ZBIN_BUFFER BUFFER_RO
+#endif
+
+// light indices sorted by view depth (of the light center)
+BUFFER_RO(b_zbinLightIndices, uint, SAMPLER_ZBIN_LIGHTINDICES);
+// for each depth bin: first and last sorted light touching the bin
+// 2 uints each, first > last if the bin is empty
+BUFFER_RO(b_zbins, uint, SAMPLER_ZBIN_BINS);
+// for each tile: bitmask over the sorted lights, u_zbinWordCount words each
+ZBIN_BUFFER(b_zbinTileMasks, uint, SAMPLER_ZBIN_TILEMASKS);
+
+struct ZBin
+{
+    uint first;
+    uint last;
+};
+
+// depth bin index from depth in eye space
+// logarithmic like the cluster depth slices, must match ZBinShader::update
+uint getZBinIndex(float eyeDepth)
+{
+    float scale = float(u_zbinCount) / log(u_zFar / u_zNear);
+    uint bin = uint(max(log(eyeDepth / u_zNear) * scale, 0.0));
+    return min(bin, u_zbinCount - 1);
+}
+
+ZBin getZBin(uint bin)
+{
+    ZBin zbin;
+    zbin.first = b_zbins[2 * bin + 0];
+    zbin.last = b_zbins[2 * bin + 1];
+    return zbin;
+}
+
+// tile index from fragment position in window coordinates (gl_FragCoord)
+uint getZBinTileIndex(vec4 fragCoord)
+{
+    uvec2 indices = uvec2(fragCoord.xy / u_clusterSize.xy);
+    return u_clusterCount.x * indices.y + indices.x;
+}
+
+// word of the tile bitmask with all lights outside of the bin's range removed
+uint getZBinTileWord(uint tile, uint word, ZBin zbin)
+{
+    uint mask = b_zbinTileMasks[tile * u_zbinWordCount + word];
+    uint firstBit = word * 32;
+    if(zbin.first > firstBit)
+        mask &= 0xFFFFFFFF << (zbin.first - firstBit);
+    if(zbin.last < firstBit + 31)
+        mask &= 0xFFFFFFFF >> (firstBit + 31 - zbin.last);
+    return mask;
+}
+
+uint getZBinLightIndex(uint sortedIndex)
+{
+    return b_zbinLightIndices[sortedIndex];
+}
+
+// bit counting without bitCount/countbits, bgfx doesn't map them for all backends
+uint countBits(uint v)
+{
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// index of the lowest set bit, v must not be 0
+uint lowestBit(uint v)
+{
+    return countBits((v & (~v + 1)) - 1);
+}
+
+#endif // ZBIN_SH_HEADER_GUARD
@@ -1,9 +1,13 @@
 #include "TileShader.h"
 
 #include "Scene/Scene.h"
+#include "Renderer/Renderer.h"
 #include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
 #include <glm/common.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
 
 bgfx::VertexLayout TileShader::TileVertex::layout;
@@ -17,21 +21,46 @@ void TileShader::initialize()
     tileSizeVecUniform = bgfx::createUniform("u_tileSizeVec", bgfx::UniformType::Vec4);
     tileCountVecUniform = bgfx::createUniform("u_tileCountVec", bgfx::UniformType::Vec4);
     zNearFarVecUniform = bgfx::createUniform("u_zNearFarVec", bgfx::UniformType::Vec4);
+
+    depthSampler = bgfx::createUniform("s_texDepth", bgfx::UniformType::Sampler);
+    transparentDepthSampler = bgfx::createUniform("s_texTransparentDepth", bgfx::UniformType::Sampler);
+
+    countersBuffer = bgfx::createDynamicIndexBuffer(COUNTER_COUNT, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+
+    char csName[128];
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_tiled_depthbounds.bin");
+    depthBoundsComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_tiled_depthbounds_transparent.bin");
+    transparentDepthBoundsComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
+    readback.initialize();
 }
 
-void TileShader::updateBuffers(uint16_t screenWidth, uint16_t screenHeight, uint32_t maxLightsPerTile, uint32_t tilePixelSizeX, uint32_t tilePixelSizeY)
+void TileShader::updateBuffers(uint16_t screenWidth, uint16_t screenHeight, uint32_t maxLightsPerTile, uint32_t tilePixelSizeX, uint32_t tilePixelSizeY, bool adaptiveCapacity)
 {
-    if(currentWidth == screenWidth && currentHeight == screenHeight && currentMaxLightsPerTile == maxLightsPerTile &&
-       currentTilePixelSizeX == tilePixelSizeX && currentTilePixelSizeY == tilePixelSizeY)
+    // without read back there's nothing to adapt to
+    adaptiveCapacity = adaptiveCapacity && CounterReadback::supported();
+
+    if(currentWidth == screenWidth && currentHeight == screenHeight && currentLightsPerTileLimit == maxLightsPerTile &&
+       currentTilePixelSizeX == tilePixelSizeX && currentTilePixelSizeY == tilePixelSizeY &&
+       currentAdaptiveCapacity == adaptiveCapacity)
     {
         return;
     }
 
     currentWidth = screenWidth;
     currentHeight = screenHeight;
-    currentMaxLightsPerTile = maxLightsPerTile;
     currentTilePixelSizeX = tilePixelSizeX;
     currentTilePixelSizeY = tilePixelSizeY;
+    currentAdaptiveCapacity = adaptiveCapacity;
+    // start at the limit so nothing gets dropped until the first counters arrive
+    currentLightsPerTileLimit = currentMaxLightsPerTile = maxLightsPerTile;
+
+    lightsPerTileCapacity.reset();
+    overflowedTiles = mostLightsPerTile = 0;
+
+    // new buffer, tile bounds need to be rebuilt
+    boundsValid = false;
 
     const auto currentTilesX = (uint16_t)std::ceil((float)currentWidth / currentTilePixelSizeX);
     const auto currentTilesY = (uint16_t)std::ceil((float)currentHeight / currentTilePixelSizeY);
@@ -42,39 +71,108 @@ void TileShader::updateBuffers(uint16_t screenWidth, uint16_t screenHeight, uint
         bgfx::destroy(tilesBuffer);
     }
 
-    if(isValid(lightIndicesBuffer))
+    if(isValid(lightGridBuffer))
     {
-        bgfx::destroy(lightIndicesBuffer);
+        bgfx::destroy(lightGridBuffer);
     }
 
-    if(isValid(lightGridBuffer))
+    if(isValid(depthBoundsBuffer))
     {
-        bgfx::destroy(lightGridBuffer);
+        bgfx::destroy(depthBoundsBuffer);
     }
 
     tilesBuffer =
         bgfx::createDynamicVertexBuffer(currentTilesCount, TileVertex::layout, BGFX_BUFFER_COMPUTE_READ_WRITE);
-    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(currentTilesCount * maxLightsPerTile,
-                                                        BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
-    lightGridBuffer = bgfx::createDynamicIndexBuffer(currentTilesCount,
+    createLightIndicesBuffer();
+    // offset and count for each tile
+    lightGridBuffer = bgfx::createDynamicIndexBuffer(currentTilesCount * 2,
                                                      BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+    // min depth, max depth and depth slice mask for each tile
+    depthBoundsBuffer = bgfx::createDynamicIndexBuffer(currentTilesCount * 3,
+                                                       BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+}
+
+void TileShader::createLightIndicesBuffer()
+{
+    if(isValid(lightIndicesBuffer))
+    {
+        bgfx::destroy(lightIndicesBuffer);
+    }
+
+    const auto currentTilesX = (uint16_t)std::ceil((float)currentWidth / currentTilePixelSizeX);
+    const auto currentTilesY = (uint16_t)std::ceil((float)currentHeight / currentTilePixelSizeY);
+    const uint32_t currentTilesCount = currentTilesX * currentTilesY;
+
+    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(currentTilesCount * currentMaxLightsPerTile,
+                                                        BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+}
+
+void TileShader::resetCounters() const
+{
+    const bgfx::Memory* mem = bgfx::alloc(COUNTER_COUNT * sizeof(uint32_t));
+    std::fill_n((uint32_t*)mem->data, COUNTER_COUNT, 0u);
+    bgfx::update(countersBuffer, 0, mem);
+}
+
+void TileShader::requestCounters(bgfx::ViewId view, bgfx::ViewId blitView)
+{
+    if(currentAdaptiveCapacity)
+        readback.request(view, blitView, countersBuffer, COUNTER_COUNT);
+}
+
+bool TileShader::adaptCapacity(uint32_t frame)
+{
+    if(!currentAdaptiveCapacity || !readback.ready(frame))
+        return false;
+
+    overflowedTiles = readback.getValue(COUNTER_OVERFLOWED_TILES);
+    mostLightsPerTile = readback.getValue(COUNTER_MAX_LIGHTS);
+
+    // every tile reserves the same number of indices, so the fullest tile decides
+    const uint32_t maxLightsPerTile = lightsPerTileCapacity.update(currentMaxLightsPerTile,
+                                                                   mostLightsPerTile,
+                                                                   overflowedTiles > 0,
+                                                                   MIN_LIGHTS_PER_TILE,
+                                                                   currentLightsPerTileLimit);
+    if(maxLightsPerTile == currentMaxLightsPerTile)
+        return false;
+
+    currentMaxLightsPerTile = maxLightsPerTile;
+    createLightIndicesBuffer();
+    return true;
 }
 
 void TileShader::shutdown()
 {
     bgfx::destroy(tileSizeVecUniform);
+    bgfx::destroy(tileCountVecUniform);
     bgfx::destroy(zNearFarVecUniform);
 
     bgfx::destroy(tilesBuffer);
     bgfx::destroy(lightIndicesBuffer);
     bgfx::destroy(lightGridBuffer);
+    bgfx::destroy(depthBoundsBuffer);
+    bgfx::destroy(depthSampler);
+    bgfx::destroy(transparentDepthSampler);
+    bgfx::destroy(depthBoundsComputeProgram);
+    bgfx::destroy(transparentDepthBoundsComputeProgram);
+    bgfx::destroy(countersBuffer);
 
-    tileSizeVecUniform = zNearFarVecUniform = BGFX_INVALID_HANDLE;
+    readback.shutdown();
+
+    tileSizeVecUniform = tileCountVecUniform = zNearFarVecUniform = BGFX_INVALID_HANDLE;
     tilesBuffer = BGFX_INVALID_HANDLE;
     lightIndicesBuffer = lightGridBuffer = BGFX_INVALID_HANDLE;
+    depthBoundsBuffer = BGFX_INVALID_HANDLE;
+    depthSampler = transparentDepthSampler = BGFX_INVALID_HANDLE;
+    depthBoundsComputeProgram = transparentDepthBoundsComputeProgram = BGFX_INVALID_HANDLE;
+    countersBuffer = BGFX_INVALID_HANDLE;
 }
 
-void TileShader::setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight) const
+void TileShader::setUniforms(const Scene* scene,
+                             uint16_t screenWidth,
+                             uint16_t screenHeight,
+                             DepthBoundsMode depthBounds) const
 {
     assert(scene != nullptr);
 
@@ -84,7 +182,10 @@ void TileShader::setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t
     float tileCountVec[4] = { (float)tilesX, (float)tilesY };
     bgfx::setUniform(tileCountVecUniform, tileCountVec);
 
-    float tileSizeVec[4] = { (float)currentTilePixelSizeX, (float)currentTilePixelSizeY, (float)currentMaxLightsPerTile };
+    float tileSizeVec[4] = { (float)currentTilePixelSizeX,
+                             (float)currentTilePixelSizeY,
+                             (float)currentMaxLightsPerTile,
+                             (float)depthBounds };
     bgfx::setUniform(tileSizeVecUniform, tileSizeVec);
 
     float zNearFarVec[4] = { scene->camera.zNear, scene->camera.zFar };
@@ -98,12 +199,78 @@ void TileShader::bindBuffers(bool lightingPass) const
     if(!lightingPass)
     {
         bgfx::setBuffer(Samplers::TILES_TILES, tilesBuffer, access);
+        bgfx::setBuffer(Samplers::TILES_DEPTHBOUNDS, depthBoundsBuffer, access);
+        bgfx::setBuffer(Samplers::TILES_COUNTERS, countersBuffer, access);
     }
     bgfx::setBuffer(Samplers::TILES_LIGHTINDICES, lightIndicesBuffer, access);
     bgfx::setBuffer(Samplers::TILES_LIGHTGRID, lightGridBuffer, access);
 }
 
+void TileShader::computeDepthBounds(bgfx::ViewId view,
+                                    bgfx::TextureHandle depthTexture,
+                                    bgfx::TextureHandle transparentDepthTexture) const
+{
+    // one work group per tile
+    const bool transparent = bgfx::isValid(transparentDepthTexture);
+    bgfx::setTexture(Samplers::DEFERRED_DEPTH, depthSampler, depthTexture);
+    if(transparent)
+        bgfx::setTexture(Samplers::TRANSPARENT_DEPTH, transparentDepthSampler, transparentDepthTexture);
+    bindBuffers(false);
+    bgfx::dispatch(view,
+                   transparent ? transparentDepthBoundsComputeProgram : depthBoundsComputeProgram,
+                   (uint32_t)std::ceil((float)currentWidth / currentTilePixelSizeX),
+                   (uint32_t)std::ceil((float)currentHeight / currentTilePixelSizeY),
+                   1);
+}
+
+void TileShader::updateLightGrid(const std::vector<uint32_t>& lightIndices,
+                                 const std::vector<uint32_t>& lightGrid) const
+{
+    // bgfx::update copies at the start of the frame, before any compute or draw calls
+    if(!lightIndices.empty())
+    {
+        bgfx::update(lightIndicesBuffer,
+                     0,
+                     bgfx::copy(lightIndices.data(), uint32_t(lightIndices.size() * sizeof(uint32_t))));
+    }
+    bgfx::update(lightGridBuffer, 0, bgfx::copy(lightGrid.data(), uint32_t(lightGrid.size() * sizeof(uint32_t))));
+}
+
 std::tuple<uint32_t, uint32_t> TileShader::getTilePixelSize() const
 {
     return std::make_tuple(currentTilePixelSizeX, currentTilePixelSizeY);
 }
+
+bool TileShader::boundsOutdated(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight)
+{
+    assert(scene != nullptr);
+
+    // compare the parameters that go into the projection matrix instead of the matrix itself
+    // this way we can test for exact equality and don't have to worry about epsilons
+    ProjectionFingerprint fingerprint;
+    fingerprint.fov = scene->camera.fov;
+    fingerprint.aspect = float(screenWidth) / screenHeight;
+    fingerprint.zNear = scene->camera.zNear;
+    fingerprint.zFar = scene->camera.zFar;
+    fingerprint.screenWidth = screenWidth;
+    fingerprint.screenHeight = screenHeight;
+    fingerprint.tilePixelSizeX = currentTilePixelSizeX;
+    fingerprint.tilePixelSizeY = currentTilePixelSizeY;
+
+    if(boundsValid && fingerprint == boundsFingerprint)
+    {
+        reusedBoundsFrames++;
+        return false;
+    }
+
+    boundsValid = true;
+    boundsFingerprint = fingerprint;
+    return true;
+}
+
+bool TileShader::ProjectionFingerprint::operator==(const ProjectionFingerprint& other) const
+{
+    return fov == other.fov && aspect == other.aspect && zNear == other.zNear && zFar == other.zFar &&
+           screenWidth == other.screenWidth && screenHeight == other.screenHeight &&
+           tilePixelSizeX == other.tilePixelSizeX && tilePixelSizeY == other.tilePixelSizeY;
+}
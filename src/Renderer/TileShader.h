@@ -1,27 +1,83 @@
 #pragma once
 
 #include <bgfx/bgfx.h>
+#include "Renderer/CounterReadback.h"
 #include <tuple>
+#include <vector>
 
 class Scene;
 
 class TileShader
 {
 public:
+    enum class DepthBoundsMode : int
+    {
+        // cull lights against the whole view frustum
+        Off = 0,
+        // cull lights against the min/max depth of geometry in the tile
+        MinMax,
+        // additionally split that range into 32 slices and skip lights that only touch empty slices (2.5D culling)
+        DepthMask
+    };
+
     TileShader();
 
     void initialize();
     void shutdown();
 
-    void setUniforms(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight) const;
+    void setUniforms(const Scene* scene,
+                     uint16_t screenWidth,
+                     uint16_t screenHeight,
+                     DepthBoundsMode depthBounds = DepthBoundsMode::Off) const;
     void bindBuffers(bool lightingPass = true) const;
-    void updateBuffers(uint16_t screenWidth, uint16_t screenHeight, uint32_t maxLightsPerTile, uint32_t tilePixelSizeX, uint32_t tilePixelSizeY);
+    // with adaptiveCapacity, maxLightsPerTile is only the upper limit and the light lists
+    // follow the usage read back from the GPU (see adaptCapacity)
+    void updateBuffers(uint16_t screenWidth, uint16_t screenHeight, uint32_t maxLightsPerTile, uint32_t tilePixelSizeX, uint32_t tilePixelSizeY, bool adaptiveCapacity = false);
+    // reset the overflow counters, call once per frame before light culling
+    void resetCounters() const;
+
+    // adaptive light lists
+    // request the counters written by this frame's light culling, call after light culling
+    // blitView has to come after view, see CounterReadback::request
+    void requestCounters(bgfx::ViewId view, bgfx::ViewId blitView);
+    // grow or shrink the light lists once counters from a previous frame arrived
+    // call before setUniforms, returns true if the light index buffer was recreated
+    bool adaptCapacity(uint32_t frame);
+    // from the last counters that arrived
+    uint32_t getOverflowedTiles() const { return overflowedTiles; }
+    uint32_t getMostLightsPerTile() const { return mostLightsPerTile; }
+
+    // calculate the depth bounds of each tile for light culling
+    // depthTexture holds the depth of opaque geometry (depth prepass or G-Buffer)
+    // transparentDepthTexture holds the closest transparent surface (see Renderer::renderTransparentDepth),
+    // pass it if the scene has transparent meshes so they keep their lights
+    // needs the same depth bounds mode in setUniforms
+    void computeDepthBounds(bgfx::ViewId view,
+                            bgfx::TextureHandle depthTexture,
+                            bgfx::TextureHandle transparentDepthTexture = BGFX_INVALID_HANDLE) const;
+
+    // upload light indices and light grid calculated on the CPU (see CPULightCulling)
+    // replaces the light culling dispatch
+    void updateLightGrid(const std::vector<uint32_t>& lightIndices, const std::vector<uint32_t>& lightGrid) const;
 
     std::tuple<uint32_t, uint32_t> getTilePixelSize() const;
+    uint32_t getMaxLightsPerTile() const { return currentMaxLightsPerTile; }
+
+    // tile bounds are saved in camera coordinates so they don't change with camera movement
+    // returns true if they need to be rebuilt because the projection or tile size changed since the last call
+    bool boundsOutdated(const Scene* scene, uint16_t screenWidth, uint16_t screenHeight);
+    // number of frames that reused the tile bounds from a previous frame
+    uint64_t getReusedBoundsFrames() const { return reusedBoundsFrames; }
+    // for culling that doesn't build the tile bounds, the next boundsOutdated call returns true
+    void invalidateBounds() { boundsValid = false; }
+
     // limit number of threads (D3D only allows up to 1024, there might also be shared memory limitations)
     // shader will be run by 6 work groups
     static constexpr uint32_t TILES_X_THREADS = 16;
     static constexpr uint32_t TILES_Y_THREADS = 16;
+
+    // lower limit for the adaptive light list size
+    static constexpr uint32_t MIN_LIGHTS_PER_TILE = 16;
 private:
     struct TileVertex
     {
@@ -45,6 +101,35 @@ private:
     uint32_t currentMaxLightsPerTile{};
     uint32_t currentTilePixelSizeX{};
     uint32_t currentTilePixelSizeY{};
+    // upper limit with adaptive capacity, otherwise the same as currentMaxLightsPerTile
+    uint32_t currentLightsPerTileLimit{};
+    bool currentAdaptiveCapacity{};
+
+    void createLightIndicesBuffer();
+
+    CounterReadback readback;
+    AdaptiveCapacity lightsPerTileCapacity;
+    uint32_t overflowedTiles = 0;
+    uint32_t mostLightsPerTile = 0;
+
+    // everything the tile bounds depend on
+    struct ProjectionFingerprint
+    {
+        float fov;
+        float aspect;
+        float zNear;
+        float zFar;
+        uint16_t screenWidth;
+        uint16_t screenHeight;
+        uint32_t tilePixelSizeX;
+        uint32_t tilePixelSizeY;
+
+        bool operator==(const ProjectionFingerprint& other) const;
+    };
+
+    bool boundsValid = false;
+    ProjectionFingerprint boundsFingerprint{};
+    uint64_t reusedBoundsFrames = 0;
 
     bgfx::UniformHandle tileSizeVecUniform = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle tileCountVecUniform = BGFX_INVALID_HANDLE;
@@ -54,4 +139,18 @@ private:
     bgfx::DynamicVertexBufferHandle tilesBuffer = BGFX_INVALID_HANDLE;
     bgfx::DynamicIndexBufferHandle lightIndicesBuffer = BGFX_INVALID_HANDLE;
     bgfx::DynamicIndexBufferHandle lightGridBuffer = BGFX_INVALID_HANDLE;
+
+    // depth bounds
+    bgfx::DynamicIndexBufferHandle depthBoundsBuffer = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle depthSampler = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle transparentDepthSampler = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle depthBoundsComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle transparentDepthBoundsComputeProgram = BGFX_INVALID_HANDLE;
+
+    // overflowed tiles, most lights per tile
+    // these should be the same as in tiles.sh
+    bgfx::DynamicIndexBufferHandle countersBuffer = BGFX_INVALID_HANDLE;
+    static constexpr uint32_t COUNTER_OVERFLOWED_TILES = 0;
+    static constexpr uint32_t COUNTER_MAX_LIGHTS = 1;
+    static constexpr uint32_t COUNTER_COUNT = 2;
 };
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "Renderer.h"
+#include "GBuffer.h"
 #include "TileShader.h"
+#include "LightBVHShader.h"
+#include "CPULightCulling.h"
 
 class TiledMultipleDeferredRenderer : public Renderer
 {
@@ -19,10 +22,9 @@ public:
 private:
     bool buffersNeedUpdate = true;
 
-    glm::mat4 oldProjMat = glm::mat4(0.0f);
-
     bgfx::ProgramHandle tileBuildingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle bvhLightCullingComputeProgram = BGFX_INVALID_HANDLE;
 
     bgfx::ProgramHandle geometryProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle fullscreenProgram = BGFX_INVALID_HANDLE;
@@ -32,55 +34,8 @@ private:
     bgfx::ProgramHandle debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 
     TileShader tiles;
+    LightBVHShader lightBVH;
+    CPULightCulling cpuLightCulling;
 
-    enum GBufferAttachment : size_t
-    {
-        // no world position
-        // gl_Fragcoord is enough to unproject
-
-        // RGB = diffuse
-        // A = a (remapped roughness)
-        Diffuse_A,
-
-        // RG = encoded normal
-        Normal,
-
-        // RGB = F0 (Fresnel at normal incidence)
-        // A = metallic
-        // TODO? don't use F0, calculate from diffuse and metallic in shader
-        //       where do we store metallic?
-        F0_Metallic,
-
-        // RGB = emissive radiance
-        // A = occlusion multiplier
-        EmissiveOcclusion,
-
-        Depth,
-
-        Count
-    };
-
-    static constexpr uint64_t gBufferSamplerFlags = BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT |
-                                                    BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP |
-                                                    BGFX_SAMPLER_V_CLAMP;
-
-    static constexpr bgfx::TextureFormat::Enum gBufferAttachmentFormats[GBufferAttachment::Count - 1] = {
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::RG16F,
-        bgfx::TextureFormat::BGRA8,
-        bgfx::TextureFormat::BGRA8
-        // depth format is determined dynamically
-    };
-
-    TextureBuffer gBufferTextures[GBufferAttachment::Count + 1]; // includes depth, + null-terminated
-    uint8_t gBufferTextureUnits[GBufferAttachment::Count];
-    const char* gBufferSamplerNames[GBufferAttachment::Count];
-    bgfx::UniformHandle gBufferSamplers[GBufferAttachment::Count];
-    bgfx::FrameBufferHandle gBuffer = BGFX_INVALID_HANDLE;
-
-    bgfx::TextureHandle lightDepthTexture = BGFX_INVALID_HANDLE;
-    bgfx::FrameBufferHandle accumFrameBuffer = BGFX_INVALID_HANDLE;
-
-    bgfx::FrameBufferHandle createGBuffer();
-    void bindGBuffer();
+    GBuffer gBuffer;
 };
@@ -6,64 +6,32 @@
 #include <bigg.hpp>
 #include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/ext/matrix_relational.hpp>
-
-TiledSingleDeferredRenderer::TiledSingleDeferredRenderer(const Scene* scene, const Config* config) :
-    Renderer(scene, config),
-    gBufferTextures { { BGFX_INVALID_HANDLE, "Diffuse + roughness" },
-                      { BGFX_INVALID_HANDLE, "Normal" },
-                      { BGFX_INVALID_HANDLE, "F0 + metallic" },
-                      { BGFX_INVALID_HANDLE, "Emissive + occlusion" },
-                      { BGFX_INVALID_HANDLE, "Depth" },
-                      { BGFX_INVALID_HANDLE, nullptr } },
-    gBufferTextureUnits { Samplers::DEFERRED_DIFFUSE_A,
-                          Samplers::DEFERRED_NORMAL,
-                          Samplers::DEFERRED_F0_METALLIC,
-                          Samplers::DEFERRED_EMISSIVE_OCCLUSION,
-                          Samplers::DEFERRED_DEPTH },
-    gBufferSamplerNames { "s_texDiffuseA", "s_texNormal", "s_texF0Metallic", "s_texEmissiveOcclusion", "s_texDepth" }
+
+TiledSingleDeferredRenderer::TiledSingleDeferredRenderer(const Scene* scene, const Config* config) : Renderer(scene, config)
 {
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        handle = BGFX_INVALID_HANDLE;
-    }
-    buffers = gBufferTextures;
+    buffers = gBuffer.getTextures();
 }
 
 bool TiledSingleDeferredRenderer::supported()
 {
     const bgfx::Caps* caps = bgfx::getCaps();
-    bool supported = Renderer::supported() &&
-                     // compute shader
-                     (caps->supported & BGFX_CAPS_COMPUTE) != 0 &&
-                     // 32-bit index buffers, used for light grid structure
-                     (caps->supported & BGFX_CAPS_INDEX32) != 0 &&
-                     // blitting depth texture after geometry pass
-                     (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
-                     // multiple render targets
-                     // depth doesn't count as an attachment
-                     caps->limits.maxFBAttachments >= GBufferAttachment::Count - 1;
-    if(!supported)
-        return false;
-
-    for(bgfx::TextureFormat::Enum format : gBufferAttachmentFormats)
-    {
-        if((caps->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER) == 0)
-            return false;
-    }
-
-    return true;
+    return Renderer::supported() &&
+           // compute shader
+           (caps->supported & BGFX_CAPS_COMPUTE) != 0 &&
+           // 32-bit index buffers, used for light grid structure
+           (caps->supported & BGFX_CAPS_INDEX32) != 0 &&
+           // blitting depth texture after geometry pass
+           (caps->supported & BGFX_CAPS_TEXTURE_BLIT) != 0 &&
+           GBuffer::supported();
 }
 
 void TiledSingleDeferredRenderer::onInitialize()
 {
     // OpenGL backend: uniforms must be created before loading shaders
     tiles.initialize();
+    lightBVH.initialize();
 
-    for(size_t i = 0; i < BX_COUNTOF(gBufferSamplers); i++)
-    {
-        gBufferSamplers[i] = bgfx::createUniform(gBufferSamplerNames[i], bgfx::UniformType::Sampler);
-    }
+    gBuffer.initialize();
 
     char csName[128], vsName[128], fsName[128];
 
@@ -73,6 +41,9 @@ void TiledSingleDeferredRenderer::onInitialize()
     bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_tiled_lightculling_single_thread_per_tile.bin");
     lightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
 
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_tiled_lightculling_single_thread_per_tile_bvh.bin");
+    bvhLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_deferred_geometry.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_deferred_geometry.bin");
     geometryProgram = bigg::loadProgram(vsName, fsName);
@@ -96,128 +67,142 @@ void TiledSingleDeferredRenderer::onReset()
 {
     buffersNeedUpdate = true;
 
-    if(!bgfx::isValid(gBuffer))
-    {
-        gBuffer = createGBuffer();
-
-        for(size_t i = 0; i < GBufferAttachment::Depth; i++)
-        {
-            gBufferTextures[i].handle = bgfx::getTexture(gBuffer, (uint8_t)i);
-        }
-
-        // we can't use the G-Buffer's depth texture in the light pass framebuffer
-        // binding a texture for reading in the shader and attaching it to a framebuffer
-        // at the same time is undefined behaviour in most APIs
-        // https://www.khronos.org/opengl/wiki/Memory_Model#Framebuffer_objects
-        // we use a different depth texture and just blit it between the geometry and light pass
-        const uint64_t flags = BGFX_TEXTURE_BLIT_DST | gBufferSamplerFlags;
-        bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-        lightDepthTexture = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
-
-        gBufferTextures[GBufferAttachment::Depth].handle = lightDepthTexture;
-    }
-
-    if(!bgfx::isValid(accumFrameBuffer))
-    {
-        const bgfx::TextureHandle textures[2] = { bgfx::getTexture(frameBuffer, 0),
-                                                  bgfx::getTexture(gBuffer, GBufferAttachment::Depth) };
-        accumFrameBuffer = bgfx::createFrameBuffer(BX_COUNTOF(textures), textures); // don't destroy textures
-    }
+    gBuffer.update(width, height, scene, config->thinGBuffer, false, bgfx::getTexture(frameBuffer, 0));
+    createTransparentDepth();
 }
 
 void TiledSingleDeferredRenderer::onRender(float dt)
 {
     if(buffersNeedUpdate)
     {
-        tiles.updateBuffers(width, height, config->maxLightsPerTileOrCluster, config->tilePixelSizeX, config->tilePixelSizeY);
+        tiles.updateBuffers(width,
+                            height,
+                            config->maxLightsPerTileOrCluster,
+                            config->tilePixelSizeX,
+                            config->tilePixelSizeY,
+                            config->adaptiveLightLists && !config->cpuLightCulling);
         buffersNeedUpdate = false;
     }
 
     enum : bgfx::ViewId
     {
         vTileBuilding = 0,
-        vLightCulling,
         vGeometry,          // write G-Buffer
+        vTransparentDepth,  // depth of transparent meshes for the depth bounds
+        vDepthBounds,       // per-tile depth range of geometry
+        vLightBVH,
+        vLightCulling,
         vFullscreenLights,  // write ambient + emissive to output buffer
         vTransparent        // forward pass for transparency
     };
 
+    // light culling on the CPU replaces tile building and light culling on the GPU
+    const bool cpuCulling = config->cpuLightCulling;
+    // size the light lists from overflow counters read back from the GPU
+    const bool adaptiveLightLists = config->adaptiveLightLists && !cpuCulling;
+
+    // cull lights against the depth range of geometry in each tile
+    // uses the G-Buffer depth, light culling has to happen after the geometry pass
+    // the CPU doesn't see the depth buffer, it always culls against the whole frustum
+    const TileShader::DepthBoundsMode depthBoundsMode =
+        cpuCulling ? TileShader::DepthBoundsMode::Off : config->tileDepthBounds;
+    const bool depthBounds = depthBoundsMode != TileShader::DepthBoundsMode::Off;
+
     const uint32_t BLACK = 0x000000FF;
 
+    // layout option or the scene's materials changed
+    gBuffer.update(width, height, scene, config->thinGBuffer, false, bgfx::getTexture(frameBuffer, 0));
+
     bgfx::setViewName(vTileBuilding, "Tile building pass (compute)");
     // set u_viewRect for screen2Eye to work correctly
     bgfx::setViewRect(vTileBuilding, 0, 0, width, height);
 
-    bgfx::setViewName(vLightCulling, "Tile light culling pass (compute)");
-    bgfx::setViewRect(vLightCulling, 0, 0, width, height);
-
     bgfx::setViewName(vGeometry, "Deferred tiled geometry pass");
     bgfx::setViewClear(vGeometry, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, BLACK, 1.0f);
     bgfx::setViewRect(vGeometry, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vGeometry, gBuffer);
+    bgfx::setViewFrameBuffer(vGeometry, gBuffer.getFrameBuffer());
     bgfx::touch(vGeometry);
 
+    bgfx::setViewName(vTransparentDepth, "Transparent depth pass");
+
+    bgfx::setViewName(vDepthBounds, "Tile depth bounds pass (compute)");
+    bgfx::setViewRect(vDepthBounds, 0, 0, width, height);
+
+    bgfx::setViewName(vLightBVH, "Light BVH build pass (compute)");
+
+    bgfx::setViewName(vLightCulling, "Tile light culling pass (compute)");
+    bgfx::setViewRect(vLightCulling, 0, 0, width, height);
+
     bgfx::setViewName(vFullscreenLights, "Deferred tiled light pass (point lights + ambient + emissive)");
     bgfx::setViewClear(vFullscreenLights, BGFX_CLEAR_COLOR, clearColor);
     bgfx::setViewRect(vFullscreenLights, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vFullscreenLights, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vFullscreenLights, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vFullscreenLights);
 
     bgfx::setViewName(vTransparent, "Transparent forward pass");
     bgfx::setViewClear(vTransparent, BGFX_CLEAR_NONE);
     bgfx::setViewRect(vTransparent, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vTransparent, accumFrameBuffer);
+    bgfx::setViewFrameBuffer(vTransparent, gBuffer.getAccumFrameBuffer());
     bgfx::touch(vTransparent);
 
     if(!scene->loaded)
         return;
 
-    tiles.setUniforms(scene, width, height);
+    // counters from a previous frame, this changes u_maxLightsPerTile so do it before setUniforms
+    const bool capacityChanged = tiles.adaptCapacity(frameNumber);
+    tiles.setUniforms(scene, width, height, depthBoundsMode);
+
+    // skip building and culling if nothing changed since the last frame, the light lists are still valid
+    const bool updateLightLists = lightListsOutdated(capacityChanged);
 
     // tile building needs u_invProj to transform screen coordinates to eye space
     setViewProjection(vTileBuilding);
-    // light culling needs u_view to transform lights to eye space
-    setViewProjection(vLightCulling);
     setViewProjection(vGeometry);
+    // light BVH and light culling need u_view to transform lights to eye space
+    setViewProjection(vLightBVH);
+    setViewProjection(vLightCulling);
     setViewProjection(vFullscreenLights);
     setViewProjection(vTransparent);
 
     // tile building
 
     // only run this step if the camera parameters changed (aspect ratio, fov, near/far plane)
-    // tile bounds are saved in camera coordinates, so they don't change with camera movement
-
-    // ideally we'd compare the relative error here but a correct implementation would involve
-    // a bunch of costly matrix operations: https://floating-point-gui.de/errors/comparison/
-    // comparing the absolute error against a rather small epsilon here works as long as the values
-    // in the projection matrix aren't getting too large
+    // or the tile grid was recreated
     const auto tilePixelSizes = tiles.getTilePixelSize();
     const auto tilePixelSizeX = std::get<0>(tilePixelSizes);
     const auto tilePixelSizeY = std::get<1>(tilePixelSizes);
 
-    tiles.bindBuffers(false /*lightingPass*/); // write access, all buffers
-
-    bgfx::dispatch(vTileBuilding,
-                   tileBuildingComputeProgram,
-                   (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
-                   (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
-                   1);
-
-    // light culling
-
-    lights.bindLights(scene);
-    tiles.bindBuffers(false);
+    // compare every frame so the fingerprint and the reuse counter stay current
+    const bool boundsOutdated = tiles.boundsOutdated(scene, width, height);
+    if(cpuCulling)
+    {
+        // CPU culling doesn't use the tile bounds, rebuild them when switching back
+        tiles.invalidateBounds();
+    }
+    else if(boundsOutdated)
+    {
+        tiles.bindBuffers(false /*lightingPass*/); // write access, all buffers
 
-    bgfx::dispatch(vLightCulling,
-                   lightCullingComputeProgram,
-                   (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
-                   (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
-                   1);
+        bgfx::dispatch(vTileBuilding,
+                       tileBuildingComputeProgram,
+                       (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
+                       (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
+                       1);
+    }
+    counters["Tile bounds reused (frames)"] = (double)tiles.getReusedBoundsFrames();
+    counters["Light lists reused (frames)"] = (double)getReusedLightListFrames();
+    counters["Max lights per tile"] = (double)tiles.getMaxLightsPerTile();
+    if(adaptiveLightLists)
+        counters["Overflowed tiles"] = (double)tiles.getOverflowedTiles();
+    else
+        counters.erase("Overflowed tiles");
 
     // render geometry, write to G-Buffer
 
     const uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
 
+    gBuffer.setUniform();
+
     for(const Mesh& mesh : scene->meshes)
     {
         const Material& mat = scene->materials[mesh.material];
@@ -238,12 +223,78 @@ void TiledSingleDeferredRenderer::onRender(float dt)
     // copy G-Buffer depth attachment to depth texture for sampling in the light pass
     // we can't attach it to the frame buffer and read it in the shader (unprojecting world position) at the same time
     // blit happens before any compute or draw calls
-    bgfx::blit(vFullscreenLights, lightDepthTexture, 0, 0, bgfx::getTexture(gBuffer, GBufferAttachment::Depth));
+    // the tile depth bounds pass reads it as well, so do it in the first view that needs it
+    // (views without any dispatches or draws might never run their blits)
+    gBuffer.blitDepth(depthBounds && updateLightLists ? vDepthBounds : vFullscreenLights);
+
+    // tile depth bounds
+
+    if(depthBounds && updateLightLists)
+    {
+        // transparent meshes aren't in the G-Buffer, without their depth
+        // tiles could cut off the lights in front of or behind the opaque geometry
+        bgfx::TextureHandle transparentDepth = BGFX_INVALID_HANDLE;
+        if(scene->transparentMeshes)
+        {
+            renderTransparentDepth(vTransparentDepth);
+            transparentDepth = transparentDepthTexture;
+        }
+        tiles.computeDepthBounds(vDepthBounds, gBuffer.getDepthTexture(), transparentDepth);
+    }
+
+    // otherwise keep the light lists and counters from the last update
+    if(updateLightLists)
+    {
+        if(cpuCulling)
+        {
+            cpuLightCulling.cullTiles(lights,
+                                      scene,
+                                      viewMat,
+                                      projMat,
+                                      width,
+                                      height,
+                                      tilePixelSizeX,
+                                      tilePixelSizeY,
+                                      tiles.getMaxLightsPerTile());
+            tiles.updateLightGrid(cpuLightCulling.getLightIndices(), cpuLightCulling.getLightGrid());
+            counters["CPU light culling (ms)"] = cpuLightCulling.getCullingTime();
+        }
+        else
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // light BVH
+
+            const bool useBVH = config->lightBVH;
+            if(useBVH)
+            {
+                lightBVH.update(vLightBVH, lights, scene);
+                counters["Light BVH sort (ms)"] = lightBVH.getSortTime();
+            }
+
+            // light culling
+
+            tiles.resetCounters();
+            lights.bindLights(scene);
+            tiles.bindBuffers(false);
+            if(useBVH)
+                lightBVH.bindBVH();
+
+            bgfx::dispatch(vLightCulling,
+                           useBVH ? bvhLightCullingComputeProgram : lightCullingComputeProgram,
+                           (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
+                           (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
+                           1);
+
+            // overflow counters for adaptCapacity, arrive a few frames later
+            tiles.requestCounters(vLightCulling, vFullscreenLights);
+        }
+    }
 
     // bind these once for all following submits
     // excluding BGFX_DISCARD_TEXTURE_SAMPLERS from the discard flags passed to submit makes sure
     // they don't get unbound
-    bindGBuffer();
+    gBuffer.bind();
     pbr.bindAlbedoLUT();
     lights.bindLights(scene);
     tiles.bindBuffers(true);
@@ -288,65 +339,19 @@ void TiledSingleDeferredRenderer::onOptionsChanged()
 void TiledSingleDeferredRenderer::onShutdown()
 {
     tiles.shutdown();
+    lightBVH.shutdown();
 
     bgfx::destroy(tileBuildingComputeProgram);
     bgfx::destroy(lightCullingComputeProgram);
+    bgfx::destroy(bvhLightCullingComputeProgram);
     bgfx::destroy(geometryProgram);
     bgfx::destroy(fullscreenProgram);
     bgfx::destroy(transparencyProgram);
     bgfx::destroy(debugVisFullscreenProgram);
     bgfx::destroy(debugVisTransparencyProgram);
 
-    for(bgfx::UniformHandle& handle : gBufferSamplers)
-    {
-        bgfx::destroy(handle);
-        handle = BGFX_INVALID_HANDLE;
-    }
-    if(bgfx::isValid(lightDepthTexture))
-        bgfx::destroy(lightDepthTexture);
-    if(bgfx::isValid(gBuffer))
-        bgfx::destroy(gBuffer);
-    if(bgfx::isValid(accumFrameBuffer))
-        bgfx::destroy(accumFrameBuffer);
-
-    lightDepthTexture = BGFX_INVALID_HANDLE;
-    gBuffer = BGFX_INVALID_HANDLE;
-    accumFrameBuffer = BGFX_INVALID_HANDLE;
-
-    tileBuildingComputeProgram = lightCullingComputeProgram = geometryProgram =
-        fullscreenProgram = transparencyProgram = debugVisFullscreenProgram = debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
-}
+    gBuffer.shutdown();
 
-bgfx::FrameBufferHandle TiledSingleDeferredRenderer::createGBuffer()
-{
-    bgfx::TextureHandle textures[GBufferAttachment::Count];
-
-    const uint64_t flags = BGFX_TEXTURE_RT | gBufferSamplerFlags;
-
-    for(size_t i = 0; i < GBufferAttachment::Depth; i++)
-    {
-        assert(bgfx::isTextureValid(0, false, 1, gBufferAttachmentFormats[i], flags));
-        textures[i] = bgfx::createTexture2D(width, height, false, 1, gBufferAttachmentFormats[i], flags);
-    }
-
-    bgfx::TextureFormat::Enum depthFormat = findDepthFormat(flags);
-    assert(depthFormat != bgfx::TextureFormat::Count);
-    textures[Depth] = bgfx::createTexture2D(width, height, false, 1, depthFormat, flags);
-
-    bgfx::FrameBufferHandle gb = bgfx::createFrameBuffer((uint8_t)GBufferAttachment::Count, textures, true);
-
-    if(!bgfx::isValid(gb))
-        Log->error("Failed to create G-Buffer");
-    else
-        bgfx::setName(gb, "G-Buffer");
-
-    return gb;
+    tileBuildingComputeProgram = lightCullingComputeProgram = bvhLightCullingComputeProgram = geometryProgram =
+        fullscreenProgram = transparencyProgram = debugVisFullscreenProgram = debugVisTransparencyProgram = BGFX_INVALID_HANDLE;
 }
-
-void TiledSingleDeferredRenderer::bindGBuffer()
-{
-    for(size_t i = 0; i < GBufferAttachment::Count; i++)
-    {
-        bgfx::setTexture(gBufferTextureUnits[i], gBufferSamplers[i], gBufferTextures[i].handle);
-    }
-}
\ No newline at end of file
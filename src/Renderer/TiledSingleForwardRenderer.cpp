@@ -5,7 +5,6 @@
 #include <bigg.hpp>
 #include <bx/string.h>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/ext/matrix_relational.hpp>
 
 TiledSingleForwardRenderer::TiledSingleForwardRenderer(const Scene* scene, const Config* config) : Renderer(scene, config) { }
 
@@ -23,6 +22,7 @@ void TiledSingleForwardRenderer::onInitialize()
 {
     // OpenGL backend: uniforms must be created before loading shaders
     tiles.initialize();
+    lightBVH.initialize();
 
     char csName[128], vsName[128], fsName[128];
 
@@ -32,6 +32,9 @@ void TiledSingleForwardRenderer::onInitialize()
     bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_tiled_lightculling_single_thread_per_tile.bin");
     lightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
 
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", shaderDir(), "cs_tiled_lightculling_single_thread_per_tile_bvh.bin");
+    bvhLightCullingComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+
     bx::snprintf(vsName, BX_COUNTOF(vsName), "%s%s", shaderDir(), "vs_tiled_forward.bin");
     bx::snprintf(fsName, BX_COUNTOF(fsName), "%s%s", shaderDir(), "fs_tiled_forward.bin");
     lightingProgram = bigg::loadProgram(vsName, fsName);
@@ -44,78 +47,189 @@ void TiledSingleForwardRenderer::onRender(float dt)
 {
     if(buffersNeedUpdate)
     {
-        tiles.updateBuffers(width, height, config->maxLightsPerTileOrCluster, config->tilePixelSizeX, config->tilePixelSizeY);
+        tiles.updateBuffers(width,
+                            height,
+                            config->maxLightsPerTileOrCluster,
+                            config->tilePixelSizeX,
+                            config->tilePixelSizeY,
+                            config->adaptiveLightLists && !config->cpuLightCulling);
         buffersNeedUpdate = false;
     }
 
     enum : bgfx::ViewId
     {
         vTileBuilding = 0,
+        vDepthPrepass,
+        vTransparentDepth,
+        vDepthBounds,
+        vLightBVH,
         vLightCulling,
         vLighting
     };
 
+    // light culling on the CPU replaces tile building and light culling on the GPU
+    const bool cpuCulling = config->cpuLightCulling;
+    // size the light lists from overflow counters read back from the GPU
+    const bool adaptiveLightLists = config->adaptiveLightLists && !cpuCulling;
+
+    // cull lights against the depth range of geometry in each tile
+    // this needs a depth prepass, the lighting pass can then reuse its depth buffer
+    // the CPU doesn't see the depth buffer, it always culls against the whole frustum
+    const TileShader::DepthBoundsMode depthBoundsMode =
+        cpuCulling ? TileShader::DepthBoundsMode::Off : config->tileDepthBounds;
+    const bool depthBounds = depthBoundsMode != TileShader::DepthBoundsMode::Off;
+
     bgfx::setViewName(vTileBuilding, "Tile building pass (compute)");
     // set u_viewRect for screen2Eye to work correctly
     bgfx::setViewRect(vTileBuilding, 0, 0, width, height);
 
+    bgfx::setViewName(vDepthPrepass, "Depth prepass");
+
+    bgfx::setViewName(vTransparentDepth, "Transparent depth pass");
+
+    bgfx::setViewName(vDepthBounds, "Tile depth bounds pass (compute)");
+    bgfx::setViewRect(vDepthBounds, 0, 0, width, height);
+
+    bgfx::setViewName(vLightBVH, "Light BVH build pass (compute)");
+
     bgfx::setViewName(vLightCulling, "Tiled light culling pass (compute)");
     bgfx::setViewRect(vLightCulling, 0, 0, width, height);
 
     bgfx::setViewName(vLighting, "Tiled lighting pass");
-    bgfx::setViewClear(vLighting, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, clearColor, 1.0f, 0);
+    bgfx::setViewClear(vLighting, depthBounds ? BGFX_CLEAR_COLOR : BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, clearColor, 1.0f, 0);
     bgfx::setViewRect(vLighting, 0, 0, width, height);
-    bgfx::setViewFrameBuffer(vLighting, frameBuffer);
+    bgfx::setViewFrameBuffer(vLighting, depthBounds ? depthPrepassFrameBuffer : frameBuffer);
     bgfx::touch(vLighting);
 
     if(!scene->loaded)
         return;
 
-    tiles.setUniforms(scene, width, height);
+    // counters from a previous frame, this changes u_maxLightsPerTile so do it before setUniforms
+    const bool capacityChanged = tiles.adaptCapacity(frameNumber);
+    tiles.setUniforms(scene, width, height, depthBoundsMode);
+
+    // skip building and culling if nothing changed since the last frame, the light lists are still valid
+    const bool updateLightLists = lightListsOutdated(capacityChanged);
 
     // tile building needs u_invProj to transform screen coordinates to eye space
     setViewProjection(vTileBuilding);
-    // light culling needs u_view to transform lights to eye space
+    // light BVH and light culling need u_view to transform lights to eye space
+    setViewProjection(vLightBVH);
     setViewProjection(vLightCulling);
     setViewProjection(vLighting);
 
     // tile building
 
     // only run this step if the camera parameters changed (aspect ratio, fov, near/far plane)
-    // tile bounds are saved in camera coordinates, so they don't change with camera movement
-
-    // ideally we'd compare the relative error here but a correct implementation would involve
-    // a bunch of costly matrix operations: https://floating-point-gui.de/errors/comparison/
-    // comparing the absolute error against a rather small epsilon here works as long as the values
-    // in the projection matrix aren't getting too large
+    // or the tile grid was recreated
     const auto tilePixelSizes = tiles.getTilePixelSize();
     const auto tilePixelSizeX = std::get<0>(tilePixelSizes);
     const auto tilePixelSizeY = std::get<1>(tilePixelSizes);
 
-    tiles.bindBuffers(false /*lightingPass*/); // write access, all buffers
+    // compare every frame so the fingerprint and the reuse counter stay current
+    const bool boundsOutdated = tiles.boundsOutdated(scene, width, height);
+    if(cpuCulling)
+    {
+        // CPU culling doesn't use the tile bounds, rebuild them when switching back
+        tiles.invalidateBounds();
+    }
+    else if(boundsOutdated)
+    {
+        tiles.bindBuffers(false /*lightingPass*/); // write access, all buffers
 
-    bgfx::dispatch(vTileBuilding,
-                   tileBuildingComputeProgram,
-                   (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
-                   (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
-                   1);
+        bgfx::dispatch(vTileBuilding,
+                       tileBuildingComputeProgram,
+                       (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
+                       (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
+                       1);
+    }
+    counters["Tile bounds reused (frames)"] = (double)tiles.getReusedBoundsFrames();
+    counters["Light lists reused (frames)"] = (double)getReusedLightListFrames();
+    counters["Max lights per tile"] = (double)tiles.getMaxLightsPerTile();
+    if(adaptiveLightLists)
+        counters["Overflowed tiles"] = (double)tiles.getOverflowedTiles();
+    else
+        counters.erase("Overflowed tiles");
 
-    // light culling
+    // tile depth bounds
 
-    lights.bindLights(scene);
-    tiles.bindBuffers(false);
+    if(depthBounds)
+    {
+        // the lighting pass needs the prepass depth either way
+        renderDepthPrepass(vDepthPrepass);
+        if(updateLightLists)
+        {
+            // transparent meshes aren't in the prepass, without their depth
+            // tiles could cut off the lights in front of or behind the opaque geometry
+            bgfx::TextureHandle transparentDepth = BGFX_INVALID_HANDLE;
+            if(scene->transparentMeshes)
+            {
+                renderTransparentDepth(vTransparentDepth);
+                transparentDepth = transparentDepthTexture;
+            }
+            tiles.computeDepthBounds(vDepthBounds, depthPrepassTexture, transparentDepth);
+        }
+    }
 
-    bgfx::dispatch(vLightCulling,
-                   lightCullingComputeProgram,
-                   (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
-                   (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
-                   1);
+    // otherwise keep the light lists and counters from the last update
+    if(updateLightLists)
+    {
+        if(cpuCulling)
+        {
+            cpuLightCulling.cullTiles(lights,
+                                      scene,
+                                      viewMat,
+                                      projMat,
+                                      width,
+                                      height,
+                                      tilePixelSizeX,
+                                      tilePixelSizeY,
+                                      tiles.getMaxLightsPerTile());
+            tiles.updateLightGrid(cpuLightCulling.getLightIndices(), cpuLightCulling.getLightGrid());
+            counters["CPU light culling (ms)"] = cpuLightCulling.getCullingTime();
+        }
+        else
+        {
+            counters.erase("CPU light culling (ms)");
+
+            // light BVH
+
+            const bool useBVH = config->lightBVH;
+            if(useBVH)
+            {
+                lightBVH.update(vLightBVH, lights, scene);
+                counters["Light BVH sort (ms)"] = lightBVH.getSortTime();
+            }
+
+            // light culling
+
+            tiles.resetCounters();
+            lights.bindLights(scene);
+            tiles.bindBuffers(false);
+            if(useBVH)
+                lightBVH.bindBVH();
+
+            bgfx::dispatch(vLightCulling,
+                           useBVH ? bvhLightCullingComputeProgram : lightCullingComputeProgram,
+                           (uint32_t)std::ceil(std::ceil((float)width / tilePixelSizeX) / TileShader::TILES_X_THREADS),
+                           (uint32_t)std::ceil(std::ceil((float)height / tilePixelSizeY) / TileShader::TILES_Y_THREADS),
+                           1);
+
+            // overflow counters for adaptCapacity, arrive a few frames later
+            tiles.requestCounters(vLightCulling, vLighting);
+        }
+    }
     // lighting
 
     bool debugVis = variables["DEBUG_VIS"] == "true";
     bgfx::ProgramHandle program = debugVis ? debugVisProgram : lightingProgram;
 
     uint64_t state = BGFX_STATE_DEFAULT & ~BGFX_STATE_CULL_MASK;
+    if(depthBounds)
+    {
+        // depth is already filled by the prepass
+        state = (state & ~BGFX_STATE_DEPTH_TEST_MASK) | BGFX_STATE_DEPTH_TEST_LEQUAL;
+    }
 
     pbr.bindAlbedoLUT();
     lights.bindLights(scene);
@@ -141,6 +255,8 @@ void TiledSingleForwardRenderer::onRender(float dt)
 void TiledSingleForwardRenderer::onReset()
 {
     buffersNeedUpdate = true;
+    createDepthPrepass();
+    createTransparentDepth();
 }
 
 void TiledSingleForwardRenderer::onOptionsChanged()
@@ -151,11 +267,14 @@ void TiledSingleForwardRenderer::onOptionsChanged()
 void TiledSingleForwardRenderer::onShutdown()
 {
     tiles.shutdown();
+    lightBVH.shutdown();
 
     bgfx::destroy(tileBuildingComputeProgram);
     bgfx::destroy(lightCullingComputeProgram);
+    bgfx::destroy(bvhLightCullingComputeProgram);
     bgfx::destroy(lightingProgram);
     bgfx::destroy(debugVisProgram);
 
-    tileBuildingComputeProgram = lightCullingComputeProgram = lightingProgram = debugVisProgram = BGFX_INVALID_HANDLE;
+    tileBuildingComputeProgram = lightCullingComputeProgram = bvhLightCullingComputeProgram = lightingProgram =
+        debugVisProgram = BGFX_INVALID_HANDLE;
 }
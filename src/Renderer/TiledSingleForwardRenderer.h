@@ -2,6 +2,8 @@
 
 #include "Renderer.h"
 #include "TileShader.h"
+#include "LightBVHShader.h"
+#include "CPULightCulling.h"
 
 class TiledSingleForwardRenderer : public Renderer
 {
@@ -19,12 +21,13 @@ public:
 private:
     bool buffersNeedUpdate = true;
 
-    glm::mat4 oldProjMat = glm::mat4(0.0f);
-
     bgfx::ProgramHandle tileBuildingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightCullingComputeProgram = BGFX_INVALID_HANDLE;
+    bgfx::ProgramHandle bvhLightCullingComputeProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle lightingProgram = BGFX_INVALID_HANDLE;
     bgfx::ProgramHandle debugVisProgram = BGFX_INVALID_HANDLE;
 
     TileShader tiles;
+    LightBVHShader lightBVH;
+    CPULightCulling cpuLightCulling;
 };
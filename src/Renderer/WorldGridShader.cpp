@@ -0,0 +1,234 @@
+#include "WorldGridShader.h"
+
+#include "Scene/Scene.h"
+#include "Renderer/LightShader.h"
+#include "Renderer/Samplers.h"
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cassert>
+
+void WorldGridShader::initialize()
+{
+    worldGridVecUniform = bgfx::createUniform("u_worldGridVec", bgfx::UniformType::Vec4);
+
+    initialize(staticLayer);
+    initialize(movingLayer);
+}
+
+void WorldGridShader::shutdown()
+{
+    bgfx::destroy(worldGridVecUniform);
+    worldGridVecUniform = BGFX_INVALID_HANDLE;
+
+    shutdown(staticLayer);
+    shutdown(movingLayer);
+
+    currentLights = nullptr;
+    valid = false;
+}
+
+void WorldGridShader::update(const LightShader& lights, const Scene* scene, float cellSize)
+{
+    assert(scene != nullptr);
+    assert(cellSize > 0.0f);
+
+    // the grid only depends on the lights, unlike clusters it doesn't care about the camera
+    // static lights only change with the change count, moving lights are uploaded whenever they move
+    const PointLightList& pointLights = lights.getPointLights(scene);
+    const uint32_t lightCount = pointLights.size();
+    const bool staticValid = valid && &pointLights == currentLights && lightCount == currentLightCount &&
+                             pointLights.getChangeCount() == currentChangeCount && cellSize == currentCellSize;
+    if(staticValid && (pointLights.getUploadedCount() == 0 || movingLayer.lights.empty()))
+    {
+        reusedFrames++;
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if(staticValid)
+    {
+        reusedFrames++;
+    }
+    else
+    {
+        valid = true;
+        currentLights = &pointLights;
+        currentLightCount = lightCount;
+        currentChangeCount = pointLights.getChangeCount();
+        currentCellSize = cellSize;
+
+        // lights can only start or stop moving with a change, so the split stays the same until then
+        staticLayer.lights.clear();
+        movingLayer.lights.clear();
+        for(uint32_t i = 0; i < lightCount; i++)
+        {
+            Layer& layer = pointLights.getAngularVelocity(i) == 0.0f ? staticLayer : movingLayer;
+            layer.lights.push_back(i);
+        }
+
+        build(staticLayer, pointLights, scene, cellSize);
+    }
+    build(movingLayer, pointLights, scene, cellSize);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void WorldGridShader::bindBuffers() const
+{
+    setUniform();
+    bgfx::setBuffer(Samplers::WORLDGRID_LIGHTINDICES, staticLayer.lightIndicesBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::WORLDGRID_BUCKETS, staticLayer.bucketsBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::WORLDGRID_MOVING_LIGHTINDICES, movingLayer.lightIndicesBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::WORLDGRID_MOVING_BUCKETS, movingLayer.bucketsBuffer, bgfx::Access::Read);
+}
+
+void WorldGridShader::initialize(Layer& layer)
+{
+    // valid (empty) buffers so we can always bind them
+    layer.bucketsBuffer =
+        bgfx::createDynamicIndexBuffer(2 * MIN_BUCKETS, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    layer.lightIndicesBuffer = bgfx::createDynamicIndexBuffer(1, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    layer.bucketsCapacity = 2 * MIN_BUCKETS;
+    layer.lightIndicesCapacity = 1;
+    layer.bucketCount = MIN_BUCKETS;
+}
+
+void WorldGridShader::shutdown(Layer& layer)
+{
+    bgfx::destroy(layer.bucketsBuffer);
+    bgfx::destroy(layer.lightIndicesBuffer);
+    layer.bucketsBuffer = layer.lightIndicesBuffer = BGFX_INVALID_HANDLE;
+    layer.bucketsCapacity = layer.lightIndicesCapacity = 0;
+    layer.lights.clear();
+}
+
+void WorldGridShader::build(Layer& layer, const PointLightList& pointLights, const Scene* scene, float cellSize)
+{
+    const uint32_t lightCount = (uint32_t)layer.lights.size();
+
+    // cell range of each light
+    // fragments only exist inside the scene bounds, so cells outside of it can be left out
+    // this keeps huge lights from touching millions of empty cells
+
+    const glm::ivec3 sceneCellsMin = glm::ivec3(glm::floor(scene->minBounds / cellSize));
+    const glm::ivec3 sceneCellsMax = glm::ivec3(glm::floor(scene->maxBounds / cellSize));
+
+    lightCellsMin.resize(lightCount);
+    lightCellsMax.resize(lightCount);
+    uint64_t pairs = 0;
+    for(uint32_t i = 0; i < lightCount; i++)
+    {
+        const glm::vec3 position = pointLights.getPosition(layer.lights[i]);
+        const float radius = pointLights.getRadius(layer.lights[i]);
+        const glm::ivec3 cellsMin = glm::max(glm::ivec3(glm::floor((position - radius) / cellSize)), sceneCellsMin);
+        const glm::ivec3 cellsMax = glm::min(glm::ivec3(glm::floor((position + radius) / cellSize)), sceneCellsMax);
+        lightCellsMin[i] = cellsMin;
+        lightCellsMax[i] = cellsMax;
+        if(glm::all(glm::lessThanEqual(cellsMin, cellsMax)))
+        {
+            const glm::ivec3 size = cellsMax - cellsMin + 1;
+            pairs += (uint64_t)size.x * size.y * size.z;
+        }
+    }
+
+    // roughly one bucket per light/cell pair, lights in the same cell share a bucket
+    uint32_t bucketCount = MIN_BUCKETS;
+    while(bucketCount < pairs && bucketCount < MAX_BUCKETS)
+        bucketCount <<= 1;
+    layer.bucketCount = bucketCount;
+
+    // call func(bucket) once per light and bucket
+    // i indexes the layer's lights
+    auto forEachBucket = [&](uint32_t i, auto func) {
+        const glm::ivec3 cellsMin = lightCellsMin[i];
+        const glm::ivec3 cellsMax = lightCellsMax[i];
+        for(int z = cellsMin.z; z <= cellsMax.z; z++)
+        {
+            for(int y = cellsMin.y; y <= cellsMax.y; y++)
+            {
+                for(int x = cellsMin.x; x <= cellsMax.x; x++)
+                {
+                    const uint32_t bucket = getBucket(glm::ivec3(x, y, z), bucketCount);
+                    if(lastLight[bucket] != i)
+                    {
+                        lastLight[bucket] = i;
+                        func(bucket);
+                    }
+                }
+            }
+        }
+    };
+
+    // count lights per bucket, then fill the compacted light index list
+
+    std::vector<uint32_t>& buckets = layer.buckets;
+    buckets.assign(2 * bucketCount, 0);
+    lastLight.assign(bucketCount, std::numeric_limits<uint32_t>::max());
+    for(uint32_t i = 0; i < lightCount; i++)
+    {
+        forEachBucket(i, [&](uint32_t bucket) { buckets[2 * bucket + 1]++; });
+    }
+
+    cursors.resize(bucketCount);
+    uint32_t lightIndexCount = 0;
+    for(uint32_t bucket = 0; bucket < bucketCount; bucket++)
+    {
+        buckets[2 * bucket + 0] = lightIndexCount;
+        cursors[bucket] = lightIndexCount;
+        lightIndexCount += buckets[2 * bucket + 1];
+    }
+
+    // the shaders index the whole light list
+    std::vector<uint32_t>& lightIndices = layer.lightIndices;
+    lightIndices.resize(lightIndexCount);
+    std::fill(lastLight.begin(), lastLight.end(), std::numeric_limits<uint32_t>::max());
+    for(uint32_t i = 0; i < lightCount; i++)
+    {
+        forEachBucket(i, [&](uint32_t bucket) { lightIndices[cursors[bucket]++] = layer.lights[i]; });
+    }
+
+    // upload
+
+    upload(layer.bucketsBuffer, layer.bucketsCapacity, buckets);
+    upload(layer.lightIndicesBuffer, layer.lightIndicesCapacity, lightIndices);
+}
+
+uint32_t WorldGridShader::getBucket(const glm::ivec3& cell, uint32_t bucketCount)
+{
+    // spatial hash from Teschner et al., Optimized Spatial Hashing for Collision Detection of Deformable Objects
+    const uint32_t hash =
+        ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u);
+    return hash & (bucketCount - 1);
+}
+
+void WorldGridShader::setUniform() const
+{
+    float worldGridVec[4] = { currentCellSize, (float)staticLayer.bucketCount, (float)movingLayer.bucketCount };
+    bgfx::setUniform(worldGridVecUniform, worldGridVec);
+}
+
+void WorldGridShader::upload(bgfx::DynamicIndexBufferHandle& buffer,
+                             uint32_t& capacity,
+                             const std::vector<uint32_t>& data)
+{
+    const uint32_t size = (uint32_t)data.size();
+    if(size > capacity)
+    {
+        // grow in powers of two so lights slowly spreading out don't recreate it every time
+        while(capacity < size)
+            capacity *= 2;
+        bgfx::destroy(buffer);
+        buffer = bgfx::createDynamicIndexBuffer(capacity, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    }
+
+    for(uint32_t first = 0; first < size; first += UPLOAD_CHUNK_SIZE)
+    {
+        const uint32_t count = std::min(size - first, (uint32_t)UPLOAD_CHUNK_SIZE);
+        bgfx::update(buffer, first, bgfx::copy(data.data() + first, count * sizeof(uint32_t)));
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+
+class Scene;
+class LightShader;
+class PointLightList;
+
+// camera-independent light lists for the clustered renderers, see worldgrid.sh
+// lights are assigned to the cells of a uniform world-space grid on the CPU, cells are hashed into buckets
+// the grid is only rebuilt when lights change, not when the camera moves
+// lights without angular velocity never move, they get their own grid that is kept while only the others move
+// replaces cluster building, light culling and the cluster light grid
+class WorldGridShader
+{
+public:
+    void initialize();
+    void shutdown();
+
+    // assign lights to grid cells and upload the buckets
+    // does nothing if neither the lights nor the cell size changed since the last call
+    // only rebuilds the grid of moving lights if nothing but their animation changed
+    void update(const LightShader& lights, const Scene* scene, float cellSize);
+    // read access for the lighting pass
+    void bindBuffers() const;
+
+    // CPU time of the last update in milliseconds
+    double getBuildTime() const { return buildTime; }
+    // number of updates that kept the grid of static lights from a previous frame
+    uint64_t getReusedFrames() const { return reusedFrames; }
+
+    // bucket index of a grid cell
+    // must match getWorldGridBucketIndex in worldgrid.sh
+    static uint32_t getBucket(const glm::ivec3& cell, uint32_t bucketCount);
+
+    // the bucket count follows the number of light/cell pairs, clamped to this range
+    static constexpr uint32_t MIN_BUCKETS = 1024;
+    static constexpr uint32_t MAX_BUCKETS = 1 << 22;
+
+private:
+    // one grid per light group, each with its own buckets and light index list
+    struct Layer
+    {
+        // lights of this group
+        std::vector<uint32_t> lights;
+
+        uint32_t bucketCount = MIN_BUCKETS;
+        // offset and light count for each bucket
+        std::vector<uint32_t> buckets;
+        std::vector<uint32_t> lightIndices;
+
+        uint32_t bucketsCapacity = 0;
+        uint32_t lightIndicesCapacity = 0;
+        bgfx::DynamicIndexBufferHandle bucketsBuffer = BGFX_INVALID_HANDLE;
+        bgfx::DynamicIndexBufferHandle lightIndicesBuffer = BGFX_INVALID_HANDLE;
+    };
+
+    static void initialize(Layer& layer);
+    static void shutdown(Layer& layer);
+    // assign the layer's lights to grid cells and upload the buckets
+    void build(Layer& layer, const PointLightList& pointLights, const Scene* scene, float cellSize);
+
+    void setUniform() const;
+    // copy into buffer in chunks, growing it if necessary
+    static void upload(bgfx::DynamicIndexBufferHandle& buffer,
+                       uint32_t& capacity,
+                       const std::vector<uint32_t>& data);
+
+    // state of the last rebuild of the static grid
+    const PointLightList* currentLights = nullptr;
+    uint32_t currentLightCount = 0;
+    uint64_t currentChangeCount = 0;
+    float currentCellSize = 1.0f;
+    bool valid = false;
+
+    uint64_t reusedFrames = 0;
+    double buildTime = 0.0;
+
+    // lights with and without angular velocity
+    Layer staticLayer;
+    Layer movingLayer;
+
+    // [min, max] cell range of each light in the layer, clamped to the scene bounds
+    std::vector<glm::ivec3> lightCellsMin;
+    std::vector<glm::ivec3> lightCellsMax;
+    // last light added to each bucket, a light covering several cells with the same bucket is only added once
+    std::vector<uint32_t> lastLight;
+    std::vector<uint32_t> cursors;
+
+    // indices per bgfx::update call
+    static constexpr uint32_t UPLOAD_CHUNK_SIZE = 65536;
+
+    bgfx::UniformHandle worldGridVecUniform = BGFX_INVALID_HANDLE;
+};
@@ -0,0 +1,175 @@
+#include "ZBinShader.h"
+
+#include "Scene/Scene.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/LightShader.h"
+#include "Renderer/Samplers.h"
+#include <bigg.hpp>
+#include <bx/string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <cassert>
+
+void ZBinShader::initialize()
+{
+    zbinVecUniform = bgfx::createUniform("u_zbinVec", bgfx::UniformType::Vec4);
+
+    // valid (empty) buffers so we can always bind them
+    lightIndicesBuffer = bgfx::createDynamicIndexBuffer(1, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    binsBuffer = bgfx::createDynamicIndexBuffer(2 * Z_BINS, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+    tileMasksBuffer = bgfx::createDynamicIndexBuffer(1, BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+
+    char csName[128];
+    bx::snprintf(csName, BX_COUNTOF(csName), "%s%s", Renderer::shaderDir(), "cs_clustered_zbin_tilemasks.bin");
+    tileMasksComputeProgram = bgfx::createProgram(bigg::loadShader(csName), true);
+}
+
+void ZBinShader::shutdown()
+{
+    bgfx::destroy(zbinVecUniform);
+    bgfx::destroy(lightIndicesBuffer);
+    bgfx::destroy(binsBuffer);
+    bgfx::destroy(tileMasksBuffer);
+    bgfx::destroy(tileMasksComputeProgram);
+
+    zbinVecUniform = BGFX_INVALID_HANDLE;
+    lightIndicesBuffer = binsBuffer = tileMasksBuffer = BGFX_INVALID_HANDLE;
+    tileMasksComputeProgram = BGFX_INVALID_HANDLE;
+
+    tileCount = currentLightCount = sortedCount = 0;
+    wordCount = 1;
+}
+
+void ZBinShader::update(const LightShader& lights,
+                        const Scene* scene,
+                        const glm::mat4& viewMat,
+                        uint32_t tilesX,
+                        uint32_t tilesY)
+{
+    assert(scene != nullptr);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const PointLightList& pointLights = lights.getPointLights(scene);
+    const uint32_t lightCount = pointLights.size();
+    const float zNear = scene->camera.zNear;
+    const float zFar = scene->camera.zFar;
+
+    // (re)create buffers if the number of lights or tiles changed
+    // the tile bitmasks have room for all lights so their size doesn't depend on the camera
+
+    if(lightCount != currentLightCount || tilesX * tilesY != tileCount)
+    {
+        currentLightCount = lightCount;
+        tileCount = tilesX * tilesY;
+        wordCount = std::max((lightCount + 31) / 32, 1u);
+
+        bgfx::destroy(lightIndicesBuffer);
+        bgfx::destroy(tileMasksBuffer);
+        lightIndicesBuffer = bgfx::createDynamicIndexBuffer(std::max(lightCount, 1u),
+                                                            BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+        tileMasksBuffer = bgfx::createDynamicIndexBuffer(std::max(tileCount * wordCount, 1u),
+                                                         BGFX_BUFFER_COMPUTE_READ_WRITE | BGFX_BUFFER_INDEX32);
+    }
+
+    // sort by view depth, lights completely outside the depth range are left out
+
+    depths.clear();
+    radii.resize(lightCount);
+    for(uint32_t i = 0; i < lightCount; i++)
+    {
+        const float z = (viewMat * glm::vec4(pointLights.getPosition(i), 1.0f)).z;
+        const float radius = pointLights.getRadius(i);
+        radii[i] = radius;
+        if(z + radius > zNear && z - radius < zFar)
+            depths.emplace_back(z, i);
+    }
+    std::sort(depths.begin(), depths.end());
+
+    sortedCount = (uint32_t)depths.size();
+    sortedIndices.resize(sortedCount);
+    for(uint32_t i = 0; i < sortedCount; i++)
+    {
+        sortedIndices[i] = depths[i].second;
+    }
+
+    // depth bins
+    // logarithmic like the cluster depth slices, must match getZBinIndex in zbin.sh
+    // empty bins have first > last
+
+    bins.resize(2 * Z_BINS);
+    for(uint32_t bin = 0; bin < Z_BINS; bin++)
+    {
+        bins[2 * bin + 0] = std::numeric_limits<uint32_t>::max();
+        bins[2 * bin + 1] = 0;
+    }
+
+    const float scale = (float)Z_BINS / std::log(zFar / zNear);
+    auto getBinIndex = [&](float depth) {
+        const float bin = std::log(std::max(depth, zNear) / zNear) * scale;
+        return std::min((uint32_t)std::max(bin, 0.0f), Z_BINS - 1);
+    };
+
+    // lights are visited in sorted order, so the first light touching a bin is the smallest index
+    for(uint32_t i = 0; i < sortedCount; i++)
+    {
+        const float z = depths[i].first;
+        const float radius = radii[depths[i].second];
+        const uint32_t firstBin = getBinIndex(z - radius);
+        const uint32_t lastBin = getBinIndex(z + radius);
+        for(uint32_t bin = firstBin; bin <= lastBin; bin++)
+        {
+            if(bins[2 * bin + 0] == std::numeric_limits<uint32_t>::max())
+                bins[2 * bin + 0] = i;
+            bins[2 * bin + 1] = i;
+        }
+    }
+
+    // upload
+
+    if(sortedCount > 0)
+        bgfx::update(lightIndicesBuffer, 0, bgfx::copy(sortedIndices.data(), sortedCount * sizeof(uint32_t)));
+    bgfx::update(binsBuffer, 0, bgfx::copy(bins.data(), (uint32_t)(bins.size() * sizeof(uint32_t))));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    sortTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void ZBinShader::buildTileMasks(bgfx::ViewId view, const LightShader& lights, const Scene* scene) const
+{
+    if(sortedCount == 0)
+        return;
+
+    // one thread per word that contains sorted lights, one row of work groups per tile
+    // tiles are split over y and z, one dimension only allows up to MAX_LIGHT_DISPATCH_GROUPS
+    const uint32_t usedWords = (sortedCount + 31) / 32;
+    const uint32_t tileGroupsY = std::min(tileCount, (uint32_t)LightShader::MAX_LIGHT_DISPATCH_GROUPS);
+    const uint32_t tileGroupsZ = (tileCount + tileGroupsY - 1) / tileGroupsY;
+
+    lights.bindLights(scene);
+    setUniform();
+    bgfx::setBuffer(Samplers::ZBIN_LIGHTINDICES, lightIndicesBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::ZBIN_BINS, binsBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::ZBIN_TILEMASKS, tileMasksBuffer, bgfx::Access::Write);
+    bgfx::dispatch(view,
+                   tileMasksComputeProgram,
+                   (uint32_t)std::ceil((float)usedWords / TILE_MASK_THREADS),
+                   tileGroupsY,
+                   tileGroupsZ);
+}
+
+void ZBinShader::bindBuffers() const
+{
+    setUniform();
+    bgfx::setBuffer(Samplers::ZBIN_LIGHTINDICES, lightIndicesBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::ZBIN_BINS, binsBuffer, bgfx::Access::Read);
+    bgfx::setBuffer(Samplers::ZBIN_TILEMASKS, tileMasksBuffer, bgfx::Access::Read);
+}
+
+void ZBinShader::setUniform() const
+{
+    float zbinVec[4] = { (float)Z_BINS, (float)wordCount, (float)sortedCount };
+    bgfx::setUniform(zbinVecUniform, zbinVec);
+}
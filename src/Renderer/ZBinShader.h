@@ -0,0 +1,69 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+#include <glm/matrix.hpp>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class Scene;
+class LightShader;
+
+// decoupled light lists for the clustered renderers (z-binning), see zbin.sh
+// lights are sorted by view depth on the CPU, each depth bin stores the range of sorted lights touching it
+// each screen tile (x/y cluster grid) stores a bitmask over the sorted lights, built on the GPU
+// replaces cluster building, light culling and the cluster light grid
+class ZBinShader
+{
+public:
+    void initialize();
+    void shutdown();
+
+    // sort lights by view depth, fill the depth bins and upload both
+    // tilesX and tilesY are the cluster grid dimensions
+    void update(const LightShader& lights,
+                const Scene* scene,
+                const glm::mat4& viewMat,
+                uint32_t tilesX,
+                uint32_t tilesY);
+    // build the tile bitmasks
+    // needs u_view, u_invProj and u_viewRect as well as the cluster uniforms (see ClusterShader::setUniforms)
+    void buildTileMasks(bgfx::ViewId view, const LightShader& lights, const Scene* scene) const;
+    // read access for the lighting pass
+    void bindBuffers() const;
+
+    // CPU time of the last sort and binning in milliseconds
+    double getSortTime() const { return sortTime; }
+
+    // number of logarithmic depth bins between the near and far plane
+    static constexpr uint32_t Z_BINS = 4096;
+
+    // these should be the same as in zbin.sh
+    static constexpr uint32_t TILE_MASK_THREADS = 64;
+
+private:
+    void setUniform() const;
+
+    uint32_t tileCount = 0;
+    // number of lights the buffers were created for
+    uint32_t currentLightCount = 0;
+    // words per tile bitmask
+    uint32_t wordCount = 1;
+    // lights within the depth range, in sorted order
+    uint32_t sortedCount = 0;
+    double sortTime = 0.0;
+
+    // view depth and light index
+    std::vector<std::pair<float, uint32_t>> depths;
+    std::vector<float> radii;
+    std::vector<uint32_t> sortedIndices;
+    std::vector<uint32_t> bins;
+
+    bgfx::UniformHandle zbinVecUniform = BGFX_INVALID_HANDLE;
+
+    bgfx::DynamicIndexBufferHandle lightIndicesBuffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle binsBuffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle tileMasksBuffer = BGFX_INVALID_HANDLE;
+
+    bgfx::ProgramHandle tileMasksComputeProgram = BGFX_INVALID_HANDLE;
+};
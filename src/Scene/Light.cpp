@@ -6,6 +6,7 @@
 
 float PointLight::calculateRadius() const
 {
+    // PointLightList::packVertices does the same for many lights at once
     // radius = where attenuation would lead to an intensity of 1W/m^2
     const float INTENSITY_CUTOFF = 1.0f;
     const float ATTENTUATION_CUTOFF = 0.05f;
@@ -15,6 +15,17 @@ struct PointLight
     float calculateRadius() const;
 };
 
+// circular motion around an axis through center
+// see PointLightList::animate and cs_lights_animate.sc
+struct PointLightMotion
+{
+    glm::vec3 center;
+    // normalized
+    glm::vec3 axis;
+    // in radians per second
+    float angularVelocity;
+};
+
 struct AmbientLight
 {
     glm::vec3 irradiance;
@@ -1,37 +1,593 @@
 #include "LightList.h"
 
+#include "Util/SIMD.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+using namespace simd;
+
 bgfx::VertexLayout LightList::PointLightVertex::layout;
+bgfx::VertexLayout LightList::PointLightMotionVertex::layout;
+
+// same as what Cluster::moveLights used to do for every light
+const PointLightMotion PointLightList::DEFAULT_MOTION = { glm::vec3(0.0f),
+                                                          glm::vec3(0.0f, 1.0f, 0.0f),
+                                                          glm::radians(10.0f) };
+
+std::vector<float> PointLightList::* const PointLightList::ARRAYS[14] = {
+    &PointLightList::x,       &PointLightList::y,       &PointLightList::z,       &PointLightList::fluxR,
+    &PointLightList::fluxG,   &PointLightList::fluxB,   &PointLightList::radius,  &PointLightList::centerX,
+    &PointLightList::centerY, &PointLightList::centerZ, &PointLightList::axisX,   &PointLightList::axisY,
+    &PointLightList::axisZ,   &PointLightList::angularVelocity
+};
+
+namespace
+{
+// Rodrigues' rotation formula, same as in cs_lights_animate.sc
+glm::vec3 rotateAroundAxis(const glm::vec3& v, const glm::vec3& axis, float angle)
+{
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+    return v * c + glm::cross(axis, v) * s + axis * glm::dot(axis, v) * (1.0f - c);
+}
+
+// shared exponent format: 9 bit mantissa for each channel and a 5 bit exponent
+// r in the lowest bits, exponent in the highest
+// same as unpackRGB9E5 in lights.sh, see EXT_texture_shared_exponent
+// maxDecoded is the largest channel after unpacking
+uint32_t packRGB9E5(glm::vec3 rgb, float& maxDecoded)
+{
+    constexpr int MANTISSA_BITS = 9;
+    constexpr int EXPONENT_BIAS = 15;
+    constexpr int MAX_EXPONENT = 31;
+    const float MAX_VALUE =
+        float((1 << MANTISSA_BITS) - 1) / (1 << MANTISSA_BITS) * std::ldexp(1.0f, MAX_EXPONENT - EXPONENT_BIAS);
+
+    rgb = glm::clamp(rgb, glm::vec3(0.0f), glm::vec3(MAX_VALUE));
+    const float maxChannel = std::max(rgb.r, std::max(rgb.g, rgb.b));
+    if(maxChannel <= 0.0f)
+    {
+        maxDecoded = 0.0f;
+        return 0;
+    }
+
+    int exponent = std::max(-EXPONENT_BIAS - 1, (int)std::floor(std::log2(maxChannel))) + 1 + EXPONENT_BIAS;
+    float scale = std::ldexp(1.0f, exponent - EXPONENT_BIAS - MANTISSA_BITS);
+    // rounding can overflow the mantissa
+    if((int)std::floor(maxChannel / scale + 0.5f) == (1 << MANTISSA_BITS))
+    {
+        scale *= 2.0f;
+        exponent++;
+    }
+
+    const uint32_t r = (uint32_t)std::floor(rgb.r / scale + 0.5f);
+    const uint32_t g = (uint32_t)std::floor(rgb.g / scale + 0.5f);
+    const uint32_t b = (uint32_t)std::floor(rgb.b / scale + 0.5f);
+    maxDecoded = (float)std::max(r, std::max(g, b)) * scale;
+    return r | (g << 9) | (b << 18) | ((uint32_t)exponent << 27);
+}
+} // namespace
 
 void PointLightList::init()
 {
     LightList::PointLightVertex::init();
-    buffer = bgfx::createDynamicVertexBuffer(
-        1, PointLightVertex::layout, BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_ALLOW_RESIZE);
+    LightList::PointLightMotionVertex::init();
+    // lights are uploaded in ranges, so the buffers are resized manually
+    // (a resizable buffer would get recreated with the size of the first range)
+    capacity = 1;
+    createBuffers();
 }
 
 void PointLightList::shutdown()
 {
     bgfx::destroy(buffer);
-    buffer = BGFX_INVALID_HANDLE;
+    bgfx::destroy(motionBuffer);
+    buffer = motionBuffer = BGFX_INVALID_HANDLE;
+    capacity = 0;
+}
+
+void PointLightList::createBuffers()
+{
+    buffer = bgfx::createDynamicVertexBuffer(capacity, PointLightVertex::layout, BGFX_BUFFER_COMPUTE_READ_WRITE);
+    motionBuffer = bgfx::createDynamicVertexBuffer(capacity, PointLightMotionVertex::layout, BGFX_BUFFER_COMPUTE_READ);
 }
 
-void PointLightList::update()
+void PointLightList::update(bool upload)
 {
-    size_t stride = PointLightVertex::layout.getStride();
-    const bgfx::Memory* mem = bgfx::alloc(uint32_t(stride * std::max(lights.size(), (size_t)1)));
+    uploadedCount = 0;
+    updatedCount = 0;
 
-    for(size_t i = 0; i < lights.size(); i++)
+    const uint32_t count = size();
+    // growing uploads every light from the CPU copy
+    if(count + virtualCapacity > capacity)
+        syncAnimation();
+    if(count + virtualCapacity > capacity)
     {
-        PointLightVertex* light = (PointLightVertex*)(mem->data + (i * stride));
-        light->position = lights[i].position;
-        // intensity = flux per unit solid angle (steradian)
-        // there are 4*pi steradians in a sphere
-        light->intensity = lights[i].flux / (4.0f * glm::pi<float>());
-        light->radius = lights[i].calculateRadius();
+        // grow in powers of two so adding lights one by one doesn't recreate the buffer every frame
+        while(capacity < count + virtualCapacity)
+            capacity *= 2;
+        bgfx::destroy(buffer);
+        bgfx::destroy(motionBuffer);
+        createBuffers();
+        dirtyRanges.assign(1, { 0, count });
+        pendingRanges.clear();
     }
 
-    bgfx::update(buffer, 0, mem);
+    // calculate radius and intensity of changed lights, the CPU side needs them even without uploading
+    mergeRanges(dirtyRanges);
+    for(const auto& range : dirtyRanges)
+    {
+        // lights might have been removed after they were changed
+        const uint32_t first = range.first;
+        const uint32_t last = std::min(range.second, count);
+        if(first >= last)
+            continue;
+
+        packVertices(first, last);
+        updatedCount += last - first;
+    }
+
+    // changes wait for the next update that uploads
+    // merge them every time so they don't pile up while nothing uploads
+    pendingRanges.insert(pendingRanges.end(), dirtyRanges.begin(), dirtyRanges.end());
+    dirtyRanges.clear();
+    mergeRanges(pendingRanges);
+    if(!upload)
+        return;
+
+    const uint32_t stride = PointLightVertex::layout.getStride();
+    const uint32_t motionStride = PointLightMotionVertex::layout.getStride();
+    assert(stride == sizeof(PointLightVertex) && motionStride == sizeof(PointLightMotionVertex));
+    for(const auto& range : pendingRanges)
+    {
+        const uint32_t first = range.first;
+        const uint32_t last = std::min(range.second, count);
+        if(first >= last)
+            continue;
+
+        // split big ranges so a single copy doesn't need hundreds of MB of memory at once
+        for(uint32_t chunkFirst = first; chunkFirst < last; chunkFirst += UPLOAD_CHUNK_SIZE)
+        {
+            const uint32_t chunkCount = std::min(last - chunkFirst, (uint32_t)UPLOAD_CHUNK_SIZE);
+            bgfx::update(buffer, chunkFirst, bgfx::copy(&vertices[chunkFirst], chunkCount * stride));
+            bgfx::update(motionBuffer, chunkFirst, bgfx::copy(&motionVertices[chunkFirst], chunkCount * motionStride));
+        }
+        uploadedCount += last - first;
+    }
+    pendingRanges.clear();
+}
+
+void PointLightList::mergeRanges(std::vector<std::pair<uint32_t, uint32_t>>& ranges)
+{
+    if(ranges.empty())
+        return;
+
+    // merge overlapping ranges and ranges with small gaps between them
+    // reuploading a few unchanged lights is cheaper than lots of tiny updates
+    const uint32_t MAX_GAP = 64;
+    std::sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    for(size_t i = 1; i < ranges.size(); i++)
+    {
+        if(ranges[i].first <= ranges[merged].second + MAX_GAP)
+            ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+        else
+            ranges[++merged] = ranges[i];
+    }
+    ranges.resize(merged + 1);
+}
+
+PointLightList::Handle PointLightList::add(const PointLight& light)
+{
+    return add(light, DEFAULT_MOTION);
+}
+
+PointLightList::Handle PointLightList::add(const PointLight& light, const PointLightMotion& motion)
+{
+    // the new light hasn't moved on the GPU yet, catch up before it's part of the list
+    syncAnimation();
+
+    Handle handle;
+    if(!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    else
+    {
+        handle = (Handle)handleToIndex.size();
+        handleToIndex.push_back(0);
+    }
+
+    const uint32_t index = size();
+    handleToIndex[handle] = index;
+    indexToHandle.push_back(handle);
+
+    x.push_back(light.position.x);
+    y.push_back(light.position.y);
+    z.push_back(light.position.z);
+    fluxR.push_back(light.flux.r);
+    fluxG.push_back(light.flux.g);
+    fluxB.push_back(light.flux.b);
+    radius.push_back(0.0f);
+    centerX.push_back(motion.center.x);
+    centerY.push_back(motion.center.y);
+    centerZ.push_back(motion.center.z);
+    axisX.push_back(motion.axis.x);
+    axisY.push_back(motion.axis.y);
+    axisZ.push_back(motion.axis.z);
+    angularVelocity.push_back(motion.angularVelocity);
+    vertices.emplace_back();
+    motionVertices.emplace_back();
+    markDirty(index);
+
+    return handle;
+}
+
+void PointLightList::remove(Handle handle)
+{
+    // removing twice would move another light into the slot and free the handle again
+    if(!valid(handle))
+        return;
+
+    syncAnimation();
+
+    // move the last light into the free slot
+    const uint32_t index = handleToIndex[handle];
+    const uint32_t last = size() - 1;
+    if(index != last)
+    {
+        const Handle lastHandle = indexToHandle[last];
+        forEachArray([=](std::vector<float>& array) { array[index] = array[last]; });
+        indexToHandle[index] = lastHandle;
+        handleToIndex[lastHandle] = index;
+        markDirty(index);
+    }
+    changeCount++;
+
+    forEachArray([](std::vector<float>& array) { array.pop_back(); });
+    vertices.pop_back();
+    motionVertices.pop_back();
+    indexToHandle.pop_back();
+    handleToIndex[handle] = UINT32_MAX;
+    freeHandles.push_back(handle);
+}
+
+void PointLightList::modify(Handle handle, const PointLight& light)
+{
+    if(!valid(handle))
+        return;
+    setAt(handleToIndex[handle], light);
+}
+
+void PointLightList::clear()
+{
+    forEachArray([](std::vector<float>& array) { array.clear(); });
+    vertices.clear();
+    motionVertices.clear();
+    handleToIndex.clear();
+    indexToHandle.clear();
+    freeHandles.clear();
+    dirtyRanges.clear();
+    pendingRanges.clear();
+    changeCount++;
+    gpuAnimationTime = 0.0f;
+}
+
+void PointLightList::assign(const PointLightList& source, const std::vector<uint32_t>& indices)
+{
+    assert(&source != this);
+    // copies the CPU positions
+    assert(source.gpuAnimationTime == 0.0f);
+
+    const uint32_t count = (uint32_t)indices.size();
+    for(std::vector<float> PointLightList::*array : ARRAYS)
+    {
+        std::vector<float>& dst = this->*array;
+        const std::vector<float>& src = source.*array;
+        dst.resize(count);
+        for(uint32_t i = 0; i < count; i++)
+        {
+            assert(indices[i] < src.size());
+            dst[i] = src[indices[i]];
+        }
+    }
+    vertices.resize(count);
+    motionVertices.resize(count);
+
+    handleToIndex.resize(count);
+    indexToHandle.resize(count);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        handleToIndex[i] = indexToHandle[i] = i;
+    }
+    freeHandles.clear();
+
+    dirtyRanges.clear();
+    pendingRanges.clear();
+    if(count > 0)
+        dirtyRanges.emplace_back(0, count);
+    changeCount++;
+    gpuAnimationTime = 0.0f;
+}
+
+void PointLightList::setMotion(Handle handle, const PointLightMotion& motion)
+{
+    if(!valid(handle))
+        return;
+
+    // the old motion applies up to now
+    syncAnimation();
+
+    const uint32_t index = handleToIndex[handle];
+    centerX[index] = motion.center.x;
+    centerY[index] = motion.center.y;
+    centerZ[index] = motion.center.z;
+    axisX[index] = motion.axis.x;
+    axisY[index] = motion.axis.y;
+    axisZ[index] = motion.axis.z;
+    angularVelocity[index] = motion.angularVelocity;
+    markDirty(index);
+}
+
+PointLight PointLightList::getAt(uint32_t index) const
+{
+    assert(index < size());
+    return { getPosition(index), { fluxR[index], fluxG[index], fluxB[index] } };
+}
+
+glm::vec3 PointLightList::getPosition(uint32_t index) const
+{
+    assert(index < size());
+
+    const glm::vec3 position(x[index], y[index], z[index]);
+    if(gpuAnimationTime == 0.0f)
+        return position;
+
+    const glm::vec3 center(centerX[index], centerY[index], centerZ[index]);
+    const glm::vec3 axis(axisX[index], axisY[index], axisZ[index]);
+    return center + rotateAroundAxis(position - center, axis, angularVelocity[index] * gpuAnimationTime);
+}
+
+void PointLightList::setAt(uint32_t index, const PointLight& light)
+{
+    assert(index < size());
+
+    // other lights keep moving from where the GPU left them
+    syncAnimation();
+
+    x[index] = light.position.x;
+    y[index] = light.position.y;
+    z[index] = light.position.z;
+    fluxR[index] = light.flux.r;
+    fluxG[index] = light.flux.g;
+    fluxB[index] = light.flux.b;
+    markDirty(index);
+}
+
+void PointLightList::transform(const glm::mat4& mat)
+{
+    syncAnimation();
+
+    const uint32_t count = size();
+
+    // affine transform, glm matrices are column-major
+    const vfloat m00 = vsplat(mat[0][0]), m10 = vsplat(mat[1][0]), m20 = vsplat(mat[2][0]), m30 = vsplat(mat[3][0]);
+    const vfloat m01 = vsplat(mat[0][1]), m11 = vsplat(mat[1][1]), m21 = vsplat(mat[2][1]), m31 = vsplat(mat[3][1]);
+    const vfloat m02 = vsplat(mat[0][2]), m12 = vsplat(mat[1][2]), m22 = vsplat(mat[2][2]), m32 = vsplat(mat[3][2]);
+
+    uint32_t i = 0;
+    for(; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+    {
+        const vfloat px = vload(&x[i]);
+        const vfloat py = vload(&y[i]);
+        const vfloat pz = vload(&z[i]);
+        vstore(&x[i], vadd(vadd(vmul(m00, px), vmul(m10, py)), vadd(vmul(m20, pz), m30)));
+        vstore(&y[i], vadd(vadd(vmul(m01, px), vmul(m11, py)), vadd(vmul(m21, pz), m31)));
+        vstore(&z[i], vadd(vadd(vmul(m02, px), vmul(m12, py)), vadd(vmul(m22, pz), m32)));
+    }
+    for(; i < count; i++)
+    {
+        const glm::vec4 position = mat * glm::vec4(x[i], y[i], z[i], 1.0f);
+        x[i] = position.x;
+        y[i] = position.y;
+        z[i] = position.z;
+    }
+
+    if(count > 0)
+        markDirty(0, count);
+}
+
+void PointLightList::animate(float dt)
+{
+    // catch up with the GPU in the same rotation
+    rotate(gpuAnimationTime + dt);
+    gpuAnimationTime = 0.0f;
+
+    // only upload lights that actually move
+    const uint32_t count = size();
+    for(uint32_t i = 0; i < count;)
+    {
+        if(angularVelocity[i] == 0.0f)
+        {
+            i++;
+            continue;
+        }
+        const uint32_t first = i;
+        while(i < count && angularVelocity[i] != 0.0f)
+            i++;
+        addDirtyRange(first, i);
+    }
+}
+
+void PointLightList::animatedOnGpu(float dt)
+{
+    gpuAnimationTime += dt;
+    if(gpuAnimationTime >= MAX_GPU_ANIMATION_TIME)
+        syncAnimation();
+}
+
+void PointLightList::syncAnimation()
+{
+    if(gpuAnimationTime == 0.0f)
+        return;
+
+    // the GPU buffer already has these positions, nothing gets marked dirty
+    rotate(gpuAnimationTime);
+    gpuAnimationTime = 0.0f;
+}
+
+void PointLightList::rotate(float dt)
+{
+    const uint32_t count = size();
+
+    const vfloat one = vsplat(1.0f);
+    // the angle is different for every light, sin and cos have no SIMD version here
+    float cosAngles[SIMD_WIDTH];
+    float sinAngles[SIMD_WIDTH];
+
+    uint32_t i = 0;
+    for(; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+    {
+        for(uint32_t lane = 0; lane < SIMD_WIDTH; lane++)
+        {
+            const float angle = angularVelocity[i + lane] * dt;
+            cosAngles[lane] = std::cos(angle);
+            sinAngles[lane] = std::sin(angle);
+        }
+        const vfloat c = vload(cosAngles);
+        const vfloat s = vload(sinAngles);
+
+        const vfloat cx = vload(&centerX[i]), cy = vload(&centerY[i]), cz = vload(&centerZ[i]);
+        const vfloat kx = vload(&axisX[i]), ky = vload(&axisY[i]), kz = vload(&axisZ[i]);
+        const vfloat vx = vsub(vload(&x[i]), cx), vy = vsub(vload(&y[i]), cy), vz = vsub(vload(&z[i]), cz);
+
+        // v * c + cross(k, v) * s + k * dot(k, v) * (1 - c)
+        const vfloat kDotV = vmul(vadd(vadd(vmul(kx, vx), vmul(ky, vy)), vmul(kz, vz)), vsub(one, c));
+        const vfloat crossX = vsub(vmul(ky, vz), vmul(kz, vy));
+        const vfloat crossY = vsub(vmul(kz, vx), vmul(kx, vz));
+        const vfloat crossZ = vsub(vmul(kx, vy), vmul(ky, vx));
+        vstore(&x[i], vadd(cx, vadd(vadd(vmul(vx, c), vmul(crossX, s)), vmul(kx, kDotV))));
+        vstore(&y[i], vadd(cy, vadd(vadd(vmul(vy, c), vmul(crossY, s)), vmul(ky, kDotV))));
+        vstore(&z[i], vadd(cz, vadd(vadd(vmul(vz, c), vmul(crossZ, s)), vmul(kz, kDotV))));
+    }
+    for(; i < count; i++)
+    {
+        const glm::vec3 center(centerX[i], centerY[i], centerZ[i]);
+        const glm::vec3 axis(axisX[i], axisY[i], axisZ[i]);
+        const glm::vec3 position =
+            center + rotateAroundAxis(glm::vec3(x[i], y[i], z[i]) - center, axis, angularVelocity[i] * dt);
+        x[i] = position.x;
+        y[i] = position.y;
+        z[i] = position.z;
+    }
+}
+
+void PointLightList::packVertices(uint32_t first, uint32_t last)
+{
+    assert(first <= last && last <= size());
+
+    // same as PointLight::calculateRadius, rearranged to a single square root:
+    // radius = 1 / sqrt(max(cutoff, a * maxIntensity) / maxIntensity)
+    //        = sqrt(maxIntensity / max(cutoff, a * maxIntensity))
+    // uses the intensity after packing, just like the shaders (pointLightRadius in lights.sh)
+    const float INTENSITY_CUTOFF = 1.0f;
+    const float ATTENTUATION_CUTOFF = 0.05f;
+    // intensity = flux per unit solid angle (steradian)
+    // there are 4*pi steradians in a sphere
+    const float FLUX_TO_INTENSITY = 1.0f / (4.0f * glm::pi<float>());
+
+    const vfloat intensityCutoff = vsplat(INTENSITY_CUTOFF);
+    const vfloat attenuationCutoff = vsplat(ATTENTUATION_CUTOFF);
+    const vfloat fluxToIntensity = vsplat(FLUX_TO_INTENSITY);
+    const vfloat zero = vsplat(0.0f);
+
+    // position, packed intensity
+    constexpr uint32_t VERTEX_FLOATS = sizeof(PointLightVertex) / sizeof(float);
+    static_assert(VERTEX_FLOATS == 4, "vertex layout changed");
+    // center, angular velocity, axis, padding
+    constexpr uint32_t MOTION_VERTEX_FLOATS = sizeof(PointLightMotionVertex) / sizeof(float);
+    static_assert(MOTION_VERTEX_FLOATS == 8, "vertex layout changed");
+
+    // the shared exponent packing has no SIMD version, lanes go through these
+    float intensityR[SIMD_WIDTH], intensityG[SIMD_WIDTH], intensityB[SIMD_WIDTH];
+    float maxIntensities[SIMD_WIDTH];
+    // packed bits, only moved around as floats
+    float packedIntensities[SIMD_WIDTH];
+
+    uint32_t i = first;
+    for(; i + SIMD_WIDTH <= last; i += SIMD_WIDTH)
+    {
+        vstore(intensityR, vmul(vload(&fluxR[i]), fluxToIntensity));
+        vstore(intensityG, vmul(vload(&fluxG[i]), fluxToIntensity));
+        vstore(intensityB, vmul(vload(&fluxB[i]), fluxToIntensity));
+        for(uint32_t lane = 0; lane < SIMD_WIDTH; lane++)
+        {
+            const uint32_t packed = packRGB9E5({ intensityR[lane], intensityG[lane], intensityB[lane] },
+                                               maxIntensities[lane]);
+            std::memcpy(&packedIntensities[lane], &packed, sizeof(packed));
+        }
+
+        const vfloat maxIntensity = vload(maxIntensities);
+        const vfloat rad = vsqrt(vdiv(maxIntensity, vmax(intensityCutoff, vmul(attenuationCutoff, maxIntensity))));
+        vstore(&radius[i], rad);
+
+        float* out = glm::value_ptr(vertices[i].position);
+        vstore4(out, VERTEX_FLOATS, vload(&x[i]), vload(&y[i]), vload(&z[i]), vload(packedIntensities));
+
+        float* motionOut = glm::value_ptr(motionVertices[i].center);
+        vstore4(motionOut,
+                MOTION_VERTEX_FLOATS,
+                vload(&centerX[i]),
+                vload(&centerY[i]),
+                vload(&centerZ[i]),
+                vload(&angularVelocity[i]));
+        vstore4(motionOut + 4, MOTION_VERTEX_FLOATS, vload(&axisX[i]), vload(&axisY[i]), vload(&axisZ[i]), zero);
+    }
+    for(; i < last; i++)
+    {
+        const glm::vec3 intensity = glm::vec3(fluxR[i], fluxG[i], fluxB[i]) * FLUX_TO_INTENSITY;
+        float maxIntensity;
+        const uint32_t packed = packRGB9E5(intensity, maxIntensity);
+        radius[i] = std::sqrt(maxIntensity / std::max(INTENSITY_CUTOFF, ATTENTUATION_CUTOFF * maxIntensity));
+
+        PointLightVertex& light = vertices[i];
+        light.position = { x[i], y[i], z[i] };
+        light.intensity = packed;
+
+        PointLightMotionVertex& motion = motionVertices[i];
+        motion.center = { centerX[i], centerY[i], centerZ[i] };
+        motion.angularVelocity = angularVelocity[i];
+        motion.axis = { axisX[i], axisY[i], axisZ[i] };
+        motion.padding = 0.0f;
+    }
+}
+
+void PointLightList::markDirty(uint32_t index)
+{
+    markDirty(index, index + 1);
+}
+
+void PointLightList::markDirty(uint32_t first, uint32_t last)
+{
+    changeCount++;
+    addDirtyRange(first, last);
+}
+
+void PointLightList::addDirtyRange(uint32_t first, uint32_t last)
+{
+    // extend the last range when lights are changed in order, the common case
+    if(!dirtyRanges.empty() && first >= dirtyRanges.back().first && first <= dirtyRanges.back().second)
+    {
+        dirtyRanges.back().second = std::max(dirtyRanges.back().second, last);
+        return;
+    }
+    dirtyRanges.emplace_back(first, last);
 }
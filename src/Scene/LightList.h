@@ -2,19 +2,40 @@
 
 #include "Scene/Light.h"
 #include <bgfx/bgfx.h>
+#include <glm/matrix.hpp>
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 struct LightList
 {
     // vertex buffers seem to be aligned to 16 bytes
+    // the shaders read lights in a loop, so keep it small
     struct PointLightVertex
     {
         glm::vec3 position;
-        float padding;
-        // radiant intensity in W/sr
+        // radiant intensity in W/sr, packed as RGB9E5 (shared exponent)
         // can be calculated from radiant flux
-        glm::vec3 intensity;
-        float radius;
+        // the shaders calculate the culling radius from it, see getPointLight in lights.sh
+        uint32_t intensity;
+
+        static void init()
+        {
+            // the layout is only used for the stride, shaders read the intensity bits with floatBitsToUint
+            layout.begin()
+                .add(bgfx::Attrib::TexCoord0, 4, bgfx::AttribType::Float)
+                .end();
+        }
+        static bgfx::VertexLayout layout;
+    };
+
+    // motion parameters for animating lights on the GPU
+    struct PointLightMotionVertex
+    {
+        glm::vec3 center;
+        float angularVelocity;
+        glm::vec3 axis;
+        float padding;
 
         static void init()
         {
@@ -27,16 +48,161 @@ struct LightList
     };
 };
 
+// pool of point lights with stable handles
+// lights are stored densely (the shaders loop over [0, size)), removing a light moves the last one
+// into its slot, so indices change but handles don't
+// changes are tracked per index range and update only uploads those
+// the CPU copy is a structure of arrays so radius, intensity and transforms are calculated with SIMD
 class PointLightList : public LightList
 {
 public:
+    using Handle = uint32_t;
+    static constexpr Handle INVALID_HANDLE = UINT32_MAX;
+
     void init();
     void shutdown();
 
     // upload changes to GPU
-    void update();
+    // without upload, changed lights are only packed (see getRadius) and uploaded by the next update that uploads
+    // for when nothing reads the GPU buffer, e.g. while shaders read pre-culled lights (see LightShader::update)
+    void update(bool upload = true);
+
+    // lights without a motion orbit the world origin around the Y axis
+    Handle add(const PointLight& light);
+    Handle add(const PointLight& light, const PointLightMotion& motion);
+    // handles of removed lights are ignored by remove, modify and setMotion
+    // they're reused by add, so a handle kept after removing its light might refer to a new light
+    void remove(Handle handle);
+    void modify(Handle handle, const PointLight& light);
+    void setMotion(Handle handle, const PointLightMotion& motion);
+    void clear();
+    // replace all lights with the lights at indices in source, in that order
+    // handles are reset to the new indices
+    void assign(const PointLightList& source, const std::vector<uint32_t>& indices);
+
+    // false for handles that were never returned by add and handles of removed lights
+    bool valid(Handle handle) const { return handle < handleToIndex.size() && handleToIndex[handle] != UINT32_MAX; }
+    PointLight get(Handle handle) const { return getAt(handleToIndex[handle]); }
+    uint32_t getIndex(Handle handle) const { return handleToIndex[handle]; }
+    Handle getHandle(uint32_t index) const { return indexToHandle[index]; }
+
+    // access by (dense) index
+    PointLight getAt(uint32_t index) const;
+    void setAt(uint32_t index, const PointLight& light);
+    // includes the motion of lights animated on the GPU since the last syncAnimation
+    glm::vec3 getPosition(uint32_t index) const;
+    // culling radius, see PointLight::calculateRadius (calculated from the packed intensity like on the GPU)
+    // only up to date for lights that didn't change since the last update
+    float getRadius(uint32_t index) const { return radius[index]; }
+
+    // transform the position of every light
+    void transform(const glm::mat4& mat);
+    // move every light along its motion path, same as cs_lights_animate.sc
+    void animate(float dt);
+    // the GPU moved every light along its motion path by dt (see LightShader::animateLights)
+    // only the GPU buffer changed, the CPU copy catches up in syncAnimation
+    void animatedOnGpu(float dt);
+    // move the CPU copy to where the GPU animated the lights, without uploading them again
+    // changing lights and growing the buffer do this first so nothing snaps back to an old position
+    void syncAnimation();
 
-    std::vector<PointLight> lights;
+    uint32_t size() const { return (uint32_t)x.size(); }
+    bool empty() const { return x.empty(); }
 
+    // dense arrays, same order as the GPU buffer
+    // positions are only current after syncAnimation
+    const float* getPositionsX() const { return x.data(); }
+    const float* getPositionsY() const { return y.data(); }
+    const float* getPositionsZ() const { return z.data(); }
+    const float* getRadii() const { return radius.data(); }
+
+    // calculate radius and intensity of lights [first, last) and write them to the CPU copy of the GPU buffers
+    // update calls this for changed lights, public for benchmarking
+    void packVertices(uint32_t first, uint32_t last);
+    const PointLightVertex* getVertices() const { return vertices.data(); }
+
+    // number of lights uploaded by the last update
+    uint32_t getUploadedCount() const { return uploadedCount; }
+    // number of changed lights packed by the last update, whether they were uploaded or not
+    uint32_t getUpdatedCount() const { return updatedCount; }
+    // counts every change except animate moving lights along their motion
+    // lights without angular velocity keep their position and index as long as this stays the same
+    uint64_t getChangeCount() const { return changeCount; }
+    float getAngularVelocity(uint32_t index) const { return angularVelocity[index]; }
+
+    // keep room for count lights after the last light in the GPU buffer
+    // only compute shaders write there (virtual lights, see LightBVHShader::update)
+    void setVirtualCapacity(uint32_t count) { virtualCapacity = count; }
+    uint32_t getVirtualCapacity() const { return virtualCapacity; }
+
+    // compute shaders can write to it to animate lights (see LightShader::animateLights)
+    // the CPU copy doesn't see those changes until syncAnimation
     bgfx::DynamicVertexBufferHandle buffer = BGFX_INVALID_HANDLE;
+    // PointLightMotionVertex for each light
+    bgfx::DynamicVertexBufferHandle motionBuffer = BGFX_INVALID_HANDLE;
+
+    static const PointLightMotion DEFAULT_MOTION;
+
+private:
+    void createBuffers();
+    // sort ranges and merge the ones that overlap or are close together
+    static void mergeRanges(std::vector<std::pair<uint32_t, uint32_t>>& ranges);
+    void markDirty(uint32_t index);
+    void markDirty(uint32_t first, uint32_t last);
+    // upload [first, last) without counting it as a change
+    void addDirtyRange(uint32_t first, uint32_t last);
+    // rotate the CPU positions along their motion path
+    void rotate(float dt);
+
+    // every per-light float array
+    static std::vector<float> PointLightList::* const ARRAYS[14];
+
+    // call func for every per-light float array
+    template<typename Func>
+    void forEachArray(Func func)
+    {
+        for(std::vector<float> PointLightList::*array : ARRAYS)
+        {
+            func(this->*array);
+        }
+    }
+
+    // lights, one array per component
+    std::vector<float> x, y, z;
+    std::vector<float> fluxR, fluxG, fluxB;
+    // derived from flux in packVertices
+    std::vector<float> radius;
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> axisX, axisY, axisZ;
+    std::vector<float> angularVelocity;
+
+    // CPU copy of the GPU buffers, written right before uploading
+    std::vector<PointLightVertex> vertices;
+    std::vector<PointLightMotionVertex> motionVertices;
+
+    std::vector<uint32_t> handleToIndex;
+    std::vector<Handle> indexToHandle;
+    std::vector<Handle> freeHandles;
+
+    // lights per bgfx::update call in update
+    static constexpr uint32_t UPLOAD_CHUNK_SIZE = 65536;
+
+    // changed [first, last) index ranges, merged in update
+    std::vector<std::pair<uint32_t, uint32_t>> dirtyRanges;
+    // packed but not uploaded yet, see update
+    std::vector<std::pair<uint32_t, uint32_t>> pendingRanges;
+
+    // number of lights the GPU buffer has room for, including virtualCapacity
+    uint32_t capacity = 0;
+    uint32_t virtualCapacity = 0;
+    uint32_t uploadedCount = 0;
+    uint32_t updatedCount = 0;
+    uint64_t changeCount = 0;
+
+    // time the GPU animated the lights for since the last syncAnimation
+    // the motion is a rotation with constant speed, so one rotation by the sum catches up
+    float gpuAnimationTime = 0.0f;
+    // sync after this many seconds so angularVelocity * gpuAnimationTime stays small
+    // sin and cos lose precision for large angles
+    static constexpr float MAX_GPU_ANIMATION_TIME = 10.0f;
 };
@@ -2,3 +2,4 @@
 
 // initialized in Scene::init
 bgfx::VertexLayout Mesh::PosNormalTangentTex0Vertex::layout;
+bgfx::VertexLayout Mesh::FetchVertex::layout;
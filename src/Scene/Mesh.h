@@ -8,6 +8,10 @@ struct Mesh
     bgfx::IndexBufferHandle indexBuffer = BGFX_INVALID_HANDLE;
     unsigned int material = 0; // index into materials vector
 
+    // triangles in Scene::fetchIndexBuffer
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+
     //bgfx::OcclusionQueryHandle occlusionQuery = BGFX_INVALID_HANDLE;
 
     // bgfx vertex attributes
@@ -30,4 +34,23 @@ struct Mesh
         }
         static bgfx::VertexLayout layout;
     };
+
+    // vertex attributes read by shaders instead of the input assembler
+    // one vec4 per attribute so it can be bound as a buffer
+    struct FetchVertex
+    {
+        float x, y, z, u;    // position + U
+        float nx, ny, nz, v; // normal + V
+        float tx, ty, tz, w; // tangent + unused
+
+        static void init()
+        {
+            layout.begin()
+                .add(bgfx::Attrib::TexCoord0, 4, bgfx::AttribType::Float)
+                .add(bgfx::Attrib::TexCoord1, 4, bgfx::AttribType::Float)
+                .add(bgfx::Attrib::TexCoord2, 4, bgfx::AttribType::Float)
+                .end();
+        }
+        static bgfx::VertexLayout layout;
+    };
 };
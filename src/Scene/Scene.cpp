@@ -26,6 +26,7 @@ Scene::Scene() :
 void Scene::init()
 {
     Mesh::PosNormalTangentTex0Vertex::init();
+    Mesh::FetchVertex::init();
 }
 
 void Scene::clear()
@@ -39,6 +40,12 @@ void Scene::clear()
             mesh.vertexBuffer = BGFX_INVALID_HANDLE;
             mesh.indexBuffer = BGFX_INVALID_HANDLE;
         }
+        if(bgfx::isValid(fetchVertexBuffer))
+            bgfx::destroy(fetchVertexBuffer);
+        if(bgfx::isValid(fetchIndexBuffer))
+            bgfx::destroy(fetchIndexBuffer);
+        fetchVertexBuffer = BGFX_INVALID_HANDLE;
+        fetchIndexBuffer = BGFX_INVALID_HANDLE;
 
         for(Material& mat : materials)
         {
@@ -72,12 +79,15 @@ void Scene::clear()
         meshes.clear();
         materials.clear();
         pointLights.shutdown();
-        pointLights.lights.clear();
+        pointLights.clear();
     }
+    fetchVertices.clear();
+    fetchIndices.clear();
     minBounds = maxBounds = { 0.0f, 0.0f, 0.0f };
     center = { 0.0f, 0.0f, 0.0f };
     diagonal = 0.0f;
     camera = Camera();
+    transparentMeshes = false;
     loaded = false;
 }
 
@@ -131,6 +141,20 @@ bool Scene::load(const char* file)
                 }
             }
 
+            if(!fetchIndices.empty())
+            {
+                fetchVertexBuffer = bgfx::createVertexBuffer(
+                    bgfx::copy(fetchVertices.data(), (uint32_t)(fetchVertices.size() * sizeof(Mesh::FetchVertex))),
+                    Mesh::FetchVertex::layout,
+                    BGFX_BUFFER_COMPUTE_READ);
+                fetchIndexBuffer =
+                    bgfx::createIndexBuffer(bgfx::copy(fetchIndices.data(), (uint32_t)(fetchIndices.size() * sizeof(uint32_t))),
+                                            BGFX_BUFFER_COMPUTE_READ | BGFX_BUFFER_INDEX32);
+            }
+            // the GPU has them now
+            fetchVertices = std::vector<Mesh::FetchVertex>();
+            fetchIndices = std::vector<uint32_t>();
+
             center = minBounds + (maxBounds - minBounds) / 2.0f;
             glm::vec3 extent = glm::abs(maxBounds - minBounds);
             diagonal = glm::sqrt(glm::dot(extent, extent));
@@ -156,6 +180,8 @@ bool Scene::load(const char* file)
             // still need depth sorting for scenes with overlapping transparent meshes
             std::partition(
                 meshes.begin(), meshes.end(), [this](const Mesh& mesh) { return !materials[mesh.material].blend; });
+            transparentMeshes = std::any_of(
+                meshes.begin(), meshes.end(), [this](const Mesh& mesh) { return materials[mesh.material].blend; });
 
             if(scene->HasCameras())
             {
@@ -226,6 +252,19 @@ Mesh Scene::loadMesh(const aiMesh* mesh)
         }
     }
 
+    // same data for shaders fetching vertex attributes themselves
+    // copy before bgfx takes ownership of the memory
+
+    const uint32_t baseVertex = (uint32_t)fetchVertices.size();
+    for(unsigned int i = 0; i < mesh->mNumVertices; i++)
+    {
+        const Mesh::PosNormalTangentTex0Vertex& vertex =
+            *(const Mesh::PosNormalTangentTex0Vertex*)(vertexMem->data + i * stride);
+        fetchVertices.push_back({ vertex.x, vertex.y, vertex.z, vertex.u,
+                                  vertex.nx, vertex.ny, vertex.nz, vertex.v,
+                                  vertex.tx, vertex.ty, vertex.tz, 0.0f });
+    }
+
     bgfx::VertexBufferHandle vbh = bgfx::createVertexBuffer(vertexMem, Mesh::PosNormalTangentTex0Vertex::layout);
 
     // indices (triangles)
@@ -241,9 +280,15 @@ Mesh Scene::loadMesh(const aiMesh* mesh)
         indices[(3 * i) + 2] = (uint16_t)mesh->mFaces[i].mIndices[2];
     }
 
+    const uint32_t firstIndex = (uint32_t)fetchIndices.size();
+    for(unsigned int i = 0; i < mesh->mNumFaces * 3; i++)
+    {
+        fetchIndices.push_back(baseVertex + indices[i]);
+    }
+
     bgfx::IndexBufferHandle ibh = bgfx::createIndexBuffer(iMem);
 
-    return { vbh, ibh, mesh->mMaterialIndex };
+    return { vbh, ibh, mesh->mMaterialIndex, firstIndex, mesh->mNumFaces * 3 };
 }
 
 Material Scene::loadMaterial(const aiMaterial* material, const char* dir)
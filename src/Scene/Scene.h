@@ -33,6 +33,15 @@ public:
     Camera camera;
     std::vector<Mesh> meshes;
     std::vector<Material> materials;
+    // any mesh uses a blended material
+    // these are rendered after the opaque meshes and aren't in the depth prepass or G-Buffer
+    bool transparentMeshes = false;
+
+    // all meshes in one vertex and index buffer, readable from shaders
+    // for fetching vertex attributes without the input assembler (visibility buffer)
+    // vertices are Mesh::FetchVertex, indices are 32-bit and point into the whole vertex buffer
+    bgfx::VertexBufferHandle fetchVertexBuffer = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle fetchIndexBuffer = BGFX_INVALID_HANDLE;
 
     // these are not populated by load
     glm::vec3 skyColor;
@@ -42,6 +51,10 @@ public:
 private:
     static bx::DefaultAllocator allocator;
 
+    // filled by loadMesh, uploaded to fetchVertexBuffer and fetchIndexBuffer
+    std::vector<Mesh::FetchVertex> fetchVertices;
+    std::vector<uint32_t> fetchIndices;
+
     Mesh loadMesh(const aiMesh* mesh); // not static because it changes minBounds and maxBounds
     static Material loadMaterial(const aiMaterial* material, const char* dir);
     static Camera loadCamera(const aiCamera* camera);
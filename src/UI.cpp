@@ -119,6 +119,11 @@ void ClusterUI::update(float dt)
             app.generateLights(app.config->lights);
         }
         ImGui::Checkbox("Moving lights", &app.config->movingLights);
+        ImGui::Checkbox("Light pre-culling", &app.config->lightPreCulling);
+        ImGui::SameLine();
+        ImGui::Text(ICON_FK_INFO_CIRCLE);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Only upload and cull lights inside the view frustum (tested on the CPU every frame)");
 
         ImGui::Separator();
 
@@ -161,6 +166,7 @@ void ClusterUI::update(float dt)
         ImGui::RadioButton("Tiled Deferred (Multiple threads per tile)", &renderPathSelected, (int)Cluster::RenderPath::TiledMultipleDeferred);
         ImGui::RadioButton("Clustered Forward", &renderPathSelected, (int)Cluster::RenderPath::ClusteredForward);
         ImGui::RadioButton("Clustered Deferred", &renderPathSelected, (int)Cluster::RenderPath::ClusteredDeferred);
+        ImGui::RadioButton("Clustered Visibility Buffer", &renderPathSelected, (int)Cluster::RenderPath::ClusteredVisibility);
         Cluster::RenderPath path = (Cluster::RenderPath)renderPathSelected;
         if(path != app.config->renderPath)
             app.setRenderPath(path);
@@ -170,15 +176,39 @@ void ClusterUI::update(float dt)
         ImGui::Checkbox("Show log", &app.config->showLog);
         ImGui::Checkbox("Show performance stats", &app.config->showStatsOverlay);
         ImGui::Checkbox("Show G-Buffer/Framebuffer", &app.config->showBuffers);
+        if(path == Cluster::RenderPath::Deferred ||
+           path == Cluster::RenderPath::TiledSingleDeferred ||
+           path == Cluster::RenderPath::TiledMultipleDeferred ||
+           path == Cluster::RenderPath::ClusteredDeferred
+        )
+        {
+            ImGui::Checkbox("Thin G-Buffer", &app.config->thinGBuffer);
+            ImGui::SameLine();
+            ImGui::Text(ICON_FK_INFO_CIRCLE);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip("Base color + metallic and octahedral normal + roughness (RGB10A2), emissive only if the scene uses it. F0 is derived when shading");
+        }
+        if(path == Cluster::RenderPath::Deferred)
+        {
+            ImGui::Checkbox("Stencil light volumes", &app.config->stencilLightVolumes);
+            ImGui::SameLine();
+            ImGui::Text(ICON_FK_INFO_CIRCLE);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip("Only shade pixels whose depth lies inside a light volume (two-pass stencil test)\n"
+                                  "one mask per batch of lights (up to 16 batches), overlapping volumes in a batch share it");
+        }
         if(path == Cluster::RenderPath::TiledSingleForward ||
            path == Cluster::RenderPath::TiledSingleDeferred ||
            path == Cluster::RenderPath::TiledMultipleForward ||
            path == Cluster::RenderPath::TiledMultipleDeferred ||
            path == Cluster::RenderPath::ClusteredForward ||
-           path == Cluster::RenderPath::ClusteredDeferred
+           path == Cluster::RenderPath::ClusteredDeferred ||
+           path == Cluster::RenderPath::ClusteredVisibility
         )
         {
-            bool isClustered = (path == Cluster::RenderPath::ClusteredForward || path == Cluster::RenderPath::ClusteredDeferred);
+            bool isClustered = (path == Cluster::RenderPath::ClusteredForward ||
+                                path == Cluster::RenderPath::ClusteredDeferred ||
+                                path == Cluster::RenderPath::ClusteredVisibility);
 
             ImGui::Checkbox(isClustered ? "Cluster light count visualization" : "Tile light count visualization", &app.config->debugVisualization);
             app.renderer->setVariable("DEBUG_VIS", app.config->debugVisualization ? "true" : "false");
@@ -187,6 +217,46 @@ void ClusterUI::update(float dt)
             ImGui::InputInt(isClustered ? "Max lights per cluster (input)" : "Max lights per tile (input)", &app.config->maxLightsPerTileOrCluster, 0, 0);
             app.config->maxLightsPerTileOrCluster = std::max(4, std::min(app.config->maxLightsPerTileOrCluster, 16384));
 
+            ImGui::Checkbox("Adaptive light lists", &app.config->adaptiveLightLists);
+            ImGui::SameLine();
+            ImGui::Text(ICON_FK_INFO_CIRCLE);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip(isClustered ? "Resize the light index list to what light culling needs (read back from the GPU)\n"
+                                                "Otherwise it has room for max lights in every cluster"
+                                              : "Resize the tile light lists to the fullest tile (read back from the GPU), up to max lights per tile");
+
+            ImGui::Checkbox("Light BVH", &app.config->lightBVH);
+            ImGui::SameLine();
+            ImGui::Text(ICON_FK_INFO_CIRCLE);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip("Skip groups of lights during light culling (not used by light-centric culling)");
+
+            if(isClustered)
+            {
+                ImGui::Checkbox("Lightcuts", &app.config->lightcuts);
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Replace far away groups of lights with one virtual light per group (needs the light BVH)");
+                if(app.config->lightcuts)
+                {
+                    ImGui::SliderFloat("Lightcuts error bound", &app.config->lightcutsErrorBound, 0.01f, 1.0f, "%.3f");
+                    if(ImGui::Button("Measure lightcuts error"))
+                        app.renderer->measureLightcutsError();
+                    ImGui::SameLine();
+                    ImGui::Text(ICON_FK_INFO_CIRCLE);
+                    if(ImGui::IsItemHovered())
+                        ImGui::SetTooltip("Compare against exact shading (RMSE and PSNR in the stats)\n"
+                                          "the camera and the lights stop for the two measured frames");
+                }
+            }
+
+            ImGui::Checkbox("CPU light culling", &app.config->cpuLightCulling);
+            ImGui::SameLine();
+            ImGui::Text(ICON_FK_INFO_CIRCLE);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip("Assign lights on the CPU (multithreaded, SIMD) and upload the light grid");
+
             if(!isClustered)
             {
                 ImGui::SliderInt("Tile pixel size [X]", &app.config->tilePixelSizeX, 4, 128);
@@ -205,9 +275,76 @@ void ClusterUI::update(float dt)
                 auto tilesY = (app.config->backbufferResolutionY + app.config->tilePixelSizeY - 1) /
                               app.config->tilePixelSizeY;
                 ImGui::LabelText("Tiles [X] x [Y]","%i x %i", tilesX, tilesY);
+
+                const char* depthBoundsModes[] = { "Off", "Min/max depth", "2.5D depth mask" };
+                int depthBounds = (int)app.config->tileDepthBounds;
+                ImGui::Combo("Tile depth bounds", &depthBounds, depthBoundsModes, IM_ARRAYSIZE(depthBoundsModes));
+                app.config->tileDepthBounds = (TileShader::DepthBoundsMode)depthBounds;
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Cull lights against the depth of geometry in each tile (depth prepass/G-Buffer depth)\n"
+                                      "2.5D: also skip lights that fall into gaps between surfaces\n"
+                                      "Transparent meshes get an extra depth pass");
             }
             else
             {
+                ImGui::Checkbox("Only cull active clusters", &app.config->cullActiveClustersOnly);
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Skip clusters without geometry (depth prepass/G-Buffer depth)\n"
+                                      "Transparent meshes get an extra depth pass");
+
+                const char* cullingModes[] = { "Cluster-centric (gather)", "Light-centric (scatter)" };
+                int cullingMode = (int)app.config->clusterLightCullingMode;
+                ImGui::Combo("Light culling", &cullingMode, cullingModes, IM_ARRAYSIZE(cullingModes));
+                app.config->clusterLightCullingMode = (ClusterShader::LightCullingMode)cullingMode;
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Gather: every cluster tests every light\nScatter: every light only visits the clusters it overlaps");
+
+                const char* gridLayouts[] = { "Linear", "Swizzled (4x4 Morton blocks)" };
+                int gridLayout = (int)app.config->clusterGridLayout;
+                ImGui::Combo("Cluster grid layout", &gridLayout, gridLayouts, IM_ARRAYSIZE(gridLayouts));
+                app.config->clusterGridLayout = (ClusterShader::GridLayout)gridLayout;
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Order of clusters in memory\n"
+                                      "Swizzled: neighbouring clusters on screen share cache lines (ignored by CPU light culling)");
+
+                ImGui::Checkbox("Radius classes", &app.config->radiusClasses);
+                ImGui::SameLine();
+                ImGui::Text(ICON_FK_INFO_CIRCLE);
+                if(ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Cull large lights against a coarser cluster grid so they don't fill up every small cluster\n"
+                                      "(cluster-centric culling only, not together with lightcuts)");
+                if(app.config->radiusClasses)
+                    ImGui::SliderFloat("Large light radius", &app.config->largeLightRadius, 0.1f, 10.0f, "%.2f");
+
+                // the visibility buffer resolve only reads the cluster light grid
+                if(path != Cluster::RenderPath::ClusteredVisibility)
+                {
+                    ImGui::Checkbox("Z-binning", &app.config->zBinning);
+                    ImGui::SameLine();
+                    ImGui::Text(ICON_FK_INFO_CIRCLE);
+                    if(ImGui::IsItemHovered())
+                        ImGui::SetTooltip("Sort lights by depth into depth bins and per-tile light bitmasks\n"
+                                          "instead of a light list per cluster (replaces light culling)");
+
+                    ImGui::Checkbox("World-space light grid", &app.config->worldLightGrid);
+                    ImGui::SameLine();
+                    ImGui::Text(ICON_FK_INFO_CIRCLE);
+                    if(ImGui::IsItemHovered())
+                        ImGui::SetTooltip("Assign lights to a hashed grid in world space, only rebuilt when lights change\n"
+                                          "Moving lights get their own grid, static lights aren't rebuilt when they move\n"
+                                          "(replaces light culling, ignored with CPU light culling or z-binning)");
+                    if(app.config->worldLightGrid)
+                        ImGui::SliderFloat("World grid cell size", &app.config->worldGridCellSize, 0.25f, 10.0f, "%.2f");
+                }
+
                 ImGui::Checkbox("Treat clusters X, Y as cluster pixel size", &app.config->treatClusterXYasPixelSize);
                 if(app.config->treatClusterXYasPixelSize)
                 {
@@ -337,6 +474,12 @@ void ClusterUI::update(float dt)
         ImGui::Text("Draw calls: %u", stats->numDraw);
         ImGui::Text("Compute calls: %u", stats->numCompute);
 
+        // renderer specific data
+        for(const auto& counter : app.renderer->counters)
+        {
+            ImGui::Text("%s: %.10g", counter.first.c_str(), counter.second);
+        }
+
         // plots
         static float fpsValues[GRAPH_HISTORY] = { 0 };
         static float frameTimeValues[GRAPH_HISTORY] = { 0 };
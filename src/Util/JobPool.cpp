@@ -0,0 +1,133 @@
+#include "JobPool.h"
+
+#include <algorithm>
+
+JobPool::JobPool(unsigned int threadCount)
+{
+    if(threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    this->threadCount = std::max(threadCount, 1u);
+
+    queues.reset(new Queue[this->threadCount]);
+    for(unsigned int i = 1; i < this->threadCount; i++)
+    {
+        workers.emplace_back(&JobPool::workerLoop, this, i);
+    }
+}
+
+JobPool::~JobPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for(std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void JobPool::parallelFor(uint32_t count, uint32_t grainSize, const RangeFunction& func)
+{
+    if(count == 0)
+        return;
+
+    grainSize = std::max(grainSize, 1u);
+    const uint32_t rangeCount = (count + grainSize - 1) / grainSize;
+
+    // not worth waking up the workers
+    if(threadCount == 1 || rangeCount == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    // ranges carry the function so workers that are still busy looking
+    // for work from the previous call can't run them with a stale one
+    remaining = rangeCount;
+    for(uint32_t i = 0; i < rangeCount; i++)
+    {
+        Range range = { i * grainSize, std::min((i + 1) * grainSize, count), &func };
+        Queue& queue = queues[i % threadCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.ranges.push_back(range);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+    }
+    wake.notify_all();
+
+    // help out instead of idling
+    while(runRange(0))
+        ;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return remaining == 0; });
+}
+
+void JobPool::workerLoop(unsigned int index)
+{
+    uint64_t seenGeneration = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return quit || generation != seenGeneration; });
+            if(quit)
+                return;
+            seenGeneration = generation;
+        }
+
+        while(runRange(index))
+            ;
+    }
+}
+
+bool JobPool::runRange(unsigned int index)
+{
+    Range range;
+    if(!pop(index, range) && !steal(index, range))
+        return false;
+
+    (*range.func)(range.begin, range.end);
+
+    if(--remaining == 0)
+    {
+        // lock so the notification can't get lost between the predicate check and the wait
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+    }
+    return true;
+}
+
+bool JobPool::pop(unsigned int index, Range& range)
+{
+    // own queue is used like a stack, the most recently added range is still warm in the cache
+    Queue& queue = queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.ranges.empty())
+        return false;
+    range = queue.ranges.back();
+    queue.ranges.pop_back();
+    return true;
+}
+
+bool JobPool::steal(unsigned int index, Range& range)
+{
+    // steal from the other end to keep contention low
+    for(unsigned int i = 1; i < threadCount; i++)
+    {
+        Queue& queue = queues[(index + i) % threadCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.ranges.empty())
+        {
+            range = queue.ranges.front();
+            queue.ranges.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed pool of worker threads with one work queue per thread
+// threads that run out of work steal ranges from the other queues
+class JobPool
+{
+public:
+    // called with a range [begin, end)
+    using RangeFunction = std::function<void(uint32_t begin, uint32_t end)>;
+
+    // 0 = one thread per core
+    // the thread calling parallelFor counts as one of them
+    explicit JobPool(unsigned int threadCount = 0);
+    ~JobPool();
+
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    // split [0, count) into ranges of grainSize elements and run func on all threads
+    // ranges always start at a multiple of grainSize so begin / grainSize can be used as a chunk index
+    // returns after all ranges are done, not reentrant
+    void parallelFor(uint32_t count, uint32_t grainSize, const RangeFunction& func);
+
+    unsigned int getThreadCount() const { return threadCount; }
+
+private:
+    struct Range
+    {
+        uint32_t begin;
+        uint32_t end;
+        const RangeFunction* func;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    void workerLoop(unsigned int index);
+    // run one range from our own queue or steal one
+    // returns false if there was nothing left to do
+    bool runRange(unsigned int index);
+    bool pop(unsigned int index, Range& range);
+    bool steal(unsigned int index, Range& range);
+
+    unsigned int threadCount = 1;
+    std::vector<std::thread> workers;
+    // one per thread, index 0 is the calling thread
+    std::unique_ptr<Queue[]> queues;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    bool quit = false;
+
+    std::atomic<uint32_t> remaining{ 0 };
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// AVX2 has to be enabled at compile time (CLUSTER_AVX2 CMake option)
+// SSE2 is always available on x64
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define CLUSTER_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CLUSTER_SIMD_SSE2
+#endif
+
+// just enough of a SIMD abstraction for the light culling and light update loops
+// everything works on SIMD_WIDTH floats at once, loads and stores are unaligned
+// comparisons return a mask, vmask turns it into one bit per lane
+namespace simd
+{
+#if defined(CLUSTER_SIMD_AVX2)
+
+using vfloat = __m256;
+constexpr uint32_t SIMD_WIDTH = 8;
+
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat vsplat(float f) { return _mm256_set1_ps(f); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+inline vfloat vless(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+inline vfloat vor(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+inline uint32_t vmask(vfloat a) { return (uint32_t)_mm256_movemask_ps(a); }
+// lane i of a, b, c, d goes to p[i * stride + 0..3] (SoA -> AoS)
+inline void vstore4(float* p, uint32_t stride, vfloat a, vfloat b, vfloat c, vfloat d)
+{
+    __m128 a0 = _mm256_castps256_ps128(a), a1 = _mm256_extractf128_ps(a, 1);
+    __m128 b0 = _mm256_castps256_ps128(b), b1 = _mm256_extractf128_ps(b, 1);
+    __m128 c0 = _mm256_castps256_ps128(c), c1 = _mm256_extractf128_ps(c, 1);
+    __m128 d0 = _mm256_castps256_ps128(d), d1 = _mm256_extractf128_ps(d, 1);
+    _MM_TRANSPOSE4_PS(a0, b0, c0, d0);
+    _MM_TRANSPOSE4_PS(a1, b1, c1, d1);
+    _mm_storeu_ps(p + 0 * stride, a0);
+    _mm_storeu_ps(p + 1 * stride, b0);
+    _mm_storeu_ps(p + 2 * stride, c0);
+    _mm_storeu_ps(p + 3 * stride, d0);
+    _mm_storeu_ps(p + 4 * stride, a1);
+    _mm_storeu_ps(p + 5 * stride, b1);
+    _mm_storeu_ps(p + 6 * stride, c1);
+    _mm_storeu_ps(p + 7 * stride, d1);
+}
+
+#elif defined(CLUSTER_SIMD_SSE2)
+
+using vfloat = __m128;
+constexpr uint32_t SIMD_WIDTH = 4;
+
+inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat vsplat(float f) { return _mm_set1_ps(f); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat vless(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+inline vfloat vor(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+inline uint32_t vmask(vfloat a) { return (uint32_t)_mm_movemask_ps(a); }
+// lane i of a, b, c, d goes to p[i * stride + 0..3] (SoA -> AoS)
+inline void vstore4(float* p, uint32_t stride, vfloat a, vfloat b, vfloat c, vfloat d)
+{
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps(p + 0 * stride, a);
+    _mm_storeu_ps(p + 1 * stride, b);
+    _mm_storeu_ps(p + 2 * stride, c);
+    _mm_storeu_ps(p + 3 * stride, d);
+}
+
+#else
+
+using vfloat = float;
+constexpr uint32_t SIMD_WIDTH = 1;
+
+inline vfloat vload(const float* p) { return *p; }
+inline void vstore(float* p, vfloat a) { *p = a; }
+inline vfloat vsplat(float f) { return f; }
+inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+inline vfloat vdiv(vfloat a, vfloat b) { return a / b; }
+inline vfloat vmax(vfloat a, vfloat b) { return std::max(a, b); }
+inline vfloat vsqrt(vfloat a) { return std::sqrt(a); }
+inline vfloat vless(vfloat a, vfloat b) { return a < b ? 1.0f : 0.0f; }
+inline vfloat vand(vfloat a, vfloat b) { return a * b; }
+inline vfloat vor(vfloat a, vfloat b) { return std::max(a, b); }
+inline uint32_t vmask(vfloat a) { return a != 0.0f ? 1u : 0u; }
+inline void vstore4(float* p, uint32_t stride, vfloat a, vfloat b, vfloat c, vfloat d)
+{
+    p[0] = a;
+    p[1] = b;
+    p[2] = c;
+    p[3] = d;
+}
+
+#endif
+} // namespace simd
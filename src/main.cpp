@@ -2,7 +2,16 @@
 #include "Config.h"
 #include "assimp/DefaultLogger.hpp"
 #include "Log/AssimpSource.h"
+#include "Scene/LightList.h"
+#include "Util/SIMD.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include <bx/commandline.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <fstream>
+#include <random>
 #include <sstream>
 
 using namespace std;
@@ -89,6 +98,15 @@ static const vector<int> lightCounts = {
     16384,
 };
 
+// way past what fits into one dispatch or a float light count, see --manylights
+static const vector<int> manyLightCounts = {
+    262144,
+    524288,
+    1048576,
+    2097152,
+    4194304,
+};
+
 static const vector<resolution> resolutions = {
     resolution{1920, 1080},
     resolution{2560, 1440},
@@ -109,13 +127,32 @@ static const vector<render_path> basicRenderPaths = {
 static const vector<render_path> renderPathsForTiled = {
     render_path{"tiled_forward_single", Cluster::RenderPath::TiledSingleForward},
     render_path{"tiled_deferred_single", Cluster::RenderPath::TiledSingleDeferred},
-    render_path{"tiled_forward_multiple", Cluster::RenderPath::TiledMultipleDeferred},
+    render_path{"tiled_forward_multiple", Cluster::RenderPath::TiledMultipleForward},
     render_path{"tiled_deferred_multiple", Cluster::RenderPath::TiledMultipleDeferred},
 };
 
 static const vector<render_path> renderPathsForClustered = {
     render_path{"clustered_forward", Cluster::RenderPath::ClusteredForward},
-    render_path{"clustered_deferred", Cluster::RenderPath::ClusteredForward},
+    render_path{"clustered_deferred", Cluster::RenderPath::ClusteredDeferred},
+    render_path{"clustered_visibility", Cluster::RenderPath::ClusteredVisibility},
+};
+
+struct cluster_grid_layout
+{
+    std::string name;
+    ClusterShader::GridLayout layout;
+};
+
+static const vector<cluster_grid_layout> clusterGridLayouts = {
+    cluster_grid_layout{"linear", ClusterShader::GridLayout::Linear},
+    cluster_grid_layout{"swizzled", ClusterShader::GridLayout::Swizzled},
+};
+
+// views doing the per-pixel light list lookups
+static const vector<std::string> clusteredLightingViews = {
+    "Clustered lighting pass",
+    "Deferred clustered light pass (point lights + ambient + emissive)",
+    "Visibility clustered resolve pass (point lights + ambient + emissive)",
 };
 
 stats run_benchmark(int argc, char* argv[], const Config& config)
@@ -142,6 +179,17 @@ std::string join_parameter_group(const clustered_parameter_group& parameterGroup
     return ss.str();
 }
 
+double lighting_gpu_time(const stats& stats)
+{
+    for(const auto& name : clusteredLightingViews)
+    {
+        const auto view = stats.views.find(name);
+        if(view != stats.views.end())
+            return view->second.avgGpuTime;
+    }
+    return 0.0;
+}
+
 std::string join_views(const stats& stats)
 {
     std::stringstream ss;
@@ -152,6 +200,111 @@ std::string join_views(const stats& stats)
     return ss.str();
 }
 
+// CPU light update throughput: animation + radius/intensity + packing into the GPU format
+// SoA with SIMD (PointLightList) vs. the old AoS loop with one light at a time
+// light_count, simd_width, soa_lights_per_second, aos_lights_per_second
+void run_light_benchmark()
+{
+    static const vector<uint32_t> benchmarkLightCounts = { 1024, 16384, 262144 };
+    constexpr int ITERATIONS = 100;
+
+    ofstream output("lightbench.csv");
+
+    std::mt19937 mt(1337);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+    const glm::mat4 rotation = glm::rotate(glm::identity<glm::mat4>(), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    using clock = std::chrono::high_resolution_clock;
+    using seconds = std::chrono::duration<double>;
+
+    for(const uint32_t count : benchmarkLightCounts)
+    {
+        vector<PointLight> lights(count);
+        for(PointLight& light : lights)
+        {
+            light.position = glm::vec3(dist(mt), dist(mt), dist(mt)) * 20.0f - 10.0f;
+            light.flux = glm::vec3(dist(mt), dist(mt), dist(mt)) * 50.0f;
+        }
+
+        // SoA, no GPU needed for transform and packVertices
+
+        PointLightList pool;
+        for(const PointLight& light : lights)
+        {
+            pool.add(light);
+        }
+
+        auto start = clock::now();
+        for(int i = 0; i < ITERATIONS; i++)
+        {
+            pool.transform(rotation);
+            pool.packVertices(0, count);
+        }
+        const double soaTime = std::chrono::duration_cast<seconds>(clock::now() - start).count();
+
+        // AoS, same as PointLightList::update and Cluster::moveLights used to do
+
+        // the old, unpacked GPU format
+        struct aos_light_vertex
+        {
+            glm::vec3 position;
+            float padding;
+            glm::vec3 intensity;
+            float radius;
+        };
+        vector<aos_light_vertex> vertices(count);
+        start = clock::now();
+        for(int i = 0; i < ITERATIONS; i++)
+        {
+            for(uint32_t l = 0; l < count; l++)
+            {
+                PointLight& light = lights[l];
+                light.position = glm::mat3(glm::rotate(glm::identity<glm::mat4>(), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f))) *
+                                 light.position;
+                vertices[l].position = light.position;
+                vertices[l].intensity = light.flux / (4.0f * glm::pi<float>());
+                vertices[l].radius = light.calculateRadius();
+            }
+        }
+        const double aosTime = std::chrono::duration_cast<seconds>(clock::now() - start).count();
+
+        const double processed = (double)count * ITERATIONS;
+        output << count << "," << simd::SIMD_WIDTH << "," << processed / soaTime << "," << processed / aosTime << endl;
+    }
+}
+
+// clustered renderers with millions of lights
+// light upload, culling and lighting all have to handle counts beyond a single dispatch
+// resolutionx, resolutiony, light_count, render_path_type, cpuTime, gpuTime, lightingGpuTime, view_timings (key;value; ;separated)
+void run_many_lights_benchmark(int argc, char* argv[], Config config)
+{
+    ofstream output("manylights.csv");
+    config.showUI = false;
+    config.measureOverSeconds = 2;
+    config.backbufferResolutionX = 1920;
+    config.backbufferResolutionY = 1080;
+    config.maxLightsPerTileOrCluster = 16384;
+
+    for(const auto& lightCount : manyLightCounts)
+    {
+        config.lights = lightCount;
+        config.maxLights = std::max(config.maxLights, lightCount);
+
+        for(const auto& renderPath : renderPathsForClustered)
+        {
+            config.renderPath = renderPath.renderPath;
+
+            const auto stats = run_benchmark(argc, argv, config);
+
+            output << config.backbufferResolutionX << "," << config.backbufferResolutionY << ",";
+            output << lightCount << "," << renderPath.name << ",";
+            output << stats.avgFrameTimeCpu << "," << stats.avgFrameTimeGpu << "," << lighting_gpu_time(stats) << ",";
+            output << join_views(stats) << endl;
+        }
+    }
+}
+
 static AssimpLogSource logSource;
 
 int main(int argc, char* argv[])
@@ -161,16 +314,35 @@ int main(int argc, char* argv[])
     // CSV format
     // resolutionx, resolutiony, light_count, render_path_type, render_properties (;separated), cpuTime, gpuTime, view_timings (key;value; ;separated)
     Config config;
-    if(argc >= 3)
+    if(argc >= 3 && isdigit((unsigned char)argv[1][0]) && isdigit((unsigned char)argv[2][0]))
     {
         config.backbufferResolutionX = stoi(argv[1]);
         config.backbufferResolutionY = stoi(argv[2]);
     }
 
-    Cluster app{config};
-    return app.run(argc, argv);
+    bx::CommandLine cmdLine(argc, argv);
+    if(cmdLine.hasArg("lightbench"))
+    {
+        run_light_benchmark();
+        return 0;
+    }
+
+    if(cmdLine.hasArg("manylights"))
+    {
+        run_many_lights_benchmark(argc, argv, config);
+        return 0;
+    }
+
+    if(!cmdLine.hasArg("benchmark"))
+    {
+        Cluster app{config};
+        return app.run(argc, argv);
+    }
 
     ofstream output("measurements.csv");
+    // lighting pass GPU time of the clustered renderers per cluster grid layout
+    // resolutionx, resolutiony, light_count, render_path_type, render_properties (;separated), linearGpuTime, swizzledGpuTime, speedup
+    ofstream layoutOutput("cluster_layouts.csv");
     config.showUI = false;
     config.measureOverSeconds = 2;
 
@@ -233,14 +405,28 @@ int main(int argc, char* argv[])
                     config.clustersY = parameterGroup.clusterCountY;
                     config.clustersZ = parameterGroup.clusterCountZ;
 
-                    const auto stats = run_benchmark(argc, argv, config);
-
-                    output << res.width << "," << res.height << ",";
-                    output << lightCount << "," << renderPath.name << ",";
-                    output << join_parameter_group(parameterGroup) << "," << stats.avgFrameTimeCpu << ","
-                           << stats.avgFrameTimeGpu << ",";
-                    output << join_views(stats) << endl;
+                    vector<double> lightingTimes;
+                    for(const auto& gridLayout : clusterGridLayouts)
+                    {
+                        config.clusterGridLayout = gridLayout.layout;
+
+                        const auto stats = run_benchmark(argc, argv, config);
+                        lightingTimes.push_back(lighting_gpu_time(stats));
+
+                        output << res.width << "," << res.height << ",";
+                        output << lightCount << "," << renderPath.name << ",";
+                        output << join_parameter_group(parameterGroup) << ";" << gridLayout.name << ","
+                               << stats.avgFrameTimeCpu << "," << stats.avgFrameTimeGpu << ",";
+                        output << join_views(stats) << endl;
+                    }
+
+                    layoutOutput << res.width << "," << res.height << ",";
+                    layoutOutput << lightCount << "," << renderPath.name << ",";
+                    layoutOutput << join_parameter_group(parameterGroup) << "," << lightingTimes[0] << ","
+                                 << lightingTimes[1] << ","
+                                 << (lightingTimes[1] > 0.0 ? lightingTimes[0] / lightingTimes[1] : 0.0) << endl;
                 }
+                config.clusterGridLayout = ClusterShader::GridLayout::Linear;
             }
         }
     }